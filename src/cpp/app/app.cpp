@@ -46,8 +46,12 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <map>
+#include <mutex>
 #include <openenclave/host.h>
 #include <string>
+#include <thread>
+#include <vector>
 #include <sys/time.h> // struct timeval
 #include <time.h>     // gettimeofday
 
@@ -55,6 +59,7 @@
 #include "crypto.h"
 #include "enclave_u.h"
 #include "errlist.h"
+#include "host_buffer_pool.h"
 
 #ifndef TRUE
 #define TRUE 1
@@ -74,6 +79,10 @@
 
 JavaVM *jvm;
 
+/* Host threads running ecall_worker_loop for each enclave */
+std::map<oe_enclave_t *, std::vector<std::thread>> enclave_workers;
+std::mutex enclave_workers_mutex;
+
 /* Check error conditions for enclave operations */
 std::string oe_error_message(oe_result_t ret) {
   size_t idx = 0;
@@ -166,10 +175,10 @@ void ocall_print_string(const char *str) {
 }
 
 void unsafe_ocall_malloc(size_t size, uint8_t **ret) {
-  *ret = static_cast<uint8_t *>(malloc(size));
+  *ret = HostBufferPool::getInstance().allocate(size);
 }
 
-void ocall_free(uint8_t *buf) { free(buf); }
+void ocall_free(uint8_t *buf) { HostBufferPool::getInstance().deallocate(buf); }
 
 void ocall_exit(int exit_code) { std::exit(exit_code); }
 
@@ -206,11 +215,34 @@ JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_St
   flags |= OE_ENCLAVE_FLAG_DEBUG;
 #endif
 
+  // Service the ocalls marked transition_using_threads from host worker threads, so that the
+  // enclave does not exit to allocate or free untrusted memory. No ecalls are switchless, so no
+  // enclave worker threads are needed.
+  oe_enclave_setting_context_switchless_t switchless_setting = {NUM_SWITCHLESS_HOST_WORKERS, 0};
+  oe_enclave_setting_t settings[1];
+  settings[0].setting_type = OE_ENCLAVE_SETTING_CONTEXT_SWITCHLESS;
+  settings[0].u.context_switchless_setting = &switchless_setting;
+
   const char *library_path_str = env->GetStringUTFChars(library_path, nullptr);
   oe_check_and_time("StartEnclave",
                     oe_create_enclave_enclave(library_path_str, OE_ENCLAVE_TYPE_AUTO, flags,
-                                              nullptr, 0, &enclave));
+                                              settings, OE_COUNTOF(settings), &enclave));
   env->ReleaseStringUTFChars(library_path, library_path_str);
+
+  if (enclave != nullptr) {
+    // Lend threads to the enclave for the tasks that operators split their work into. They stay
+    // inside the enclave until it is stopped.
+    std::lock_guard<std::mutex> lock(enclave_workers_mutex);
+    std::vector<std::thread> &workers = enclave_workers[enclave];
+    for (uint32_t i = 0; i < NUM_ENCLAVE_WORKERS; i++) {
+      workers.emplace_back([enclave]() {
+        oe_result_t ret = ecall_worker_loop(enclave);
+        if (ret != OE_OK) {
+          fprintf(stderr, "Enclave worker failed. %s\n", oe_error_message(ret).c_str());
+        }
+      });
+    }
+  }
   long int enclavePtr = (long int)enclave;
 
   return enclavePtr;
@@ -250,7 +282,7 @@ JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Fin
                                              reinterpret_cast<uint8_t *>(shared_key_msg_bytes),
                                              shared_key_msg_size));
 
-  env->ReleaseByteArrayElements(shared_key_msg_input, shared_key_msg_bytes, 0);
+  env->ReleaseByteArrayElements(shared_key_msg_input, shared_key_msg_bytes, JNI_ABORT);
 }
 
 JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_StopEnclave(
@@ -258,7 +290,21 @@ JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Sto
   (void)env;
   (void)obj;
 
-  oe_check("StopEnclave", oe_terminate_enclave((oe_enclave_t *)eid));
+  oe_enclave_t *enclave = (oe_enclave_t *)eid;
+  std::vector<std::thread> workers;
+  {
+    std::lock_guard<std::mutex> lock(enclave_workers_mutex);
+    workers = std::move(enclave_workers[enclave]);
+    enclave_workers.erase(enclave);
+  }
+  if (!workers.empty()) {
+    oe_check("StopEnclave", ecall_stop_workers(enclave));
+    for (auto &&worker : workers) {
+      worker.join();
+    }
+  }
+
+  oe_check("StopEnclave", oe_terminate_enclave(enclave));
 }
 
 JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_Project(
@@ -285,12 +331,12 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
                                     &output_rows_length));
   }
 
-  env->ReleaseByteArrayElements(project_list, (jbyte *)project_list_ptr, 0);
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(project_list, (jbyte *)project_list_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
   return ret;
 }
@@ -318,12 +364,12 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
                                              &output_rows_length));
   }
 
-  env->ReleaseByteArrayElements(condition, (jbyte *)condition_ptr, 0);
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(condition, (jbyte *)condition_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
   return ret;
 }
@@ -352,7 +398,7 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
   jbyteArray ciphertext = env->NewByteArray(clength);
   env->SetByteArrayRegion(ciphertext, 0, clength, (jbyte *)ciphertext_copy);
 
-  env->ReleaseByteArrayElements(plaintext, (jbyte *)plaintext_ptr, 0);
+  env->ReleaseByteArrayElements(plaintext, (jbyte *)plaintext_ptr, JNI_ABORT);
 
   delete[] ciphertext_copy;
 
@@ -381,9 +427,9 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   return ret;
 }
@@ -420,10 +466,10 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FindRangeBounds(JNIEnv *en
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
-  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), JNI_ABORT);
 
   return ret;
 }
@@ -461,16 +507,17 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartitionForSort(
                           boundary_rows_length, output_partitions, output_partition_lengths));
   }
 
-  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
-  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
-  env->ReleaseByteArrayElements(boundary_rows, reinterpret_cast<jbyte *>(boundary_rows_ptr), 0);
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), JNI_ABORT);
+  env->ReleaseByteArrayElements(boundary_rows, reinterpret_cast<jbyte *>(boundary_rows_ptr),
+                                JNI_ABORT);
 
   jobjectArray result = env->NewObjectArray(num_partitions, env->FindClass("[B"), nullptr);
   for (jint i = 0; i < num_partitions; i++) {
     jbyteArray partition = env->NewByteArray(output_partition_lengths[i]);
     env->SetByteArrayRegion(partition, 0, output_partition_lengths[i],
                             reinterpret_cast<jbyte *>(output_partitions[i]));
-    free(output_partitions[i]);
+    ocall_free(output_partitions[i]);
     env->SetObjectArrayElement(result, i, partition);
   }
   delete[] output_partitions;
@@ -507,10 +554,10 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), 0);
-  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), 0);
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, reinterpret_cast<jbyte *>(input_rows_ptr), JNI_ABORT);
 
   return ret;
 }
@@ -542,10 +589,44 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoin(
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(join_expr, (jbyte *)join_expr_ptr, 0);
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(join_expr, (jbyte *)join_expr_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashJoin(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t join_expr_length = (uint32_t)env->GetArrayLength(join_expr);
+  uint8_t *join_expr_ptr = (uint8_t *)env->GetByteArrayElements(join_expr, &if_copy);
+
+  uint32_t input_rows_length = (uint32_t)env->GetArrayLength(input_rows);
+  uint8_t *input_rows_ptr = (uint8_t *)env->GetByteArrayElements(input_rows, &if_copy);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("HashJoin: JNI failed to get input byte array.");
+  } else {
+    oe_check_and_time("Hash Join",
+                      ecall_hash_join((oe_enclave_t *)eid, join_expr_ptr, join_expr_length,
+                                      input_rows_ptr, input_rows_length, &output_rows,
+                                      &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
+  ocall_free(output_rows);
+
+  env->ReleaseByteArrayElements(join_expr, (jbyte *)join_expr_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   return ret;
 }
@@ -584,11 +665,11 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastNestedLoopJoin(
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(join_expr, (jbyte *)join_expr_ptr, 0);
-  env->ReleaseByteArrayElements(outer_rows, (jbyte *)outer_rows_ptr, 0);
-  env->ReleaseByteArrayElements(inner_rows, (jbyte *)inner_rows_ptr, 0);
+  env->ReleaseByteArrayElements(join_expr, (jbyte *)join_expr_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(outer_rows, (jbyte *)outer_rows_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(inner_rows, (jbyte *)inner_rows_ptr, JNI_ABORT);
 
   return ret;
 }
@@ -623,10 +704,85 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregate(
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(agg_op, (jbyte *)agg_op_ptr, 0);
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(agg_op, (jbyte *)agg_op_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashAggregate(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jbyteArray input_rows,
+    jboolean isPartial) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  uint32_t agg_op_length = (uint32_t)env->GetArrayLength(agg_op);
+  uint8_t *agg_op_ptr = (uint8_t *)env->GetByteArrayElements(agg_op, &if_copy);
+
+  uint32_t input_rows_length = (uint32_t)env->GetArrayLength(input_rows);
+  uint8_t *input_rows_ptr = (uint8_t *)env->GetByteArrayElements(input_rows, &if_copy);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  bool is_partial = (bool)isPartial;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("HashAggregate: JNI failed to get input byte array.");
+  } else {
+    oe_check_and_time("Hash Aggregate",
+                      ecall_hash_aggregate((oe_enclave_t *)eid, agg_op_ptr, agg_op_length,
+                                           input_rows_ptr, input_rows_length, &output_rows,
+                                           &output_rows_length, is_partial));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
+  ocall_free(output_rows);
+
+  env->ReleaseByteArrayElements(agg_op, (jbyte *)agg_op_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
+
+  return ret;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExecutePipeline(JNIEnv *env, jobject obj,
+                                                                      jlong eid,
+                                                                      jbyteArray pipeline,
+                                                                      jbyteArray input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t pipeline_length = (size_t)env->GetArrayLength(pipeline);
+  uint8_t *pipeline_ptr = (uint8_t *)env->GetByteArrayElements(pipeline, &if_copy);
+
+  uint32_t input_rows_length = (uint32_t)env->GetArrayLength(input_rows);
+  uint8_t *input_rows_ptr = (uint8_t *)env->GetByteArrayElements(input_rows, &if_copy);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("ExecutePipeline: JNI failed to get input byte array.");
+  } else {
+    oe_check_and_time("Execute Pipeline",
+                      ecall_execute_pipeline((oe_enclave_t *)eid, pipeline_ptr, pipeline_length,
+                                             input_rows_ptr, input_rows_length, &output_rows,
+                                             &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(pipeline, (jbyte *)pipeline_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
+  ocall_free(output_rows);
 
   return ret;
 }
@@ -655,9 +811,9 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_CountRowsPerPartition(
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   return ret;
 }
@@ -686,9 +842,9 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ComputeNumRowsPerPartition
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   return ret;
 }
@@ -715,9 +871,9 @@ JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEncla
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
 
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
 
   return ret;
 }
@@ -752,9 +908,544 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_LimitReturnRows(JNIEnv *en
 
   jbyteArray ret = env->NewByteArray(output_rows_length);
   env->SetByteArrayRegion(ret, 0, output_rows_length, (jbyte *)output_rows);
-  free(output_rows);
+  ocall_free(output_rows);
+
+  env->ReleaseByteArrayElements(limits, (jbyte *)limits_ptr, JNI_ABORT);
+  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, JNI_ABORT);
+
+  return ret;
+}
+
+/*
+ * Variants of the operator methods above that take their input rows in direct ByteBuffers and
+ * return their output rows in direct ByteBuffers, so that neither is copied between the JVM and the
+ * host. The input rows fill the whole capacity of their buffer. The output wraps the host buffer
+ * that the enclave allocated with ocall_malloc, and must be released with FreeDirectBuffer.
+ */
+
+/** Return the address of the given direct ByteBuffer and set `length` to its capacity. */
+static uint8_t *direct_buffer_input(JNIEnv *env, jobject buffer, size_t *length) {
+  uint8_t *ptr = static_cast<uint8_t *>(env->GetDirectBufferAddress(buffer));
+  jlong capacity = env->GetDirectBufferCapacity(buffer);
+  *length = capacity > 0 ? static_cast<size_t>(capacity) : 0;
+  return ptr;
+}
+
+/** Wrap an ecall's output in a direct ByteBuffer, or return null if there is none. */
+static jobject direct_buffer_output(JNIEnv *env, uint8_t *output_rows, size_t output_rows_length) {
+  if (output_rows == nullptr) {
+    return nullptr;
+  }
+  jobject ret = env->NewDirectByteBuffer(output_rows, static_cast<jlong>(output_rows_length));
+  if (ret == nullptr) {
+    ocall_free(output_rows);
+  }
+  return ret;
+}
+
+JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_DirectBufferAddress(
+    JNIEnv *env, jobject obj, jobject buffer) {
+  (void)obj;
+
+  return reinterpret_cast<jlong>(env->GetDirectBufferAddress(buffer));
+}
+
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FreeDirectBuffer(
+    JNIEnv *env, jobject obj, jlong address) {
+  (void)env;
+  (void)obj;
+
+  ocall_free(reinterpret_cast<uint8_t *>(address));
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostBufferPoolStats(JNIEnv *env,
+                                                                          jobject obj) {
+  (void)obj;
+
+  HostBufferPool::Stats stats = HostBufferPool::getInstance().stats();
+  jlong values[] = {static_cast<jlong>(stats.allocations), static_cast<jlong>(stats.hits),
+                    static_cast<jlong>(stats.bytes_outstanding),
+                    static_cast<jlong>(stats.peak_bytes_outstanding),
+                    static_cast<jlong>(stats.bytes_pooled)};
+  const jsize num_values = sizeof(values) / sizeof(values[0]);
+
+  jlongArray ret = env->NewLongArray(num_values);
+  env->SetLongArrayRegion(ret, 0, num_values, values);
+  return ret;
+}
+
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_SetMaxMaterializedSize(
+    JNIEnv *env, jobject obj, jlong eid, jlong size) {
+  (void)env;
+  (void)obj;
+
+  oe_check("SetMaxMaterializedSize",
+           ecall_set_max_materialized_size((oe_enclave_t *)eid, static_cast<size_t>(size)));
+}
+
+JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NumSpills(
+    JNIEnv *env, jobject obj, jlong eid) {
+  (void)env;
+  (void)obj;
+
+  uint64_t num_spills = 0;
+  oe_check("NumSpills", ecall_num_spills((oe_enclave_t *)eid, &num_spills));
+  return static_cast<jlong>(num_spills);
+}
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ProjectDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray project_list, jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t project_list_length = static_cast<size_t>(env->GetArrayLength(project_list));
+  uint8_t *project_list_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(project_list, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("ProjectDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Project",
+                      ecall_project((oe_enclave_t *)eid, project_list_ptr, project_list_length,
+                                    input_rows_ptr, input_rows_length, &output_rows,
+                                    &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(project_list, reinterpret_cast<jbyte *>(project_list_ptr),
+                                JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FilterDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray condition, jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t condition_length = static_cast<size_t>(env->GetArrayLength(condition));
+  uint8_t *condition_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(condition, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("FilterDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Filter", ecall_filter((oe_enclave_t *)eid, condition_ptr, condition_length,
+                                             input_rows_ptr, input_rows_length, &output_rows,
+                                             &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(condition, reinterpret_cast<jbyte *>(condition_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalSortDirect(JNIEnv *env, jobject obj,
+                                                                         jlong eid,
+                                                                         jbyteArray sort_order,
+                                                                         jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("ExternalSortDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("External Non-Oblivious Sort",
+                      ecall_external_sort((oe_enclave_t *)eid, sort_order_ptr, sort_order_length,
+                                          input_rows_ptr, input_rows_length, &output_rows,
+                                          &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoinDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("NonObliviousSortMergeJoinDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Non-Oblivious Sort-Merge Join",
+                      ecall_non_oblivious_sort_merge_join(
+                          (oe_enclave_t *)eid, join_expr_ptr, join_expr_length, input_rows_ptr,
+                          input_rows_length, &output_rows, &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashJoinDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("HashJoinDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Hash Join",
+                      ecall_hash_join((oe_enclave_t *)eid, join_expr_ptr, join_expr_length,
+                                      input_rows_ptr, input_rows_length, &output_rows,
+                                      &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jobject input_rows,
+    jboolean isPartial) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t agg_op_length = static_cast<size_t>(env->GetArrayLength(agg_op));
+  uint8_t *agg_op_ptr = reinterpret_cast<uint8_t *>(env->GetByteArrayElements(agg_op, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  bool is_partial = (bool)isPartial;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("NonObliviousAggregateDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Non-Oblivious Aggregate",
+                      ecall_non_oblivious_aggregate(
+                          (oe_enclave_t *)eid, agg_op_ptr, agg_op_length, input_rows_ptr,
+                          input_rows_length, &output_rows, &output_rows_length, is_partial));
+  }
+
+  env->ReleaseByteArrayElements(agg_op, reinterpret_cast<jbyte *>(agg_op_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashAggregateDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray agg_op, jobject input_rows,
+    jboolean isPartial) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t agg_op_length = static_cast<size_t>(env->GetArrayLength(agg_op));
+  uint8_t *agg_op_ptr = reinterpret_cast<uint8_t *>(env->GetByteArrayElements(agg_op, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  bool is_partial = (bool)isPartial;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("HashAggregateDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Hash Aggregate",
+                      ecall_hash_aggregate((oe_enclave_t *)eid, agg_op_ptr, agg_op_length,
+                                           input_rows_ptr, input_rows_length, &output_rows,
+                                           &output_rows_length, is_partial));
+  }
+
+  env->ReleaseByteArrayElements(agg_op, reinterpret_cast<jbyte *>(agg_op_ptr), JNI_ABORT);
 
-  env->ReleaseByteArrayElements(input_rows, (jbyte *)input_rows_ptr, 0);
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastNestedLoopJoinDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray join_expr, jobject outer_rows,
+    jbyteArray inner_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t join_expr_length = static_cast<size_t>(env->GetArrayLength(join_expr));
+  uint8_t *join_expr_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(join_expr, &if_copy));
+
+  size_t outer_rows_length = 0;
+  uint8_t *outer_rows_ptr = direct_buffer_input(env, outer_rows, &outer_rows_length);
+
+  size_t inner_rows_length = static_cast<size_t>(env->GetArrayLength(inner_rows));
+  uint8_t *inner_rows_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(inner_rows, &if_copy));
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (outer_rows_ptr == nullptr) {
+    ocall_throw("BroadcastNestedLoopJoinDirect: outer input is not a direct ByteBuffer.");
+  } else if (inner_rows_ptr == nullptr) {
+    ocall_throw("BroadcastNestedLoopJoinDirect: JNI failed to get inner byte array.");
+  } else {
+    oe_check_and_time(
+        "Broadcast Nested Loop Join",
+        ecall_broadcast_nested_loop_join((oe_enclave_t *)eid, join_expr_ptr, join_expr_length,
+                                         outer_rows_ptr, outer_rows_length, inner_rows_ptr,
+                                         inner_rows_length, &output_rows, &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(join_expr, reinterpret_cast<jbyte *>(join_expr_ptr), JNI_ABORT);
+  env->ReleaseByteArrayElements(inner_rows, reinterpret_cast<jbyte *>(inner_rows_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExecutePipelineDirect(JNIEnv *env,
+                                                                            jobject obj,
+                                                                            jlong eid,
+                                                                            jbyteArray pipeline,
+                                                                            jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t pipeline_length = static_cast<size_t>(env->GetArrayLength(pipeline));
+  uint8_t *pipeline_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(pipeline, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("ExecutePipelineDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Execute Pipeline",
+                      ecall_execute_pipeline((oe_enclave_t *)eid, pipeline_ptr, pipeline_length,
+                                             input_rows_ptr, input_rows_length, &output_rows,
+                                             &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(pipeline, reinterpret_cast<jbyte *>(pipeline_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_LocalLimitDirect(
+    JNIEnv *env, jobject obj, jlong eid, jint limit, jobject input_rows) {
+  (void)obj;
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("LocalLimitDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("LocalLimit",
+                      ecall_local_limit((oe_enclave_t *)eid, limit, input_rows_ptr,
+                                        input_rows_length, &output_rows, &output_rows_length));
+  }
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_LimitReturnRowsDirect(JNIEnv *env,
+                                                                            jobject obj,
+                                                                            jlong eid,
+                                                                            jlong partition_id,
+                                                                            jbyteArray limits,
+                                                                            jobject input_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t limits_length = static_cast<size_t>(env->GetArrayLength(limits));
+  uint8_t *limits_ptr = reinterpret_cast<uint8_t *>(env->GetByteArrayElements(limits, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("LimitReturnRowsDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("LimitReturnRows",
+                      ecall_limit_return_rows((oe_enclave_t *)eid, partition_id, limits_ptr,
+                                              limits_length, input_rows_ptr, input_rows_length,
+                                              &output_rows, &output_rows_length));
+  }
+
+  env->ReleaseByteArrayElements(limits, reinterpret_cast<jbyte *>(limits_ptr), JNI_ABORT);
+
+  return direct_buffer_output(env, output_rows, output_rows_length);
+}
+
+/*
+ * The operators below read their input rows from a direct ByteBuffer, but return their output in
+ * Java arrays, because it is always collected or shuffled and so serialized anyway.
+ */
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_SampleDirect(
+    JNIEnv *env, jobject obj, jlong eid, jobject input_rows) {
+  (void)obj;
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("SampleDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Sample",
+                      ecall_sample((oe_enclave_t *)eid, input_rows_ptr, input_rows_length,
+                                   &output_rows, &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  ocall_free(output_rows);
+
+  return ret;
+}
+
+JNIEXPORT jobjectArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartitionForSortDirect(
+    JNIEnv *env, jobject obj, jlong eid, jbyteArray sort_order, jint num_partitions,
+    jobject input_rows, jbyteArray boundary_rows) {
+  (void)obj;
+
+  jboolean if_copy;
+
+  size_t sort_order_length = static_cast<size_t>(env->GetArrayLength(sort_order));
+  uint8_t *sort_order_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(sort_order, &if_copy));
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  size_t boundary_rows_length = static_cast<size_t>(env->GetArrayLength(boundary_rows));
+  uint8_t *boundary_rows_ptr =
+      reinterpret_cast<uint8_t *>(env->GetByteArrayElements(boundary_rows, &if_copy));
+
+  uint8_t **output_partitions = new uint8_t *[num_partitions];
+  size_t *output_partition_lengths = new size_t[num_partitions];
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("PartitionForSortDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("Partition For Sort",
+                      ecall_partition_for_sort(
+                          (oe_enclave_t *)eid, sort_order_ptr, sort_order_length, num_partitions,
+                          input_rows_ptr, input_rows_length, boundary_rows_ptr,
+                          boundary_rows_length, output_partitions, output_partition_lengths));
+  }
+
+  env->ReleaseByteArrayElements(sort_order, reinterpret_cast<jbyte *>(sort_order_ptr), JNI_ABORT);
+  env->ReleaseByteArrayElements(boundary_rows, reinterpret_cast<jbyte *>(boundary_rows_ptr),
+                                JNI_ABORT);
+
+  jobjectArray result = env->NewObjectArray(num_partitions, env->FindClass("[B"), nullptr);
+  for (jint i = 0; i < num_partitions; i++) {
+    jbyteArray partition = env->NewByteArray(output_partition_lengths[i]);
+    env->SetByteArrayRegion(partition, 0, output_partition_lengths[i],
+                            reinterpret_cast<jbyte *>(output_partitions[i]));
+    ocall_free(output_partitions[i]);
+    env->SetObjectArrayElement(result, i, partition);
+  }
+  delete[] output_partitions;
+  delete[] output_partition_lengths;
+
+  return result;
+}
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_CountRowsPerPartitionDirect(
+    JNIEnv *env, jobject obj, jlong eid, jobject input_rows) {
+  (void)obj;
+
+  size_t input_rows_length = 0;
+  uint8_t *input_rows_ptr = direct_buffer_input(env, input_rows, &input_rows_length);
+
+  uint8_t *output_rows = nullptr;
+  size_t output_rows_length = 0;
+
+  if (input_rows_ptr == nullptr) {
+    ocall_throw("CountRowsPerPartitionDirect: input is not a direct ByteBuffer.");
+  } else {
+    oe_check_and_time("CountRowsPerPartition",
+                      ecall_count_rows_per_partition((oe_enclave_t *)eid, input_rows_ptr,
+                                                     input_rows_length, &output_rows,
+                                                     &output_rows_length));
+  }
+
+  jbyteArray ret = env->NewByteArray(output_rows_length);
+  env->SetByteArrayRegion(ret, 0, output_rows_length, reinterpret_cast<jbyte *>(output_rows));
+  ocall_free(output_rows);
 
   return ret;
 }
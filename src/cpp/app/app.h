@@ -45,6 +45,9 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoin(
                                                                                 jlong, jbyteArray,
                                                                                 jbyteArray);
 
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashJoin(
+    JNIEnv *, jobject, jlong, jbyteArray, jbyteArray);
+
 JNIEXPORT jbyteArray JNICALL
 Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastNestedLoopJoin(JNIEnv *, jobject,
                                                                               jlong, jbyteArray,
@@ -56,6 +59,15 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregate(JNIE
                                                                             jlong, jbyteArray,
                                                                             jbyteArray, jboolean);
 
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashAggregate(JNIEnv *, jobject, jlong,
+                                                                    jbyteArray, jbyteArray,
+                                                                    jboolean);
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExecutePipeline(JNIEnv *, jobject, jlong,
+                                                                      jbyteArray, jbyteArray);
+
 JNIEXPORT jbyteArray JNICALL
 Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_CountRowsPerPartition(JNIEnv *, jobject,
                                                                             jlong, jbyteArray);
@@ -80,6 +92,77 @@ Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_GenerateEvidence(JNIEnv *,
 JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FinishAttestation(
     JNIEnv *, jobject, jlong, jbyteArray);
 
+JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_DirectBufferAddress(
+    JNIEnv *, jobject, jobject);
+
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FreeDirectBuffer(
+    JNIEnv *, jobject, jlong);
+
+JNIEXPORT jlongArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HostBufferPoolStats(JNIEnv *, jobject);
+
+JNIEXPORT void JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_SetMaxMaterializedSize(
+    JNIEnv *, jobject, jlong, jlong);
+
+JNIEXPORT jlong JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NumSpills(JNIEnv *,
+                                                                                       jobject,
+                                                                                       jlong);
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ProjectDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jobject);
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_FilterDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jobject);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExternalSortDirect(JNIEnv *, jobject, jlong,
+                                                                         jbyteArray, jobject);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousSortMergeJoinDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jobject);
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashJoinDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jobject);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_NonObliviousAggregateDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jobject, jboolean);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_HashAggregateDirect(JNIEnv *, jobject,
+                                                                          jlong, jbyteArray,
+                                                                          jobject, jboolean);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_BroadcastNestedLoopJoinDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jobject, jbyteArray);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_ExecutePipelineDirect(JNIEnv *, jobject,
+                                                                            jlong, jbyteArray,
+                                                                            jobject);
+
+JNIEXPORT jobject JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_LocalLimitDirect(
+    JNIEnv *, jobject, jlong, jint, jobject);
+
+JNIEXPORT jobject JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_LimitReturnRowsDirect(JNIEnv *, jobject,
+                                                                            jlong, jlong,
+                                                                            jbyteArray, jobject);
+
+JNIEXPORT jbyteArray JNICALL Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_SampleDirect(
+    JNIEnv *, jobject, jlong, jobject);
+
+JNIEXPORT jobjectArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_PartitionForSortDirect(
+    JNIEnv *, jobject, jlong, jbyteArray, jint, jobject, jbyteArray);
+
+JNIEXPORT jbyteArray JNICALL
+Java_edu_berkeley_cs_rise_opaque_execution_SGXEnclave_CountRowsPerPartitionDirect(JNIEnv *,
+                                                                                  jobject, jlong,
+                                                                                  jobject);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,111 @@
+#include "host_buffer_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/mman.h>
+
+#include "common.h"
+
+HostBufferPool::HostBufferPool() : free_buffers(Classes::NUM_CLASSES), buffer_sizes(), current() {}
+
+HostBufferPool::~HostBufferPool() {
+  for (uint32_t i = 0; i < free_buffers.size(); i++) {
+    for (auto buf = free_buffers[i].begin(); buf != free_buffers[i].end(); ++buf) {
+      unmap_buffer(*buf, Classes::capacity(i));
+    }
+  }
+}
+
+uint8_t *HostBufferPool::map_buffer(size_t size) {
+#ifdef MADV_HUGEPAGE
+  if (HOST_BUFFER_HUGEPAGES && size >= HUGE_PAGE_SIZE) {
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+      return nullptr;
+    }
+    // Only advice, so failure just leaves the buffer on regular pages
+    madvise(base, size, MADV_HUGEPAGE);
+    return static_cast<uint8_t *>(base);
+  }
+#endif
+  return static_cast<uint8_t *>(malloc(size));
+}
+
+void HostBufferPool::unmap_buffer(uint8_t *buf, size_t size) {
+#ifdef MADV_HUGEPAGE
+  if (HOST_BUFFER_HUGEPAGES && size >= HUGE_PAGE_SIZE) {
+    munmap(buf, size);
+    return;
+  }
+#endif
+  free(buf);
+}
+
+uint8_t *HostBufferPool::allocate(size_t size) {
+  const uint32_t size_class = Classes::index(size);
+  // Buffers too large to pool are allocated at their exact size
+  const size_t cap = size_class == Classes::NUM_CLASSES ? size : Classes::capacity(size_class);
+
+  uint8_t *buf = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size_class < Classes::NUM_CLASSES && !free_buffers[size_class].empty()) {
+      buf = free_buffers[size_class].back();
+      free_buffers[size_class].pop_back();
+      current.bytes_pooled -= cap;
+      current.hits++;
+    }
+  }
+  if (buf == nullptr) {
+    buf = map_buffer(cap);
+    if (buf == nullptr) {
+      return nullptr;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  buffer_sizes[buf] = cap;
+  current.allocations++;
+  current.bytes_outstanding += cap;
+  current.peak_bytes_outstanding =
+      std::max(current.peak_bytes_outstanding, current.bytes_outstanding);
+  return buf;
+}
+
+void HostBufferPool::deallocate(uint8_t *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  uint8_t *buf;
+  size_t cap;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // The buffer containing ptr is the last one that starts at or before it
+    auto it = buffer_sizes.upper_bound(ptr);
+    if (it != buffer_sizes.begin()) {
+      --it;
+    }
+    if (it == buffer_sizes.end() || ptr < it->first || ptr >= it->first + it->second) {
+      throw std::runtime_error("Freeing a buffer that the host buffer pool did not allocate");
+    }
+    buf = it->first;
+    cap = it->second;
+    buffer_sizes.erase(it);
+    current.bytes_outstanding -= cap;
+    // Buffers too large to pool are larger than every class
+    const uint32_t size_class = Classes::index(cap);
+    if (size_class < Classes::NUM_CLASSES &&
+        current.bytes_pooled + cap <= MAX_POOLED_HOST_BUFFER_BYTES) {
+      free_buffers[size_class].push_back(buf);
+      current.bytes_pooled += cap;
+      return;
+    }
+  }
+  unmap_buffer(buf, cap);
+}
+
+HostBufferPool::Stats HostBufferPool::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return current;
+}
@@ -0,0 +1,78 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "size_classes.h"
+
+#ifndef HOST_BUFFER_POOL_H
+#define HOST_BUFFER_POOL_H
+
+/**
+ * The host's counterpart of the enclave's BufferPool, for the untrusted buffers that the enclave
+ * allocates through unsafe_ocall_malloc and frees through ocall_free. Operators write every
+ * output block, sorted run and partition into such a buffer, and large allocations from the C heap
+ * would be mapped and unmapped each time, faulting in fresh pages. Free buffers are kept per size
+ * class up to MAX_POOLED_HOST_BUFFER_BYTES, and the most recently freed one is reused first since
+ * its pages are the most likely to still be resident. If HOST_BUFFER_HUGEPAGES is set, buffers of
+ * at least one huge page are mapped separately and advised to be backed by transparent huge pages.
+ *
+ * Buffers handed out by the pool must be freed with deallocate(), not free(). The pool may be used
+ * from any thread, including the host workers that service switchless ocalls.
+ */
+class HostBufferPool {
+public:
+  HostBufferPool(HostBufferPool const &) = delete;
+  void operator=(HostBufferPool const &) = delete;
+
+  static HostBufferPool &getInstance() {
+    static HostBufferPool instance;
+    return instance;
+  }
+
+  /** Allocate a buffer of at least `size` bytes, or return nullptr if out of memory. */
+  uint8_t *allocate(size_t size);
+
+  /**
+   * Free a buffer returned by allocate(), given any address in the buffer. The enclave's writers
+   * hand out their output from partway into the buffer they built it in. Does nothing for nullptr.
+   */
+  void deallocate(uint8_t *ptr);
+
+  struct Stats {
+    /** Number of buffers allocated, and how many of them were reused from a free list. */
+    uint64_t allocations;
+    uint64_t hits;
+    /** Number of bytes in buffers allocated and not yet freed, and the largest such number. */
+    uint64_t bytes_outstanding;
+    uint64_t peak_bytes_outstanding;
+    /** Number of bytes in free buffers kept for reuse. */
+    uint64_t bytes_pooled;
+  };
+
+  Stats stats();
+
+private:
+  HostBufferPool();
+  ~HostBufferPool();
+
+  /** Allocate or free the memory of a buffer of the given size. */
+  static uint8_t *map_buffer(size_t size);
+  static void unmap_buffer(uint8_t *buf, size_t size);
+
+  // From 4KB to 64MB
+  typedef SizeClasses<12, 26> Classes;
+  static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t *>> free_buffers;
+  // Size of each buffer handed out and not yet freed, by its start. Kept apart from the buffers so
+  // that a request for a whole size class fits in that class.
+  std::map<uint8_t *, size_t> buffer_sizes;
+  Stats current;
+};
+
+#endif
@@ -3,6 +3,39 @@
 
 #define MAX_BLOCK_SIZE 1000000
 
+// Whether RowWriter encrypts blocks as ColumnarRows rather than Rows when all of their rows have
+// the same number of fields
+#define COLUMNAR_BLOCKS true
+
+// Whether RowWriter compresses the plaintext of blocks of at least MIN_COMPRESSED_BLOCK_SIZE bytes
+// before encrypting them
+#define COMPRESS_BLOCKS true
+#define MIN_COMPRESSED_BLOCK_SIZE 1024
+
 #define MAX_NUM_STREAMS 40u
 
+// Version of the block format written by RowWriter, recorded as the producer of each block it
+// encrypts. Blocks from the same version are trusted not to need verification when read back.
+#define TRUSTED_PRODUCER_VERSION 1
+
+// Maximum number of plaintext bytes an operator may materialize in enclave memory at once
+#define MAX_MATERIALIZED_SIZE 64000000
+
+// Number of host threads that service the enclave's switchless ocalls, which allocate and free the
+// untrusted memory that operators write their output to
+#define NUM_SWITCHLESS_HOST_WORKERS 2
+
+// Number of host threads that enter the enclave to run the tasks that operators split their work
+// into. Each occupies one of the enclave's TCSs, so NumTCS in Enclave.conf reserves this many on
+// top of the 10 left for the ecalls of Spark tasks.
+#define NUM_ENCLAVE_WORKERS 4
+
+// Maximum number of bytes in free untrusted buffers that the host keeps for reuse by the enclave,
+// and whether those of at least one huge page are backed by transparent huge pages
+#define MAX_POOLED_HOST_BUFFER_BYTES 256000000
+#define HOST_BUFFER_HUGEPAGES false
+
+// Maximum number of bytes in free plaintext buffers that BufferPool keeps for reuse
+#define MAX_POOLED_BUFFER_BYTES 32000000
+
 #endif // DEFINE_H
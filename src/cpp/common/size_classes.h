@@ -0,0 +1,29 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef SIZE_CLASSES_H
+#define SIZE_CLASSES_H
+
+/**
+ * The power-of-two size classes of a buffer pool, from 2^MinShift to 2^MaxShift bytes. Class i
+ * holds buffers of 2^(MinShift + i) bytes.
+ */
+template <uint32_t MinShift, uint32_t MaxShift> struct SizeClasses {
+  static const uint32_t NUM_CLASSES = MaxShift - MinShift + 1;
+
+  /** Index of the smallest class whose buffers hold `size` bytes, or NUM_CLASSES if none does. */
+  static uint32_t index(size_t size) {
+    uint32_t i = 0;
+    while (i < NUM_CLASSES && capacity(i) < size) {
+      i++;
+    }
+    return i;
+  }
+
+  /** Size in bytes of the buffers of class `i`. */
+  static size_t capacity(uint32_t i) { return static_cast<size_t>(1) << (MinShift + i); }
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "lz4_block.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Parameters of the LZ4 block format
+static const size_t MIN_MATCH = 4;
+// The last match must start at least this many bytes before the end of the block
+static const size_t MF_LIMIT = 12;
+// The last bytes of the block are always literals
+static const size_t LAST_LITERALS = 5;
+static const size_t MAX_OFFSET = 65535;
+
+static const uint32_t HASH_LOG = 12;
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash4(uint32_t v) { return (v * 2654435761u) >> (32 - HASH_LOG); }
+
+/** Append a length that did not fit in its 4-bit token field. */
+static void write_length(std::vector<uint8_t> &out, size_t len) {
+  for (; len >= 255; len -= 255) {
+    out.push_back(255);
+  }
+  out.push_back(static_cast<uint8_t>(len));
+}
+
+static void write_sequence(std::vector<uint8_t> &out, const uint8_t *literals, size_t literal_len,
+                           size_t offset, size_t match_len) {
+  const size_t match_code = match_len >= MIN_MATCH ? match_len - MIN_MATCH : 0;
+  out.push_back(static_cast<uint8_t>((std::min<size_t>(literal_len, 15) << 4) |
+                                     (match_len > 0 ? std::min<size_t>(match_code, 15) : 0)));
+  if (literal_len >= 15) {
+    write_length(out, literal_len - 15);
+  }
+  out.insert(out.end(), literals, literals + literal_len);
+  if (match_len == 0) {
+    return;
+  }
+  out.push_back(static_cast<uint8_t>(offset & 0xff));
+  out.push_back(static_cast<uint8_t>(offset >> 8));
+  if (match_code >= 15) {
+    write_length(out, match_code - 15);
+  }
+}
+
+void lz4_compress(const uint8_t *src, size_t len, std::vector<uint8_t> &out) {
+  out.clear();
+  out.reserve(len + len / 255 + 16);
+
+  size_t anchor = 0;
+  if (len > MF_LIMIT) {
+    // Positions are stored plus one, so that zero marks an empty slot
+    std::vector<uint32_t> table(1 << HASH_LOG, 0);
+    const size_t match_limit = len - MF_LIMIT;
+    const size_t match_end_limit = len - LAST_LITERALS;
+    size_t ip = 0;
+    while (ip < match_limit) {
+      const uint32_t h = hash4(read32(src + ip));
+      const size_t ref = table[h];
+      table[h] = static_cast<uint32_t>(ip + 1);
+      if (ref == 0 || ip - (ref - 1) > MAX_OFFSET || read32(src + ref - 1) != read32(src + ip)) {
+        ip++;
+        continue;
+      }
+
+      const size_t match_start = ref - 1;
+      size_t match_end = ip + MIN_MATCH;
+      while (match_end < match_end_limit &&
+             src[match_end] == src[match_start + (match_end - ip)]) {
+        match_end++;
+      }
+      write_sequence(out, src + anchor, ip - anchor, ip - match_start, match_end - ip);
+      ip = match_end;
+      anchor = ip;
+    }
+  }
+  write_sequence(out, src + anchor, len - anchor, 0, 0);
+}
+
+/** Read a length continuation, returning false if it runs past the end of the input. */
+static bool read_length(const uint8_t *src, size_t len, size_t &ip, size_t &value) {
+  uint8_t b;
+  do {
+    if (ip >= len) {
+      return false;
+    }
+    b = src[ip++];
+    value += b;
+  } while (b == 255);
+  return true;
+}
+
+bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) {
+  size_t ip = 0;
+  size_t op = 0;
+  while (true) {
+    if (ip >= len) {
+      return false;
+    }
+    const uint8_t token = src[ip++];
+
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !read_length(src, len, ip, literal_len)) {
+      return false;
+    }
+    if (literal_len > len - ip || literal_len > dst_len - op) {
+      return false;
+    }
+    memcpy(dst + op, src + ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+
+    // The last sequence has only literals
+    if (ip == len) {
+      break;
+    }
+
+    if (len - ip < 2) {
+      return false;
+    }
+    const size_t offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op) {
+      return false;
+    }
+
+    size_t match_len = token & 15;
+    if (match_len == 15 && !read_length(src, len, ip, match_len)) {
+      return false;
+    }
+    match_len += MIN_MATCH;
+    if (match_len > dst_len - op) {
+      return false;
+    }
+    // Matches may overlap their own output, so they are copied a byte at a time
+    for (size_t i = 0; i < match_len; i++, op++) {
+      dst[op] = dst[op - offset];
+    }
+  }
+  return op == dst_len;
+}
@@ -0,0 +1,24 @@
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A dependency-free compressor for the LZ4 block format, used to shrink block plaintext before it
+ * is encrypted. Compression is greedy with a small hash table, trading ratio for speed; the
+ * output can be decompressed by any LZ4 implementation.
+ */
+
+/** Compress `len` bytes from `src`, replacing the contents of `out`. */
+void lz4_compress(const uint8_t *src, size_t len, std::vector<uint8_t> &out);
+
+/**
+ * Decompress an LZ4 block of `len` bytes into exactly `dst_len` bytes at `dst`. Return false if
+ * the block is malformed or does not decompress to exactly `dst_len` bytes. Never reads or writes
+ * out of bounds, so it is safe to use on untrusted input.
+ */
+bool lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+
+#endif
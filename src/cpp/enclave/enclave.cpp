@@ -9,10 +9,14 @@
 #include "physical_operators/aggregate.h"
 #include "physical_operators/broadcast_nested_loop_join.h"
 #include "physical_operators/filter.h"
+#include "physical_operators/hash_aggregate.h"
+#include "physical_operators/hash_join.h"
 #include "physical_operators/limit.h"
 #include "physical_operators/non_oblivious_sort_merge_join.h"
+#include "physical_operators/pipeline.h"
 #include "physical_operators/project.h"
 #include "physical_operators/sort.h"
+#include "task_pool.h"
 #include "util.h"
 
 #include "attestation.h"
@@ -158,6 +162,21 @@ void ecall_non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_le
   }
 }
 
+void ecall_hash_join(uint8_t *join_expr, size_t join_expr_length, uint8_t *input_rows,
+                     size_t input_rows_length, uint8_t **output_rows,
+                     size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(oe_is_outside_enclave(input_rows, input_rows_length) == 1);
+  __builtin_ia32_lfence();
+
+  try {
+    hash_join(join_expr, join_expr_length, input_rows, input_rows_length, output_rows,
+              output_rows_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
 void ecall_broadcast_nested_loop_join(uint8_t *join_expr, size_t join_expr_length,
                                       uint8_t *outer_rows, size_t outer_rows_length,
                                       uint8_t *inner_rows, size_t inner_rows_length,
@@ -191,6 +210,36 @@ void ecall_non_oblivious_aggregate(uint8_t *agg_op, size_t agg_op_length, uint8_
   }
 }
 
+void ecall_hash_aggregate(uint8_t *agg_op, size_t agg_op_length, uint8_t *input_rows,
+                          size_t input_rows_length, uint8_t **output_rows,
+                          size_t *output_rows_length, bool is_partial) {
+  // Guard against operating on arbitrary enclave memory
+  assert(oe_is_outside_enclave(input_rows, input_rows_length) == 1);
+  __builtin_ia32_lfence();
+
+  try {
+    hash_aggregate(agg_op, agg_op_length, input_rows, input_rows_length, output_rows,
+                   output_rows_length, is_partial);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
+void ecall_execute_pipeline(uint8_t *pipeline, size_t pipeline_length, uint8_t *input_rows,
+                            size_t input_rows_length, uint8_t **output_rows,
+                            size_t *output_rows_length) {
+  // Guard against operating on arbitrary enclave memory
+  assert(oe_is_outside_enclave(input_rows, input_rows_length) == 1);
+  __builtin_ia32_lfence();
+
+  try {
+    execute_pipeline(pipeline, pipeline_length, input_rows, input_rows_length, output_rows,
+                     output_rows_length);
+  } catch (const std::runtime_error &e) {
+    ocall_throw(e.what());
+  }
+}
+
 void ecall_count_rows_per_partition(uint8_t *input_rows, size_t input_rows_length,
                                     uint8_t **output_rows, size_t *output_rows_length) {
   assert(oe_is_outside_enclave(input_rows, input_rows_length) == 1);
@@ -244,6 +293,14 @@ void ecall_limit_return_rows(uint64_t partition_id, uint8_t *limits, size_t limi
   }
 }
 
+void ecall_worker_loop() { TaskPool::getInstance().worker_loop(); }
+
+void ecall_stop_workers() { TaskPool::getInstance().stop(); }
+
+void ecall_set_max_materialized_size(size_t size) { set_max_materialized_size(size); }
+
+uint64_t ecall_num_spills() { return num_spills(); }
+
 typedef struct oe_evidence_msg_t {
   uint8_t enc_public_key[CIPHER_PK_SIZE];
   uint8_t nonce[CIPHER_IV_SIZE];
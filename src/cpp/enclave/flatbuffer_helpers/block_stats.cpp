@@ -0,0 +1,163 @@
+#include "block_stats.h"
+
+#include <cstring>
+
+#include "crypto/crypto_context.h"
+
+/** Return the statistics of the column that `expr` reads, or null if it is not a column. */
+const tuix::ColumnStats *get_column_stats(const tuix::Expr *expr, const tuix::BlockStats *stats) {
+  if (expr == nullptr || expr->expr_type() != tuix::ExprUnion_Col) {
+    return nullptr;
+  }
+  uint32_t col_num = static_cast<const tuix::Col *>(expr->expr())->col_num();
+  return col_num < stats->columns()->size() ? stats->columns()->Get(col_num) : nullptr;
+}
+
+/** Return the value of `expr` if it is a literal, or null otherwise. */
+const tuix::Field *get_literal_value(const tuix::Expr *expr) {
+  if (expr == nullptr || expr->expr_type() != tuix::ExprUnion_Literal) {
+    return nullptr;
+  }
+  return static_cast<const tuix::Literal *>(expr->expr())->value();
+}
+
+/** Swap the operands of a comparison, e.g. turning `1 < x` into `x > 1`. */
+tuix::ExprUnion flip_comparison(tuix::ExprUnion op) {
+  switch (op) {
+  case tuix::ExprUnion_LessThan:
+    return tuix::ExprUnion_GreaterThan;
+  case tuix::ExprUnion_LessThanOrEqual:
+    return tuix::ExprUnion_GreaterThanOrEqual;
+  case tuix::ExprUnion_GreaterThan:
+    return tuix::ExprUnion_LessThan;
+  case tuix::ExprUnion_GreaterThanOrEqual:
+    return tuix::ExprUnion_LessThanOrEqual;
+  default:
+    return op;
+  }
+}
+
+template <typename TuixExpr>
+bool comparison_may_match(tuix::ExprUnion op, const tuix::Expr *expr,
+                          const tuix::BlockStats *stats) {
+  auto *comparison = static_cast<const TuixExpr *>(expr->expr());
+  const tuix::Expr *left = comparison->left();
+  const tuix::Expr *right = comparison->right();
+  if (get_literal_value(left) != nullptr && get_column_stats(right, stats) != nullptr) {
+    std::swap(left, right);
+    op = flip_comparison(op);
+  }
+
+  const tuix::ColumnStats *column = get_column_stats(left, stats);
+  const tuix::Field *literal = get_literal_value(right);
+  if (column == nullptr || literal == nullptr) {
+    return true;
+  }
+  // A comparison with NULL is never true
+  if (literal->is_null() || column->null_count() >= stats->num_rows()) {
+    return false;
+  }
+  if (column->min() == nullptr || column->max() == nullptr ||
+      column->min()->value_type() != literal->value_type() ||
+      column->max()->value_type() != literal->value_type()) {
+    return true;
+  }
+
+  // Sort keys order values of the same type as comparisons do
+  std::string min_key, max_key, literal_key;
+  append_sort_key(column->min(), false, true, min_key);
+  append_sort_key(column->max(), false, true, max_key);
+  append_sort_key(literal, false, true, literal_key);
+  switch (op) {
+  case tuix::ExprUnion_LessThan:
+    return min_key < literal_key;
+  case tuix::ExprUnion_LessThanOrEqual:
+    return min_key <= literal_key;
+  case tuix::ExprUnion_GreaterThan:
+    return max_key > literal_key;
+  case tuix::ExprUnion_GreaterThanOrEqual:
+    return max_key >= literal_key;
+  case tuix::ExprUnion_EqualTo:
+    return min_key <= literal_key && literal_key <= max_key;
+  default:
+    return true;
+  }
+}
+
+bool stats_may_match(const tuix::Expr *condition, const tuix::BlockStats *stats) {
+  if (condition == nullptr) {
+    return true;
+  }
+  switch (condition->expr_type()) {
+  case tuix::ExprUnion_And: {
+    auto *e = static_cast<const tuix::And *>(condition->expr());
+    return stats_may_match(e->left(), stats) && stats_may_match(e->right(), stats);
+  }
+  case tuix::ExprUnion_Or: {
+    auto *e = static_cast<const tuix::Or *>(condition->expr());
+    return stats_may_match(e->left(), stats) || stats_may_match(e->right(), stats);
+  }
+  case tuix::ExprUnion_LessThan:
+    return comparison_may_match<tuix::LessThan>(condition->expr_type(), condition, stats);
+  case tuix::ExprUnion_LessThanOrEqual:
+    return comparison_may_match<tuix::LessThanOrEqual>(condition->expr_type(), condition, stats);
+  case tuix::ExprUnion_GreaterThan:
+    return comparison_may_match<tuix::GreaterThan>(condition->expr_type(), condition, stats);
+  case tuix::ExprUnion_GreaterThanOrEqual:
+    return comparison_may_match<tuix::GreaterThanOrEqual>(condition->expr_type(), condition,
+                                                          stats);
+  case tuix::ExprUnion_EqualTo:
+    return comparison_may_match<tuix::EqualTo>(condition->expr_type(), condition, stats);
+  case tuix::ExprUnion_IsNull: {
+    auto *column =
+        get_column_stats(static_cast<const tuix::IsNull *>(condition->expr())->child(), stats);
+    return column == nullptr || column->null_count() > 0;
+  }
+  case tuix::ExprUnion_Not: {
+    const tuix::Expr *child = static_cast<const tuix::Not *>(condition->expr())->child();
+    if (child != nullptr && child->expr_type() == tuix::ExprUnion_IsNull) {
+      auto *column =
+          get_column_stats(static_cast<const tuix::IsNull *>(child->expr())->child(), stats);
+      return column == nullptr || column->null_count() < stats->num_rows();
+    }
+    return true;
+  }
+  case tuix::ExprUnion_Literal: {
+    const tuix::Field *value = get_literal_value(condition);
+    return value == nullptr || value->value_type() != tuix::FieldUnion_BooleanField ||
+           (!value->is_null() && value->value_as_BooleanField()->value());
+  }
+  default:
+    return true;
+  }
+}
+
+bool block_may_match(const tuix::EncryptedBlock *encrypted_block, const tuix::Expr *condition) {
+  const flatbuffers::Vector<uint8_t> *enc_stats = encrypted_block->enc_stats();
+  if (enc_stats == nullptr) {
+    return true;
+  }
+
+  Crypto *crypto = CryptoContext::getInstance().crypto;
+  const size_t stats_len = crypto->SymDecSize(enc_stats->size());
+  std::unique_ptr<uint8_t> stats_buf(new uint8_t[stats_len]);
+  crypto->SymDec(shared_key, enc_stats->data(), NULL, stats_buf.get(), enc_stats->size(), 0);
+
+  flatbuffers::Verifier v(stats_buf.get(), stats_len);
+  if (!v.VerifyBuffer<tuix::BlockStats>(nullptr)) {
+    throw std::runtime_error(std::string("Corrupt BlockStats buffer of length ") +
+                             std::to_string(stats_len));
+  }
+  const tuix::BlockStats *stats = flatbuffers::GetRoot<tuix::BlockStats>(stats_buf.get());
+
+  // Statistics only describe the block whose rows were encrypted with the IV they record
+  const flatbuffers::Vector<uint8_t> *enc_rows = encrypted_block->enc_rows();
+  if (stats->rows_iv() == nullptr || stats->rows_iv()->size() != CIPHER_IV_SIZE ||
+      enc_rows->size() < CIPHER_IV_SIZE ||
+      memcmp(stats->rows_iv()->data(), enc_rows->data(), CIPHER_IV_SIZE) != 0 ||
+      stats->num_rows() != encrypted_block->num_rows() || stats->columns() == nullptr) {
+    throw std::runtime_error("BlockStats do not belong to their block");
+  }
+
+  return stats_may_match(condition, stats);
+}
@@ -0,0 +1,21 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include "flatbuffers.h"
+
+#ifndef BLOCK_STATS_H
+#define BLOCK_STATS_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/**
+ * Return false if the statistics of the given block show that `condition` is not true for any of
+ * its rows, so that the block can be skipped without decrypting its rows. Return true if the block
+ * has no statistics or the condition may hold. Only the statistics are decrypted.
+ *
+ * The condition is analyzed conservatively: comparisons between a column and a literal, null
+ * checks, and conjunctions and disjunctions of them can rule out a block, and any other
+ * expression is assumed to hold.
+ */
+bool block_may_match(const tuix::EncryptedBlock *encrypted_block, const tuix::Expr *condition);
+
+#endif
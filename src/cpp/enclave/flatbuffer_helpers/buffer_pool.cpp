@@ -0,0 +1,70 @@
+#include "buffer_pool.h"
+
+#include "common.h"
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) {
+  if (this != &other) {
+    reset();
+    buf = other.buf;
+    cap = other.cap;
+    other.buf = nullptr;
+    other.cap = 0;
+  }
+  return *this;
+}
+
+void PooledBuffer::reset() {
+  if (buf != nullptr) {
+    BufferPool::getInstance().release(buf, cap);
+    buf = nullptr;
+    cap = 0;
+  }
+}
+
+BufferPool::BufferPool() : free_buffers(Classes::NUM_CLASSES), pooled(0) {}
+
+BufferPool::~BufferPool() {
+  for (auto it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+    for (auto buf = it->begin(); buf != it->end(); ++buf) {
+      delete[] *buf;
+    }
+  }
+}
+
+PooledBuffer BufferPool::acquire(size_t len) {
+  const uint32_t size_class = Classes::index(len);
+  if (size_class == Classes::NUM_CLASSES) {
+    // Too large to pool
+    return PooledBuffer(new uint8_t[len], len);
+  }
+
+  const size_t cap = Classes::capacity(size_class);
+  uint8_t *buf = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint8_t *> &free_list = free_buffers[size_class];
+    if (!free_list.empty()) {
+      buf = free_list.back();
+      free_list.pop_back();
+      pooled -= cap;
+    }
+  }
+  if (buf == nullptr) {
+    buf = new uint8_t[cap];
+  }
+  return PooledBuffer(buf, cap);
+}
+
+void BufferPool::release(uint8_t *buf, size_t cap) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Buffers too large to pool are larger than every class
+    const uint32_t size_class = Classes::index(cap);
+    if (size_class < Classes::NUM_CLASSES && pooled + cap <= MAX_POOLED_BUFFER_BYTES) {
+      free_buffers[size_class].push_back(buf);
+      pooled += cap;
+      return;
+    }
+  }
+  delete[] buf;
+}
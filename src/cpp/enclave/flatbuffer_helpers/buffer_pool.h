@@ -0,0 +1,81 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "size_classes.h"
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+class BufferPool;
+
+/**
+ * An enclave buffer taken from the BufferPool, which it is returned to when the buffer is reset or
+ * destroyed. Its capacity may exceed the size that was asked for.
+ */
+class PooledBuffer {
+public:
+  PooledBuffer() : buf(nullptr), cap(0) {}
+  PooledBuffer(PooledBuffer &&other) : buf(other.buf), cap(other.cap) {
+    other.buf = nullptr;
+    other.cap = 0;
+  }
+  PooledBuffer &operator=(PooledBuffer &&other);
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+  ~PooledBuffer() { reset(); }
+
+  uint8_t *get() const { return buf; }
+  size_t capacity() const { return cap; }
+
+  /** Return the buffer to the pool, leaving this object empty. */
+  void reset();
+
+private:
+  friend class BufferPool;
+  PooledBuffer(uint8_t *buf, size_t cap) : buf(buf), cap(cap) {}
+
+  uint8_t *buf;
+  size_t cap;
+};
+
+/**
+ * A pool of enclave buffers for the plaintext of decrypted blocks. Readers decrypt one block after
+ * another into buffers of about the same size, so rather than allocating each from the enclave
+ * heap, buffers are rounded up to a power-of-two size class and returned to a free list for their
+ * class when released. At most MAX_POOLED_BUFFER_BYTES are kept on the free lists, and buffers
+ * larger than the largest class are allocated and freed directly. The pool may be used from any
+ * thread.
+ */
+class BufferPool {
+public:
+  BufferPool(BufferPool const &) = delete;
+  void operator=(BufferPool const &) = delete;
+
+  static BufferPool &getInstance() {
+    static BufferPool instance;
+    return instance;
+  }
+
+  /** Take a buffer of at least `len` bytes. Its contents are undefined. */
+  PooledBuffer acquire(size_t len);
+
+private:
+  friend class PooledBuffer;
+  BufferPool();
+  ~BufferPool();
+
+  void release(uint8_t *buf, size_t cap);
+
+  // From 4KB to 16MB
+  typedef SizeClasses<12, 24> Classes;
+
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t *>> free_buffers;
+  size_t pooled;
+};
+
+#endif
@@ -1,12 +1,17 @@
 // -*- c-basic-offset: 2; fill-column: 100 -*-
 
+#include <algorithm>
 #include <cmath>
 #include <functional>
 #include <limits>
 #include <typeinfo>
+#include <unordered_map>
 
 #include "crypto/crypto_context.h"
+#include "expression_program.h"
 #include "flatbuffers.h"
+#include "literal_set.h"
+#include "string_matcher.h"
 
 int printf(const char *fmt, ...);
 
@@ -213,21 +218,252 @@ eval_binary_comparison(flatbuffers::FlatBufferBuilder &builder, const tuix::Fiel
 
 class FlatbuffersExpressionEvaluator {
 public:
-  FlatbuffersExpressionEvaluator(const tuix::Expr *expr) : builder(), expr(expr) {}
+  FlatbuffersExpressionEvaluator(const tuix::Expr *expr)
+      : builder(), expr(expr), program(), batch_rows(nullptr), is_batch_compiled(false),
+        literal_matchers(), literal_sets() {
+    is_compiled = program.compile(expr);
+  }
 
   /**
    * Evaluate the stored expression on the given row. Return a Field containing
    * the result. Warning: The Field points to internally-managed memory that may
    * be overwritten the next time eval is called. Therefore it is only valid
    * until the next call to eval.
+   *
+   * The expression is run as a compiled ExprProgram when possible, and is
+   * otherwise interpreted by eval_helper.
    */
   const tuix::Field *eval(const tuix::Row *row) {
     builder.Clear();
-    flatbuffers::Offset<tuix::Field> result_offset = eval_helper(row, expr);
+    flatbuffers::Offset<tuix::Field> result_offset;
+    if (is_compiled && program.run(row)) {
+      result_offset = program.write_result(builder);
+    } else {
+      result_offset = eval_helper(row, expr);
+    }
+    return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, result_offset);
+  }
+
+  /**
+   * Evaluate the stored expression on a batch of rows, such as all rows of a
+   * block. The results can then be accessed using batch_result and
+   * select_batch. The rows must remain valid until then.
+   */
+  void eval_batch(const std::vector<const tuix::Row *> &rows) {
+    batch_rows = &rows;
+    is_batch_compiled = is_compiled && program.run_batch(rows);
+  }
+
+  /**
+   * Return a Field containing the result for the given row of the last batch.
+   * The Field is only valid until the next call to batch_result or eval.
+   */
+  const tuix::Field *batch_result(uint32_t row_idx) {
+    if (!is_batch_compiled) {
+      return eval((*batch_rows)[row_idx]);
+    }
+    builder.Clear();
+    flatbuffers::Offset<tuix::Field> result_offset =
+        program.write_batch_result(row_idx, builder);
     return flatbuffers::GetTemporaryPointer<tuix::Field>(builder, result_offset);
   }
 
+  /**
+   * Set `selection` to the indices of the rows of the last batch for which the
+   * result is true and not NULL. Return false if the batch was not evaluated as
+   * a whole or the result is not a boolean, in which case the caller must
+   * inspect batch_result for each row instead.
+   */
+  bool select_batch(std::vector<uint32_t> &selection) {
+    return is_batch_compiled && program.select_batch(selection);
+  }
+
+  /**
+   * Set `selection` to the positions in `indices` of the rows of a block stored
+   * column by column for which the result is true and not NULL, reading the
+   * columns directly without building rows. Return false if the expression
+   * cannot be evaluated on these columns, in which case the caller must
+   * evaluate it on the rows instead. Invalidates the last batch.
+   */
+  bool select_columns(const std::vector<const tuix::Column *> &columns,
+                      const std::vector<uint32_t> &indices, std::vector<uint32_t> &selection) {
+    batch_rows = nullptr;
+    is_batch_compiled = false;
+    return is_compiled && program.run_columns(columns, indices) &&
+           program.select_batch(selection);
+  }
+
+  /**
+   * Mark the columns that the stored expression reads in `used_columns`, growing it as
+   * necessary, so that readers can skip decrypting the others.
+   */
+  void mark_used_columns(std::vector<bool> &used_columns) {
+    mark_used_columns_helper(expr, used_columns);
+  }
+
+  /** Return whether the stored expression is run as a compiled ExprProgram when possible. */
+  bool has_program() const { return is_compiled; }
+
 private:
+  template <typename TuixExpr>
+  static void mark_used_columns_binary(const tuix::Expr *expr, std::vector<bool> &used_columns) {
+    auto *e = static_cast<const TuixExpr *>(expr->expr());
+    mark_used_columns_helper(e->left(), used_columns);
+    mark_used_columns_helper(e->right(), used_columns);
+  }
+
+  template <typename TuixExpr>
+  static void mark_used_columns_unary(const tuix::Expr *expr, std::vector<bool> &used_columns) {
+    mark_used_columns_helper(static_cast<const TuixExpr *>(expr->expr())->child(), used_columns);
+  }
+
+  template <typename TuixExpr>
+  static void mark_used_columns_children(const tuix::Expr *expr,
+                                         std::vector<bool> &used_columns) {
+    auto *children = static_cast<const TuixExpr *>(expr->expr())->children();
+    if (children != nullptr) {
+      for (auto it = children->begin(); it != children->end(); ++it) {
+        mark_used_columns_helper(*it, used_columns);
+      }
+    }
+  }
+
+  static void mark_used_columns_helper(const tuix::Expr *expr, std::vector<bool> &used_columns) {
+    if (expr == nullptr) {
+      return;
+    }
+    switch (expr->expr_type()) {
+    case tuix::ExprUnion_Col: {
+      uint32_t col_num = static_cast<const tuix::Col *>(expr->expr())->col_num();
+      if (col_num >= used_columns.size()) {
+        used_columns.resize(col_num + 1, false);
+      }
+      used_columns[col_num] = true;
+      break;
+    }
+    case tuix::ExprUnion_Literal:
+      break;
+    case tuix::ExprUnion_Cast:
+      mark_used_columns_helper(static_cast<const tuix::Cast *>(expr->expr())->value(),
+                               used_columns);
+      break;
+    case tuix::ExprUnion_Decrypt:
+      mark_used_columns_helper(static_cast<const tuix::Decrypt *>(expr->expr())->value(),
+                               used_columns);
+      break;
+    case tuix::ExprUnion_Substring: {
+      auto *substring = static_cast<const tuix::Substring *>(expr->expr());
+      mark_used_columns_helper(substring->str(), used_columns);
+      mark_used_columns_helper(substring->pos(), used_columns);
+      mark_used_columns_helper(substring->len(), used_columns);
+      break;
+    }
+    case tuix::ExprUnion_If: {
+      auto *if_expr = static_cast<const tuix::If *>(expr->expr());
+      mark_used_columns_helper(if_expr->predicate(), used_columns);
+      mark_used_columns_helper(if_expr->true_value(), used_columns);
+      mark_used_columns_helper(if_expr->false_value(), used_columns);
+      break;
+    }
+    case tuix::ExprUnion_Not:
+      mark_used_columns_unary<tuix::Not>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_IsNull:
+      mark_used_columns_unary<tuix::IsNull>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Year:
+      mark_used_columns_unary<tuix::Year>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Exp:
+      mark_used_columns_unary<tuix::Exp>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_NormalizeNaNAndZero:
+      mark_used_columns_unary<tuix::NormalizeNaNAndZero>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Upper:
+      mark_used_columns_unary<tuix::Upper>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Concat:
+      mark_used_columns_children<tuix::Concat>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_In:
+      mark_used_columns_children<tuix::In>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_CaseWhen:
+      mark_used_columns_children<tuix::CaseWhen>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_CreateArray:
+      mark_used_columns_children<tuix::CreateArray>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_LessThan:
+      mark_used_columns_binary<tuix::LessThan>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_LessThanOrEqual:
+      mark_used_columns_binary<tuix::LessThanOrEqual>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_GreaterThan:
+      mark_used_columns_binary<tuix::GreaterThan>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_GreaterThanOrEqual:
+      mark_used_columns_binary<tuix::GreaterThanOrEqual>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_EqualTo:
+      mark_used_columns_binary<tuix::EqualTo>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Contains:
+      mark_used_columns_binary<tuix::Contains>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_And:
+      mark_used_columns_binary<tuix::And>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Or:
+      mark_used_columns_binary<tuix::Or>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Like:
+      mark_used_columns_binary<tuix::Like>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_StartsWith:
+      mark_used_columns_binary<tuix::StartsWith>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_EndsWith:
+      mark_used_columns_binary<tuix::EndsWith>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Multiply:
+      mark_used_columns_binary<tuix::Multiply>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Divide:
+      mark_used_columns_binary<tuix::Divide>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Add:
+      mark_used_columns_binary<tuix::Add>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_Subtract:
+      mark_used_columns_binary<tuix::Subtract>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_DateAdd:
+      mark_used_columns_binary<tuix::DateAdd>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_DateAddInterval:
+      mark_used_columns_binary<tuix::DateAddInterval>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_VectorAdd:
+      mark_used_columns_binary<tuix::VectorAdd>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_VectorMultiply:
+      mark_used_columns_binary<tuix::VectorMultiply>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_DotProduct:
+      mark_used_columns_binary<tuix::DotProduct>(expr, used_columns);
+      break;
+    case tuix::ExprUnion_ClosestPoint:
+      mark_used_columns_binary<tuix::ClosestPoint>(expr, used_columns);
+      break;
+    default:
+      throw std::runtime_error(std::string("Can't find the columns used by expression of type ") +
+                               std::string(tuix::EnumNameExprUnion(expr->expr_type())));
+    }
+  }
+
   /**
    * Evaluate the given expression on the given row. Return the offset (within
    * builder) of the Field containing the result. This offset is only valid
@@ -290,10 +526,8 @@ private:
         crypto->SymDec(shared_key, reinterpret_cast<const uint8_t *>(ciphertext_decoded.data()),
                        NULL, plaintext, ciphertext_decoded.size(), 0);
 
-        BufferRefView<tuix::Rows> buf(plaintext, ciphertext_decoded.size());
-        buf.verify();
-
-        const tuix::Rows *rows = buf.root();
+        flatbuffers::FlatBufferBuilder rows_builder;
+        const tuix::Rows *rows = decode_rows(plaintext, ciphertext_decoded.size(), rows_builder);
         const tuix::Field *field = rows->rows()->Get(0)->field_values()->Get(0);
         auto ret = flatbuffers_copy<tuix::Field>(field, builder);
 
@@ -447,30 +681,33 @@ private:
 
     // Predicates
     case tuix::ExprUnion_And: {
+      // The right operand is only evaluated if the left does not already make the result false
       auto a = static_cast<const tuix::And *>(expr->expr());
-      auto left_offset = eval_helper(row, a->left());
-      auto right_offset = eval_helper(row, a->right());
-      auto left = flatbuffers::GetTemporaryPointer(builder, left_offset);
-      auto right = flatbuffers::GetTemporaryPointer(builder, right_offset);
-
-      if (left->value_type() != tuix::FieldUnion_BooleanField ||
-          right->value_type() != tuix::FieldUnion_BooleanField) {
+      auto left = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, a->left()));
+      if (left->value_type() != tuix::FieldUnion_BooleanField) {
         throw std::runtime_error(std::string("And can't operate on ") +
-                                 std::string(tuix::EnumNameFieldUnion(left->value_type())) +
-                                 std::string(" and ") +
-                                 std::string(tuix::EnumNameFieldUnion(right->value_type())));
+                                 std::string(tuix::EnumNameFieldUnion(left->value_type())));
       }
+      bool left_is_null = left->is_null();
+      bool left_value = static_cast<const tuix::BooleanField *>(left->value())->value();
 
       bool result = false, result_is_null = false;
-      bool left_value = static_cast<const tuix::BooleanField *>(left->value())->value();
-      if (!left->is_null() && !left_value) {
+      if (!left_is_null && !left_value) {
         result = false;
       } else {
+        // Evaluating the right operand invalidates the left temporary pointer
+        auto right = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, a->right()));
+        if (right->value_type() != tuix::FieldUnion_BooleanField) {
+          throw std::runtime_error(std::string("And can't operate on ") +
+                                   std::string(tuix::EnumNameFieldUnion(left->value_type())) +
+                                   std::string(" and ") +
+                                   std::string(tuix::EnumNameFieldUnion(right->value_type())));
+        }
         bool right_value = static_cast<const tuix::BooleanField *>(right->value())->value();
         if (!right->is_null() && !right_value) {
           result = false;
         } else {
-          if (!left->is_null() && !right->is_null()) {
+          if (!left_is_null && !right->is_null()) {
             result = true;
           } else {
             result_is_null = true;
@@ -484,30 +721,33 @@ private:
     }
 
     case tuix::ExprUnion_Or: {
+      // The right operand is only evaluated if the left does not already make the result true
       auto o = static_cast<const tuix::Or *>(expr->expr());
-      auto left_offset = eval_helper(row, o->left());
-      auto right_offset = eval_helper(row, o->right());
-      auto left = flatbuffers::GetTemporaryPointer(builder, left_offset);
-      auto right = flatbuffers::GetTemporaryPointer(builder, right_offset);
-
-      if (left->value_type() != tuix::FieldUnion_BooleanField ||
-          right->value_type() != tuix::FieldUnion_BooleanField) {
+      auto left = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, o->left()));
+      if (left->value_type() != tuix::FieldUnion_BooleanField) {
         throw std::runtime_error(std::string("Or can't operate on ") +
-                                 std::string(tuix::EnumNameFieldUnion(left->value_type())) +
-                                 std::string(" and ") +
-                                 std::string(tuix::EnumNameFieldUnion(right->value_type())));
+                                 std::string(tuix::EnumNameFieldUnion(left->value_type())));
       }
+      bool left_is_null = left->is_null();
+      bool left_value = static_cast<const tuix::BooleanField *>(left->value())->value();
 
       bool result = false, result_is_null = false;
-      bool left_value = static_cast<const tuix::BooleanField *>(left->value())->value();
-      if (!left->is_null() && left_value) {
+      if (!left_is_null && left_value) {
         result = true;
       } else {
+        // Evaluating the right operand invalidates the left temporary pointer
+        auto right = flatbuffers::GetTemporaryPointer(builder, eval_helper(row, o->right()));
+        if (right->value_type() != tuix::FieldUnion_BooleanField) {
+          throw std::runtime_error(std::string("Or can't operate on ") +
+                                   std::string(tuix::EnumNameFieldUnion(left->value_type())) +
+                                   std::string(" and ") +
+                                   std::string(tuix::EnumNameFieldUnion(right->value_type())));
+        }
         bool right_value = static_cast<const tuix::BooleanField *>(right->value())->value();
         if (!right->is_null() && right_value) {
           result = true;
         } else {
-          if (!left->is_null() && !right->is_null()) {
+          if (!left_is_null && !right->is_null()) {
             result = false;
           } else {
             result_is_null = true;
@@ -650,43 +890,8 @@ private:
     }
 
     case tuix::ExprUnion_Contains: {
-      // TODO: handle Contains(str, "")
-
       auto c = static_cast<const tuix::Contains *>(expr->expr());
-      auto left_offset = eval_helper(row, c->left());
-      auto right_offset = eval_helper(row, c->right());
-
-      // Note: These temporary pointers will be invalidated when we next write
-      // to builder
-      const tuix::Field *left = flatbuffers::GetTemporaryPointer(builder, left_offset);
-      const tuix::Field *right = flatbuffers::GetTemporaryPointer(builder, right_offset);
-
-      if (left->value_type() != tuix::FieldUnion_StringField ||
-          right->value_type() != tuix::FieldUnion_StringField) {
-        throw std::runtime_error(
-            std::string("tuix::Contains requires left String, right String, not ") +
-            std::string("left ") + std::string(tuix::EnumNameFieldUnion(left->value_type())) +
-            std::string(", right ") + std::string(tuix::EnumNameFieldUnion(right->value_type())));
-      }
-
-      bool result_is_null = left->is_null() || right->is_null();
-      if (!result_is_null) {
-        auto left_field = static_cast<const tuix::StringField *>(left->value());
-        auto right_field = static_cast<const tuix::StringField *>(right->value());
-        auto last = flatbuffers::VectorIterator<uint8_t, uint8_t>(left_field->value()->Data(),
-                                                                  left_field->length());
-        auto it = std::find_end(
-            flatbuffers::VectorIterator<uint8_t, uint8_t>(left_field->value()->Data(), 0), last,
-            flatbuffers::VectorIterator<uint8_t, uint8_t>(right_field->value()->Data(), 0),
-            flatbuffers::VectorIterator<uint8_t, uint8_t>(right_field->value()->Data(),
-                                                          right_field->length()));
-        bool result = (it != last);
-        return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                                 tuix::CreateBooleanField(builder, result).Union(), false);
-      } else {
-        return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                                 tuix::CreateBooleanField(builder, false).Union(), true);
-      }
+      return eval_string_predicate(row, expr, c->left(), c->right());
     }
 
     case tuix::ExprUnion_Concat: {
@@ -741,12 +946,30 @@ private:
 
       auto left_offset = eval_helper(row, (*c->children())[0]);
       const tuix::Field *left = flatbuffers::GetTemporaryPointer(builder, left_offset);
+      bool left_is_null = left->is_null();
+
+      // Lists of literals are looked up in a set built the first time they are evaluated
+      const LiteralSet *items = literal_set(c);
+      if (items != nullptr) {
+        if (items->type != left->value_type()) {
+          throw std::runtime_error(std::string("In can't operate on ") +
+                                   std::string(tuix::EnumNameFieldUnion(left->value_type())) +
+                                   std::string(" and ") +
+                                   std::string(tuix::EnumNameFieldUnion(items->type)) +
+                                   ". Please double check the type of each input");
+        }
+        result = !left_is_null && items->contains(left);
+        return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
+                                 tuix::CreateBooleanField(builder, result).Union(),
+                                 !result && (left_is_null || items->has_null));
+      }
 
-      bool result_is_null = left->is_null();
+      bool result_is_null = left_is_null;
 
       for (size_t i = 1; i < num_children; i++) {
         auto right_offset = eval_helper(row, (*c->children())[i]);
         const tuix::Field *item = flatbuffers::GetTemporaryPointer(builder, right_offset);
+        left = flatbuffers::GetTemporaryPointer(builder, left_offset);
         if (item->value_type() != left->value_type()) {
           throw std::runtime_error(std::string("In can't operate on ") +
                                    std::string(tuix::EnumNameFieldUnion(left->value_type())) +
@@ -756,6 +979,11 @@ private:
         }
         result_is_null = result_is_null || item->is_null();
 
+        // A NULL value is not equal to any item, including a NULL one
+        if (left_is_null) {
+          continue;
+        }
+
         // adding dynamic casting
         bool temporary_result =
             static_cast<const tuix::BooleanField *>(
@@ -827,166 +1055,38 @@ private:
 
     case tuix::ExprUnion_Like: {
       auto e = static_cast<const tuix::Like *>(expr->expr());
-      auto left_offset = eval_helper(row, e->left());
-      auto right_offset = eval_helper(row, e->right());
-      const tuix::Field *left = flatbuffers::GetTemporaryPointer(builder, left_offset);
-      const tuix::Field *right = flatbuffers::GetTemporaryPointer(builder, right_offset);
-
-      // Type check
-      if (left->value_type() != tuix::FieldUnion_StringField ||
-          right->value_type() != tuix::FieldUnion_StringField) {
-        throw std::runtime_error(
-            std::string("tuix::Contains requires left String, right String, not ") +
-            std::string("left ") + std::string(tuix::EnumNameFieldUnion(left->value_type())) +
-            std::string(", right ") + std::string(tuix::EnumNameFieldUnion(right->value_type())));
-      }
-
-      // Null check
-      if (left->is_null() || right->is_null()) {
-        return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                                 tuix::CreateBooleanField(builder, false).Union(), true);
-      }
-
-      // Copy strings into char buffer
-      auto left_field = static_cast<const tuix::StringField *>(left->value());
-      auto right_field = static_cast<const tuix::StringField *>(right->value());
-      uint32_t n = left_field->length();
-      uint32_t m = right_field->length();
-
-      // DP algorithm for wildcard matching taken from:
-      // https://www.geeksforgeeks.org/wildcard-pattern-matching/
-      bool result;
-      if (m == 0)
-        return (n == 0);
-      bool lookup[n + 1][m + 1];
-      memset(lookup, false, sizeof(lookup));
-      lookup[0][0] = true;
-      for (uint32_t j = 1; j <= m; j++) {
-        if (right_field->value()->Get(j - 1) == '%') {
-          lookup[0][j] = lookup[0][j - 1];
-        }
-      }
-      for (uint32_t i = 1; i <= n; i++) {
-        for (uint32_t j = 1; j <= m; j++) {
-          if (right_field->value()->Get(j - 1) == '%') {
-            lookup[i][j] = lookup[i][j - 1] || lookup[i - 1][j];
-          } else if (right_field->value()->Get(j - 1) == '_' ||
-                     left_field->value()->Get(i - 1) == right_field->value()->Get(j - 1)) {
-            lookup[i][j] = lookup[i - 1][j - 1];
-          } else {
-            lookup[i][j] = false;
-          }
-        }
-      }
-      result = lookup[n][m];
-      return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                               tuix::CreateBooleanField(builder, result).Union(), false);
+      return eval_string_predicate(row, expr, e->left(), e->right());
     }
 
     case tuix::ExprUnion_StartsWith: {
-      auto e = static_cast<const tuix::Like *>(expr->expr());
-      auto left_offset = eval_helper(row, e->left());
-      auto right_offset = eval_helper(row, e->right());
-      const tuix::Field *left = flatbuffers::GetTemporaryPointer(builder, left_offset);
-      const tuix::Field *right = flatbuffers::GetTemporaryPointer(builder, right_offset);
-
-      // Type check
-      if (left->value_type() != tuix::FieldUnion_StringField ||
-          right->value_type() != tuix::FieldUnion_StringField) {
-        throw std::runtime_error(
-            std::string("tuix::Contains requires left String, right String, not ") +
-            std::string("left ") + std::string(tuix::EnumNameFieldUnion(left->value_type())) +
-            std::string(", right ") + std::string(tuix::EnumNameFieldUnion(right->value_type())));
-      }
-
-      // Null check
-      if (left->is_null() || right->is_null()) {
-        return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                                 tuix::CreateBooleanField(builder, false).Union(), true);
-      }
-
-      auto left_field = static_cast<const tuix::StringField *>(left->value());
-      auto right_field = static_cast<const tuix::StringField *>(right->value());
-      uint32_t pattern_len = right_field->length();
-      bool result = true;
-      for (uint32_t i = 0; i < pattern_len; i++) {
-        result = result && (left_field->value()->Get(i) == right_field->value()->Get(i));
-      }
-
-      return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                               tuix::CreateBooleanField(builder, result).Union(), false);
+      auto e = static_cast<const tuix::StartsWith *>(expr->expr());
+      return eval_string_predicate(row, expr, e->left(), e->right());
     }
 
     case tuix::ExprUnion_EndsWith: {
-      auto e = static_cast<const tuix::Like *>(expr->expr());
-      auto left_offset = eval_helper(row, e->left());
-      auto right_offset = eval_helper(row, e->right());
-      const tuix::Field *left = flatbuffers::GetTemporaryPointer(builder, left_offset);
-      const tuix::Field *right = flatbuffers::GetTemporaryPointer(builder, right_offset);
-
-      // Type check
-      if (left->value_type() != tuix::FieldUnion_StringField ||
-          right->value_type() != tuix::FieldUnion_StringField) {
-        throw std::runtime_error(
-            std::string("tuix::Contains requires left String, right String, not ") +
-            std::string("left ") + std::string(tuix::EnumNameFieldUnion(left->value_type())) +
-            std::string(", right ") + std::string(tuix::EnumNameFieldUnion(right->value_type())));
-      }
-
-      // Null check
-      if (left->is_null() || right->is_null()) {
-        return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                                 tuix::CreateBooleanField(builder, false).Union(), true);
-      }
-
-      auto left_field = static_cast<const tuix::StringField *>(left->value());
-      auto right_field = static_cast<const tuix::StringField *>(right->value());
-      uint32_t str_len = left_field->length();
-      uint32_t pattern_len = right_field->length();
-      bool result = true;
-      for (uint32_t i = 0; i < pattern_len; i++) {
-        uint32_t str_dex = str_len - pattern_len + i;
-        result = result && (left_field->value()->Get(str_dex) == right_field->value()->Get(i));
-      }
-      return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
-                               tuix::CreateBooleanField(builder, result).Union(), false);
+      auto e = static_cast<const tuix::EndsWith *>(expr->expr());
+      return eval_string_predicate(row, expr, e->left(), e->right());
     }
 
     // Conditional expressions
     case tuix::ExprUnion_If: {
+      // Only the branch selected by the predicate is evaluated
       auto e = static_cast<const tuix::If *>(expr->expr());
-      auto predicate_offset = eval_helper(row, e->predicate());
-      auto true_value_offset = eval_helper(row, e->true_value());
-      auto false_value_offset = eval_helper(row, e->false_value());
-      // Note: These temporary pointers will be invalidated when we next write
-      // to builder
-      const tuix::Field *predicate = flatbuffers::GetTemporaryPointer(builder, predicate_offset);
-      const tuix::Field *true_value =
-          flatbuffers::GetTemporaryPointer(builder, true_value_offset);
-      const tuix::Field *false_value =
-          flatbuffers::GetTemporaryPointer(builder, false_value_offset);
+      // Note: This temporary pointer will be invalidated when we next write to builder
+      const tuix::Field *predicate =
+          flatbuffers::GetTemporaryPointer(builder, eval_helper(row, e->predicate()));
       if (predicate->value_type() != tuix::FieldUnion_BooleanField) {
         throw std::runtime_error(
             std::string("tuix::If requires predicate to return Boolean, not ") +
             std::string(tuix::EnumNameFieldUnion(predicate->value_type())));
       }
-      if (true_value->value_type() != false_value->value_type()) {
-        throw std::runtime_error(
-            std::string("tuix::If requires true and false types to be the same, but ") +
-            std::string(tuix::EnumNameFieldUnion(true_value->value_type())) +
-            std::string(" != ") +
-            std::string(tuix::EnumNameFieldUnion(false_value->value_type())));
-      }
       if (!predicate->is_null()) {
         bool pred_val = static_cast<const tuix::BooleanField *>(predicate->value())->value();
-        if (pred_val) {
-          return GetOffset<tuix::Field>(builder, true_value);
-        } else {
-          return GetOffset<tuix::Field>(builder, false_value);
-        }
+        return eval_helper(row, pred_val ? e->true_value() : e->false_value());
       } else {
-        // Writing the result invalidates the predicate, true_value, false_value
-        // temporary pointers
+        const tuix::Field *true_value =
+            flatbuffers::GetTemporaryPointer(builder, eval_helper(row, e->true_value()));
+        // Writing the result invalidates the true_value temporary pointer
         // TODO: this is therefore unsafe
         return flatbuffers_copy<tuix::Field>(true_value, builder, true);
       }
@@ -997,33 +1097,20 @@ private:
       size_t num_children = e->children()->size();
 
       // Evaluate to the first value whose predicate is true.
-      // Short circuit on the earliest branch possible.
-      tuix::FieldUnion result_type = tuix::FieldUnion_NONE;
+      // Short circuit on the earliest branch possible, without evaluating the values of branches
+      // whose predicates are false.
       for (size_t i = 0; i < num_children - 1; i += 2) {
-        auto predicate_offset = eval_helper(row, (*e->children())[i]);
-        auto true_value_offset = eval_helper(row, (*e->children())[i + 1]);
         const tuix::Field *predicate =
-            flatbuffers::GetTemporaryPointer(builder, predicate_offset);
-        const tuix::Field *true_value =
-            flatbuffers::GetTemporaryPointer(builder, true_value_offset);
-        if (result_type == tuix::FieldUnion_NONE) {
-          result_type = true_value->value_type();
-        }
+            flatbuffers::GetTemporaryPointer(builder, eval_helper(row, (*e->children())[i]));
         if (predicate->value_type() != tuix::FieldUnion_BooleanField) {
           throw std::runtime_error(
               std::string("tuix::CaseWhen requires predicate to return Boolean, not ") +
               std::string(tuix::EnumNameFieldUnion(predicate->value_type())));
         }
-        if (true_value->value_type() != result_type) {
-          throw std::runtime_error(
-              std::string("tuix::CaseWhen requires a uniform data type, but ") +
-              std::string(tuix::EnumNameFieldUnion(true_value->value_type())) +
-              std::string(" != ") + std::string(tuix::EnumNameFieldUnion(result_type)));
-        }
         if (!predicate->is_null()) {
           bool pred_val = static_cast<const tuix::BooleanField *>(predicate->value())->value();
           if (pred_val) {
-            return GetOffset<tuix::Field>(builder, true_value);
+            return eval_helper(row, (*e->children())[i + 1]);
           }
         }
       }
@@ -1031,10 +1118,14 @@ private:
       // None of the predicates were true.
       // Return the else value if it exists, or a null value if it doesn't.
       if (num_children % 2 == 1) {
-        auto else_value_offset = eval_helper(row, (*e->children())[num_children - 1]);
-        const tuix::Field *else_value =
-            flatbuffers::GetTemporaryPointer(builder, else_value_offset);
-        return GetOffset<tuix::Field>(builder, else_value);
+        return eval_helper(row, (*e->children())[num_children - 1]);
+      }
+      // The null value takes the type of the first branch, which must be evaluated to find it
+      tuix::FieldUnion result_type = tuix::FieldUnion_NONE;
+      if (num_children >= 2) {
+        result_type =
+            flatbuffers::GetTemporaryPointer(builder, eval_helper(row, (*e->children())[1]))
+                ->value_type();
       }
       // Null strings require special handling...
       if (result_type == tuix::FieldUnion_StringField) {
@@ -1487,14 +1578,267 @@ private:
     }
   }
 
+  /**
+   * Evaluate a string predicate `expr` (Like, StartsWith, EndsWith or Contains) matching the
+   * string `left` against the pattern `right`. A literal pattern is compiled into a StringMatcher
+   * only the first time it is evaluated.
+   */
+  flatbuffers::Offset<tuix::Field> eval_string_predicate(const tuix::Row *row,
+                                                         const tuix::Expr *expr,
+                                                         const tuix::Expr *left_expr,
+                                                         const tuix::Expr *right_expr) {
+    auto left_offset = eval_helper(row, left_expr);
+    auto right_offset = eval_helper(row, right_expr);
+    // Note: These temporary pointers will be invalidated when we next write to builder
+    const tuix::Field *left = flatbuffers::GetTemporaryPointer(builder, left_offset);
+    const tuix::Field *right = flatbuffers::GetTemporaryPointer(builder, right_offset);
+
+    // Type check
+    if (left->value_type() != tuix::FieldUnion_StringField ||
+        right->value_type() != tuix::FieldUnion_StringField) {
+      throw std::runtime_error(
+          std::string("tuix::") + std::string(tuix::EnumNameExprUnion(expr->expr_type())) +
+          std::string(" requires left String, right String, not ") + std::string("left ") +
+          std::string(tuix::EnumNameFieldUnion(left->value_type())) + std::string(", right ") +
+          std::string(tuix::EnumNameFieldUnion(right->value_type())));
+    }
+
+    // Null check
+    if (left->is_null() || right->is_null()) {
+      return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
+                               tuix::CreateBooleanField(builder, false).Union(), true);
+    }
+
+    auto str = static_cast<const tuix::StringField *>(left->value());
+    auto pattern = static_cast<const tuix::StringField *>(right->value());
+    const StringMatcher *matcher;
+    StringMatcher row_matcher;
+    if (right_expr->expr_type() == tuix::ExprUnion_Literal) {
+      auto it = literal_matchers.find(expr);
+      if (it == literal_matchers.end()) {
+        StringMatcher literal_matcher =
+            StringMatcher::for_predicate(expr, pattern->value()->data(), pattern->length());
+        it = literal_matchers.insert(std::make_pair(expr, std::move(literal_matcher))).first;
+      }
+      matcher = &it->second;
+    } else {
+      row_matcher =
+          StringMatcher::for_predicate(expr, pattern->value()->data(), pattern->length());
+      matcher = &row_matcher;
+    }
+    bool result = matcher->matches(str->value()->data(), str->length());
+    return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
+                             tuix::CreateBooleanField(builder, result).Union(), false);
+  }
+
+  /**
+   * Return the set of the items of the given tuix::In expression, building it if this is the first
+   * time it is needed, or nullptr if its items are not all literals of one type a set can hold.
+   */
+  const LiteralSet *literal_set(const tuix::In *in) {
+    auto it = literal_sets.find(in);
+    if (it == literal_sets.end()) {
+      std::unique_ptr<LiteralSet> items(new LiteralSet);
+      if (!items->build(in->children())) {
+        items.reset();
+      }
+      it = literal_sets.insert(std::make_pair(in, std::move(items))).first;
+    }
+    return it->second.get();
+  }
+
   flatbuffers::FlatBufferBuilder builder;
   const tuix::Expr *expr;
+  ExprProgram program;
+  bool is_compiled;
+  const std::vector<const tuix::Row *> *batch_rows;
+  bool is_batch_compiled;
+  // Compiled matchers of the string predicates with literal patterns, by predicate
+  std::unordered_map<const tuix::Expr *, StringMatcher> literal_matchers;
+  // Item sets of the tuix::In expressions, or nullptr for those whose items are not literals
+  std::unordered_map<const tuix::In *, std::unique_ptr<LiteralSet>> literal_sets;
+};
+
+/**
+ * Evaluates a filter condition conjunct by conjunct, so that each top-level conjunct of the
+ * condition is only evaluated on the rows of a batch that satisfied the ones before it. A row
+ * satisfies the condition exactly when every conjunct is true and not NULL, so the conjuncts can
+ * be evaluated in any order. After each batch they are reordered by the cost and selectivity
+ * observed so far, so that cheap conjuncts that reject many rows are evaluated first.
+ */
+class FlatbuffersConjunctionEvaluator {
+public:
+  FlatbuffersConjunctionEvaluator(const tuix::Expr *condition)
+      : conjuncts(), batch_rows(), batch_selection(), batch_counts() {
+    add_conjuncts(condition);
+  }
+
+  /** Mark the columns that the condition reads in `used_columns`, as for a single expression. */
+  void mark_used_columns(std::vector<bool> &used_columns) {
+    for (auto &conjunct : conjuncts) {
+      conjunct.eval->mark_used_columns(used_columns);
+    }
+  }
+
+  /**
+   * Set `selection` to the indices of the given rows for which the condition is true and not NULL.
+   */
+  void select(const std::vector<const tuix::Row *> &rows, std::vector<uint32_t> &selection) {
+    selection.resize(rows.size());
+    for (uint32_t i = 0; i < rows.size(); i++) {
+      selection[i] = i;
+    }
+
+    for (auto &conjunct : conjuncts) {
+      if (selection.empty()) {
+        break;
+      }
+      batch_rows.clear();
+      for (uint32_t idx : selection) {
+        batch_rows.push_back(rows[idx]);
+      }
+      bool vectorized = select_batch(*conjunct.eval, batch_rows, batch_selection);
+
+      conjunct.rows_in += batch_rows.size();
+      conjunct.rows_out += batch_selection.size();
+      conjunct.cost += batch_rows.size() * (vectorized ? 1.0 : INTERPRETED_ROW_COST);
+
+      // batch_selection indexes into batch_rows, and is in increasing order like selection
+      for (uint32_t i = 0; i < batch_selection.size(); i++) {
+        selection[i] = selection[batch_selection[i]];
+      }
+      selection.resize(batch_selection.size());
+    }
+
+    std::stable_sort(conjuncts.begin(), conjuncts.end(),
+                     [](const Conjunct &a, const Conjunct &b) { return a.rank() < b.rank(); });
+  }
+
+  /**
+   * Set `selection` as select() does for the `num_rows` rows of a block stored column by column,
+   * reading the columns directly rather than building the rows first. Return false if some
+   * conjunct cannot be evaluated on the columns, in which case `selection` is undefined and the
+   * rows must be passed to select() instead.
+   */
+  bool select_columns(const std::vector<const tuix::Column *> &columns, uint32_t num_rows,
+                      std::vector<uint32_t> &selection) {
+    selection.resize(num_rows);
+    for (uint32_t i = 0; i < num_rows; i++) {
+      selection[i] = i;
+    }
+
+    // The statistics are only recorded once every conjunct has been evaluated, since the rows
+    // are evaluated again by select() otherwise
+    batch_counts.clear();
+    for (auto &conjunct : conjuncts) {
+      if (selection.empty()) {
+        break;
+      }
+      if (!conjunct.eval->select_columns(columns, selection, batch_selection)) {
+        return false;
+      }
+      batch_counts.push_back(std::make_pair(selection.size(), batch_selection.size()));
+
+      // batch_selection indexes into selection, and is in increasing order
+      for (uint32_t i = 0; i < batch_selection.size(); i++) {
+        selection[i] = selection[batch_selection[i]];
+      }
+      selection.resize(batch_selection.size());
+    }
+
+    for (uint32_t i = 0; i < batch_counts.size(); i++) {
+      conjuncts[i].rows_in += batch_counts[i].first;
+      conjuncts[i].rows_out += batch_counts[i].second;
+      conjuncts[i].cost += batch_counts[i].first;
+    }
+    std::stable_sort(conjuncts.begin(), conjuncts.end(),
+                     [](const Conjunct &a, const Conjunct &b) { return a.rank() < b.rank(); });
+    return true;
+  }
+
+private:
+  // Relative cost of evaluating a conjunct on one row with eval_helper rather than with a batch of
+  // an ExprProgram
+  static constexpr double INTERPRETED_ROW_COST = 10.0;
+
+  struct Conjunct {
+    std::unique_ptr<FlatbuffersExpressionEvaluator> eval;
+    // Number of rows the conjunct was evaluated on and number of those that satisfied it
+    uint64_t rows_in;
+    uint64_t rows_out;
+    // Total cost of the rows evaluated so far, in units of one row of an ExprProgram batch
+    double cost;
+
+    /**
+     * Return the expected cost of evaluating this conjunct per row it rejects. Conjuncts are
+     * evaluated in increasing order of rank. Before any rows are seen, the cost is estimated from
+     * whether the conjunct compiled to an ExprProgram and half of the rows are assumed to pass.
+     */
+    double rank() const {
+      double row_cost = rows_in > 0 ? cost / rows_in
+                                    : (eval->has_program() ? 1.0 : INTERPRETED_ROW_COST);
+      double pass_rate = (rows_out + 1.0) / (rows_in + 2.0);
+      return row_cost / (1.0 - pass_rate);
+    }
+  };
+
+  void add_conjuncts(const tuix::Expr *expr) {
+    if (expr->expr_type() == tuix::ExprUnion_And) {
+      auto a = static_cast<const tuix::And *>(expr->expr());
+      add_conjuncts(a->left());
+      add_conjuncts(a->right());
+    } else {
+      Conjunct conjunct;
+      conjunct.eval.reset(new FlatbuffersExpressionEvaluator(expr));
+      conjunct.rows_in = 0;
+      conjunct.rows_out = 0;
+      conjunct.cost = 0.0;
+      conjuncts.push_back(std::move(conjunct));
+    }
+  }
+
+  /**
+   * Set `selection` to the indices of the given rows that satisfy the expression of `eval`.
+   * Return whether the batch was evaluated by an ExprProgram rather than row by row.
+   */
+  static bool select_batch(FlatbuffersExpressionEvaluator &eval,
+                           const std::vector<const tuix::Row *> &rows,
+                           std::vector<uint32_t> &selection) {
+    eval.eval_batch(rows);
+    if (eval.select_batch(selection)) {
+      return true;
+    }
+
+    selection.clear();
+    for (uint32_t i = 0; i < rows.size(); i++) {
+      const tuix::Field *condition_result = eval.batch_result(i);
+      if (condition_result->value_type() != tuix::FieldUnion_BooleanField) {
+        throw std::runtime_error(
+            std::string("Filter expression expected to return BooleanField, "
+                        "instead returned ") +
+            std::string(tuix::EnumNameFieldUnion(condition_result->value_type())));
+      }
+
+      // If condition_result is NULL, then always return false
+      bool keep_row = !condition_result->is_null() &&
+                      static_cast<const tuix::BooleanField *>(condition_result->value())->value();
+      if (keep_row) {
+        selection.push_back(i);
+      }
+    }
+    return false;
+  }
+
+  std::vector<Conjunct> conjuncts;
+  std::vector<const tuix::Row *> batch_rows;
+  std::vector<uint32_t> batch_selection;
+  // Rows in and out of each conjunct evaluated by select_columns(), in evaluation order
+  std::vector<std::pair<uint64_t, uint64_t>> batch_counts;
 };
 
 class FlatbuffersSortOrderEvaluator {
 public:
-  FlatbuffersSortOrderEvaluator(const tuix::SortExpr *sort_expr)
-      : sort_expr(sort_expr), builder() {
+  FlatbuffersSortOrderEvaluator(const tuix::SortExpr *sort_expr) : sort_expr(sort_expr) {
     for (auto sort_order_it = sort_expr->sort_order()->begin();
          sort_order_it != sort_expr->sort_order()->end(); ++sort_order_it) {
       sort_order_evaluators.emplace_back(std::unique_ptr<FlatbuffersExpressionEvaluator>(
@@ -1517,71 +1861,34 @@ public:
     }
   }
 
+  /* Encode the fields of comparison of the given row into `key`, such that row1 should come
+   * before row2 according to the list of sort orders supplied to SortExpr if and only if the key
+   * of row1 is lexicographically smaller than the key of row2. Sorting by key therefore evaluates
+   * the sort order expressions once per row rather than once per comparison.
+   */
+  void get_sort_key(const tuix::Row *row, std::string &key) {
+    key.clear();
+    for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
+      const tuix::SortOrder *sort_order = sort_expr->sort_order()->Get(i);
+      append_sort_key(sort_order_evaluators[i]->eval(row),
+                      sort_order->direction() == tuix::SortDirection_Descending,
+                      sort_order->null_ordering() == tuix::NullOrdering_NullsFirst, key);
+    }
+  }
+
   /* Evaluate whether or not row1 should come before row2 according to
    * the list of sort orders supplied to SortExpr.
    */
   bool order_before(const tuix::Row *row1, const tuix::Row *row2) {
-    builder.Clear();
-    const tuix::Row *a = nullptr, *b = nullptr;
-    for (uint32_t i = 0; i < sort_order_evaluators.size(); i++) {
-      switch (sort_expr->sort_order()->Get(i)->direction()) {
-      case tuix::SortDirection_Ascending:
-        a = row1;
-        b = row2;
-        break;
-      case tuix::SortDirection_Descending:
-        a = row2;
-        b = row1;
-        break;
-      }
-
-      // Evaluate the field of comparison for rows a and b. Because the first
-      // evaluation returns a temporary pointer that is invalidated by the
-      // second evaluation, we must copy the result of the first evaluation
-      // before performing the second evaluation. For simplicity, we then
-      // maintain offsets into builder rather than pointers, because offsets
-      // will not be invalidated by further operations.
-      auto a_eval_offset = flatbuffers_copy(sort_order_evaluators[i]->eval(a), builder);
-      auto b_eval_offset = flatbuffers_copy(sort_order_evaluators[i]->eval(b), builder);
-
-      // We ignore the result's NULL flag and use only its underlying value for
-      // the comparison. eval_binary_comparison() uses this underlying value to
-      // pass the desired information.
-      bool a_less_than_b =
-          static_cast<const tuix::BooleanField *>(
-              flatbuffers::GetTemporaryPointer<tuix::Field>(
-                  builder,
-                  eval_binary_comparison<tuix::LessThan, std::less>(
-                      builder,
-                      flatbuffers::GetTemporaryPointer<tuix::Field>(builder, a_eval_offset),
-                      flatbuffers::GetTemporaryPointer<tuix::Field>(builder, b_eval_offset)))
-                  ->value())
-              ->value();
-      bool b_less_than_a =
-          static_cast<const tuix::BooleanField *>(
-              flatbuffers::GetTemporaryPointer<tuix::Field>(
-                  builder,
-                  eval_binary_comparison<tuix::LessThan, std::less>(
-                      builder,
-                      flatbuffers::GetTemporaryPointer<tuix::Field>(builder, b_eval_offset),
-                      flatbuffers::GetTemporaryPointer<tuix::Field>(builder, a_eval_offset)))
-                  ->value())
-              ->value();
-
-      if (a_less_than_b) {
-        return true;
-      } else if (b_less_than_a) {
-        return false;
-      }
-    }
-    // a is equal to b
-    return false;
+    get_sort_key(row1, key1);
+    get_sort_key(row2, key2);
+    return key1 < key2;
   }
 
 private:
   const tuix::SortExpr *sort_expr;
-  flatbuffers::FlatBufferBuilder builder;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> sort_order_evaluators;
+  std::string key1, key2;
 };
 
 class FlatbuffersJoinExprEvaluator {
@@ -1670,6 +1977,23 @@ public:
     return true;
   }
 
+  /** Encode the join keys of the given row into `key`, such that two rows are in the same join
+   * group if and only if their encodings are equal. Returns false if any join key is NULL, since
+   * such a row cannot match any other row. Rows MUST have been tagged in Scala.
+   */
+  bool get_join_key(const tuix::Row *row, std::string &key) {
+    key.clear();
+    auto &evaluators = is_primary(row) ? left_key_evaluators : right_key_evaluators;
+    for (auto &&e : evaluators) {
+      const tuix::Field *field = e->eval(row);
+      if (field->is_null()) {
+        return false;
+      }
+      append_key(field, key);
+    }
+    return true;
+  }
+
   /** Evaluate condition on the two input rows */
   bool eval_condition(const tuix::Row *row1, const tuix::Row *row2) {
     if (condition_eval != nullptr) {
@@ -1759,9 +2083,366 @@ private:
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> evaluate_evaluators;
 };
 
+/**
+ * One field of an aggregation buffer held natively by a NativeAggregateEvaluator. Booleans,
+ * numbers and dates are kept unboxed and strings as their bytes, so that updating them does not
+ * write to a FlatBufferBuilder. Values of other types are kept as a copy of their Field.
+ */
+class AggregateSlot {
+public:
+  AggregateSlot() : type(tuix::FieldUnion_NONE), is_null(true), str(), boxed() { v.l = 0; }
+
+  /** Set the type of this slot to that of `field` and its value to the value of `field`. */
+  void init(const tuix::Field *field) {
+    type = field->value_type();
+    load(field);
+  }
+
+  /** Set this slot to the value of `field`, which must be of the same type. */
+  void load(const tuix::Field *field) {
+    check_type(field);
+    is_null = field->is_null();
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      v.b = field->value_as_BooleanField()->value();
+      break;
+    case tuix::FieldUnion_IntegerField:
+      v.i = field->value_as_IntegerField()->value();
+      break;
+    case tuix::FieldUnion_LongField:
+      v.l = field->value_as_LongField()->value();
+      break;
+    case tuix::FieldUnion_FloatField:
+      v.f = field->value_as_FloatField()->value();
+      break;
+    case tuix::FieldUnion_DoubleField:
+      v.d = field->value_as_DoubleField()->value();
+      break;
+    case tuix::FieldUnion_DateField:
+      v.i = field->value_as_DateField()->value();
+      break;
+    case tuix::FieldUnion_StringField: {
+      auto str_field = field->value_as_StringField();
+      if (str_field->value() != nullptr) {
+        str.assign(str_field->value()->data(), str_field->value()->data() + str_field->length());
+      } else {
+        str.clear();
+      }
+      break;
+    }
+    default: {
+      flatbuffers::FlatBufferBuilder builder;
+      builder.Finish(flatbuffers_copy(field, builder));
+      boxed.assign(builder.GetBufferPointer(), builder.GetBufferPointer() + builder.GetSize());
+      break;
+    }
+    }
+  }
+
+  /**
+   * Add the value of the non-NULL numeric `field` to this slot, treating NULL as zero. Integer
+   * sums wrap around on overflow, as in Spark SQL when ANSI mode is off.
+   */
+  void add(const tuix::Field *field) {
+    check_type(field);
+    switch (type) {
+    case tuix::FieldUnion_IntegerField:
+      v.i = static_cast<int32_t>(static_cast<uint32_t>(is_null ? 0 : v.i) +
+                                 static_cast<uint32_t>(field->value_as_IntegerField()->value()));
+      break;
+    case tuix::FieldUnion_LongField:
+      v.l = static_cast<int64_t>(static_cast<uint64_t>(is_null ? 0 : v.l) +
+                                 static_cast<uint64_t>(field->value_as_LongField()->value()));
+      break;
+    case tuix::FieldUnion_FloatField:
+      v.f = (is_null ? 0 : v.f) + field->value_as_FloatField()->value();
+      break;
+    case tuix::FieldUnion_DoubleField:
+      v.d = (is_null ? 0 : v.d) + field->value_as_DoubleField()->value();
+      break;
+    default:
+      throw std::runtime_error(std::string("Can't sum ") +
+                               std::string(tuix::EnumNameFieldUnion(type)));
+    }
+    is_null = false;
+  }
+
+  /** Add one to this slot, which must be a non-NULL long. */
+  void increment() { v.l++; }
+
+  /**
+   * Compare the non-NULL value of `field` to the non-NULL value of this slot in the same way as
+   * tuix::LessThan, returning a negative number, zero or a positive number.
+   */
+  int compare(const tuix::Field *field) const {
+    check_type(field);
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      return compare_values(field->value_as_BooleanField()->value(), v.b);
+    case tuix::FieldUnion_IntegerField:
+      return compare_values(field->value_as_IntegerField()->value(), v.i);
+    case tuix::FieldUnion_LongField:
+      return compare_values(field->value_as_LongField()->value(), v.l);
+    case tuix::FieldUnion_FloatField:
+      return compare_values(field->value_as_FloatField()->value(), v.f);
+    case tuix::FieldUnion_DoubleField:
+      return compare_values(field->value_as_DoubleField()->value(), v.d);
+    case tuix::FieldUnion_DateField:
+      return compare_values(field->value_as_DateField()->value(), v.i);
+    case tuix::FieldUnion_StringField: {
+      auto str_field = field->value_as_StringField();
+      uint32_t len = str_field->length();
+      uint32_t min_len = std::min<uint32_t>(len, str.size());
+      int result = min_len > 0 ? memcmp(str_field->value()->data(), str.data(), min_len) : 0;
+      return result != 0 ? result : compare_values<uint32_t>(len, str.size());
+    }
+    default:
+      throw std::runtime_error(std::string("Can't compare ") +
+                               std::string(tuix::EnumNameFieldUnion(type)));
+    }
+  }
+
+  /** Return whether this slot holds a type that compare() can order. */
+  bool is_ordered() const {
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+    case tuix::FieldUnion_IntegerField:
+    case tuix::FieldUnion_LongField:
+    case tuix::FieldUnion_FloatField:
+    case tuix::FieldUnion_DoubleField:
+    case tuix::FieldUnion_DateField:
+    case tuix::FieldUnion_StringField:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  /** Return whether this slot holds a type that add() can sum. */
+  bool is_numeric() const {
+    return type == tuix::FieldUnion_IntegerField || type == tuix::FieldUnion_LongField ||
+           type == tuix::FieldUnion_FloatField || type == tuix::FieldUnion_DoubleField;
+  }
+
+  flatbuffers::Offset<tuix::Field> write(flatbuffers::FlatBufferBuilder &builder) const {
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      return tuix::CreateField(builder, type, tuix::CreateBooleanField(builder, v.b).Union(),
+                               is_null);
+    case tuix::FieldUnion_IntegerField:
+      return tuix::CreateField(builder, type, tuix::CreateIntegerField(builder, v.i).Union(),
+                               is_null);
+    case tuix::FieldUnion_LongField:
+      return tuix::CreateField(builder, type, tuix::CreateLongField(builder, v.l).Union(),
+                               is_null);
+    case tuix::FieldUnion_FloatField:
+      return tuix::CreateField(builder, type, tuix::CreateFloatField(builder, v.f).Union(),
+                               is_null);
+    case tuix::FieldUnion_DoubleField:
+      return tuix::CreateField(builder, type, tuix::CreateDoubleField(builder, v.d).Union(),
+                               is_null);
+    case tuix::FieldUnion_DateField:
+      return tuix::CreateField(builder, type, tuix::CreateDateField(builder, v.i).Union(),
+                               is_null);
+    case tuix::FieldUnion_StringField:
+      return tuix::CreateField(
+          builder, type, tuix::CreateStringFieldDirect(builder, &str, str.size()).Union(),
+          is_null);
+    default:
+      return flatbuffers_copy(flatbuffers::GetRoot<tuix::Field>(boxed.data()), builder);
+    }
+  }
+
+  tuix::FieldUnion type;
+  bool is_null;
+  union {
+    bool b;
+    int32_t i;
+    int64_t l;
+    float f;
+    double d;
+  } v;
+
+private:
+  template <typename T> static int compare_values(T a, T b) { return a < b ? -1 : (b < a ? 1 : 0); }
+
+  void check_type(const tuix::Field *field) const {
+    if (field->value_type() != type) {
+      throw std::runtime_error(std::string("Aggregation buffer of type ") +
+                               std::string(tuix::EnumNameFieldUnion(type)) +
+                               std::string(" can't hold ") +
+                               std::string(tuix::EnumNameFieldUnion(field->value_type())));
+    }
+  }
+
+  std::vector<uint8_t> str;
+  // A finished Field buffer, for types that are not kept unboxed
+  std::vector<uint8_t> boxed;
+};
+
+/**
+ * Updates the aggregation buffer of one of the common aggregate functions with native typed
+ * accumulators, rather than by concatenating the buffer with each input row and evaluating
+ * update_exprs on the result. The buffer has the same layout and initial values as for the
+ * generic update, so the two produce interchangeable partial aggregates.
+ *
+ * NULL inputs are ignored by Sum, Count, Average, Min and Max as in Spark SQL, and First and Last
+ * keep the first and last input respectively, including NULLs.
+ */
+class NativeAggregateEvaluator {
+public:
+  /**
+   * Return an evaluator for the given aggregate expression, whose aggregation buffer initially
+   * holds `initial_values`, or nullptr if it must be updated generically.
+   */
+  static std::unique_ptr<NativeAggregateEvaluator>
+  create(const tuix::AggregateExpr *expr, const std::vector<const tuix::Field *> &initial_values) {
+    std::unique_ptr<NativeAggregateEvaluator> result;
+    if (expr->function() == tuix::AggregateFunction_Generic || expr->native_inputs() == nullptr) {
+      return result;
+    }
+    result.reset(new NativeAggregateEvaluator(expr, initial_values));
+    if (!result->is_supported()) {
+      result.reset();
+    }
+    return result;
+  }
+
+  /** Set the aggregation buffer to its initial values. */
+  void reset() { slots = initial_slots; }
+
+  /** Load the aggregation buffer from the fields of `agg_row` starting at `col`, advancing it. */
+  void load(const tuix::Row *agg_row, uint32_t &col) {
+    for (auto &slot : slots) {
+      slot.load(agg_row->field_values()->Get(col++));
+    }
+  }
+
+  /** Update the aggregation buffer with the given input row. */
+  void update(const tuix::Row *row) {
+    inputs.clear();
+    for (auto &e : input_evaluators) {
+      inputs.push_back(e->eval(row));
+    }
+
+    switch (function) {
+    case tuix::AggregateFunction_Sum:
+      if (!inputs[0]->is_null()) {
+        slots[0].add(inputs[0]);
+      }
+      break;
+    case tuix::AggregateFunction_Count:
+      if (merge) {
+        if (!inputs[0]->is_null()) {
+          slots[0].add(inputs[0]);
+        }
+      } else if (std::none_of(inputs.begin(), inputs.end(),
+                              [](const tuix::Field *f) { return f->is_null(); })) {
+        slots[0].increment();
+      }
+      break;
+    case tuix::AggregateFunction_Average:
+      if (merge) {
+        slots[0].add(inputs[0]);
+        slots[1].add(inputs[1]);
+      } else if (!inputs[0]->is_null()) {
+        slots[0].add(inputs[0]);
+        slots[1].increment();
+      }
+      break;
+    case tuix::AggregateFunction_Min:
+      if (!inputs[0]->is_null() && (slots[0].is_null || slots[0].compare(inputs[0]) < 0)) {
+        slots[0].load(inputs[0]);
+      }
+      break;
+    case tuix::AggregateFunction_Max:
+      if (!inputs[0]->is_null() && (slots[0].is_null || slots[0].compare(inputs[0]) > 0)) {
+        slots[0].load(inputs[0]);
+      }
+      break;
+    case tuix::AggregateFunction_First:
+      if (!slots[1].v.b) {
+        slots[0].load(inputs[0]);
+      }
+      slots[1].v.b = slots[1].v.b || !merge || is_true(inputs[1]);
+      break;
+    case tuix::AggregateFunction_Last:
+      if (!merge || is_true(inputs[1])) {
+        slots[0].load(inputs[0]);
+        slots[1].v.b = true;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  /** Write the fields of the aggregation buffer to `builder`, appending them to `fields`. */
+  void write(flatbuffers::FlatBufferBuilder &builder,
+             std::vector<flatbuffers::Offset<tuix::Field>> &fields) const {
+    for (auto &slot : slots) {
+      fields.push_back(slot.write(builder));
+    }
+  }
+
+private:
+  NativeAggregateEvaluator(const tuix::AggregateExpr *expr,
+                           const std::vector<const tuix::Field *> &initial_values)
+      : function(expr->function()), merge(expr->merge()), input_evaluators(), inputs(),
+        initial_slots(initial_values.size()), slots() {
+    for (auto e : *expr->native_inputs()) {
+      input_evaluators.emplace_back(
+          std::unique_ptr<FlatbuffersExpressionEvaluator>(new FlatbuffersExpressionEvaluator(e)));
+    }
+    for (uint32_t i = 0; i < initial_values.size(); i++) {
+      initial_slots[i].init(initial_values[i]);
+    }
+    slots = initial_slots;
+  }
+
+  /** Return whether the buffer and inputs have the layout and types the function expects. */
+  bool is_supported() const {
+    uint32_t num_slots = initial_slots.size();
+    uint32_t num_inputs = input_evaluators.size();
+    switch (function) {
+    case tuix::AggregateFunction_Sum:
+      return num_slots == 1 && num_inputs == 1 && initial_slots[0].is_numeric();
+    case tuix::AggregateFunction_Count:
+      return num_slots == 1 && (!merge || num_inputs == 1) &&
+             initial_slots[0].type == tuix::FieldUnion_LongField && !initial_slots[0].is_null;
+    case tuix::AggregateFunction_Average:
+      return num_slots == 2 && num_inputs == (merge ? 2u : 1u) && initial_slots[0].is_numeric() &&
+             initial_slots[1].type == tuix::FieldUnion_LongField && !initial_slots[1].is_null;
+    case tuix::AggregateFunction_Min:
+    case tuix::AggregateFunction_Max:
+      return num_slots == 1 && num_inputs == 1 && initial_slots[0].is_ordered();
+    case tuix::AggregateFunction_First:
+    case tuix::AggregateFunction_Last:
+      return num_slots == 2 && num_inputs == (merge ? 2u : 1u) &&
+             initial_slots[1].type == tuix::FieldUnion_BooleanField && !initial_slots[1].is_null;
+    default:
+      return false;
+    }
+  }
+
+  static bool is_true(const tuix::Field *field) {
+    return field->value_type() == tuix::FieldUnion_BooleanField && !field->is_null() &&
+           field->value_as_BooleanField()->value();
+  }
+
+  tuix::AggregateFunction function;
+  bool merge;
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> input_evaluators;
+  // The values of input_evaluators for the current input row
+  std::vector<const tuix::Field *> inputs;
+  std::vector<AggregateSlot> initial_slots;
+  std::vector<AggregateSlot> slots;
+};
+
 class FlatbuffersAggOpEvaluator {
 public:
-  FlatbuffersAggOpEvaluator(uint8_t *buf, size_t len) : a(nullptr), builder(), builder2() {
+  FlatbuffersAggOpEvaluator(uint8_t *buf, size_t len)
+      : a(nullptr), builder(), builder2(), is_native(false), is_a_current(false) {
     flatbuffers::Verifier v(buf, len);
     if (!v.VerifyBuffer<tuix::AggregateOp>(nullptr)) {
       throw std::runtime_error(std::string("Corrupt AggregateOp buffer of length ") +
@@ -1779,12 +2460,35 @@ public:
           std::unique_ptr<AggregateExpressionEvaluator>(new AggregateExpressionEvaluator(e)));
     }
 
+    // Aggregation buffers are updated natively if every aggregate function supports it, since
+    // the generic update expressions read the whole buffer
+    is_native = true;
+    for (uint32_t i = 0; i < agg_op->aggregate_expressions()->size(); i++) {
+      auto initial_values = aggregate_evaluators[i]->initial_values(nullptr);
+      auto native =
+          NativeAggregateEvaluator::create(agg_op->aggregate_expressions()->Get(i), initial_values);
+      if (!native) {
+        is_native = false;
+        native_evaluators.clear();
+        break;
+      }
+      native_evaluators.push_back(std::move(native));
+    }
+
     reset_group();
   }
 
   size_t get_num_grouping_keys() { return grouping_evaluators.size(); }
 
   void reset_group() {
+    if (is_native) {
+      for (auto &&e : native_evaluators) {
+        e->reset();
+      }
+      is_a_current = false;
+      return;
+    }
+
     builder2.Clear();
     // Write initial values to a
     std::vector<flatbuffers::Offset<tuix::Field>> init_fields;
@@ -1798,6 +2502,19 @@ public:
   }
 
   void set(const tuix::Row *agg_row) {
+    if (is_native) {
+      if (agg_row) {
+        uint32_t col = 0;
+        for (auto &&e : native_evaluators) {
+          e->load(agg_row, col);
+        }
+        is_a_current = false;
+      } else {
+        reset_group();
+      }
+      return;
+    }
+
     builder2.Clear();
     if (agg_row) {
       a = flatbuffers::GetTemporaryPointer<tuix::Row>(
@@ -1808,6 +2525,14 @@ public:
   }
 
   void aggregate(const tuix::Row *row) {
+    if (is_native) {
+      for (auto &&e : native_evaluators) {
+        e->update(row);
+      }
+      is_a_current = false;
+      return;
+    }
+
     builder.Clear();
     flatbuffers::Offset<tuix::Row> concat;
 
@@ -1834,9 +2559,13 @@ public:
         builder2, tuix::CreateRowDirect(builder2, &output_fields));
   }
 
-  const tuix::Row *get_partial_agg() { return a; }
+  const tuix::Row *get_partial_agg() {
+    materialize();
+    return a;
+  }
 
   const tuix::Row *evaluate() {
+    materialize();
     builder.Clear();
     std::vector<flatbuffers::Offset<tuix::Field>> output_fields;
     for (auto &&e : aggregate_evaluators) {
@@ -1848,6 +2577,15 @@ public:
         builder, tuix::CreateRowDirect(builder, &output_fields));
   }
 
+  /** Encode the grouping keys of the given row into `key`, such that two rows are in the same
+   * group if and only if their encodings are equal. */
+  void get_grouping_key(const tuix::Row *row, std::string &key) {
+    key.clear();
+    for (auto &&e : grouping_evaluators) {
+      append_key(e->eval(row), key);
+    }
+  }
+
   /** Return true if the two rows are from the same join group. */
   bool is_same_group(const tuix::Row *row1, const tuix::Row *row2) {
     builder.Clear();
@@ -1876,13 +2614,32 @@ public:
   }
 
 private:
-  // Pointer into builder2
+  /** Write the natively held aggregation buffers to `a`, if it does not already hold them. */
+  void materialize() {
+    if (!is_native || is_a_current) {
+      return;
+    }
+    builder2.Clear();
+    std::vector<flatbuffers::Offset<tuix::Field>> agg_fields;
+    for (auto &&e : native_evaluators) {
+      e->write(builder2, agg_fields);
+    }
+    a = flatbuffers::GetTemporaryPointer<tuix::Row>(builder2,
+                                                   tuix::CreateRowDirect(builder2, &agg_fields));
+    is_a_current = true;
+  }
+
+  // Pointer into builder2. When aggregating natively, it is only current if is_a_current is set.
   const tuix::Row *a;
 
   flatbuffers::FlatBufferBuilder builder;
   flatbuffers::FlatBufferBuilder builder2;
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> grouping_evaluators;
   std::vector<std::unique_ptr<AggregateExpressionEvaluator>> aggregate_evaluators;
+  // Whether the aggregation buffers are held by native_evaluators rather than `a`
+  bool is_native;
+  bool is_a_current;
+  std::vector<std::unique_ptr<NativeAggregateEvaluator>> native_evaluators;
 };
 
 #endif
@@ -0,0 +1,989 @@
+#include "expression_program.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+/** Load the given field into a register without copying it. */
+void load_field(const tuix::Field *field, ExprValue &out) {
+  out.type = field->value_type();
+  out.is_null = field->is_null();
+  out.field = field;
+  switch (field->value_type()) {
+  case tuix::FieldUnion_BooleanField:
+    out.v.b = field->value_as_BooleanField()->value();
+    break;
+  case tuix::FieldUnion_IntegerField:
+    out.v.i = field->value_as_IntegerField()->value();
+    break;
+  case tuix::FieldUnion_LongField:
+    out.v.l = field->value_as_LongField()->value();
+    break;
+  case tuix::FieldUnion_FloatField:
+    out.v.f = field->value_as_FloatField()->value();
+    break;
+  case tuix::FieldUnion_DoubleField:
+    out.v.d = field->value_as_DoubleField()->value();
+    break;
+  case tuix::FieldUnion_DateField:
+    out.v.i = field->value_as_DateField()->value();
+    break;
+  case tuix::FieldUnion_StringField: {
+    auto str_field = field->value_as_StringField();
+    out.str = str_field->value() != nullptr ? str_field->value()->data() : nullptr;
+    out.str_len = str_field->length();
+    break;
+  }
+  default:
+    // Other types can only be output as they are
+    break;
+  }
+}
+
+/** Compare two strings in the same way as std::string::compare. */
+int compare_strings(const uint8_t *left, uint32_t left_len, const uint8_t *right,
+                    uint32_t right_len) {
+  uint32_t min_len = std::min(left_len, right_len);
+  int result = min_len > 0 ? memcmp(left, right, min_len) : 0;
+  if (result == 0) {
+    result = left_len < right_len ? -1 : (left_len > right_len ? 1 : 0);
+  }
+  return result;
+}
+
+/** Register counterpart of eval_binary_arithmetic_op(). */
+template <template <typename T> class Operation>
+bool run_arithmetic(const ExprValue &left, const ExprValue &right, ExprValue &out) {
+  if (left.type != right.type) {
+    return false;
+  }
+  out.type = left.type;
+  out.is_null = left.is_null || right.is_null;
+  out.field = nullptr;
+  // The underlying value of a NULL result is never read, so it is not computed. This also avoids
+  // dividing by the underlying value of a NULL integer.
+  switch (left.type) {
+  case tuix::FieldUnion_IntegerField:
+    out.v.i = out.is_null ? 0 : Operation<int32_t>()(left.v.i, right.v.i);
+    return true;
+  case tuix::FieldUnion_LongField:
+    out.v.l = out.is_null ? 0 : Operation<int64_t>()(left.v.l, right.v.l);
+    return true;
+  case tuix::FieldUnion_FloatField:
+    out.v.f = out.is_null ? 0 : Operation<float>()(left.v.f, right.v.f);
+    return true;
+  case tuix::FieldUnion_DoubleField:
+    out.v.d = out.is_null ? 0 : Operation<double>()(left.v.d, right.v.d);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/** Register counterpart of eval_binary_comparison() with NULLS FIRST. */
+template <template <typename T> class Operation>
+bool run_comparison(const ExprValue &left, const ExprValue &right, ExprValue &out) {
+  if (left.type != right.type) {
+    return false;
+  }
+  out.type = tuix::FieldUnion_BooleanField;
+  out.is_null = left.is_null || right.is_null;
+  out.field = nullptr;
+  if (out.is_null) {
+    out.v.b = Operation<bool>()(!left.is_null, !right.is_null);
+    return true;
+  }
+  switch (left.type) {
+  case tuix::FieldUnion_BooleanField:
+    out.v.b = Operation<bool>()(left.v.b, right.v.b);
+    return true;
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_DateField:
+    out.v.b = Operation<int32_t>()(left.v.i, right.v.i);
+    return true;
+  case tuix::FieldUnion_LongField:
+    out.v.b = Operation<int64_t>()(left.v.l, right.v.l);
+    return true;
+  case tuix::FieldUnion_FloatField:
+    out.v.b = Operation<float>()(left.v.f, right.v.f);
+    return true;
+  case tuix::FieldUnion_DoubleField:
+    out.v.b = Operation<double>()(left.v.d, right.v.d);
+    return true;
+  case tuix::FieldUnion_StringField:
+    out.v.b =
+        Operation<int>()(compare_strings(left.str, left.str_len, right.str, right.str_len), 0);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/** Three-valued AND (or OR, if `is_and` is false) of two boolean registers. */
+bool run_logical(bool is_and, const ExprValue &left, const ExprValue &right, ExprValue &out) {
+  if (left.type != tuix::FieldUnion_BooleanField || right.type != tuix::FieldUnion_BooleanField) {
+    return false;
+  }
+  out.type = tuix::FieldUnion_BooleanField;
+  out.field = nullptr;
+  // A non-NULL operand equal to the short-circuit value determines the result
+  bool short_circuit_value = !is_and;
+  if ((!left.is_null && left.v.b == short_circuit_value) ||
+      (!right.is_null && right.v.b == short_circuit_value)) {
+    out.is_null = false;
+    out.v.b = short_circuit_value;
+  } else if (!left.is_null && !right.is_null) {
+    out.is_null = false;
+    out.v.b = !short_circuit_value;
+  } else {
+    out.is_null = true;
+    out.v.b = false;
+  }
+  return true;
+}
+
+/** Write a computed register value to the given builder. */
+flatbuffers::Offset<tuix::Field> write_value(const ExprValue &value,
+                                             flatbuffers::FlatBufferBuilder &builder) {
+  switch (value.type) {
+  case tuix::FieldUnion_BooleanField:
+    return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
+                             tuix::CreateBooleanField(builder, value.v.b).Union(), value.is_null);
+  case tuix::FieldUnion_IntegerField:
+    return tuix::CreateField(builder, tuix::FieldUnion_IntegerField,
+                             tuix::CreateIntegerField(builder, value.v.i).Union(), value.is_null);
+  case tuix::FieldUnion_LongField:
+    return tuix::CreateField(builder, tuix::FieldUnion_LongField,
+                             tuix::CreateLongField(builder, value.v.l).Union(), value.is_null);
+  case tuix::FieldUnion_FloatField:
+    return tuix::CreateField(builder, tuix::FieldUnion_FloatField,
+                             tuix::CreateFloatField(builder, value.v.f).Union(), value.is_null);
+  case tuix::FieldUnion_DoubleField:
+    return tuix::CreateField(builder, tuix::FieldUnion_DoubleField,
+                             tuix::CreateDoubleField(builder, value.v.d).Union(), value.is_null);
+  default:
+    throw std::runtime_error(std::string("ExprProgram can't output a computed ") +
+                             std::string(tuix::EnumNameFieldUnion(value.type)));
+  }
+}
+
+template <typename T, typename TuixField>
+void load_column_values(const std::vector<const tuix::Field *> &fields, std::vector<T> &values) {
+  values.resize(fields.size());
+  for (uint32_t k = 0; k < fields.size(); k++) {
+    values[k] = static_cast<const TuixField *>(fields[k]->value())->value();
+  }
+}
+
+/**
+ * Load the given column of every row into `out`. Return false if the column does not have the
+ * same type in every row.
+ */
+bool load_column(const std::vector<const tuix::Row *> &rows, uint32_t col_num, ExprColumn &out) {
+  uint32_t n = rows.size();
+  out.type = rows[0]->field_values()->Get(col_num)->value_type();
+  out.fields.resize(n);
+  out.is_null.resize(n);
+  for (uint32_t k = 0; k < n; k++) {
+    const tuix::Field *field = rows[k]->field_values()->Get(col_num);
+    if (field->value_type() != out.type) {
+      return false;
+    }
+    out.fields[k] = field;
+    out.is_null[k] = field->is_null();
+  }
+
+  switch (out.type) {
+  case tuix::FieldUnion_BooleanField:
+    load_column_values<uint8_t, tuix::BooleanField>(out.fields, out.bools);
+    break;
+  case tuix::FieldUnion_IntegerField:
+    load_column_values<int32_t, tuix::IntegerField>(out.fields, out.ints);
+    break;
+  case tuix::FieldUnion_LongField:
+    load_column_values<int64_t, tuix::LongField>(out.fields, out.longs);
+    break;
+  case tuix::FieldUnion_FloatField:
+    load_column_values<float, tuix::FloatField>(out.fields, out.floats);
+    break;
+  case tuix::FieldUnion_DoubleField:
+    load_column_values<double, tuix::DoubleField>(out.fields, out.doubles);
+    break;
+  case tuix::FieldUnion_DateField:
+    load_column_values<int32_t, tuix::DateField>(out.fields, out.ints);
+    break;
+  case tuix::FieldUnion_StringField: {
+    ExprValue value;
+    out.strs.resize(n);
+    out.str_lens.resize(n);
+    for (uint32_t k = 0; k < n; k++) {
+      load_field(out.fields[k], value);
+      out.strs[k] = value.str;
+      out.str_lens[k] = value.str_len;
+    }
+    break;
+  }
+  default:
+    // Other types can only be output as they are
+    break;
+  }
+  return true;
+}
+
+template <typename T, typename V>
+void gather_column_values(const flatbuffers::Vector<V> *values,
+                          const std::vector<uint32_t> &indices, std::vector<T> &out) {
+  out.resize(indices.size());
+  for (uint32_t k = 0; k < indices.size(); k++) {
+    out[k] = values->Get(indices[k]);
+  }
+}
+
+/**
+ * Load the values at the given indices of a checked tuix::Column into `out` without building
+ * fields. Return false if the column was not decrypted or does not store its values by type.
+ */
+bool load_typed_column(const std::vector<const tuix::Column *> &block_columns,
+                       const std::vector<uint32_t> &indices, uint32_t col_num, ExprColumn &out) {
+  if (col_num >= block_columns.size() || block_columns[col_num] == nullptr ||
+      block_columns[col_num]->fields() != nullptr) {
+    return false;
+  }
+  const tuix::Column *column = block_columns[col_num];
+  uint32_t n = indices.size();
+  out.fields.clear();
+  out.is_null.resize(n);
+  for (uint32_t k = 0; k < n; k++) {
+    out.is_null[k] = is_bit_set(column->nulls(), indices[k]);
+  }
+
+  switch (column->col_type()) {
+  case tuix::ColType_BooleanType:
+    out.type = tuix::FieldUnion_BooleanField;
+    gather_column_values(column->bools(), indices, out.bools);
+    break;
+  case tuix::ColType_IntegerType:
+    out.type = tuix::FieldUnion_IntegerField;
+    gather_column_values(column->ints(), indices, out.ints);
+    break;
+  case tuix::ColType_DateType:
+    out.type = tuix::FieldUnion_DateField;
+    gather_column_values(column->ints(), indices, out.ints);
+    break;
+  case tuix::ColType_LongType:
+    out.type = tuix::FieldUnion_LongField;
+    gather_column_values(column->longs(), indices, out.longs);
+    break;
+  case tuix::ColType_FloatType:
+    out.type = tuix::FieldUnion_FloatField;
+    gather_column_values(column->floats(), indices, out.floats);
+    break;
+  case tuix::ColType_DoubleType:
+    out.type = tuix::FieldUnion_DoubleField;
+    gather_column_values(column->doubles(), indices, out.doubles);
+    break;
+  case tuix::ColType_StringType:
+    out.type = tuix::FieldUnion_StringField;
+    out.strs.resize(n);
+    out.str_lens.resize(n);
+    for (uint32_t k = 0; k < n; k++) {
+      const uint32_t begin = column->offsets()->Get(indices[k]);
+      out.strs[k] = column->bytes()->data() + begin;
+      out.str_lens[k] = column->offsets()->Get(indices[k] + 1) - begin;
+    }
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+/** Fill `out` with `n` copies of a literal already loaded into `value`. */
+void load_literal_column(const ExprValue &value, uint32_t n, ExprColumn &out) {
+  out.type = value.type;
+  out.is_null.assign(n, value.is_null);
+  out.fields.assign(n, value.field);
+  switch (value.type) {
+  case tuix::FieldUnion_BooleanField:
+    out.bools.assign(n, value.v.b);
+    break;
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_DateField:
+    out.ints.assign(n, value.v.i);
+    break;
+  case tuix::FieldUnion_LongField:
+    out.longs.assign(n, value.v.l);
+    break;
+  case tuix::FieldUnion_FloatField:
+    out.floats.assign(n, value.v.f);
+    break;
+  case tuix::FieldUnion_DoubleField:
+    out.doubles.assign(n, value.v.d);
+    break;
+  case tuix::FieldUnion_StringField:
+    out.strs.assign(n, value.str);
+    out.str_lens.assign(n, value.str_len);
+    break;
+  default:
+    break;
+  }
+}
+
+/** Set `out` to the union of two null masks. */
+void union_nulls(const std::vector<uint8_t> &left, const std::vector<uint8_t> &right, uint32_t n,
+                 std::vector<uint8_t> &out) {
+  out.resize(n);
+  const uint8_t *l = left.data(), *r = right.data();
+  uint8_t *o = out.data();
+  for (uint32_t k = 0; k < n; k++) {
+    o[k] = l[k] | r[k];
+  }
+}
+
+template <template <typename T> class Operation, typename T>
+void arithmetic_kernel(const std::vector<T> &left, const std::vector<T> &right,
+                       const std::vector<uint8_t> &is_null, uint32_t n, std::vector<T> &out) {
+  out.resize(n);
+  const T *l = left.data(), *r = right.data();
+  const uint8_t *nulls = is_null.data();
+  T *o = out.data();
+  for (uint32_t k = 0; k < n; k++) {
+    // The right operand of a NULL result is replaced by 1 so that a NULL integer divisor is
+    // never used, without a branch that would prevent vectorization
+    o[k] = Operation<T>()(l[k], nulls[k] ? T(1) : r[k]);
+  }
+}
+
+/** Batch counterpart of run_arithmetic(). */
+template <template <typename T> class Operation>
+bool run_arithmetic_batch(const ExprColumn &left, const ExprColumn &right, uint32_t n,
+                          ExprColumn &out) {
+  if (left.type != right.type) {
+    return false;
+  }
+  out.type = left.type;
+  out.fields.clear();
+  union_nulls(left.is_null, right.is_null, n, out.is_null);
+  switch (left.type) {
+  case tuix::FieldUnion_IntegerField:
+    arithmetic_kernel<Operation>(left.ints, right.ints, out.is_null, n, out.ints);
+    return true;
+  case tuix::FieldUnion_LongField:
+    arithmetic_kernel<Operation>(left.longs, right.longs, out.is_null, n, out.longs);
+    return true;
+  case tuix::FieldUnion_FloatField:
+    arithmetic_kernel<Operation>(left.floats, right.floats, out.is_null, n, out.floats);
+    return true;
+  case tuix::FieldUnion_DoubleField:
+    arithmetic_kernel<Operation>(left.doubles, right.doubles, out.is_null, n, out.doubles);
+    return true;
+  default:
+    return false;
+  }
+}
+
+template <template <typename T> class Operation, typename T>
+void comparison_kernel(const std::vector<T> &left, const std::vector<T> &right,
+                       const ExprColumn &left_column, const ExprColumn &right_column, uint32_t n,
+                       ExprColumn &out) {
+  out.bools.resize(n);
+  const T *l = left.data(), *r = right.data();
+  const uint8_t *l_null = left_column.is_null.data(), *r_null = right_column.is_null.data();
+  const uint8_t *o_null = out.is_null.data();
+  uint8_t *o = out.bools.data();
+  for (uint32_t k = 0; k < n; k++) {
+    bool value_result = Operation<T>()(l[k], r[k]);
+    bool null_result = Operation<bool>()(!l_null[k], !r_null[k]);
+    o[k] = o_null[k] ? null_result : value_result;
+  }
+}
+
+/** Batch counterpart of run_comparison(). */
+template <template <typename T> class Operation>
+bool run_comparison_batch(const ExprColumn &left, const ExprColumn &right, uint32_t n,
+                          ExprColumn &out) {
+  if (left.type != right.type) {
+    return false;
+  }
+  out.type = tuix::FieldUnion_BooleanField;
+  out.fields.clear();
+  union_nulls(left.is_null, right.is_null, n, out.is_null);
+  switch (left.type) {
+  case tuix::FieldUnion_BooleanField:
+    comparison_kernel<Operation>(left.bools, right.bools, left, right, n, out);
+    return true;
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_DateField:
+    comparison_kernel<Operation>(left.ints, right.ints, left, right, n, out);
+    return true;
+  case tuix::FieldUnion_LongField:
+    comparison_kernel<Operation>(left.longs, right.longs, left, right, n, out);
+    return true;
+  case tuix::FieldUnion_FloatField:
+    comparison_kernel<Operation>(left.floats, right.floats, left, right, n, out);
+    return true;
+  case tuix::FieldUnion_DoubleField:
+    comparison_kernel<Operation>(left.doubles, right.doubles, left, right, n, out);
+    return true;
+  case tuix::FieldUnion_StringField:
+    out.bools.resize(n);
+    for (uint32_t k = 0; k < n; k++) {
+      // NULL strings are not compared, since their contents may not be valid
+      out.bools[k] = out.is_null[k]
+                         ? Operation<bool>()(!left.is_null[k], !right.is_null[k])
+                         : Operation<int>()(compare_strings(left.strs[k], left.str_lens[k],
+                                                            right.strs[k], right.str_lens[k]),
+                                            0);
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+/** Batch counterpart of run_logical(). */
+bool run_logical_batch(bool is_and, const ExprColumn &left, const ExprColumn &right, uint32_t n,
+                       ExprColumn &out) {
+  if (left.type != tuix::FieldUnion_BooleanField || right.type != tuix::FieldUnion_BooleanField) {
+    return false;
+  }
+  out.type = tuix::FieldUnion_BooleanField;
+  out.fields.clear();
+  out.is_null.resize(n);
+  out.bools.resize(n);
+  const uint8_t *l = left.bools.data(), *r = right.bools.data();
+  const uint8_t *l_null = left.is_null.data(), *r_null = right.is_null.data();
+  uint8_t *o = out.bools.data(), *o_null = out.is_null.data();
+  uint8_t short_circuit_value = !is_and;
+  for (uint32_t k = 0; k < n; k++) {
+    uint8_t determined = (!l_null[k] & (l[k] == short_circuit_value)) |
+                         (!r_null[k] & (r[k] == short_circuit_value));
+    uint8_t both_non_null = !l_null[k] & !r_null[k];
+    o_null[k] = !determined & !both_non_null;
+    o[k] = determined ? short_circuit_value : (both_non_null & !short_circuit_value);
+  }
+  return true;
+}
+
+/** Return whether the non-NULL value in the given register is one of the given items. */
+bool literal_set_contains(const LiteralSet &items, const ExprValue &value) {
+  switch (value.type) {
+  case tuix::FieldUnion_BooleanField:
+    return items.contains_integer(value.v.b);
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_DateField:
+    return items.contains_integer(value.v.i);
+  case tuix::FieldUnion_LongField:
+    return items.contains_integer(value.v.l);
+  case tuix::FieldUnion_FloatField:
+    return items.contains_real(value.v.f);
+  case tuix::FieldUnion_DoubleField:
+    return items.contains_real(value.v.d);
+  case tuix::FieldUnion_StringField:
+    return items.contains_string(value.str, value.str_len);
+  default:
+    return false;
+  }
+}
+
+/** Set `found` for each non-NULL value of the given column that is one of the given items. */
+template <typename T, typename Contains>
+void in_kernel(const std::vector<T> &values, const std::vector<uint8_t> &is_null, uint32_t n,
+               Contains contains, std::vector<uint8_t> &found) {
+  for (uint32_t k = 0; k < n; k++) {
+    found[k] = !is_null[k] && contains(values[k]);
+  }
+}
+
+/** Batch counterpart of literal_set_contains(), with the NULL semantics of In. */
+void run_in_batch(const LiteralSet &items, const ExprColumn &left, uint32_t n, ExprColumn &out) {
+  out.type = tuix::FieldUnion_BooleanField;
+  out.fields.clear();
+  out.bools.resize(n);
+  out.is_null.resize(n);
+  auto contains_integer = [&items](int64_t v) { return items.contains_integer(v); };
+  auto contains_real = [&items](double v) { return items.contains_real(v); };
+  switch (left.type) {
+  case tuix::FieldUnion_BooleanField:
+    in_kernel(left.bools, left.is_null, n, contains_integer, out.bools);
+    break;
+  case tuix::FieldUnion_IntegerField:
+  case tuix::FieldUnion_DateField:
+    in_kernel(left.ints, left.is_null, n, contains_integer, out.bools);
+    break;
+  case tuix::FieldUnion_LongField:
+    in_kernel(left.longs, left.is_null, n, contains_integer, out.bools);
+    break;
+  case tuix::FieldUnion_FloatField:
+    in_kernel(left.floats, left.is_null, n, contains_real, out.bools);
+    break;
+  case tuix::FieldUnion_DoubleField:
+    in_kernel(left.doubles, left.is_null, n, contains_real, out.bools);
+    break;
+  case tuix::FieldUnion_StringField:
+    for (uint32_t k = 0; k < n; k++) {
+      out.bools[k] = !left.is_null[k] && items.contains_string(left.strs[k], left.str_lens[k]);
+    }
+    break;
+  default:
+    out.bools.assign(n, 0);
+    break;
+  }
+  for (uint32_t k = 0; k < n; k++) {
+    out.is_null[k] = !out.bools[k] & (left.is_null[k] | items.has_null);
+  }
+}
+
+bool ExprProgram::compile(const tuix::Expr *expr) {
+  instructions.clear();
+  literals.clear();
+  matchers.clear();
+  literal_sets.clear();
+  if (!compile_helper(expr)) {
+    instructions.clear();
+    literals.clear();
+    matchers.clear();
+    literal_sets.clear();
+    registers.clear();
+    return false;
+  }
+
+  // Literals are loaded once here rather than on every run
+  registers.resize(instructions.size());
+  for (uint32_t i = 0; i < instructions.size(); i++) {
+    if (instructions[i].op == ExprOp_Literal) {
+      load_field(literals[i], registers[i]);
+    }
+  }
+  return true;
+}
+
+bool ExprProgram::compile_helper(const tuix::Expr *expr) {
+  switch (expr->expr_type()) {
+  case tuix::ExprUnion_Col: {
+    ExprInstruction instruction = {ExprOp_Col, 0, 0, expr->expr_as_Col()->col_num()};
+    instructions.push_back(instruction);
+    literals.push_back(nullptr);
+    matchers.push_back(StringMatcher());
+    literal_sets.push_back(LiteralSet());
+    return true;
+  }
+  case tuix::ExprUnion_Literal: {
+    const tuix::Field *value = expr->expr_as_Literal()->value();
+    // CalendarIntervals need special handling when output, so leave them to the interpreter
+    if (value->value_type() == tuix::FieldUnion_CalendarIntervalField) {
+      return false;
+    }
+    ExprInstruction instruction = {ExprOp_Literal, 0, 0, 0};
+    instructions.push_back(instruction);
+    literals.push_back(value);
+    matchers.push_back(StringMatcher());
+    literal_sets.push_back(LiteralSet());
+    return true;
+  }
+  case tuix::ExprUnion_Add: {
+    auto e = expr->expr_as_Add();
+    return compile_binary(ExprOp_Add, e->left(), e->right());
+  }
+  case tuix::ExprUnion_Subtract: {
+    auto e = expr->expr_as_Subtract();
+    return compile_binary(ExprOp_Subtract, e->left(), e->right());
+  }
+  case tuix::ExprUnion_Multiply: {
+    auto e = expr->expr_as_Multiply();
+    return compile_binary(ExprOp_Multiply, e->left(), e->right());
+  }
+  case tuix::ExprUnion_Divide: {
+    auto e = expr->expr_as_Divide();
+    return compile_binary(ExprOp_Divide, e->left(), e->right());
+  }
+  case tuix::ExprUnion_And: {
+    auto e = expr->expr_as_And();
+    return compile_binary(ExprOp_And, e->left(), e->right());
+  }
+  case tuix::ExprUnion_Or: {
+    auto e = expr->expr_as_Or();
+    return compile_binary(ExprOp_Or, e->left(), e->right());
+  }
+  case tuix::ExprUnion_Not:
+    return compile_unary(ExprOp_Not, expr->expr_as_Not()->child());
+  case tuix::ExprUnion_LessThan: {
+    auto e = expr->expr_as_LessThan();
+    return compile_binary(ExprOp_LessThan, e->left(), e->right());
+  }
+  case tuix::ExprUnion_LessThanOrEqual: {
+    auto e = expr->expr_as_LessThanOrEqual();
+    return compile_binary(ExprOp_LessThanOrEqual, e->left(), e->right());
+  }
+  case tuix::ExprUnion_GreaterThan: {
+    auto e = expr->expr_as_GreaterThan();
+    return compile_binary(ExprOp_GreaterThan, e->left(), e->right());
+  }
+  case tuix::ExprUnion_GreaterThanOrEqual: {
+    auto e = expr->expr_as_GreaterThanOrEqual();
+    return compile_binary(ExprOp_GreaterThanOrEqual, e->left(), e->right());
+  }
+  case tuix::ExprUnion_EqualTo: {
+    auto e = expr->expr_as_EqualTo();
+    return compile_binary(ExprOp_EqualTo, e->left(), e->right());
+  }
+  case tuix::ExprUnion_IsNull:
+    return compile_unary(ExprOp_IsNull, expr->expr_as_IsNull()->child());
+  case tuix::ExprUnion_Like: {
+    auto e = expr->expr_as_Like();
+    return compile_match(expr, e->left(), e->right());
+  }
+  case tuix::ExprUnion_StartsWith: {
+    auto e = expr->expr_as_StartsWith();
+    return compile_match(expr, e->left(), e->right());
+  }
+  case tuix::ExprUnion_EndsWith: {
+    auto e = expr->expr_as_EndsWith();
+    return compile_match(expr, e->left(), e->right());
+  }
+  case tuix::ExprUnion_Contains: {
+    auto e = expr->expr_as_Contains();
+    return compile_match(expr, e->left(), e->right());
+  }
+  case tuix::ExprUnion_In:
+    return compile_in(expr->expr_as_In());
+  default:
+    return false;
+  }
+}
+
+bool ExprProgram::compile_unary(ExprOp op, const tuix::Expr *child) {
+  if (!compile_helper(child)) {
+    return false;
+  }
+  uint32_t child_reg = instructions.size() - 1;
+  ExprInstruction instruction = {op, child_reg, 0, 0};
+  instructions.push_back(instruction);
+  literals.push_back(nullptr);
+  matchers.push_back(StringMatcher());
+  literal_sets.push_back(LiteralSet());
+  return true;
+}
+
+bool ExprProgram::compile_binary(ExprOp op, const tuix::Expr *left, const tuix::Expr *right) {
+  if (!compile_helper(left)) {
+    return false;
+  }
+  uint32_t left_reg = instructions.size() - 1;
+  if (!compile_helper(right)) {
+    return false;
+  }
+  uint32_t right_reg = instructions.size() - 1;
+  ExprInstruction instruction = {op, left_reg, right_reg, 0};
+  instructions.push_back(instruction);
+  literals.push_back(nullptr);
+  matchers.push_back(StringMatcher());
+  literal_sets.push_back(LiteralSet());
+  return true;
+}
+
+/**
+ * Compile a string predicate whose pattern `right` is a non-NULL string literal into a single
+ * instruction that matches the string `left` against the pattern compiled once here. Predicates
+ * with other patterns are left to the interpreter.
+ */
+bool ExprProgram::compile_match(const tuix::Expr *expr, const tuix::Expr *left,
+                                const tuix::Expr *right) {
+  if (right->expr_type() != tuix::ExprUnion_Literal) {
+    return false;
+  }
+  const tuix::Field *pattern = right->expr_as_Literal()->value();
+  if (pattern->value_type() != tuix::FieldUnion_StringField || pattern->is_null()) {
+    return false;
+  }
+  if (!compile_helper(left)) {
+    return false;
+  }
+  uint32_t left_reg = instructions.size() - 1;
+  auto pattern_field = pattern->value_as_StringField();
+  ExprInstruction instruction = {ExprOp_Match, left_reg, 0, 0};
+  instructions.push_back(instruction);
+  literals.push_back(nullptr);
+  matchers.push_back(StringMatcher::for_predicate(expr, pattern_field->value()->data(),
+                                                  pattern_field->length()));
+  literal_sets.push_back(LiteralSet());
+  return true;
+}
+
+/**
+ * Compile an In expression whose items are all literals into a single instruction that looks up
+ * the value in a set of the items built once here. Other In expressions are left to the
+ * interpreter.
+ */
+bool ExprProgram::compile_in(const tuix::In *in) {
+  LiteralSet items;
+  if (in->children()->size() < 2 || !items.build(in->children())) {
+    return false;
+  }
+  if (!compile_helper(in->children()->Get(0))) {
+    return false;
+  }
+  uint32_t left_reg = instructions.size() - 1;
+  ExprInstruction instruction = {ExprOp_In, left_reg, 0, 0};
+  instructions.push_back(instruction);
+  literals.push_back(nullptr);
+  matchers.push_back(StringMatcher());
+  literal_sets.push_back(std::move(items));
+  return true;
+}
+
+bool ExprProgram::run(const tuix::Row *row) {
+  for (uint32_t i = 0; i < instructions.size(); i++) {
+    const ExprInstruction &instruction = instructions[i];
+    const ExprValue &left = registers[instruction.left];
+    const ExprValue &right = registers[instruction.right];
+    ExprValue &out = registers[i];
+
+    bool ok = true;
+    switch (instruction.op) {
+    case ExprOp_Col:
+      load_field(row->field_values()->Get(instruction.col_num), out);
+      break;
+    case ExprOp_Literal:
+      break;
+    case ExprOp_Add:
+      ok = run_arithmetic<std::plus>(left, right, out);
+      break;
+    case ExprOp_Subtract:
+      ok = run_arithmetic<std::minus>(left, right, out);
+      break;
+    case ExprOp_Multiply:
+      ok = run_arithmetic<std::multiplies>(left, right, out);
+      break;
+    case ExprOp_Divide:
+      ok = run_arithmetic<std::divides>(left, right, out);
+      break;
+    case ExprOp_And:
+      ok = run_logical(true, left, right, out);
+      break;
+    case ExprOp_Or:
+      ok = run_logical(false, left, right, out);
+      break;
+    case ExprOp_Not:
+      ok = left.type == tuix::FieldUnion_BooleanField;
+      out.type = tuix::FieldUnion_BooleanField;
+      out.is_null = left.is_null;
+      out.field = nullptr;
+      out.v.b = !left.v.b;
+      break;
+    case ExprOp_LessThan:
+      ok = run_comparison<std::less>(left, right, out);
+      break;
+    case ExprOp_LessThanOrEqual:
+      ok = run_comparison<std::less_equal>(left, right, out);
+      break;
+    case ExprOp_GreaterThan:
+      ok = run_comparison<std::greater>(left, right, out);
+      break;
+    case ExprOp_GreaterThanOrEqual:
+      ok = run_comparison<std::greater_equal>(left, right, out);
+      break;
+    case ExprOp_EqualTo:
+      ok = run_comparison<std::equal_to>(left, right, out);
+      break;
+    case ExprOp_IsNull:
+      out.type = tuix::FieldUnion_BooleanField;
+      out.is_null = false;
+      out.field = nullptr;
+      out.v.b = left.is_null;
+      break;
+    case ExprOp_Match:
+      ok = left.type == tuix::FieldUnion_StringField;
+      out.type = tuix::FieldUnion_BooleanField;
+      out.is_null = left.is_null;
+      out.field = nullptr;
+      out.v.b = ok && !left.is_null && matchers[i].matches(left.str, left.str_len);
+      break;
+    case ExprOp_In:
+      ok = left.type == literal_sets[i].type;
+      out.type = tuix::FieldUnion_BooleanField;
+      out.field = nullptr;
+      out.v.b = ok && !left.is_null && literal_set_contains(literal_sets[i], left);
+      out.is_null = !out.v.b && (left.is_null || literal_sets[i].has_null);
+      break;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+flatbuffers::Offset<tuix::Field>
+ExprProgram::write_result(flatbuffers::FlatBufferBuilder &builder) const {
+  const ExprValue &result = registers.back();
+  if (result.field != nullptr) {
+    return flatbuffers_copy<tuix::Field>(result.field, builder);
+  }
+  return write_value(result, builder);
+}
+
+bool ExprProgram::run_batch(const std::vector<const tuix::Row *> &rows) {
+  if (rows.empty()) {
+    return false;
+  }
+  batch_size = rows.size();
+  return run_instructions(&rows, nullptr, nullptr);
+}
+
+bool ExprProgram::run_columns(const std::vector<const tuix::Column *> &block_columns,
+                              const std::vector<uint32_t> &indices) {
+  if (indices.empty()) {
+    return false;
+  }
+  batch_size = indices.size();
+  return run_instructions(nullptr, &block_columns, &indices);
+}
+
+bool ExprProgram::run_instructions(const std::vector<const tuix::Row *> *rows,
+                                   const std::vector<const tuix::Column *> *block_columns,
+                                   const std::vector<uint32_t> *indices) {
+  uint32_t n = batch_size;
+  columns.resize(instructions.size());
+  for (uint32_t i = 0; i < instructions.size(); i++) {
+    const ExprInstruction &instruction = instructions[i];
+    const ExprColumn &left = columns[instruction.left];
+    const ExprColumn &right = columns[instruction.right];
+    ExprColumn &out = columns[i];
+
+    bool ok = true;
+    switch (instruction.op) {
+    case ExprOp_Col:
+      ok = rows != nullptr
+               ? load_column(*rows, instruction.col_num, out)
+               : load_typed_column(*block_columns, *indices, instruction.col_num, out);
+      break;
+    case ExprOp_Literal:
+      load_literal_column(registers[i], n, out);
+      break;
+    case ExprOp_Add:
+      ok = run_arithmetic_batch<std::plus>(left, right, n, out);
+      break;
+    case ExprOp_Subtract:
+      ok = run_arithmetic_batch<std::minus>(left, right, n, out);
+      break;
+    case ExprOp_Multiply:
+      ok = run_arithmetic_batch<std::multiplies>(left, right, n, out);
+      break;
+    case ExprOp_Divide:
+      ok = run_arithmetic_batch<std::divides>(left, right, n, out);
+      break;
+    case ExprOp_And:
+      ok = run_logical_batch(true, left, right, n, out);
+      break;
+    case ExprOp_Or:
+      ok = run_logical_batch(false, left, right, n, out);
+      break;
+    case ExprOp_Not:
+      ok = left.type == tuix::FieldUnion_BooleanField;
+      if (ok) {
+        out.type = tuix::FieldUnion_BooleanField;
+        out.fields.clear();
+        out.is_null = left.is_null;
+        out.bools.resize(n);
+        for (uint32_t k = 0; k < n; k++) {
+          out.bools[k] = !left.bools[k];
+        }
+      }
+      break;
+    case ExprOp_LessThan:
+      ok = run_comparison_batch<std::less>(left, right, n, out);
+      break;
+    case ExprOp_LessThanOrEqual:
+      ok = run_comparison_batch<std::less_equal>(left, right, n, out);
+      break;
+    case ExprOp_GreaterThan:
+      ok = run_comparison_batch<std::greater>(left, right, n, out);
+      break;
+    case ExprOp_GreaterThanOrEqual:
+      ok = run_comparison_batch<std::greater_equal>(left, right, n, out);
+      break;
+    case ExprOp_EqualTo:
+      ok = run_comparison_batch<std::equal_to>(left, right, n, out);
+      break;
+    case ExprOp_IsNull:
+      out.type = tuix::FieldUnion_BooleanField;
+      out.fields.clear();
+      out.bools = left.is_null;
+      out.is_null.assign(n, 0);
+      break;
+    case ExprOp_Match:
+      ok = left.type == tuix::FieldUnion_StringField;
+      if (ok) {
+        out.type = tuix::FieldUnion_BooleanField;
+        out.fields.clear();
+        out.is_null = left.is_null;
+        out.bools.resize(n);
+        for (uint32_t k = 0; k < n; k++) {
+          // NULL strings are not matched, since their contents may not be valid
+          out.bools[k] = !left.is_null[k] && matchers[i].matches(left.strs[k], left.str_lens[k]);
+        }
+      }
+      break;
+    case ExprOp_In:
+      ok = left.type == literal_sets[i].type;
+      if (ok) {
+        run_in_batch(literal_sets[i], left, n, out);
+      }
+      break;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+flatbuffers::Offset<tuix::Field>
+ExprProgram::write_batch_result(uint32_t row_idx, flatbuffers::FlatBufferBuilder &builder) const {
+  const ExprColumn &result = columns.back();
+  if (!result.fields.empty()) {
+    return flatbuffers_copy<tuix::Field>(result.fields[row_idx], builder);
+  }
+
+  ExprValue value;
+  value.type = result.type;
+  value.is_null = result.is_null[row_idx];
+  value.field = nullptr;
+  switch (result.type) {
+  case tuix::FieldUnion_BooleanField:
+    value.v.b = result.bools[row_idx];
+    break;
+  case tuix::FieldUnion_IntegerField:
+    value.v.i = result.ints[row_idx];
+    break;
+  case tuix::FieldUnion_LongField:
+    value.v.l = result.longs[row_idx];
+    break;
+  case tuix::FieldUnion_FloatField:
+    value.v.f = result.floats[row_idx];
+    break;
+  case tuix::FieldUnion_DoubleField:
+    value.v.d = result.doubles[row_idx];
+    break;
+  default:
+    break;
+  }
+  return write_value(value, builder);
+}
+
+bool ExprProgram::select_batch(std::vector<uint32_t> &selection) const {
+  const ExprColumn &result = columns.back();
+  if (result.type != tuix::FieldUnion_BooleanField) {
+    return false;
+  }
+  // Write every index and only advance past the selected ones, which avoids a branch per row
+  selection.resize(batch_size);
+  uint32_t num_selected = 0;
+  for (uint32_t k = 0; k < batch_size; k++) {
+    selection[num_selected] = k;
+    num_selected += !result.is_null[k] & (result.bools[k] != 0);
+  }
+  selection.resize(num_selected);
+  return true;
+}
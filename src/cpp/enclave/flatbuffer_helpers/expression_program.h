@@ -0,0 +1,160 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include "flatbuffers.h"
+#include "literal_set.h"
+#include "string_matcher.h"
+
+#ifndef EXPRESSION_PROGRAM_H
+#define EXPRESSION_PROGRAM_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/**
+ * The value of a register in an ExprProgram. Scalars are stored unboxed and strings point into the
+ * row or literal they were read from. Values read directly from a row or literal also keep a
+ * pointer to their source Field, so that they can be output as an exact copy of it.
+ */
+struct ExprValue {
+  tuix::FieldUnion type;
+  bool is_null;
+  const tuix::Field *field;
+  union {
+    bool b;
+    int32_t i;
+    int64_t l;
+    float f;
+    double d;
+  } v;
+  const uint8_t *str;
+  uint32_t str_len;
+};
+
+/**
+ * The values of a register in an ExprProgram for every row of a batch. Only the value vector
+ * matching `type` is populated; dates are stored in `ints`. Columns read directly from the rows or
+ * a literal also hold the source Field of each row.
+ */
+struct ExprColumn {
+  tuix::FieldUnion type;
+  std::vector<uint8_t> is_null;
+  std::vector<const tuix::Field *> fields;
+  std::vector<uint8_t> bools;
+  std::vector<int32_t> ints;
+  std::vector<int64_t> longs;
+  std::vector<float> floats;
+  std::vector<double> doubles;
+  std::vector<const uint8_t *> strs;
+  std::vector<uint32_t> str_lens;
+};
+
+enum ExprOp {
+  ExprOp_Col,
+  ExprOp_Literal,
+  ExprOp_Add,
+  ExprOp_Subtract,
+  ExprOp_Multiply,
+  ExprOp_Divide,
+  ExprOp_And,
+  ExprOp_Or,
+  ExprOp_Not,
+  ExprOp_LessThan,
+  ExprOp_LessThanOrEqual,
+  ExprOp_GreaterThan,
+  ExprOp_GreaterThanOrEqual,
+  ExprOp_EqualTo,
+  ExprOp_IsNull,
+  ExprOp_Match,
+  ExprOp_In
+};
+
+/**
+ * A single step of an ExprProgram. Instruction i writes its result to register i and reads its
+ * operands from the registers `left` and `right`, which always precede it.
+ */
+struct ExprInstruction {
+  ExprOp op;
+  uint32_t left;
+  uint32_t right;
+  uint32_t col_num;
+};
+
+/**
+ * A tuix::Expr tree lowered to a flat list of instructions over typed registers, so that
+ * evaluating it on a row does not recurse over the expression or materialize intermediate values
+ * as Flatbuffers. Only the final result is written to a FlatBufferBuilder.
+ *
+ * Column types are only known once a row is seen, so instructions check the types of their
+ * operands when run. A program handles the common scalar expressions; anything else, including
+ * type errors, is left to FlatbuffersExpressionEvaluator, which reports errors.
+ */
+class ExprProgram {
+public:
+  ExprProgram()
+      : instructions(), registers(), literals(), matchers(), literal_sets(), columns(),
+        batch_size(0) {}
+
+  /**
+   * Lower the given expression into this program. Return false if the expression contains an
+   * expression that programs cannot evaluate, in which case the program must not be run.
+   */
+  bool compile(const tuix::Expr *expr);
+
+  /**
+   * Run the program on the given row. Return false if the row contains values that the program
+   * cannot operate on, in which case the result is undefined and the expression must be evaluated
+   * by other means.
+   */
+  bool run(const tuix::Row *row);
+
+  /** Write the result of the last successful run to the given builder. */
+  flatbuffers::Offset<tuix::Field> write_result(flatbuffers::FlatBufferBuilder &builder) const;
+
+  /**
+   * Run the program on a batch of rows, one instruction at a time over all rows, so that each
+   * instruction is a tight loop over column vectors. Return false under the same conditions as
+   * run(), or if a column does not have the same type in every row.
+   */
+  bool run_batch(const std::vector<const tuix::Row *> &rows);
+
+  /**
+   * Run the program like run_batch() on the rows at the given indices of a block stored column by
+   * column, reading each column directly rather than from rows. Return false under the same
+   * conditions as run_batch(), or if a column was not decrypted or does not store typed values.
+   * Only select_batch() can be used after this, since no fields are loaded.
+   */
+  bool run_columns(const std::vector<const tuix::Column *> &block_columns,
+                   const std::vector<uint32_t> &indices);
+
+  /** Write the result for the given row of the last successful batch to the given builder. */
+  flatbuffers::Offset<tuix::Field>
+  write_batch_result(uint32_t row_idx, flatbuffers::FlatBufferBuilder &builder) const;
+
+  /**
+   * Set `selection` to the indices of the rows of the last successful batch for which the result
+   * is true and not NULL. Return false if the result is not a boolean.
+   */
+  bool select_batch(std::vector<uint32_t> &selection) const;
+
+private:
+  bool compile_helper(const tuix::Expr *expr);
+  bool compile_unary(ExprOp op, const tuix::Expr *child);
+  bool compile_binary(ExprOp op, const tuix::Expr *left, const tuix::Expr *right);
+  bool compile_match(const tuix::Expr *expr, const tuix::Expr *left, const tuix::Expr *right);
+  bool compile_in(const tuix::In *in);
+  bool run_instructions(const std::vector<const tuix::Row *> *rows,
+                        const std::vector<const tuix::Column *> *block_columns,
+                        const std::vector<uint32_t> *indices);
+
+  std::vector<ExprInstruction> instructions;
+  std::vector<ExprValue> registers;
+  // The literal of each ExprOp_Literal instruction, indexed like `instructions`
+  std::vector<const tuix::Field *> literals;
+  // The compiled pattern of each ExprOp_Match instruction, indexed like `instructions`
+  std::vector<StringMatcher> matchers;
+  // The items of each ExprOp_In instruction, indexed like `instructions`
+  std::vector<LiteralSet> literal_sets;
+  std::vector<ExprColumn> columns;
+  uint32_t batch_size;
+};
+
+#endif
@@ -2,6 +2,11 @@
 
 #include "flatbuffers.h"
 
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
 std::string to_string(const tuix::Row *row) {
   std::string s;
   flatbuffers::uoffset_t num_fields = row->field_values()->size();
@@ -273,3 +278,584 @@ flatbuffers::Offset<tuix::Field> flatbuffers_copy(const tuix::Field *field,
                              std::to_string(field->value_type()));
   }
 }
+
+template <typename T> void append_key_bytes(std::string &key, T value) {
+  key.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> T normalize_floating_point(T value) {
+  if (std::isnan(value)) {
+    return std::numeric_limits<T>::quiet_NaN();
+  }
+  // Maps -0.0 to 0.0
+  return value == 0 ? 0 : value;
+}
+
+void append_key(const tuix::Field *field, std::string &key) {
+  key.push_back(static_cast<char>(field->value_type()));
+  key.push_back(static_cast<char>(field->is_null()));
+  if (field->is_null()) {
+    return;
+  }
+
+  switch (field->value_type()) {
+  case tuix::FieldUnion_BooleanField:
+    append_key_bytes<uint8_t>(key, field->value_as_BooleanField()->value());
+    break;
+  case tuix::FieldUnion_IntegerField:
+    append_key_bytes(key, field->value_as_IntegerField()->value());
+    break;
+  case tuix::FieldUnion_LongField:
+    append_key_bytes(key, field->value_as_LongField()->value());
+    break;
+  case tuix::FieldUnion_FloatField:
+    append_key_bytes(key, normalize_floating_point(field->value_as_FloatField()->value()));
+    break;
+  case tuix::FieldUnion_DoubleField:
+    append_key_bytes(key, normalize_floating_point(field->value_as_DoubleField()->value()));
+    break;
+  case tuix::FieldUnion_StringField: {
+    auto string_field = field->value_as_StringField();
+    append_key_bytes(key, string_field->length());
+    key.append(reinterpret_cast<const char *>(string_field->value()->data()),
+               string_field->length());
+    break;
+  }
+  case tuix::FieldUnion_DateField:
+    append_key_bytes(key, field->value_as_DateField()->value());
+    break;
+  case tuix::FieldUnion_BinaryField: {
+    auto binary_field = field->value_as_BinaryField();
+    append_key_bytes(key, binary_field->length());
+    key.append(reinterpret_cast<const char *>(binary_field->value()->data()),
+               binary_field->length());
+    break;
+  }
+  case tuix::FieldUnion_ByteField:
+    append_key_bytes(key, field->value_as_ByteField()->value());
+    break;
+  case tuix::FieldUnion_CalendarIntervalField: {
+    auto cif = field->value_as_CalendarIntervalField();
+    append_key_bytes(key, cif->months());
+    append_key_bytes(key, cif->days());
+    append_key_bytes(key, cif->microseconds());
+    break;
+  }
+  case tuix::FieldUnion_NullField:
+    break;
+  case tuix::FieldUnion_ShortField:
+    append_key_bytes(key, field->value_as_ShortField()->value());
+    break;
+  case tuix::FieldUnion_TimestampField:
+    append_key_bytes(key, field->value_as_TimestampField()->value());
+    break;
+  case tuix::FieldUnion_ArrayField: {
+    auto array_field = field->value_as_ArrayField();
+    append_key_bytes(key, array_field->value()->size());
+    for (auto f : *array_field->value()) {
+      append_key(f, key);
+    }
+    break;
+  }
+  default:
+    throw std::runtime_error(std::string("append_key: Unsupported field type ") +
+                             std::string(tuix::EnumNameFieldUnion(field->value_type())));
+  }
+}
+
+/** Append `bits` to `key` most significant byte first, so that bytewise order is numeric order. */
+template <typename T> void append_big_endian(std::string &key, T bits) {
+  for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8) {
+    key.push_back(static_cast<char>((bits >> shift) & 0xff));
+  }
+}
+
+template <typename T> void append_sort_key_integer(std::string &key, T value) {
+  typedef typename std::make_unsigned<T>::type Bits;
+  // Flipping the sign bit maps two's complement order onto unsigned order
+  const Bits sign = static_cast<Bits>(Bits(1) << (sizeof(Bits) * 8 - 1));
+  append_big_endian(key, static_cast<Bits>(static_cast<Bits>(value) ^ sign));
+}
+
+template <typename T, typename Bits>
+void append_sort_key_floating_point(std::string &key, T value) {
+  value = normalize_floating_point(value);
+  Bits bits;
+  memcpy(&bits, &value, sizeof(bits));
+  // Positive values sort after negative ones, and negative values sort in reverse order of their
+  // magnitude. NaN has been normalized to a positive NaN, which sorts after infinity.
+  const Bits sign = Bits(1) << (sizeof(Bits) * 8 - 1);
+  append_big_endian(key, (bits & sign) ? static_cast<Bits>(~bits) : static_cast<Bits>(bits | sign));
+}
+
+void append_sort_key_bytes(std::string &key, const uint8_t *data, size_t len) {
+  // Zero bytes are escaped as 0x00 0xFF and the value is terminated by 0x00 0x00, so a value sorts
+  // before every value it is a proper prefix of
+  for (size_t i = 0; i < len; i++) {
+    key.push_back(static_cast<char>(data[i]));
+    if (data[i] == 0) {
+      key.push_back(static_cast<char>(0xff));
+    }
+  }
+  key.push_back(0);
+  key.push_back(0);
+}
+
+void append_sort_key(const tuix::Field *field, bool descending, bool nulls_first,
+                     std::string &key) {
+  if (field->is_null()) {
+    key.push_back(nulls_first ? 0 : 2);
+    return;
+  }
+  key.push_back(1);
+
+  const size_t value_start = key.size();
+  switch (field->value_type()) {
+  case tuix::FieldUnion_BooleanField:
+    key.push_back(field->value_as_BooleanField()->value() ? 1 : 0);
+    break;
+  case tuix::FieldUnion_IntegerField:
+    append_sort_key_integer(key, field->value_as_IntegerField()->value());
+    break;
+  case tuix::FieldUnion_LongField:
+    append_sort_key_integer(key, field->value_as_LongField()->value());
+    break;
+  case tuix::FieldUnion_FloatField:
+    append_sort_key_floating_point<float, uint32_t>(key, field->value_as_FloatField()->value());
+    break;
+  case tuix::FieldUnion_DoubleField:
+    append_sort_key_floating_point<double, uint64_t>(key, field->value_as_DoubleField()->value());
+    break;
+  case tuix::FieldUnion_StringField: {
+    auto string_field = field->value_as_StringField();
+    append_sort_key_bytes(key, string_field->value()->data(), string_field->length());
+    break;
+  }
+  case tuix::FieldUnion_DateField:
+    append_sort_key_integer(key, field->value_as_DateField()->value());
+    break;
+  case tuix::FieldUnion_BinaryField: {
+    auto binary_field = field->value_as_BinaryField();
+    append_sort_key_bytes(key, binary_field->value()->data(), binary_field->length());
+    break;
+  }
+  case tuix::FieldUnion_ByteField:
+    append_sort_key_integer(key, field->value_as_ByteField()->value());
+    break;
+  case tuix::FieldUnion_ShortField:
+    append_sort_key_integer(key, field->value_as_ShortField()->value());
+    break;
+  case tuix::FieldUnion_TimestampField:
+    append_sort_key_integer(key, static_cast<int64_t>(field->value_as_TimestampField()->value()));
+    break;
+  case tuix::FieldUnion_ArrayField: {
+    // Arrays sort lexicographically by element. Each element is preceded by 0x01 and the array is
+    // terminated by 0x00, so an array sorts before every array it is a proper prefix of.
+    for (auto f : *field->value_as_ArrayField()->value()) {
+      key.push_back(1);
+      append_sort_key(f, false, true, key);
+    }
+    key.push_back(0);
+    break;
+  }
+  default:
+    throw std::runtime_error(std::string("Can't sort on ") +
+                             std::string(tuix::EnumNameFieldUnion(field->value_type())));
+  }
+
+  if (descending) {
+    for (size_t i = value_start; i < key.size(); i++) {
+      key[i] = ~key[i];
+    }
+  }
+}
+
+uint32_t key_partition(const std::string &key, uint32_t seed, uint32_t num_partitions) {
+  uint64_t h = std::hash<std::string>()(key) + (seed + 1) * 0x9e3779b97f4a7c15ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h % num_partitions;
+}
+
+bool is_bit_set(const flatbuffers::Vector<uint8_t> *bitmap, uint32_t i) {
+  return (bitmap->Get(i / 8) >> (i % 8)) & 1;
+}
+
+void set_bit(std::vector<uint8_t> &bitmap, uint32_t i) { bitmap[i / 8] |= 1 << (i % 8); }
+
+/**
+ * The rows of a column holding its smallest and largest non-NULL values, which are only known for
+ * columns with a columnar encoding.
+ */
+struct ColumnRange {
+  bool is_known;
+  uint32_t min_row;
+  uint32_t max_row;
+};
+
+/** Order values as Spark does, with NaN greater than every other value. */
+template <typename T> bool range_less(T a, T b) { return a < b; }
+template <> bool range_less(float a, float b) { return a < b || (std::isnan(b) && !std::isnan(a)); }
+template <> bool range_less(double a, double b) {
+  return a < b || (std::isnan(b) && !std::isnan(a));
+}
+
+/**
+ * Collect the values of one fixed-width column, using a default value for NULL rows, and find the
+ * range of its values.
+ */
+template <typename T, typename TuixField>
+flatbuffers::Offset<flatbuffers::Vector<T>>
+create_column_values(const std::vector<const tuix::Row *> &rows, uint32_t col,
+                     ColumnRange &range, flatbuffers::FlatBufferBuilder &builder) {
+  std::vector<T> values(rows.size());
+  for (uint32_t i = 0; i < rows.size(); i++) {
+    const tuix::Field *field = rows[i]->field_values()->Get(col);
+    if (field->is_null()) {
+      values[i] = T();
+      continue;
+    }
+    values[i] = static_cast<const TuixField *>(field->value())->value();
+    if (!range.is_known) {
+      range.is_known = true;
+      range.min_row = range.max_row = i;
+    } else if (range_less(values[i], values[range.min_row])) {
+      range.min_row = i;
+    } else if (range_less(values[range.max_row], values[i])) {
+      range.max_row = i;
+    }
+  }
+  return builder.CreateVector(values);
+}
+
+/**
+ * Concatenate the values of one string or binary column, writing their boundaries to `offsets`,
+ * and find the range of its values.
+ */
+template <typename TuixField>
+flatbuffers::Offset<flatbuffers::Vector<uint8_t>>
+create_column_bytes(const std::vector<const tuix::Row *> &rows, uint32_t col,
+                    std::vector<uint32_t> &offsets, ColumnRange &range,
+                    flatbuffers::FlatBufferBuilder &builder) {
+  std::vector<uint8_t> bytes;
+  offsets.assign(1, 0);
+  for (uint32_t i = 0; i < rows.size(); i++) {
+    const tuix::Field *field = rows[i]->field_values()->Get(col);
+    auto value = static_cast<const TuixField *>(field->value());
+    if (!field->is_null() && value->value() != nullptr) {
+      uint32_t length = std::min<uint32_t>(value->length(), value->value()->size());
+      bytes.insert(bytes.end(), value->value()->data(), value->value()->data() + length);
+    }
+    offsets.push_back(bytes.size());
+    if (field->is_null()) {
+      continue;
+    }
+
+    // Compare the appended value with earlier ones by their offsets into `bytes`
+    auto compare = [&](uint32_t j) {
+      uint32_t len_i = offsets[i + 1] - offsets[i];
+      uint32_t len_j = offsets[j + 1] - offsets[j];
+      int result = memcmp(bytes.data() + offsets[i], bytes.data() + offsets[j],
+                          std::min(len_i, len_j));
+      return result != 0 ? result : (len_i < len_j ? -1 : (len_i > len_j ? 1 : 0));
+    };
+    if (!range.is_known) {
+      range.is_known = true;
+      range.min_row = range.max_row = i;
+    } else if (compare(range.min_row) < 0) {
+      range.min_row = i;
+    } else if (compare(range.max_row) > 0) {
+      range.max_row = i;
+    }
+  }
+  return builder.CreateVector(bytes);
+}
+
+/**
+ * Serialize one column of the given rows into a tuix::Column, and write its statistics to
+ * `stats_builder`.
+ */
+flatbuffers::Offset<tuix::Column>
+create_column(const std::vector<const tuix::Row *> &rows, uint32_t col,
+              flatbuffers::FlatBufferBuilder &builder,
+              flatbuffers::FlatBufferBuilder &stats_builder,
+              flatbuffers::Offset<tuix::ColumnStats> &stats) {
+  const tuix::FieldUnion type = rows[0]->field_values()->Get(col)->value_type();
+  bool same_type = true;
+  uint32_t null_count = 0;
+  std::vector<uint8_t> nulls((rows.size() + 7) / 8);
+  for (uint32_t i = 0; i < rows.size(); i++) {
+    const tuix::Field *field = rows[i]->field_values()->Get(col);
+    same_type = same_type && field->value_type() == type;
+    if (field->is_null()) {
+      set_bit(nulls, i);
+      null_count++;
+    }
+  }
+  auto nulls_offset = builder.CreateVector(nulls);
+
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> bools, bytes;
+  flatbuffers::Offset<flatbuffers::Vector<int32_t>> ints;
+  flatbuffers::Offset<flatbuffers::Vector<int64_t>> longs;
+  flatbuffers::Offset<flatbuffers::Vector<float>> floats;
+  flatbuffers::Offset<flatbuffers::Vector<double>> doubles;
+  flatbuffers::Offset<flatbuffers::Vector<uint32_t>> offsets;
+  flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<tuix::Field>>> fields;
+  tuix::ColType col_type = tuix::ColType_NullType;
+  std::vector<uint32_t> offsets_vector;
+  ColumnRange range = {false, 0, 0};
+  switch (same_type ? type : tuix::FieldUnion_NONE) {
+  case tuix::FieldUnion_BooleanField:
+    col_type = tuix::ColType_BooleanType;
+    bools = create_column_values<uint8_t, tuix::BooleanField>(rows, col, range, builder);
+    break;
+  case tuix::FieldUnion_IntegerField:
+    col_type = tuix::ColType_IntegerType;
+    ints = create_column_values<int32_t, tuix::IntegerField>(rows, col, range, builder);
+    break;
+  case tuix::FieldUnion_DateField:
+    col_type = tuix::ColType_DateType;
+    ints = create_column_values<int32_t, tuix::DateField>(rows, col, range, builder);
+    break;
+  case tuix::FieldUnion_LongField:
+    col_type = tuix::ColType_LongType;
+    longs = create_column_values<int64_t, tuix::LongField>(rows, col, range, builder);
+    break;
+  case tuix::FieldUnion_FloatField:
+    col_type = tuix::ColType_FloatType;
+    floats = create_column_values<float, tuix::FloatField>(rows, col, range, builder);
+    break;
+  case tuix::FieldUnion_DoubleField:
+    col_type = tuix::ColType_DoubleType;
+    doubles = create_column_values<double, tuix::DoubleField>(rows, col, range, builder);
+    break;
+  case tuix::FieldUnion_StringField:
+    col_type = tuix::ColType_StringType;
+    bytes = create_column_bytes<tuix::StringField>(rows, col, offsets_vector, range, builder);
+    offsets = builder.CreateVector(offsets_vector);
+    break;
+  case tuix::FieldUnion_BinaryField:
+    col_type = tuix::ColType_BinaryType;
+    bytes = create_column_bytes<tuix::BinaryField>(rows, col, offsets_vector, range, builder);
+    offsets = builder.CreateVector(offsets_vector);
+    break;
+  default: {
+    std::vector<flatbuffers::Offset<tuix::Field>> field_values(rows.size());
+    for (uint32_t i = 0; i < rows.size(); i++) {
+      field_values[i] = flatbuffers_copy(rows[i]->field_values()->Get(col), builder);
+    }
+    fields = builder.CreateVector(field_values);
+    break;
+  }
+  }
+
+  flatbuffers::Offset<tuix::Field> min, max;
+  if (range.is_known) {
+    min = flatbuffers_copy(rows[range.min_row]->field_values()->Get(col), stats_builder);
+    max = flatbuffers_copy(rows[range.max_row]->field_values()->Get(col), stats_builder);
+  }
+  stats = tuix::CreateColumnStats(stats_builder, min, max, null_count);
+
+  return tuix::CreateColumn(builder, col_type, nulls_offset, bools, ints, longs, floats, doubles,
+                            bytes, offsets, fields);
+}
+
+bool create_columnar_rows(const std::vector<const tuix::Row *> &rows,
+                          flatbuffers::FlatBufferBuilder &builder,
+                          flatbuffers::FlatBufferBuilder &stats_builder,
+                          std::vector<flatbuffers::Offset<tuix::ColumnStats>> &column_stats) {
+  const uint32_t num_rows = rows.size();
+  const uint32_t num_fields = num_rows > 0 ? rows[0]->field_values()->size() : 0;
+  std::vector<uint8_t> dummies((num_rows + 7) / 8);
+  for (uint32_t i = 0; i < num_rows; i++) {
+    if (rows[i]->field_values()->size() != num_fields) {
+      return false;
+    }
+    if (rows[i]->is_dummy()) {
+      set_bit(dummies, i);
+    }
+  }
+
+  std::vector<flatbuffers::Offset<tuix::Column>> columns(num_fields);
+  column_stats.resize(num_fields);
+  for (uint32_t col = 0; col < num_fields; col++) {
+    columns[col] = create_column(rows, col, builder, stats_builder, column_stats[col]);
+  }
+  tuix::FinishColumnarRowsBuffer(
+      builder, tuix::CreateColumnarRowsDirect(builder, num_rows, &columns, &dummies));
+  return true;
+}
+
+void check_column(const tuix::Column *column, uint32_t num_rows) {
+  bool valid = column->nulls() != nullptr && column->nulls()->size() >= (num_rows + 7) / 8;
+  if (column->fields() != nullptr) {
+    valid = valid && column->fields()->size() == num_rows;
+  } else {
+    switch (column->col_type()) {
+    case tuix::ColType_BooleanType:
+      valid = valid && column->bools() != nullptr && column->bools()->size() == num_rows;
+      break;
+    case tuix::ColType_IntegerType:
+    case tuix::ColType_DateType:
+      valid = valid && column->ints() != nullptr && column->ints()->size() == num_rows;
+      break;
+    case tuix::ColType_LongType:
+      valid = valid && column->longs() != nullptr && column->longs()->size() == num_rows;
+      break;
+    case tuix::ColType_FloatType:
+      valid = valid && column->floats() != nullptr && column->floats()->size() == num_rows;
+      break;
+    case tuix::ColType_DoubleType:
+      valid = valid && column->doubles() != nullptr && column->doubles()->size() == num_rows;
+      break;
+    case tuix::ColType_StringType:
+    case tuix::ColType_BinaryType: {
+      auto offsets = column->offsets();
+      valid = valid && column->bytes() != nullptr && offsets != nullptr &&
+              offsets->size() == num_rows + 1 && offsets->Get(0) == 0;
+      for (uint32_t i = 0; valid && i < num_rows; i++) {
+        valid = offsets->Get(i) <= offsets->Get(i + 1);
+      }
+      valid = valid && offsets->Get(num_rows) <= column->bytes()->size();
+      break;
+    }
+    default:
+      valid = false;
+    }
+  }
+  if (!valid) {
+    throw std::runtime_error(std::string("Corrupt ColumnarRows column of type ") +
+                             std::to_string(column->col_type()));
+  }
+}
+
+/** Write the value in row `i` of a checked tuix::Column as a tuix::Field. */
+flatbuffers::Offset<tuix::Field> create_column_field(const tuix::Column *column, uint32_t i,
+                                                     flatbuffers::FlatBufferBuilder &builder) {
+  if (column->fields() != nullptr) {
+    return flatbuffers_copy(column->fields()->Get(i), builder);
+  }
+
+  bool is_null = is_bit_set(column->nulls(), i);
+  switch (column->col_type()) {
+  case tuix::ColType_BooleanType:
+    return tuix::CreateField(builder, tuix::FieldUnion_BooleanField,
+                             tuix::CreateBooleanField(builder, column->bools()->Get(i)).Union(),
+                             is_null);
+  case tuix::ColType_IntegerType:
+    return tuix::CreateField(builder, tuix::FieldUnion_IntegerField,
+                             tuix::CreateIntegerField(builder, column->ints()->Get(i)).Union(),
+                             is_null);
+  case tuix::ColType_DateType:
+    return tuix::CreateField(builder, tuix::FieldUnion_DateField,
+                             tuix::CreateDateField(builder, column->ints()->Get(i)).Union(),
+                             is_null);
+  case tuix::ColType_LongType:
+    return tuix::CreateField(builder, tuix::FieldUnion_LongField,
+                             tuix::CreateLongField(builder, column->longs()->Get(i)).Union(),
+                             is_null);
+  case tuix::ColType_FloatType:
+    return tuix::CreateField(builder, tuix::FieldUnion_FloatField,
+                             tuix::CreateFloatField(builder, column->floats()->Get(i)).Union(),
+                             is_null);
+  case tuix::ColType_DoubleType:
+    return tuix::CreateField(builder, tuix::FieldUnion_DoubleField,
+                             tuix::CreateDoubleField(builder, column->doubles()->Get(i)).Union(),
+                             is_null);
+  case tuix::ColType_StringType:
+  case tuix::ColType_BinaryType: {
+    uint32_t start = column->offsets()->Get(i);
+    uint32_t length = column->offsets()->Get(i + 1) - start;
+    auto value = builder.CreateVector(column->bytes()->data() + start, length);
+    if (column->col_type() == tuix::ColType_StringType) {
+      return tuix::CreateField(builder, tuix::FieldUnion_StringField,
+                               tuix::CreateStringField(builder, value, length).Union(), is_null);
+    }
+    return tuix::CreateField(builder, tuix::FieldUnion_BinaryField,
+                             tuix::CreateBinaryField(builder, value, length).Union(), is_null);
+  }
+  default:
+    throw std::runtime_error(std::string("Corrupt ColumnarRows column of type ") +
+                             std::to_string(column->col_type()));
+  }
+}
+
+const tuix::Rows *decode_rows(const uint8_t *buf, size_t len,
+                              flatbuffers::FlatBufferBuilder &builder, bool trusted) {
+  builder.Clear();
+  const tuix::ColumnarRows *columnar_rows = decode_columnar_rows(buf, len, trusted);
+  if (columnar_rows == nullptr) {
+    BufferRefView<tuix::Rows> rows_buf(const_cast<uint8_t *>(buf), len);
+    if (!trusted) {
+      rows_buf.verify();
+    }
+    return rows_buf.root();
+  }
+
+  std::vector<const tuix::Column *> columns(columnar_rows->columns()->begin(),
+                                            columnar_rows->columns()->end());
+  return create_rows_from_columns(columns, columnar_rows->dummies(), columnar_rows->num_rows(),
+                                  builder);
+}
+
+const tuix::ColumnarRows *decode_columnar_rows(const uint8_t *buf, size_t len, bool trusted) {
+  if (trusted && (len < sizeof(flatbuffers::uoffset_t) ||
+                  flatbuffers::ReadScalar<flatbuffers::uoffset_t>(buf) >= len)) {
+    throw std::runtime_error(std::string("Corrupt trusted block of length ") +
+                             std::to_string(len));
+  }
+
+  // A buffer with a file identifier starts with the root offset followed by the 4-byte identifier
+  if (len < sizeof(flatbuffers::uoffset_t) + 4 ||
+      !tuix::ColumnarRowsBufferHasIdentifier(buf)) {
+    return nullptr;
+  }
+
+  if (!trusted) {
+    flatbuffers::Verifier v(buf, len);
+    if (!tuix::VerifyColumnarRowsBuffer(v)) {
+      throw std::runtime_error(std::string("Corrupt ColumnarRows buffer of length ") +
+                               std::to_string(len));
+    }
+  }
+  const tuix::ColumnarRows *columnar_rows = tuix::GetColumnarRows(buf);
+  const uint32_t num_rows = columnar_rows->num_rows();
+  if (!trusted) {
+    if (columnar_rows->dummies() == nullptr ||
+        columnar_rows->dummies()->size() < (num_rows + 7) / 8) {
+      throw std::runtime_error("Corrupt ColumnarRows dummy bitmap");
+    }
+    for (auto it = columnar_rows->columns()->begin(); it != columnar_rows->columns()->end();
+         ++it) {
+      check_column(*it, num_rows);
+    }
+  }
+  return columnar_rows;
+}
+
+const tuix::Rows *create_rows_from_columns(const std::vector<const tuix::Column *> &columns,
+                                           const flatbuffers::Vector<uint8_t> *dummies,
+                                           uint32_t num_rows,
+                                           flatbuffers::FlatBufferBuilder &builder,
+                                           const std::vector<uint32_t> *selection) {
+  builder.Clear();
+  // Rebuild each row from its values in every column
+  const uint32_t num_built = selection != nullptr ? selection->size() : num_rows;
+  std::vector<flatbuffers::Offset<tuix::Row>> rows(num_built);
+  std::vector<flatbuffers::Offset<tuix::Field>> field_values(columns.size());
+  for (uint32_t k = 0; k < num_built; k++) {
+    const uint32_t i = selection != nullptr ? (*selection)[k] : k;
+    for (uint32_t col = 0; col < columns.size(); col++) {
+      if (columns[col] != nullptr) {
+        field_values[col] = create_column_field(columns[col], i, builder);
+      } else {
+        field_values[col] = tuix::CreateField(builder, tuix::FieldUnion_NullField,
+                                              tuix::CreateNullField(builder).Union(), true);
+      }
+    }
+    rows[k] = tuix::CreateRowDirect(builder, &field_values, is_bit_set(dummies, i));
+  }
+  builder.Finish(tuix::CreateRowsDirect(builder, &rows));
+  return flatbuffers::GetRoot<tuix::Rows>(builder.GetBufferPointer());
+}
@@ -198,6 +198,138 @@ private:
   const tuix::Row *row;
 };
 
+/**
+ * Append-only container for rows stored in enclave memory. Rows are addressed by the index
+ * returned when they were appended.
+ */
+class FlatbuffersRowArena {
+public:
+  FlatbuffersRowArena() : builder(), offsets() {}
+
+  /** Copy the given row into the arena. Invalidates any previously-returned Row pointers. */
+  uint32_t append(const tuix::Row *row) {
+    offsets.push_back(flatbuffers_copy(row, builder));
+    return offsets.size() - 1;
+  }
+
+  /** Copy the given `Field`s into the arena as a Row. Invalidates previously-returned pointers. */
+  uint32_t append(const std::vector<const tuix::Field *> &row_fields) {
+    std::vector<flatbuffers::Offset<tuix::Field>> field_values(row_fields.size());
+    for (uint32_t i = 0; i < row_fields.size(); i++) {
+      field_values[i] = flatbuffers_copy<tuix::Field>(row_fields[i], builder);
+    }
+    offsets.push_back(tuix::CreateRowDirect(builder, &field_values));
+    return offsets.size() - 1;
+  }
+
+  const tuix::Row *get(uint32_t idx) {
+    return flatbuffers::GetTemporaryPointer<tuix::Row>(builder, offsets[idx]);
+  }
+
+  uint32_t size() { return offsets.size(); }
+
+  /** Number of bytes of enclave memory used by the stored rows. */
+  size_t size_bytes() { return builder.GetSize(); }
+
+  void clear() {
+    builder.Clear();
+    offsets.clear();
+  }
+
+private:
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<flatbuffers::Offset<tuix::Row>> offsets;
+};
+
+/**
+ * Append an encoding of the given field to `key`. Two fields have equal encodings if and only if
+ * they have the same type and are equal, so a concatenation of encodings can be used as a hash
+ * table key. -0.0 and 0.0 encode identically, as do all NaNs. A NULL field encodes differently from
+ * every non-NULL field of its type.
+ */
+void append_key(const tuix::Field *field, std::string &key);
+
+/**
+ * Append an order-preserving encoding of the given field to `key`: for two fields of the same
+ * type, the first sorts before the second in the given direction and null ordering if and only if
+ * its encoding is lexicographically (memcmp) smaller. Encodings are prefix-free, so concatenating
+ * the encodings of several fields gives a key that sorts by all of them in turn.
+ */
+void append_sort_key(const tuix::Field *field, bool descending, bool nulls_first,
+                     std::string &key);
+
+/**
+ * Assign a key produced by append_key() to one of `num_partitions` partitions. Different seeds
+ * give independent assignments, so keys that share a partition under one seed can be split up by
+ * repartitioning them with another.
+ */
+uint32_t key_partition(const std::string &key, uint32_t seed, uint32_t num_partitions);
+
+/**
+ * Serialize the given rows as a finished tuix::ColumnarRows buffer in `builder`, writing the
+ * statistics of each column, gathered while serializing it, to `column_stats` in
+ * `stats_builder`. Return false without writing anything if the rows do not all have the same
+ * number of fields.
+ */
+bool create_columnar_rows(const std::vector<const tuix::Row *> &rows,
+                          flatbuffers::FlatBufferBuilder &builder,
+                          flatbuffers::FlatBufferBuilder &stats_builder,
+                          std::vector<flatbuffers::Offset<tuix::ColumnStats>> &column_stats);
+
+/**
+ * Verify a decrypted block, which holds either a tuix::Rows or a tuix::ColumnarRows, and return
+ * its rows. A ColumnarRows is converted into a Rows in `builder`, which then owns the result;
+ * otherwise `builder` is left empty and the result points into `buf`. If `trusted`, the block was
+ * authenticated as written by RowWriter, and only the location of its root is checked.
+ */
+const tuix::Rows *decode_rows(const uint8_t *buf, size_t len,
+                              flatbuffers::FlatBufferBuilder &builder, bool trusted = false);
+
+/**
+ * If a decrypted block holds a tuix::ColumnarRows, verify it and its columns as decode_rows() does
+ * and return it. Return nullptr if the block holds a tuix::Rows.
+ */
+const tuix::ColumnarRows *decode_columnar_rows(const uint8_t *buf, size_t len, bool trusted);
+
+/** Return whether bit `i` of a bitmap stored least significant bit first is set. */
+bool is_bit_set(const flatbuffers::Vector<uint8_t> *bitmap, uint32_t i);
+
+/**
+ * The additional authenticated data with which the enc_rows of a tuix::EncryptedBlock is
+ * encrypted, as described by EncryptedBlock.fbs.
+ */
+class EncryptedBlockAAD {
+public:
+  EncryptedBlockAAD(uint32_t uncompressed_size, uint8_t producer) {
+    values[0] = uncompressed_size;
+    values[1] = producer;
+    len = producer != 0 ? 2 * sizeof(uint32_t) : uncompressed_size > 0 ? sizeof(uint32_t) : 0;
+  }
+
+  const uint8_t *data() const {
+    return len > 0 ? reinterpret_cast<const uint8_t *>(values) : nullptr;
+  }
+  uint32_t size() const { return len; }
+
+private:
+  uint32_t values[2];
+  uint32_t len;
+};
+
+/** Check that a verified tuix::Column holds a well-formed column of `num_rows` values. */
+void check_column(const tuix::Column *column, uint32_t num_rows);
+
+/**
+ * Build a finished tuix::Rows in `builder` from checked columns of `num_rows` values and return
+ * it. The fields of columns that are null are written as NULL. If `selection` is given, only the
+ * rows at those indices, which must be increasing, are built.
+ */
+const tuix::Rows *create_rows_from_columns(const std::vector<const tuix::Column *> &columns,
+                                           const flatbuffers::Vector<uint8_t> *dummies,
+                                           uint32_t num_rows,
+                                           flatbuffers::FlatBufferBuilder &builder,
+                                           const std::vector<uint32_t> *selection = nullptr);
+
 void print(const tuix::Row *in);
 void print(const tuix::Field *field);
 
@@ -1,29 +1,164 @@
 #include "flatbuffers_readers.h"
+#include "compression/lz4_block.h"
 #include "crypto/crypto_context.h"
 
-void EncryptedBlockToRowReader::reset(const tuix::EncryptedBlock *encrypted_block) {
+void EncryptedBlockToRowReader::reset(const tuix::EncryptedBlock *encrypted_block,
+                                      const std::vector<bool> *used_columns) {
+  if (reset_columns(encrypted_block, used_columns)) {
+    select_rows(nullptr);
+  }
+}
+
+bool EncryptedBlockToRowReader::reset_columns(const tuix::EncryptedBlock *encrypted_block,
+                                              const std::vector<bool> *used_columns) {
   Crypto *crypto = CryptoContext::getInstance().crypto;
 
   uint32_t num_rows = encrypted_block->num_rows();
 
-  const size_t rows_len = crypto->SymDecSize(encrypted_block->enc_rows()->size());
-  rows_buf.reset(new uint8_t[rows_len]);
-
-  crypto->SymDec(shared_key, encrypted_block->enc_rows()->data(), NULL, rows_buf.get(),
-                 encrypted_block->enc_rows()->size(), 0);
-  BufferRefView<tuix::Rows> buf(rows_buf.get(), rows_len);
-  buf.verify();
-
-  rows = buf.root();
-  if (rows->rows()->size() != num_rows) {
+  size_t rows_len = crypto->SymDecSize(encrypted_block->enc_rows()->size());
+  const uint32_t uncompressed_size = encrypted_block->uncompressed_size();
+  // The producer is authenticated along with the rows, so only blocks that this enclave's
+  // RowWriter encrypted can claim to be trusted
+  const EncryptedBlockAAD aad(uncompressed_size, encrypted_block->producer());
+  const bool trusted = encrypted_block->producer() == TRUSTED_PRODUCER_VERSION &&
+                       encrypted_block->enc_columns() == nullptr;
+  // Release the previous block before taking buffers for this one, so that they can be reused
+  rows_buf.reset();
+  column_bufs.clear();
+  block_columns.clear();
+  decoded_rows_builder.Clear();
+  initialized = false;
+  BufferPool &pool = BufferPool::getInstance();
+  if (uncompressed_size > 0) {
+    PooledBuffer compressed_buf = pool.acquire(rows_len);
+    crypto->SymDec(shared_key, encrypted_block->enc_rows()->data(), aad.data(),
+                   compressed_buf.get(), encrypted_block->enc_rows()->size(), aad.size());
+    rows_buf = pool.acquire(uncompressed_size);
+    if (!lz4_decompress(compressed_buf.get(), rows_len, rows_buf.get(), uncompressed_size)) {
+      throw std::runtime_error(std::string("Corrupt compressed block of length ") +
+                               std::to_string(rows_len));
+    }
+    rows_len = uncompressed_size;
+  } else {
+    rows_buf = pool.acquire(rows_len);
+    crypto->SymDec(shared_key, encrypted_block->enc_rows()->data(), aad.data(), rows_buf.get(),
+                   encrypted_block->enc_rows()->size(), aad.size());
+  }
+  uint32_t decoded_rows;
+  bool columnar = true;
+  if (encrypted_block->enc_columns() != nullptr) {
+    decode_columns(encrypted_block, rows_len, used_columns);
+    decoded_rows = block_num_rows;
+  } else if (const tuix::ColumnarRows *columnar_rows =
+                 decode_columnar_rows(rows_buf.get(), rows_len, trusted)) {
+    block_columns.assign(columnar_rows->columns()->begin(), columnar_rows->columns()->end());
+    block_dummies = columnar_rows->dummies();
+    block_num_rows = columnar_rows->num_rows();
+    decoded_rows = block_num_rows;
+  } else {
+    rows = decode_rows(rows_buf.get(), rows_len, decoded_rows_builder, trusted);
+    decoded_rows = rows->rows()->size();
+    columnar = false;
+  }
+  if (decoded_rows != num_rows) {
     throw std::runtime_error(std::string("EncryptedBlock claimed to contain ") +
                              std::to_string(num_rows) +
                              std::string("rows but actually contains ") +
-                             std::to_string(rows->rows()->size()) + std::string(" rows"));
+                             std::to_string(decoded_rows) + std::string(" rows"));
   }
 
+  if (columnar) {
+    return true;
+  }
   row_idx = 0;
   initialized = true;
+  return false;
+}
+
+void EncryptedBlockToRowReader::add_columns(const tuix::EncryptedBlock *encrypted_block,
+                                            const std::vector<bool> *used_columns) {
+  if (encrypted_block->enc_columns() != nullptr) {
+    decrypt_columns(encrypted_block, used_columns);
+  }
+}
+
+void EncryptedBlockToRowReader::select_rows(const std::vector<uint32_t> *selection,
+                                            bool keep_columns) {
+  rows = create_rows_from_columns(block_columns, block_dummies, block_num_rows,
+                                  decoded_rows_builder, selection);
+  if (!keep_columns) {
+    // The rows were rebuilt from columns and no longer refer to the decrypted block
+    block_columns.clear();
+    block_dummies = nullptr;
+    column_bufs.clear();
+    rows_buf.reset();
+  }
+
+  row_idx = 0;
+  initialized = true;
+}
+
+void EncryptedBlockToRowReader::decode_columns(const tuix::EncryptedBlock *encrypted_block,
+                                          size_t directory_len,
+                                          const std::vector<bool> *used_columns) {
+  flatbuffers::Verifier v(rows_buf.get(), directory_len);
+  if (!v.VerifyBuffer<tuix::ColumnDirectory>(nullptr)) {
+    throw std::runtime_error(std::string("Corrupt ColumnDirectory buffer of length ") +
+                             std::to_string(directory_len));
+  }
+  const tuix::ColumnDirectory *directory =
+      flatbuffers::GetRoot<tuix::ColumnDirectory>(rows_buf.get());
+  const uint32_t num_rows = directory->num_rows();
+  const uint32_t num_fields = encrypted_block->enc_columns()->size();
+  if (directory->column_ivs() == nullptr ||
+      directory->column_ivs()->size() != num_fields * CIPHER_IV_SIZE ||
+      directory->dummies() == nullptr || directory->dummies()->size() < (num_rows + 7) / 8) {
+    throw std::runtime_error("Corrupt ColumnDirectory");
+  }
+
+  column_bufs.resize(num_fields);
+  block_columns.assign(num_fields, nullptr);
+  block_dummies = directory->dummies();
+  block_num_rows = num_rows;
+  decrypt_columns(encrypted_block, used_columns);
+}
+
+void EncryptedBlockToRowReader::decrypt_columns(const tuix::EncryptedBlock *encrypted_block,
+                                                const std::vector<bool> *used_columns) {
+  Crypto *crypto = CryptoContext::getInstance().crypto;
+
+  // Verified by decode_columns()
+  const tuix::ColumnDirectory *directory =
+      flatbuffers::GetRoot<tuix::ColumnDirectory>(rows_buf.get());
+
+  // Decrypt the used columns that are not decrypted yet, checking that each was encrypted for
+  // this block
+  for (uint32_t col = 0; col < block_columns.size(); col++) {
+    if (block_columns[col] != nullptr ||
+        (used_columns != nullptr && (col >= used_columns->size() || !(*used_columns)[col]))) {
+      continue;
+    }
+
+    auto enc_data = encrypted_block->enc_columns()->Get(col)->enc_data();
+    if (enc_data == nullptr || enc_data->size() < CIPHER_IV_SIZE + CIPHER_TAG_SIZE ||
+        memcmp(enc_data->data(), directory->column_ivs()->data() + col * CIPHER_IV_SIZE,
+               CIPHER_IV_SIZE) != 0) {
+      throw std::runtime_error(std::string("Encrypted column ") + std::to_string(col) +
+                               std::string(" does not belong to its block"));
+    }
+    const size_t column_len = crypto->SymDecSize(enc_data->size());
+    column_bufs[col] = BufferPool::getInstance().acquire(column_len);
+    crypto->SymDec(shared_key, enc_data->data(), NULL, column_bufs[col].get(), enc_data->size(),
+                   0);
+
+    flatbuffers::Verifier column_v(column_bufs[col].get(), column_len);
+    if (!column_v.VerifyBuffer<tuix::Column>(nullptr)) {
+      throw std::runtime_error(std::string("Corrupt Column buffer of length ") +
+                               std::to_string(column_len));
+    }
+    block_columns[col] = flatbuffers::GetRoot<tuix::Column>(column_bufs[col].get());
+    check_column(block_columns[col], block_num_rows);
+  }
 }
 
 RowReader::RowReader(BufferRefView<tuix::EncryptedBlocks> buf) { reset(buf); }
@@ -38,6 +173,11 @@ void RowReader::reset(BufferRefView<tuix::EncryptedBlocks> buf) {
 void RowReader::reset(const tuix::EncryptedBlocks *encrypted_blocks) {
   this->encrypted_blocks = encrypted_blocks;
   block_idx = 0;
+  prev_block_reader.reset();
+  pinned_block_reader.reset();
+  if (!block_reader || block_reader.use_count() > 1) {
+    block_reader = std::make_shared<EncryptedBlockToRowReader>();
+  }
   init_block_reader();
 }
 
@@ -51,27 +191,83 @@ uint32_t RowReader::num_rows() {
 }
 
 bool RowReader::has_next() {
-  return block_reader.has_next() || block_idx + 1 < encrypted_blocks->blocks()->size();
+  return block_reader->has_next() || block_idx + 1 < encrypted_blocks->blocks()->size();
 }
 
 const tuix::Row *RowReader::next() {
-  // Note: this will invalidate any pointers returned by previous invocations of
-  // this method
-  if (!block_reader.has_next()) {
+  if (!block_reader->has_next()) {
     assert(block_idx + 1 < encrypted_blocks->blocks()->size());
     block_idx++;
+
+    // Keep the finished block as the previous one. The block before it is released, and its
+    // reader reused for the new block unless it is pinned.
+    std::shared_ptr<EncryptedBlockToRowReader> reader = std::move(prev_block_reader);
+    if (!reader || reader.use_count() > 1) {
+      reader = std::make_shared<EncryptedBlockToRowReader>();
+    }
+    prev_block_reader = std::move(block_reader);
+    block_reader = std::move(reader);
     init_block_reader();
   }
 
-  return block_reader.next();
+  return block_reader->next();
 }
 
-const tuix::Row *RowReader::peek() { return block_reader.peek(); }
+const tuix::Row *RowReader::peek() { return block_reader->peek(); }
 
 void RowReader::init_block_reader() {
   if (block_idx < encrypted_blocks->blocks()->size()) {
-    block_reader.reset(encrypted_blocks->blocks()->Get(block_idx));
+    block_reader->reset(encrypted_blocks->blocks()->Get(block_idx));
+  }
+}
+
+uint32_t MaterializedRowsReader::load(const tuix::EncryptedBlocks *encrypted_blocks,
+                                     uint32_t block_start, size_t budget) {
+  if (this->encrypted_blocks == encrypted_blocks && loaded_start == block_start &&
+      loaded_end > loaded_start) {
+    return loaded_end;
   }
+
+  Crypto *crypto = CryptoContext::getInstance().crypto;
+  const uint32_t num_blocks = encrypted_blocks->blocks()->size();
+
+  this->encrypted_blocks = encrypted_blocks;
+  loaded_start = block_start;
+  loaded_end = block_start;
+  loaded_bytes = 0;
+  loaded_rows.clear();
+
+  uint32_t num_readers = 0;
+  while (loaded_end < num_blocks) {
+    const tuix::EncryptedBlock *block = encrypted_blocks->blocks()->Get(loaded_end);
+    size_t block_bytes = block->uncompressed_size() > 0
+                             ? block->uncompressed_size()
+                             : crypto->SymDecSize(block->enc_rows()->size());
+    if (block->enc_columns() != nullptr) {
+      for (auto it = block->enc_columns()->begin(); it != block->enc_columns()->end(); ++it) {
+        if (it->enc_data() != nullptr) {
+          block_bytes += crypto->SymDecSize(it->enc_data()->size());
+        }
+      }
+    }
+    if (num_readers > 0 && loaded_bytes + block_bytes > budget) {
+      break;
+    }
+
+    if (num_readers == block_readers.size()) {
+      block_readers.emplace_back(new EncryptedBlockToRowReader());
+    }
+    EncryptedBlockToRowReader &block_reader = *block_readers[num_readers++];
+    block_reader.reset(block);
+    loaded_rows.insert(loaded_rows.end(), block_reader.begin(), block_reader.end());
+
+    loaded_bytes += block_bytes;
+    loaded_end++;
+  }
+  // Release the plaintext of blocks that are no longer part of the loaded range
+  block_readers.resize(num_readers);
+
+  return loaded_end;
 }
 
 SortedRunsReader::SortedRunsReader(BufferRefView<tuix::SortedRuns> buf) { reset(buf); }
@@ -1,3 +1,4 @@
+#include "buffer_pool.h"
 #include "flatbuffers.h"
 
 #ifndef FLATBUFFERS_READERS_H
@@ -7,13 +8,52 @@ using namespace edu::berkeley::cs::rise::opaque;
 
 /**
  * A reader for Row objects within an EncryptedBlock object that provides both
- * iterator-based and range-style interfaces.
+ * iterator-based and range-style interfaces. Blocks encrypted as ColumnarRows
+ * or column by column are converted to Rows when they are decrypted.
  */
 class EncryptedBlockToRowReader {
 public:
-  EncryptedBlockToRowReader() : rows(nullptr), initialized(false) {}
+  EncryptedBlockToRowReader()
+      : block_dummies(nullptr), block_num_rows(0), decoded_rows_builder(), rows(nullptr),
+        initialized(false) {}
 
-  void reset(const tuix::EncryptedBlock *encrypted_block);
+  void reset(const tuix::EncryptedBlock *encrypted_block) { reset(encrypted_block, nullptr); }
+
+  /**
+   * Read the given block, decrypting only the columns marked in `used_columns` if the block's
+   * columns are encrypted separately. The other fields of each row are then NULL. All columns
+   * are decrypted if `used_columns` is null or the block is encrypted as a whole.
+   */
+  void reset(const tuix::EncryptedBlock *encrypted_block, const std::vector<bool> *used_columns);
+
+  /**
+   * Decrypt the given block as reset() does, but if it stores its rows column by column, keep the
+   * columns without building rows and return true. The columns are then available through
+   * columns() until select_rows() builds the rows. Return false if the block stores rows, which
+   * are then read as after reset().
+   */
+  bool reset_columns(const tuix::EncryptedBlock *encrypted_block,
+                     const std::vector<bool> *used_columns);
+
+  /**
+   * The columns of a block read by reset_columns(). Columns that were not decrypted are null.
+   */
+  const std::vector<const tuix::Column *> &columns() const { return block_columns; }
+
+  /**
+   * Decrypt the columns marked in `used_columns`, or all columns if it is null, that
+   * reset_columns() left encrypted in the given block, which must be the one it read. Columns that
+   * are already decrypted are kept as they are. Does nothing for blocks encrypted as a whole.
+   */
+  void add_columns(const tuix::EncryptedBlock *encrypted_block,
+                   const std::vector<bool> *used_columns);
+
+  /**
+   * Build the rows at the given increasing indices from the columns kept by reset_columns(), or
+   * all rows if `selection` is null. The columns are released unless `keep_columns` is set, in
+   * which case rows can be built from them again, for example after add_columns().
+   */
+  void select_rows(const std::vector<uint32_t> *selection, bool keep_columns = false);
 
   bool has_next() { return initialized && row_idx < rows->rows()->size(); }
 
@@ -29,35 +69,106 @@ public:
     return rows->rows()->end();
   }
 
+  /** Number of enclave bytes held for the plaintext of the current block. */
+  size_t size_bytes() { return rows_buf.capacity() + decoded_rows_builder.GetSize(); }
+
 private:
-  std::unique_ptr<uint8_t> rows_buf;
+  void decode_columns(const tuix::EncryptedBlock *encrypted_block, size_t directory_len,
+                      const std::vector<bool> *used_columns);
+  void decrypt_columns(const tuix::EncryptedBlock *encrypted_block,
+                       const std::vector<bool> *used_columns);
+
+  // Taken from the BufferPool, and returned to it when the next block is read or the reader is
+  // destroyed
+  PooledBuffer rows_buf;
+  std::vector<PooledBuffer> column_bufs;
+  std::vector<const tuix::Column *> block_columns;
+  const flatbuffers::Vector<uint8_t> *block_dummies;
+  uint32_t block_num_rows;
+  flatbuffers::FlatBufferBuilder decoded_rows_builder;
   const tuix::Rows *rows;
   uint32_t row_idx;
   bool initialized;
 };
 
-/** An iterator-style reader for Rows organized into EncryptedBlocks. */
+/**
+ * A reader that decrypts a contiguous range of blocks from an EncryptedBlocks object into enclave
+ * memory so that their Rows can be scanned repeatedly without being decrypted again.
+ *
+ * Blocks are loaded until the plaintext would exceed a byte budget, so callers that need to scan
+ * a large input several times can process it in chunks. At least one block is always loaded.
+ */
+class MaterializedRowsReader {
+public:
+  MaterializedRowsReader()
+      : encrypted_blocks(nullptr), loaded_start(0), loaded_end(0), loaded_bytes(0) {}
+
+  /**
+   * Materialize the blocks starting at `block_start`, returning the index one past the last
+   * block loaded. Does nothing if that range is already loaded. Invalidates any
+   * previously-returned Row pointers if a new range is loaded.
+   */
+  uint32_t load(const tuix::EncryptedBlocks *encrypted_blocks, uint32_t block_start,
+                size_t budget = max_materialized_size());
+
+  /** Rows of the currently-loaded blocks, in order. */
+  const std::vector<const tuix::Row *> &rows() { return loaded_rows; }
+
+  /** Number of plaintext bytes held for the currently-loaded blocks. */
+  size_t size_bytes() { return loaded_bytes; }
+
+private:
+  const tuix::EncryptedBlocks *encrypted_blocks;
+  std::vector<std::unique_ptr<EncryptedBlockToRowReader>> block_readers;
+  std::vector<const tuix::Row *> loaded_rows;
+  uint32_t loaded_start;
+  uint32_t loaded_end;
+  size_t loaded_bytes;
+};
+
+/**
+ * An iterator-style reader for Rows organized into EncryptedBlocks.
+ *
+ * The reader keeps the block before the current one decrypted, so a Row stays valid until the
+ * reader moves past the block after its own. In particular, the Row returned by the previous call
+ * to next() is always still valid, and operators that compare each row with the one before it do
+ * not need to copy it. A block can also be pinned to keep its Rows valid for longer.
+ */
 class RowReader {
 public:
   RowReader(BufferRefView<tuix::EncryptedBlocks> buf);
   RowReader(const tuix::EncryptedBlocks *encrypted_blocks);
+  RowReader(const RowReader &) = delete;
+  RowReader(RowReader &&) = default;
 
   void reset(BufferRefView<tuix::EncryptedBlocks> buf);
   void reset(const tuix::EncryptedBlocks *encrypted_blocks);
 
   uint32_t num_rows();
   bool has_next();
-  /** Access the next Row. Invalidates any previously-returned Row pointers. */
+  /**
+   * Access the next Row. Invalidates Row pointers from blocks before the previous block that are
+   * not pinned.
+   */
   const tuix::Row *next();
   /** Access the next Row without incrementing the reader. */
   const tuix::Row *peek();
 
+  /**
+   * Keep the block of the Row last returned by next() decrypted until the next call to pin() or
+   * unpin(), so that Row pointers into it remain valid even after the reader has moved past it.
+   */
+  void pin() { pinned_block_reader = block_reader; }
+  void unpin() { pinned_block_reader.reset(); }
+
 private:
   void init_block_reader();
 
   const tuix::EncryptedBlocks *encrypted_blocks;
   uint32_t block_idx;
-  EncryptedBlockToRowReader block_reader;
+  std::shared_ptr<EncryptedBlockToRowReader> block_reader;
+  std::shared_ptr<EncryptedBlockToRowReader> prev_block_reader;
+  std::shared_ptr<EncryptedBlockToRowReader> pinned_block_reader;
 };
 
 /**
@@ -1,13 +1,18 @@
 #include "flatbuffers_writers.h"
+#include "compression/lz4_block.h"
 #include "crypto/crypto_context.h"
+#include "task_pool.h"
 
 void RowWriter::clear() {
   builder.Clear();
+  columnar_builder.Clear();
+  stats_builder.Clear();
   rows_vector.clear();
   total_num_rows = 0;
-  enc_block_builder.Clear();
+  enc_block_builder->Clear();
   enc_block_vector.clear();
   finished = false;
+  released = false;
 }
 
 void RowWriter::append(const tuix::Row *row, bool force_null) {
@@ -43,18 +48,52 @@ void RowWriter::append(const tuix::Row *row1, const tuix::Row *row2, bool row1_f
   maybe_finish_block();
 }
 
+void RowWriter::append_blocks(const tuix::EncryptedBlocks *blocks) {
+  if (rows_vector.size() > 0) {
+    finish_block();
+  }
+  for (auto it = blocks->blocks()->begin(); it != blocks->blocks()->end(); ++it) {
+    if (it->enc_rows() == nullptr) {
+      throw std::runtime_error("EncryptedBlock is missing its rows");
+    }
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> enc_stats;
+    if (it->enc_stats() != nullptr) {
+      enc_stats = enc_block_builder->CreateVector(it->enc_stats()->data(), it->enc_stats()->size());
+    }
+    enc_block_vector.push_back(tuix::CreateEncryptedBlock(
+        *enc_block_builder, it->num_rows(),
+        enc_block_builder->CreateVector(it->enc_rows()->data(), it->enc_rows()->size()), 0,
+        enc_stats, it->uncompressed_size(), it->producer()));
+    total_num_rows += it->num_rows();
+  }
+}
+
 UntrustedBufferRef<tuix::EncryptedBlocks> RowWriter::output_buffer() {
   if (!finished) {
     finish_blocks();
   }
+  return release_buffer<tuix::EncryptedBlocks>();
+}
 
-  uint8_t *buf_ptr;
-  ocall_malloc(enc_block_builder.GetSize(), &buf_ptr);
+template <typename T> UntrustedBufferRef<T> RowWriter::release_buffer() {
+  if (released) {
+    throw std::runtime_error("RowWriter output was already released");
+  }
+  released = true;
 
-  std::unique_ptr<uint8_t, decltype(&ocall_free)> buf(buf_ptr, &ocall_free);
-  memcpy(buf.get(), enc_block_builder.GetBufferPointer(), enc_block_builder.GetSize());
+  const flatbuffers::uoffset_t len = enc_block_builder->GetSize();
+  std::unique_ptr<uint8_t, decltype(&ocall_free)> buf(nullptr, &ocall_free);
+  {
+    // The builder already allocated its buffer outside the enclave, so the buffer is handed over
+    // instead of being copied into a new one. The builder fills its buffer from the end, so the
+    // finished data starts partway into the buffer, which the host frees from any address in it.
+    flatbuffers::DetachedBuffer detached = enc_block_builder->Release();
+    untrusted_alloc.detach();
+    buf.reset(detached.data());
+  }
+  enc_block_builder.reset(new flatbuffers::FlatBufferBuilder(1024, &untrusted_alloc));
 
-  UntrustedBufferRef<tuix::EncryptedBlocks> buffer(std::move(buf), enc_block_builder.GetSize());
+  UntrustedBufferRef<T> buffer(std::move(buf), len);
   return buffer;
 }
 
@@ -73,22 +112,67 @@ void RowWriter::maybe_finish_block() {
 }
 
 void RowWriter::finish_block() {
-  builder.Finish(tuix::CreateRowsDirect(builder, &rows_vector));
+  // Encrypt the block as ColumnarRows if possible, and otherwise as Rows
+  flatbuffers::FlatBufferBuilder *plaintext_builder = &builder;
+  if (COLUMNAR_BLOCKS) {
+    std::vector<const tuix::Row *> rows(rows_vector.size());
+    for (uint32_t i = 0; i < rows_vector.size(); i++) {
+      rows[i] = flatbuffers::GetTemporaryPointer(builder, rows_vector[i]);
+    }
+    if (create_columnar_rows(rows, columnar_builder, stats_builder, column_stats)) {
+      plaintext_builder = &columnar_builder;
+    }
+  }
+  if (plaintext_builder == &builder) {
+    builder.Finish(tuix::CreateRowsDirect(builder, &rows_vector));
+  }
+
+  // Compress the plaintext if that makes it smaller. The uncompressed size is authenticated along
+  // with the ciphertext, so a compressed block cannot be passed off as an uncompressed one.
+  const uint8_t *plaintext = plaintext_builder->GetBufferPointer();
+  size_t plaintext_len = plaintext_builder->GetSize();
+  uint32_t uncompressed_size = 0;
+  if (COMPRESS_BLOCKS && plaintext_len >= MIN_COMPRESSED_BLOCK_SIZE) {
+    lz4_compress(plaintext, plaintext_len, compressed_buf);
+    if (compressed_buf.size() < plaintext_len) {
+      uncompressed_size = plaintext_len;
+      plaintext = compressed_buf.data();
+      plaintext_len = compressed_buf.size();
+    }
+  }
+
   Crypto *crypto = CryptoContext::getInstance().crypto;
-  size_t enc_rows_len = crypto->SymEncSize(builder.GetSize());
+  size_t enc_rows_len = crypto->SymEncSize(plaintext_len);
 
   uint8_t *enc_rows_ptr = nullptr;
   ocall_malloc(enc_rows_len, &enc_rows_ptr);
 
   std::unique_ptr<uint8_t, decltype(&ocall_free)> enc_rows(enc_rows_ptr, &ocall_free);
-  crypto->SymEnc(shared_key, builder.GetBufferPointer(), NULL, enc_rows.get(), builder.GetSize(),
-                 0);
+  const EncryptedBlockAAD aad(uncompressed_size, TRUSTED_PRODUCER_VERSION);
+  crypto->SymEnc(shared_key, plaintext, aad.data(), enc_rows.get(), plaintext_len, aad.size());
 
-  enc_block_vector.push_back(
-      tuix::CreateEncryptedBlock(enc_block_builder, rows_vector.size(),
-                                 enc_block_builder.CreateVector(enc_rows.get(), enc_rows_len)));
+  // Encrypt the statistics gathered for a ColumnarRows block, binding them to the block by the IV
+  // of its rows
+  flatbuffers::Offset<flatbuffers::Vector<uint8_t>> enc_stats;
+  if (plaintext_builder == &columnar_builder) {
+    std::vector<uint8_t> rows_iv(enc_rows.get(), enc_rows.get() + CIPHER_IV_SIZE);
+    stats_builder.Finish(
+        tuix::CreateBlockStatsDirect(stats_builder, rows_vector.size(), &rows_iv, &column_stats));
+    size_t enc_stats_len = crypto->SymEncSize(stats_builder.GetSize());
+    std::unique_ptr<uint8_t> enc_stats_buf(new uint8_t[enc_stats_len]);
+    crypto->SymEnc(shared_key, stats_builder.GetBufferPointer(), NULL, enc_stats_buf.get(),
+                   stats_builder.GetSize(), 0);
+    enc_stats = enc_block_builder->CreateVector(enc_stats_buf.get(), enc_stats_len);
+  }
+
+  enc_block_vector.push_back(tuix::CreateEncryptedBlock(
+      *enc_block_builder, rows_vector.size(),
+      enc_block_builder->CreateVector(enc_rows.get(), enc_rows_len), 0, enc_stats,
+      uncompressed_size, TRUSTED_PRODUCER_VERSION));
 
   builder.Clear();
+  columnar_builder.Clear();
+  stats_builder.Clear();
   rows_vector.clear();
 }
 
@@ -96,8 +180,8 @@ flatbuffers::Offset<tuix::EncryptedBlocks> RowWriter::finish_blocks() {
   if (rows_vector.size() > 0) {
     finish_block();
   }
-  auto result = tuix::CreateEncryptedBlocksDirect(enc_block_builder, &enc_block_vector);
-  enc_block_builder.Finish(result);
+  auto result = tuix::CreateEncryptedBlocksDirect(*enc_block_builder, &enc_block_vector);
+  enc_block_builder->Finish(result);
   enc_block_vector.clear();
 
   finished = true;
@@ -122,22 +206,19 @@ void SortedRunsWriter::append(const tuix::Row *row1, const tuix::Row *row2) {
 
 void SortedRunsWriter::finish_run() { runs.push_back(container.finish_blocks()); }
 
+void SortedRunsWriter::append_runs(const tuix::SortedRuns *sorted_runs) {
+  for (auto it = sorted_runs->runs()->begin(); it != sorted_runs->runs()->end(); ++it) {
+    container.append_blocks(*it);
+    finish_run();
+  }
+}
+
 uint32_t SortedRunsWriter::num_runs() { return runs.size(); }
 
 UntrustedBufferRef<tuix::SortedRuns> SortedRunsWriter::output_buffer() {
-  container.enc_block_builder.Finish(
-      tuix::CreateSortedRunsDirect(container.enc_block_builder, &runs));
-
-  uint8_t *buf_ptr;
-  ocall_malloc(container.enc_block_builder.GetSize(), &buf_ptr);
-
-  std::unique_ptr<uint8_t, decltype(&ocall_free)> buf(buf_ptr, &ocall_free);
-  memcpy(buf.get(), container.enc_block_builder.GetBufferPointer(),
-         container.enc_block_builder.GetSize());
-
-  UntrustedBufferRef<tuix::SortedRuns> buffer(std::move(buf),
-                                              container.enc_block_builder.GetSize());
-  return buffer;
+  container.enc_block_builder->Finish(
+      tuix::CreateSortedRunsDirect(*container.enc_block_builder, &runs));
+  return container.release_buffer<tuix::SortedRuns>();
 }
 
 RowWriter *SortedRunsWriter::as_row_writer() {
@@ -148,3 +229,79 @@ RowWriter *SortedRunsWriter::as_row_writer() {
 
   return &container;
 }
+
+void write_blocks_in_parallel(const tuix::EncryptedBlocks *input, RowWriter &w,
+                              const std::function<void(uint32_t, uint32_t, RowWriter &)> &fn) {
+  const uint32_t num_blocks = input->blocks()->size();
+  const uint32_t num_ranges = std::min(num_blocks, TaskPool::getInstance().num_threads());
+  if (num_ranges <= 1) {
+    fn(0, num_blocks, w);
+    return;
+  }
+
+  // Each range is encrypted by its own writer, whose blocks are then concatenated in order. They
+  // are verified again since they were written to untrusted memory.
+  std::vector<std::unique_ptr<UntrustedBufferRef<tuix::EncryptedBlocks>>> range_outputs(
+      num_ranges);
+  TaskPool::getInstance().run_ranges(num_ranges, num_blocks, [&](uint32_t i, uint32_t begin,
+                                                                 uint32_t end) {
+    RowWriter range_w;
+    fn(begin, end, range_w);
+    range_outputs[i].reset(new UntrustedBufferRef<tuix::EncryptedBlocks>(range_w.output_buffer()));
+  });
+  for (auto &&range_output : range_outputs) {
+    BufferRefView<tuix::EncryptedBlocks> view = range_output->view();
+    view.verify();
+    w.append_blocks(view.root());
+  }
+}
+
+void SpillableRowBuffer::clear() {
+  rows.clear();
+  spilled.clear();
+  rewind();
+}
+
+void SpillableRowBuffer::append(const tuix::Row *row) {
+  rows.append(row);
+  if (rows.size_bytes() > budget) {
+    spill();
+  }
+}
+
+void SpillableRowBuffer::rewind() {
+  spill_idx = 0;
+  spill_reader.reset();
+  row_idx = 0;
+}
+
+bool SpillableRowBuffer::has_next() {
+  while (spill_idx < spilled.size()) {
+    if (!spill_reader) {
+      spill_reader.reset(new RowReader(spilled[spill_idx].view()));
+    }
+    if (spill_reader->has_next()) {
+      return true;
+    }
+    spill_reader.reset();
+    spill_idx++;
+  }
+  return row_idx < rows.size();
+}
+
+const tuix::Row *SpillableRowBuffer::next() {
+  if (has_next() && spill_idx < spilled.size()) {
+    return spill_reader->next();
+  }
+  return rows.get(row_idx++);
+}
+
+void SpillableRowBuffer::spill() {
+  count_spill();
+  RowWriter w;
+  for (uint32_t i = 0; i < rows.size(); i++) {
+    w.append(rows.get(i));
+  }
+  spilled.push_back(w.output_buffer());
+  rows.clear();
+}
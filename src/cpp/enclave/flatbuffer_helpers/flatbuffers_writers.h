@@ -1,4 +1,7 @@
+#include <functional>
+
 #include "flatbuffers.h"
+#include "flatbuffers_readers.h"
 
 #ifndef FLATBUFFERS_WRITERS_H
 #define FLATBUFFERS_WRITERS_H
@@ -7,23 +10,47 @@ using namespace edu::berkeley::cs::rise::opaque;
 
 class UntrustedMemoryAllocator : public flatbuffers::Allocator {
 public:
+  UntrustedMemoryAllocator() : current(nullptr), detached(nullptr) {}
+
   virtual uint8_t *allocate(size_t size) {
     uint8_t *result = nullptr;
     ocall_malloc(size, &result);
+    current = result;
     return result;
   }
   virtual void deallocate(uint8_t *p, size_t size) {
     (void)size;
+    if (p == detached) {
+      detached = nullptr;
+      return;
+    }
     ocall_free(p);
   }
+
+  /**
+   * Take ownership of the buffer most recently allocated by the builder, which must already have
+   * released it. The builder's later attempt to deallocate the buffer is ignored, and the caller
+   * must free it with ocall_free(), given the buffer or any address in it.
+   */
+  uint8_t *detach() {
+    detached = current;
+    current = nullptr;
+    return detached;
+  }
+
+private:
+  uint8_t *current;
+  uint8_t *detached;
 };
 
 /** Append-only container for rows wrapped in tuix::EncryptedBlocks. */
 class RowWriter {
 public:
   RowWriter()
-      : builder(), rows_vector(), total_num_rows(0), untrusted_alloc(),
-        enc_block_builder(1024, &untrusted_alloc), finished(false) {}
+      : builder(), columnar_builder(), stats_builder(), column_stats(), rows_vector(),
+        total_num_rows(0), compressed_buf(), untrusted_alloc(),
+        enc_block_builder(new flatbuffers::FlatBufferBuilder(1024, &untrusted_alloc)),
+        finished(false), released(false) {}
 
   void clear();
 
@@ -37,7 +64,16 @@ public:
   void append(const tuix::Row *row1, const tuix::Row *row2, bool row1_force_null = false,
               bool row2_force_null = false);
 
-  /** Expose the stored rows as a buffer. */
+  /**
+   * Append the blocks of the given EncryptedBlocks, which must have been written by a RowWriter,
+   * without decrypting them. Rows appended before are first finished into a block of their own.
+   */
+  void append_blocks(const tuix::EncryptedBlocks *blocks);
+
+  /**
+   * Expose the stored rows as a buffer. The buffer the rows were written into is handed over
+   * rather than copied, so this may only be called once until the writer is cleared.
+   */
   UntrustedBufferRef<tuix::EncryptedBlocks> output_buffer();
 
   /** Expose the stored rows as a buffer. The caller takes ownership of the
@@ -51,17 +87,27 @@ private:
   void maybe_finish_block();
   void finish_block();
   flatbuffers::Offset<tuix::EncryptedBlocks> finish_blocks();
+  /** Take the finished buffer of enc_block_builder, replacing the builder with an empty one. */
+  template <typename T> UntrustedBufferRef<T> release_buffer();
 
   flatbuffers::FlatBufferBuilder builder;
+  // For converting a finished block to ColumnarRows, along with the statistics of its columns
+  flatbuffers::FlatBufferBuilder columnar_builder;
+  flatbuffers::FlatBufferBuilder stats_builder;
+  std::vector<flatbuffers::Offset<tuix::ColumnStats>> column_stats;
   std::vector<flatbuffers::Offset<tuix::Row>> rows_vector;
   uint32_t total_num_rows;
+  // For compressing the plaintext of a finished block
+  std::vector<uint8_t> compressed_buf;
 
   // For writing the resulting EncryptedBlocks
   UntrustedMemoryAllocator untrusted_alloc;
-  flatbuffers::FlatBufferBuilder enc_block_builder;
+  // Replaced after its buffer is released, since a released builder does not allocate again
+  std::unique_ptr<flatbuffers::FlatBufferBuilder> enc_block_builder;
   std::vector<flatbuffers::Offset<tuix::EncryptedBlock>> enc_block_vector;
 
   bool finished;
+  bool released;
 
   friend class SortedRunsWriter;
 };
@@ -89,11 +135,14 @@ public:
    */
   void finish_run();
 
+  /** Append each of the given runs, which must have been written by a SortedRunsWriter. */
+  void append_runs(const tuix::SortedRuns *sorted_runs);
+
   /** Count how many runs have been written (i.e., how many times `finish_run`
    * has been called). */
   uint32_t num_runs();
 
-  /** Expose the stored runs as a buffer. */
+  /** Expose the stored runs as a buffer. May only be called once until the writer is cleared. */
   UntrustedBufferRef<tuix::SortedRuns> output_buffer();
 
   /**
@@ -107,4 +156,50 @@ private:
   std::vector<flatbuffers::Offset<tuix::EncryptedBlocks>> runs;
 };
 
+/**
+ * Process the blocks of `input` in parallel on the TaskPool, appending their output to `w` in the
+ * order of the blocks. The blocks are split into one contiguous range per thread, and `fn` is
+ * called with the start and end of each range and a writer for its output. `fn` may be called
+ * from several threads at once.
+ */
+void write_blocks_in_parallel(const tuix::EncryptedBlocks *input, RowWriter &w,
+                              const std::function<void(uint32_t, uint32_t, RowWriter &)> &fn);
+
+/**
+ * Append-only container for rows that can be scanned repeatedly, such as a group of rows that is
+ * joined against many others. Rows are kept in plaintext in enclave memory; only once they exceed
+ * a byte budget are they spilled to encrypted blocks outside the enclave, which must be decrypted
+ * again on every scan.
+ */
+class SpillableRowBuffer {
+public:
+  SpillableRowBuffer(size_t budget = max_materialized_size())
+      : budget(budget), rows(), spilled(), spill_idx(0), spill_reader(), row_idx(0) {}
+
+  void clear();
+
+  /** Append the given Row. Must not be called during a scan. */
+  void append(const tuix::Row *row);
+
+  /** Start a scan over the stored rows, in the order they were appended. */
+  void rewind();
+
+  bool has_next();
+
+  /** Access the next Row of the scan. Invalidates any previously-returned Row pointers. */
+  const tuix::Row *next();
+
+private:
+  void spill();
+
+  size_t budget;
+  FlatbuffersRowArena rows;
+  std::vector<UntrustedBufferRef<tuix::EncryptedBlocks>> spilled;
+
+  // Position of the current scan: first through the spilled rows, then through `rows`
+  uint32_t spill_idx;
+  std::unique_ptr<RowReader> spill_reader;
+  uint32_t row_idx;
+};
+
 #endif
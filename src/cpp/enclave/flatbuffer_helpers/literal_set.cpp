@@ -0,0 +1,139 @@
+#include "literal_set.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+bool StringRef::operator==(const StringRef &other) const {
+  return len == other.len && (len == 0 || memcmp(data, other.data, len) == 0);
+}
+
+bool StringRef::operator<(const StringRef &other) const {
+  uint32_t min_len = std::min(len, other.len);
+  int result = min_len > 0 ? memcmp(data, other.data, min_len) : 0;
+  return result < 0 || (result == 0 && len < other.len);
+}
+
+size_t StringRefHash::operator()(const StringRef &s) const {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (uint32_t i = 0; i < s.len; i++) {
+    hash = (hash ^ s.data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+template <typename T, typename Hash> void ValueSet<T, Hash>::build(std::vector<T> &values) {
+  sorted.clear();
+  hashed.clear();
+  if (values.size() <= MAX_SORTED_SIZE) {
+    std::sort(values.begin(), values.end());
+    sorted.swap(values);
+  } else {
+    hashed.insert(values.begin(), values.end());
+  }
+}
+
+template <typename T, typename Hash> bool ValueSet<T, Hash>::contains(const T &value) const {
+  if (hashed.empty()) {
+    return std::binary_search(sorted.begin(), sorted.end(), value);
+  }
+  return hashed.find(value) != hashed.end();
+}
+
+template class ValueSet<int64_t>;
+template class ValueSet<double>;
+template class ValueSet<StringRef, StringRefHash>;
+
+bool LiteralSet::build(const flatbuffers::Vector<flatbuffers::Offset<tuix::Expr>> *children) {
+  type = tuix::FieldUnion_NONE;
+  has_null = false;
+  std::vector<int64_t> integer_values;
+  std::vector<double> real_values;
+  std::vector<StringRef> string_values;
+  for (flatbuffers::uoffset_t i = 1; i < children->size(); i++) {
+    if (children->Get(i)->expr_type() != tuix::ExprUnion_Literal) {
+      return false;
+    }
+    const tuix::Field *item = children->Get(i)->expr_as_Literal()->value();
+    if (type == tuix::FieldUnion_NONE) {
+      type = item->value_type();
+    } else if (item->value_type() != type) {
+      return false;
+    }
+    if (item->is_null()) {
+      has_null = true;
+      continue;
+    }
+
+    switch (type) {
+    case tuix::FieldUnion_BooleanField:
+      integer_values.push_back(item->value_as_BooleanField()->value());
+      break;
+    case tuix::FieldUnion_IntegerField:
+      integer_values.push_back(item->value_as_IntegerField()->value());
+      break;
+    case tuix::FieldUnion_LongField:
+      integer_values.push_back(item->value_as_LongField()->value());
+      break;
+    case tuix::FieldUnion_DateField:
+      integer_values.push_back(item->value_as_DateField()->value());
+      break;
+    case tuix::FieldUnion_FloatField:
+    case tuix::FieldUnion_DoubleField: {
+      double value = type == tuix::FieldUnion_FloatField ? item->value_as_FloatField()->value()
+                                                         : item->value_as_DoubleField()->value();
+      // NaN equals nothing, and 0.0 and -0.0 are equal, so they are stored as one value
+      if (!std::isnan(value)) {
+        real_values.push_back(value == 0 ? 0.0 : value);
+      }
+      break;
+    }
+    case tuix::FieldUnion_StringField: {
+      auto str_field = item->value_as_StringField();
+      StringRef value = {str_field->value()->data(), str_field->length()};
+      string_values.push_back(value);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  integers.build(integer_values);
+  reals.build(real_values);
+  strings.build(string_values);
+  return type != tuix::FieldUnion_NONE;
+}
+
+bool LiteralSet::contains(const tuix::Field *value) const {
+  switch (type) {
+  case tuix::FieldUnion_BooleanField:
+    return contains_integer(value->value_as_BooleanField()->value());
+  case tuix::FieldUnion_IntegerField:
+    return contains_integer(value->value_as_IntegerField()->value());
+  case tuix::FieldUnion_LongField:
+    return contains_integer(value->value_as_LongField()->value());
+  case tuix::FieldUnion_DateField:
+    return contains_integer(value->value_as_DateField()->value());
+  case tuix::FieldUnion_FloatField:
+    return contains_real(value->value_as_FloatField()->value());
+  case tuix::FieldUnion_DoubleField:
+    return contains_real(value->value_as_DoubleField()->value());
+  case tuix::FieldUnion_StringField: {
+    auto str_field = value->value_as_StringField();
+    return contains_string(str_field->value()->data(), str_field->length());
+  }
+  default:
+    return false;
+  }
+}
+
+bool LiteralSet::contains_real(double value) const {
+  return !std::isnan(value) && reals.contains(value == 0 ? 0.0 : value);
+}
+
+bool LiteralSet::contains_string(const uint8_t *data, uint32_t len) const {
+  StringRef value = {data, len};
+  return strings.contains(value);
+}
@@ -0,0 +1,86 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include <unordered_set>
+
+#include "flatbuffers.h"
+
+#ifndef LITERAL_SET_H
+#define LITERAL_SET_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/** A string stored elsewhere, such as in a literal of an expression. */
+struct StringRef {
+  const uint8_t *data;
+  uint32_t len;
+
+  bool operator==(const StringRef &other) const;
+  bool operator<(const StringRef &other) const;
+};
+
+struct StringRefHash {
+  size_t operator()(const StringRef &s) const;
+};
+
+/**
+ * A set of values of one type, kept as a sorted array searched by bisection while it is small and
+ * as a hash set once it is large.
+ */
+template <typename T, typename Hash = std::hash<T>> class ValueSet {
+public:
+  ValueSet() : sorted(), hashed() {}
+
+  void build(std::vector<T> &values);
+  bool contains(const T &value) const;
+
+private:
+  // Sets of at most this many values are searched by bisection
+  static const uint32_t MAX_SORTED_SIZE = 16;
+
+  std::vector<T> sorted;
+  std::unordered_set<T, Hash> hashed;
+};
+
+/**
+ * The items of a tuix::In expression whose items are all literals, compiled once so that
+ * membership of a value takes constant time rather than a comparison per item. Items are compared
+ * with the same equality as tuix::EqualTo, so NaN is not equal to itself. Strings are not copied,
+ * so the literals must outlive the set.
+ */
+class LiteralSet {
+public:
+  LiteralSet()
+      : type(tuix::FieldUnion_NONE), has_null(false), integers(), reals(), strings() {}
+
+  /**
+   * Build the set from the children of a tuix::In expression, all but the first of which are its
+   * items. Return false if the items are not all literals of the same type, or are of a type that
+   * sets cannot hold, in which case the set must not be used.
+   */
+  bool build(const flatbuffers::Vector<flatbuffers::Offset<tuix::Expr>> *children);
+
+  /**
+   * Return whether the given non-NULL value equals a non-NULL item. The value must be of the same
+   * type as the items.
+   */
+  bool contains(const tuix::Field *value) const;
+
+  /** Counterparts of contains() for unboxed values of the same type as the items. */
+  bool contains_integer(int64_t value) const { return integers.contains(value); }
+  bool contains_real(double value) const;
+  bool contains_string(const uint8_t *data, uint32_t len) const;
+
+  /** The type of the items. */
+  tuix::FieldUnion type;
+  /** Whether any of the items is NULL. */
+  bool has_null;
+
+private:
+  // Booleans, integers, longs and dates
+  ValueSet<int64_t> integers;
+  // Floats and doubles
+  ValueSet<double> reals;
+  ValueSet<StringRef, StringRefHash> strings;
+};
+
+#endif
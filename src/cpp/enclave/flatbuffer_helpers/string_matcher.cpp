@@ -0,0 +1,185 @@
+#include "string_matcher.h"
+
+#include <algorithm>
+#include <cstring>
+
+/** Return whether `segment` matches the characters starting at `str`, which must be long enough. */
+bool segment_matches_at(const std::vector<uint8_t> &segment, const std::vector<bool> &wildcards,
+                        const uint8_t *str) {
+  if (wildcards.empty()) {
+    return segment.empty() || memcmp(segment.data(), str, segment.size()) == 0;
+  }
+  for (uint32_t i = 0; i < segment.size(); i++) {
+    if (!wildcards[i] && segment[i] != str[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Return the earliest position in the given string at which `segment` matches, or nullptr if there
+ * is none. Segments without wildcards are found by scanning for their first character with memchr.
+ */
+const uint8_t *find_segment(const std::vector<uint8_t> &segment, const std::vector<bool> &wildcards,
+                            const uint8_t *str, uint32_t len) {
+  if (segment.size() > len) {
+    return nullptr;
+  }
+  const uint8_t *last = str + (len - segment.size());
+  if (wildcards.empty()) {
+    const uint8_t *p = str;
+    while (p <= last) {
+      p = static_cast<const uint8_t *>(memchr(p, segment[0], last - p + 1));
+      if (p == nullptr) {
+        return nullptr;
+      }
+      if (memcmp(p + 1, segment.data() + 1, segment.size() - 1) == 0) {
+        return p;
+      }
+      p++;
+    }
+    return nullptr;
+  }
+  for (const uint8_t *p = str; p <= last; p++) {
+    if (segment_matches_at(segment, wildcards, p)) {
+      return p;
+    }
+  }
+  return nullptr;
+}
+
+StringMatcher StringMatcher::like(const uint8_t *pattern, uint32_t len, uint8_t escape_char) {
+  StringMatcher result;
+  result.segments.clear();
+  Segment segment;
+  bool has_wildcards = false;
+  for (uint32_t i = 0; i < len; i++) {
+    uint8_t c = pattern[i];
+    if (c == escape_char) {
+      if (i + 1 == len) {
+        throw std::runtime_error("LIKE pattern must not end with the escape character");
+      }
+      c = pattern[++i];
+      if (c != '%' && c != '_' && c != escape_char) {
+        throw std::runtime_error(std::string("The LIKE escape character must not precede '") +
+                                 std::string(1, static_cast<char>(c)) + "'");
+      }
+      segment.chars.push_back(c);
+      segment.wildcards.push_back(false);
+    } else if (c == '%') {
+      if (!has_wildcards) {
+        segment.wildcards.clear();
+      }
+      result.add_segment(std::move(segment));
+      segment = Segment();
+      has_wildcards = false;
+    } else {
+      segment.chars.push_back(c);
+      segment.wildcards.push_back(c == '_');
+      has_wildcards = has_wildcards || c == '_';
+    }
+  }
+  if (!has_wildcards) {
+    segment.wildcards.clear();
+  }
+  result.add_segment(std::move(segment));
+
+  // Empty segments between two '%' match anywhere, so only the anchored ones are kept
+  if (result.segments.size() > 2) {
+    std::vector<Segment> segments;
+    segments.push_back(std::move(result.segments.front()));
+    for (uint32_t i = 1; i + 1 < result.segments.size(); i++) {
+      if (!result.segments[i].chars.empty()) {
+        segments.push_back(std::move(result.segments[i]));
+      }
+    }
+    segments.push_back(std::move(result.segments.back()));
+    result.segments.swap(segments);
+  }
+  return result;
+}
+
+StringMatcher StringMatcher::starts_with(const uint8_t *s, uint32_t len) {
+  StringMatcher result;
+  result.segments.clear();
+  result.add_segment(s, len);
+  result.add_segment(nullptr, 0);
+  return result;
+}
+
+StringMatcher StringMatcher::ends_with(const uint8_t *s, uint32_t len) {
+  StringMatcher result;
+  result.segments.clear();
+  result.add_segment(nullptr, 0);
+  result.add_segment(s, len);
+  return result;
+}
+
+StringMatcher StringMatcher::contains(const uint8_t *s, uint32_t len) {
+  StringMatcher result;
+  result.segments.clear();
+  result.add_segment(nullptr, 0);
+  if (len > 0) {
+    result.add_segment(s, len);
+  }
+  result.add_segment(nullptr, 0);
+  return result;
+}
+
+StringMatcher StringMatcher::for_predicate(const tuix::Expr *expr, const uint8_t *pattern,
+                                           uint32_t len) {
+  switch (expr->expr_type()) {
+  case tuix::ExprUnion_Like:
+    return like(pattern, len, expr->expr_as_Like()->escape_char());
+  case tuix::ExprUnion_StartsWith:
+    return starts_with(pattern, len);
+  case tuix::ExprUnion_EndsWith:
+    return ends_with(pattern, len);
+  case tuix::ExprUnion_Contains:
+    return contains(pattern, len);
+  default:
+    throw std::runtime_error(std::string("Can't match strings for expression type ") +
+                             std::string(tuix::EnumNameExprUnion(expr->expr_type())));
+  }
+}
+
+bool StringMatcher::matches(const uint8_t *str, uint32_t len) const {
+  if (len < min_len) {
+    return false;
+  }
+  const Segment &first = segments.front();
+  if (segments.size() == 1) {
+    return len == first.chars.size() && segment_matches_at(first.chars, first.wildcards, str);
+  }
+
+  // The string is at least as long as all segments together, so the first and last segments do
+  // not overlap
+  const Segment &last = segments.back();
+  if (!segment_matches_at(first.chars, first.wildcards, str) ||
+      !segment_matches_at(last.chars, last.wildcards, str + (len - last.chars.size()))) {
+    return false;
+  }
+  const uint8_t *p = str + first.chars.size();
+  const uint8_t *end = str + (len - last.chars.size());
+  for (uint32_t i = 1; i + 1 < segments.size(); i++) {
+    const Segment &segment = segments[i];
+    p = find_segment(segment.chars, segment.wildcards, p, end - p);
+    if (p == nullptr) {
+      return false;
+    }
+    p += segment.chars.size();
+  }
+  return true;
+}
+
+void StringMatcher::add_segment(const uint8_t *chars, uint32_t len) {
+  Segment segment;
+  segment.chars.assign(chars, chars + len);
+  add_segment(std::move(segment));
+}
+
+void StringMatcher::add_segment(Segment segment) {
+  min_len += segment.chars.size();
+  segments.push_back(std::move(segment));
+}
@@ -0,0 +1,59 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include "flatbuffers.h"
+
+#ifndef STRING_MATCHER_H
+#define STRING_MATCHER_H
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/**
+ * A string pattern compiled once so that it can be matched against many strings without
+ * allocating. Every pattern is a sequence of segments separated by '%' wildcards, each of which
+ * matches exactly as many characters as it has and may contain '_' wildcards. The first segment is
+ * anchored at the start of the string and the last at its end, so exact, prefix, suffix and
+ * substring patterns are all special cases. The segments in between are found left to right and
+ * each is matched at its earliest position, which takes time linear in the length of the string
+ * for segments without '_'.
+ */
+class StringMatcher {
+public:
+  StringMatcher() : segments(1), min_len(0) {}
+
+  /**
+   * Compile a pattern of tuix::Like, in which '%' and '_' are wildcards unless they follow
+   * `escape_char`. As in Spark, the escape character may only precede a wildcard or itself.
+   */
+  static StringMatcher like(const uint8_t *pattern, uint32_t len, uint8_t escape_char);
+
+  /** Compile a pattern matching strings that start with, end with, or contain `s`. */
+  static StringMatcher starts_with(const uint8_t *s, uint32_t len);
+  static StringMatcher ends_with(const uint8_t *s, uint32_t len);
+  static StringMatcher contains(const uint8_t *s, uint32_t len);
+
+  /**
+   * Compile the pattern of the given string predicate, which must be tuix::Like,
+   * tuix::StartsWith, tuix::EndsWith or tuix::Contains.
+   */
+  static StringMatcher for_predicate(const tuix::Expr *expr, const uint8_t *pattern,
+                                     uint32_t len);
+
+  /** Return whether the given string matches the pattern. */
+  bool matches(const uint8_t *str, uint32_t len) const;
+
+private:
+  struct Segment {
+    std::vector<uint8_t> chars;
+    // Whether each of `chars` is a '_' wildcard, or empty if none is
+    std::vector<bool> wildcards;
+  };
+
+  void add_segment(const uint8_t *chars, uint32_t len);
+  void add_segment(Segment segment);
+
+  std::vector<Segment> segments;
+  // Total length of the segments, which no shorter string can match
+  uint32_t min_len;
+};
+
+#endif
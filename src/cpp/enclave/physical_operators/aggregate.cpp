@@ -13,18 +13,19 @@ void non_oblivious_aggregate(uint8_t *agg_op, size_t agg_op_length, uint8_t *inp
   RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
   RowWriter w;
 
-  FlatbuffersTemporaryRow prev, cur;
+  // The reader keeps the previous row valid, so neither row needs to be copied
+  const tuix::Row *prev = nullptr, *cur = nullptr;
   size_t count = 0;
 
   while (r.has_next()) {
-    prev.set(cur.get());
-    cur.set(r.next());
+    prev = cur;
+    cur = r.next();
 
-    if (prev.get() != nullptr && !agg_op_eval.is_same_group(prev.get(), cur.get())) {
+    if (prev != nullptr && !agg_op_eval.is_same_group(prev, cur)) {
       w.append(agg_op_eval.evaluate());
       agg_op_eval.reset_group();
     }
-    agg_op_eval.aggregate(cur.get());
+    agg_op_eval.aggregate(cur);
     count += 1;
   }
 
@@ -42,53 +42,82 @@ void outer_join(uint8_t *join_expr, size_t join_expr_length, uint8_t *outer_rows
   FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
   const tuix::JoinType join_type = join_expr_eval.get_join_type();
 
-  RowReader outer_r(BufferRefView<tuix::EncryptedBlocks>(outer_rows, outer_rows_length));
+  EncryptedBlocksToEncryptedBlockReader outer_r(
+      BufferRefView<tuix::EncryptedBlocks>(outer_rows, outer_rows_length));
+  BufferRefView<tuix::EncryptedBlocks> inner_buf(inner_rows, inner_rows_length);
+  inner_buf.verify();
+  const tuix::EncryptedBlocks *inner_blocks = inner_buf.root();
+  const uint32_t num_inner_blocks = inner_blocks->blocks()->size();
+
+  // The inner side is decrypted once and reused for every outer row. If it does not fit within
+  // MAX_MATERIALIZED_SIZE, it is instead loaded in chunks, each of which is joined against a whole
+  // outer block at a time.
+  MaterializedRowsReader inner_r;
+  EncryptedBlockToRowReader outer_block_r;
   RowWriter w;
 
-  FlatbuffersTemporaryRow last_inner;
-
-  while (outer_r.has_next()) {
-    const tuix::Row *outer = outer_r.next();
-    bool o_i_match = false;
-    RowReader inner_r(BufferRefView<tuix::EncryptedBlocks>(inner_rows, inner_rows_length));
-
-    const tuix::Row *inner;
-    while (inner_r.has_next()) {
-      inner = inner_r.next();
-      bool condition_met = join_expr_eval.is_right_join()
-                               ? join_expr_eval.eval_condition(inner, outer)
-                               : join_expr_eval.eval_condition(outer, inner);
-      if (!inner->is_dummy() && condition_met) {
-        switch (join_type) {
-        case tuix::JoinType_LeftOuter:
-          w.append(outer, inner);
-          break;
-        case tuix::JoinType_RightOuter:
-          w.append(inner, outer);
-          break;
-        default:
-          break;
-        }
-        o_i_match |= condition_met;
+  // Values of the null-padded side do not matter, so any inner row can serve as its template.
+  // Scala adds a dummy row to the inner side to guarantee that one exists.
+  FlatbuffersTemporaryRow null_inner;
+  std::vector<bool> outer_matched;
+
+  for (const tuix::EncryptedBlock *outer_block : outer_r) {
+    outer_block_r.reset(outer_block);
+    outer_matched.assign(outer_block->num_rows(), false);
+
+    uint32_t inner_start = 0;
+    do {
+      const uint32_t inner_end = inner_r.load(inner_blocks, inner_start);
+      const bool last_chunk = inner_end == num_inner_blocks;
+      const std::vector<const tuix::Row *> &inner_chunk = inner_r.rows();
+      if (null_inner.get() == nullptr && !inner_chunk.empty()) {
+        null_inner.set(inner_chunk.front());
       }
-    }
 
-    switch (join_type) {
-    case tuix::JoinType_LeftOuter:
-      if (!o_i_match) {
-        // Values of inner (right) do not matter: they are all set to null
-        w.append(outer, inner, false, true);
-      }
-      break;
-    case tuix::JoinType_RightOuter:
-      if (!o_i_match) {
-        // Values of inner (left) do not matter: they are all set to null
-        w.append(inner, outer, true, false);
+      uint32_t outer_idx = 0;
+      for (const tuix::Row *outer : outer_block_r) {
+        for (const tuix::Row *inner : inner_chunk) {
+          if (inner->is_dummy()) {
+            continue;
+          }
+          bool condition_met = join_expr_eval.is_right_join()
+                                   ? join_expr_eval.eval_condition(inner, outer)
+                                   : join_expr_eval.eval_condition(outer, inner);
+          if (condition_met) {
+            switch (join_type) {
+            case tuix::JoinType_LeftOuter:
+              w.append(outer, inner);
+              break;
+            case tuix::JoinType_RightOuter:
+              w.append(inner, outer);
+              break;
+            default:
+              break;
+            }
+            outer_matched[outer_idx] = true;
+          }
+        }
+
+        if (last_chunk && !outer_matched[outer_idx]) {
+          if (null_inner.get() == nullptr) {
+            throw std::runtime_error("Outer join requires a non-empty inner table");
+          }
+          switch (join_type) {
+          case tuix::JoinType_LeftOuter:
+            w.append(outer, null_inner.get(), false, true);
+            break;
+          case tuix::JoinType_RightOuter:
+            w.append(null_inner.get(), outer, true, false);
+            break;
+          default:
+            break;
+          }
+        }
+        outer_idx++;
       }
-      break;
-    default:
-      break;
-    }
+
+      inner_start = inner_end;
+    } while (inner_start < num_inner_blocks);
   }
   w.output_buffer(output_rows, output_rows_length);
 }
@@ -99,36 +128,51 @@ void default_join(uint8_t *join_expr, size_t join_expr_length, uint8_t *outer_ro
 
   FlatbuffersJoinExprEvaluator join_expr_eval(join_expr, join_expr_length);
   const tuix::JoinType join_type = join_expr_eval.get_join_type();
+  if (join_type != tuix::JoinType_LeftSemi && join_type != tuix::JoinType_LeftAnti) {
+    throw std::runtime_error(std::string("Join type not supported: ") +
+                             std::string(to_string(join_type)));
+  }
 
-  RowReader outer_r(BufferRefView<tuix::EncryptedBlocks>(outer_rows, outer_rows_length));
+  EncryptedBlocksToEncryptedBlockReader outer_r(
+      BufferRefView<tuix::EncryptedBlocks>(outer_rows, outer_rows_length));
+  BufferRefView<tuix::EncryptedBlocks> inner_buf(inner_rows, inner_rows_length);
+  inner_buf.verify();
+  const tuix::EncryptedBlocks *inner_blocks = inner_buf.root();
+  const uint32_t num_inner_blocks = inner_blocks->blocks()->size();
+
+  // See outer_join() for how the inner side is materialized
+  MaterializedRowsReader inner_r;
+  EncryptedBlockToRowReader outer_block_r;
   RowWriter w;
 
-  while (outer_r.has_next()) {
-    const tuix::Row *outer = outer_r.next();
-    bool o_i_match = false;
-
-    RowReader inner_r(BufferRefView<tuix::EncryptedBlocks>(inner_rows, inner_rows_length));
-    const tuix::Row *inner;
-    while (inner_r.has_next()) {
-      inner = inner_r.next();
-      o_i_match |= join_expr_eval.eval_condition(outer, inner);
-    }
-
-    switch (join_type) {
-    case tuix::JoinType_LeftAnti:
-      if (!o_i_match) {
-        w.append(outer);
-      }
-      break;
-    case tuix::JoinType_LeftSemi:
-      if (o_i_match) {
-        w.append(outer);
+  std::vector<bool> outer_matched;
+
+  for (const tuix::EncryptedBlock *outer_block : outer_r) {
+    outer_block_r.reset(outer_block);
+    outer_matched.assign(outer_block->num_rows(), false);
+
+    uint32_t inner_start = 0;
+    do {
+      const uint32_t inner_end = inner_r.load(inner_blocks, inner_start);
+      const bool last_chunk = inner_end == num_inner_blocks;
+      const std::vector<const tuix::Row *> &inner_chunk = inner_r.rows();
+
+      uint32_t outer_idx = 0;
+      for (const tuix::Row *outer : outer_block_r) {
+        // Semi and anti joins only need to know whether some inner row matches
+        for (auto it = inner_chunk.begin(); !outer_matched[outer_idx] && it != inner_chunk.end();
+             ++it) {
+          outer_matched[outer_idx] = join_expr_eval.eval_condition(outer, *it);
+        }
+
+        if (last_chunk && outer_matched[outer_idx] == (join_type == tuix::JoinType_LeftSemi)) {
+          w.append(outer);
+        }
+        outer_idx++;
       }
-      break;
-    default:
-      throw std::runtime_error(std::string("Join type not supported: ") +
-                               std::string(to_string(join_type)));
-    }
+
+      inner_start = inner_end;
+    } while (inner_start < num_inner_blocks);
   }
   w.output_buffer(output_rows, output_rows_length);
 }
@@ -1,37 +1,83 @@
 #include "filter.h"
 
 #include "common.h"
+#include "flatbuffer_helpers/block_stats.h"
 #include "flatbuffer_helpers/expression_evaluation.h"
 #include "flatbuffer_helpers/flatbuffers_readers.h"
 #include "flatbuffer_helpers/flatbuffers_writers.h"
 
 using namespace edu::berkeley::cs::rise::opaque;
 
+/** Filter the blocks from `begin` to `end` of `blocks`, writing the rows that are kept to `w`. */
+void filter_blocks(const tuix::Expr *condition, const tuix::EncryptedBlocks *blocks, uint32_t begin,
+                   uint32_t end, RowWriter &w) {
+  FlatbuffersConjunctionEvaluator condition_eval(condition);
+  EncryptedBlockToRowReader block_reader;
+
+  std::vector<bool> condition_columns;
+  condition_eval.mark_used_columns(condition_columns);
+
+  // Evaluate the condition on one block at a time, producing the indices of the rows to keep. The
+  // conjuncts of the condition are reordered between blocks as their selectivity is observed.
+  std::vector<const tuix::Row *> rows;
+  std::vector<uint32_t> selection;
+  for (uint32_t i = begin; i < end; i++) {
+    const tuix::EncryptedBlock *block = blocks->blocks()->Get(i);
+    // Skip blocks whose statistics show that no row satisfies the condition
+    if (!block_may_match(block, condition)) {
+      continue;
+    }
+
+    // Blocks stored column by column are filtered on their typed columns when possible, so only
+    // the rows that are kept are built. Blocks with separately-encrypted columns were only
+    // partially decrypted, so the rest of their columns are decrypted if any rows are kept.
+    const bool columnar = block_reader.reset_columns(block, &condition_columns);
+    const bool partial = block->enc_columns() != nullptr;
+    if (columnar &&
+        condition_eval.select_columns(block_reader.columns(), block->num_rows(), selection)) {
+      if (selection.empty()) {
+        continue;
+      }
+      block_reader.add_columns(block, nullptr);
+      block_reader.select_rows(&selection);
+      for (auto it = block_reader.begin(); it != block_reader.end(); ++it) {
+        w.append(*it);
+      }
+      continue;
+    }
+    if (columnar) {
+      block_reader.select_rows(nullptr, partial);
+    }
+    rows.assign(block_reader.begin(), block_reader.end());
+    condition_eval.select(rows, selection);
+
+    if (partial && !selection.empty()) {
+      block_reader.add_columns(block, nullptr);
+      block_reader.select_rows(&selection);
+      for (auto it = block_reader.begin(); it != block_reader.end(); ++it) {
+        w.append(*it);
+      }
+      continue;
+    }
+    for (uint32_t idx : selection) {
+      w.append(rows[idx]);
+    }
+  }
+}
+
 void filter(uint8_t *condition, size_t condition_length, uint8_t *input_rows,
             size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length) {
 
   BufferRefView<tuix::FilterExpr> condition_buf(condition, condition_length);
   condition_buf.verify();
-  FlatbuffersExpressionEvaluator condition_eval(condition_buf.root()->condition());
-  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  BufferRefView<tuix::EncryptedBlocks> input(input_rows, input_rows_length);
+  input.verify();
   RowWriter w;
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
-    const tuix::Field *condition_result = condition_eval.eval(row);
-    if (condition_result->value_type() != tuix::FieldUnion_BooleanField) {
-      throw std::runtime_error(
-          std::string("Filter expression expected to return BooleanField, "
-                      "instead returned ") +
-          std::string(tuix::EnumNameFieldUnion(condition_result->value_type())));
-    }
 
-    // If condition_result is NULL, then always return false
-    bool keep_row = !condition_result->is_null() &&
-                    static_cast<const tuix::BooleanField *>(condition_result->value())->value();
-    if (keep_row) {
-      w.append(row);
-    }
-  }
+  // The blocks are filtered in parallel, each range of them with its own evaluator
+  write_blocks_in_parallel(input.root(), w, [&](uint32_t begin, uint32_t end, RowWriter &out) {
+    filter_blocks(condition_buf.root()->condition(), input.root(), begin, end, out);
+  });
 
   w.output_buffer(output_rows, output_rows_length);
 }
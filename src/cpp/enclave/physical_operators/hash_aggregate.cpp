@@ -0,0 +1,134 @@
+#include "hash_aggregate.h"
+
+#include "common.h"
+
+// Number of times the input of a final aggregation may be repartitioned before the remaining
+// groups are aggregated in memory regardless of their number
+#define HASH_AGGREGATE_MAX_SPILL_DEPTH 3
+
+// Estimated per-group overhead of the hash table, in bytes
+#define HASH_AGGREGATE_GROUP_OVERHEAD 64
+
+/** Copy the aggregation state currently held by `agg_op_eval` into `state`. */
+void save_group_state(FlatbuffersAggOpEvaluator &agg_op_eval,
+                      flatbuffers::FlatBufferBuilder &state_builder, std::vector<uint8_t> &state,
+                      size_t &table_bytes) {
+  state_builder.Clear();
+  state_builder.Finish(flatbuffers_copy(agg_op_eval.get_partial_agg(), state_builder));
+  table_bytes -= state.size();
+  state.assign(state_builder.GetBufferPointer(),
+               state_builder.GetBufferPointer() + state_builder.GetSize());
+  table_bytes += state.size();
+}
+
+void write_groups(FlatbuffersAggOpEvaluator &agg_op_eval, GroupTable &groups, RowWriter &w) {
+  for (auto &&group : groups) {
+    agg_op_eval.set(flatbuffers::GetRoot<tuix::Row>(group.second.data()));
+    w.append(agg_op_eval.evaluate());
+  }
+}
+
+HashAggregator::HashAggregator(FlatbuffersAggOpEvaluator &agg_op_eval, bool is_partial,
+                               size_t input_length, uint32_t depth, RowWriter &w)
+    : agg_op_eval(agg_op_eval), is_partial(is_partial), input_length(input_length), depth(depth),
+      w(w), groups(), table_bytes(0), state_builder(), active_state(nullptr), num_partitions(0),
+      partition_writers(), num_rows(0), key() {}
+
+void HashAggregator::aggregate(const tuix::Row *row) {
+  num_rows++;
+  agg_op_eval.get_grouping_key(row, key);
+
+  auto it = groups.find(key);
+  if (it == groups.end()) {
+    if (!groups.empty() && depth < HASH_AGGREGATE_MAX_SPILL_DEPTH &&
+        table_bytes + key.size() + HASH_AGGREGATE_GROUP_OVERHEAD > max_materialized_size()) {
+      if (is_partial) {
+        count_spill();
+        save_group_state(agg_op_eval, state_builder, *active_state, table_bytes);
+        write_groups(agg_op_eval, groups, w);
+        groups.clear();
+        table_bytes = 0;
+        active_state = nullptr;
+      } else {
+        if (partition_writers.empty()) {
+          count_spill();
+          num_partitions =
+              std::min<size_t>(MAX_NUM_STREAMS, input_length / max_materialized_size() + 2);
+          for (uint32_t i = 0; i < num_partitions; i++) {
+            partition_writers.emplace_back(new RowWriter());
+          }
+        }
+        partition_writers[key_partition(key, depth, num_partitions)]->append(row);
+        return;
+      }
+    }
+
+    if (active_state != nullptr) {
+      save_group_state(agg_op_eval, state_builder, *active_state, table_bytes);
+    }
+    it = groups.emplace(key, std::vector<uint8_t>()).first;
+    table_bytes += key.size() + HASH_AGGREGATE_GROUP_OVERHEAD;
+    active_state = &it->second;
+    agg_op_eval.reset_group();
+  } else if (&it->second != active_state) {
+    save_group_state(agg_op_eval, state_builder, *active_state, table_bytes);
+    active_state = &it->second;
+    agg_op_eval.set(flatbuffers::GetRoot<tuix::Row>(active_state->data()));
+  }
+
+  agg_op_eval.aggregate(row);
+}
+
+uint32_t HashAggregator::finish() {
+  if (active_state != nullptr) {
+    save_group_state(agg_op_eval, state_builder, *active_state, table_bytes);
+    active_state = nullptr;
+  }
+  write_groups(agg_op_eval, groups, w);
+  groups.clear();
+  table_bytes = 0;
+
+  // Move all partitions out of enclave memory before aggregating any of them
+  std::vector<UntrustedBufferRef<tuix::EncryptedBlocks>> partitions;
+  for (auto &&partition_writer : partition_writers) {
+    if (partition_writer->num_rows() > 0) {
+      partitions.push_back(partition_writer->output_buffer());
+    }
+    partition_writer.reset();
+  }
+  partition_writers.clear();
+  for (auto &&partition : partitions) {
+    HashAggregator partition_aggregator(agg_op_eval, is_partial, partition.len, depth + 1, w);
+    RowReader r(partition.view());
+    while (r.has_next()) {
+      partition_aggregator.aggregate(r.next());
+    }
+    partition_aggregator.finish();
+  }
+
+  return num_rows;
+}
+
+void hash_aggregate(uint8_t *agg_op, size_t agg_op_length, uint8_t *input_rows,
+                    size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length,
+                    bool is_partial) {
+
+  FlatbuffersAggOpEvaluator agg_op_eval(agg_op, agg_op_length);
+  RowWriter w;
+
+  HashAggregator aggregator(agg_op_eval, is_partial, input_rows_length, 0, w);
+  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
+  while (r.has_next()) {
+    aggregator.aggregate(r.next());
+  }
+  uint32_t count = aggregator.finish();
+
+  // As in non_oblivious_aggregate(), a partial global aggregation outputs the initial values even
+  // if there are no input rows
+  if (count == 0 && agg_op_eval.get_num_grouping_keys() == 0 && is_partial) {
+    agg_op_eval.reset_group();
+    w.append(agg_op_eval.evaluate());
+  }
+
+  w.output_buffer(output_rows, output_rows_length);
+}
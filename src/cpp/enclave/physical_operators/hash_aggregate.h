@@ -0,0 +1,64 @@
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "flatbuffer_helpers/expression_evaluation.h"
+#include "flatbuffer_helpers/flatbuffers_readers.h"
+#include "flatbuffer_helpers/flatbuffers_writers.h"
+
+#ifndef HASH_AGGREGATE_H
+#define HASH_AGGREGATE_H
+
+/** Aggregation state of each group, stored as a finished tuix::Row buffer and keyed on the encoded
+ * grouping keys. */
+typedef std::unordered_map<std::string, std::vector<uint8_t>> GroupTable;
+
+/**
+ * Aggregates rows one at a time using a hash table from grouping keys to aggregation state, and
+ * writes one row per group to `w` when finished.
+ *
+ * If the table would exceed max_materialized_size(), a partial aggregation outputs and clears the
+ * table, since the final aggregation merges partial aggregates of the same group. A final
+ * aggregation instead keeps updating the groups already in the table, and writes the input rows
+ * of new groups to encrypted partitions in untrusted memory, which are then aggregated
+ * separately. `input_length` is the size of the encrypted input, from which the number of
+ * partitions is chosen.
+ */
+class HashAggregator {
+public:
+  HashAggregator(FlatbuffersAggOpEvaluator &agg_op_eval, bool is_partial, size_t input_length,
+                 uint32_t depth, RowWriter &w);
+
+  /** Aggregate the given row. The row is not used after this returns. */
+  void aggregate(const tuix::Row *row);
+
+  /** Write out all groups, including those of spilled rows. Returns the number of input rows. */
+  uint32_t finish();
+
+private:
+  FlatbuffersAggOpEvaluator &agg_op_eval;
+  bool is_partial;
+  size_t input_length;
+  uint32_t depth;
+  RowWriter &w;
+
+  GroupTable groups;
+  size_t table_bytes;
+  flatbuffers::FlatBufferBuilder state_builder;
+  // The group whose state is currently held by agg_op_eval. Its entry in the table is only updated
+  // when switching to another group, so consecutive rows of the same group are aggregated without
+  // copying the state.
+  std::vector<uint8_t> *active_state;
+
+  uint32_t num_partitions;
+  std::vector<std::unique_ptr<RowWriter>> partition_writers;
+
+  uint32_t num_rows;
+  std::string key;
+};
+
+void hash_aggregate(uint8_t *agg_op, size_t agg_op_length, uint8_t *input_rows,
+                    size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length,
+                    bool is_partial);
+
+#endif // HASH_AGGREGATE_H
@@ -0,0 +1,326 @@
+#include "hash_join.h"
+
+#include <unordered_map>
+
+#include "common.h"
+#include "flatbuffer_helpers/expression_evaluation.h"
+#include "flatbuffer_helpers/flatbuffers_readers.h"
+#include "flatbuffer_helpers/flatbuffers_writers.h"
+
+// Number of times a partition may be repartitioned before its primary rows are joined a chunk at
+// a time instead. This bounds the work spent on partitions that are too large because of skew,
+// e.g. because most of their primary rows share a single join key, which repartitioning cannot
+// split.
+#define HASH_JOIN_MAX_SPILL_DEPTH 3
+
+// Estimated per-row overhead of the hash table, in bytes
+#define HASH_JOIN_ENTRY_OVERHEAD 32
+
+/** State shared by all partitions of a single hash join. */
+struct HashJoinState {
+  HashJoinState(uint8_t *join_expr, size_t join_expr_length)
+      : join_expr_eval(join_expr, join_expr_length), join_type(join_expr_eval.get_join_type()) {}
+
+  FlatbuffersJoinExprEvaluator join_expr_eval;
+  tuix::JoinType join_type;
+
+  // Used for outer rows to get the schema of the foreign table.
+  // A "dummy" row with the desired schema is added for each partition,
+  // so dummy_foreign_row.get() is guaranteed to not be null.
+  FlatbuffersTemporaryRow dummy_foreign_row;
+
+  // A "dummy" row needed for FullOuter joins so that
+  // dummy_primary_row.get() is guaranteed to not be null
+  FlatbuffersTemporaryRow dummy_primary_row;
+
+  RowWriter w;
+};
+
+void set_dummy_row(HashJoinState &state, const tuix::Row *dummy) {
+  // For FullOuter join, dummy rows for both primary and foreign tables are provided.
+  // Scala code ensures that the primary table dummy row appears first
+  // and the foreign table dummy row appears second
+  if (state.join_type == tuix::JoinType_FullOuter) {
+    if (state.dummy_primary_row.get() == nullptr) {
+      state.dummy_primary_row.set(dummy);
+    } else if (state.dummy_foreign_row.get() == nullptr) {
+      state.dummy_foreign_row.set(dummy);
+    }
+  } else {
+    // Only a single foreign table dummy row provided for non-FullOuter join
+    state.dummy_foreign_row.set(dummy);
+  }
+}
+
+/** Evaluate the join condition on a pair of rows with matching join keys. */
+bool eval_condition(HashJoinState &state, const tuix::Row *primary, const tuix::Row *foreign) {
+  // The condition refers to the left table's columns first
+  return state.join_expr_eval.is_right_join()
+             ? state.join_expr_eval.eval_condition(foreign, primary)
+             : state.join_expr_eval.eval_condition(primary, foreign);
+}
+
+void write_match(HashJoinState &state, const tuix::Row *primary, const tuix::Row *foreign) {
+  switch (state.join_type) {
+  case tuix::JoinType_Inner:
+  case tuix::JoinType_LeftOuter:
+  case tuix::JoinType_FullOuter:
+    state.w.append(primary, foreign);
+    break;
+  case tuix::JoinType_RightOuter:
+    state.w.append(foreign, primary);
+    break;
+  default:
+    // Semi and anti joins output primary rows only after all foreign rows have been seen
+    break;
+  }
+}
+
+void write_unmatched_primary(HashJoinState &state, const tuix::Row *primary) {
+  switch (state.join_type) {
+  case tuix::JoinType_LeftAnti:
+    state.w.append(primary);
+    break;
+  case tuix::JoinType_LeftOuter:
+  case tuix::JoinType_FullOuter:
+    state.w.append(primary, state.dummy_foreign_row.get(), false, true);
+    break;
+  case tuix::JoinType_RightOuter:
+    state.w.append(state.dummy_foreign_row.get(), primary, true, false);
+    break;
+  default:
+    break;
+  }
+}
+
+void write_unmatched_foreign(HashJoinState &state, const tuix::Row *foreign) {
+  if (state.join_type == tuix::JoinType_FullOuter) {
+    state.w.append(state.dummy_primary_row.get(), foreign, true, false);
+  }
+}
+
+void hash_join_partition(HashJoinState &state, BufferRefView<tuix::EncryptedBlocks> input,
+                         uint32_t depth);
+
+/**
+ * Split the input into partitions by the hash of the join keys, storing each partition encrypted
+ * in untrusted memory, then join each partition separately. Rows from both tables with equal join
+ * keys are sent to the same partition.
+ */
+void spill_and_join(HashJoinState &state, BufferRefView<tuix::EncryptedBlocks> input,
+                    uint32_t depth) {
+  count_spill();
+  const uint32_t num_partitions =
+      std::min<size_t>(MAX_NUM_STREAMS, input.len / max_materialized_size() + 2);
+
+  std::vector<std::unique_ptr<RowWriter>> partition_writers;
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    partition_writers.emplace_back(new RowWriter());
+  }
+
+  RowReader r(input);
+  std::string key;
+  while (r.has_next()) {
+    const tuix::Row *row = r.next();
+    if (row->is_dummy()) {
+      continue;
+    }
+
+    if (!state.join_expr_eval.get_join_key(row, key)) {
+      // Rows with NULL join keys cannot match, so they can be output right away
+      if (state.join_expr_eval.is_primary(row)) {
+        write_unmatched_primary(state, row);
+      } else {
+        write_unmatched_foreign(state, row);
+      }
+      continue;
+    }
+
+    partition_writers[key_partition(key, depth, num_partitions)]->append(row);
+  }
+
+  // Move all partitions out of enclave memory before joining any of them
+  std::vector<UntrustedBufferRef<tuix::EncryptedBlocks>> partitions;
+  for (auto &&partition_writer : partition_writers) {
+    if (partition_writer->num_rows() > 0) {
+      partitions.push_back(partition_writer->output_buffer());
+    }
+    partition_writer.reset();
+  }
+
+  for (auto &&partition : partitions) {
+    hash_join_partition(state, partition.view(), depth + 1);
+  }
+}
+
+/**
+ * Probe the table of a chunk of primary rows with every foreign row of the input, and output the
+ * matching pairs that satisfy the join condition, marking the primary rows that matched. If
+ * `foreign_matched` is given, the foreign rows that matched are marked in it, in input order,
+ * rather than output as unmatched, since they may match primary rows in a later chunk.
+ */
+void probe_chunk(HashJoinState &state, BufferRefView<tuix::EncryptedBlocks> input,
+                 FlatbuffersRowArena &primary_rows,
+                 const std::unordered_map<std::string, std::vector<uint32_t>> &table,
+                 std::vector<bool> &primary_matched, std::vector<bool> *foreign_matched) {
+  const bool is_existence_join =
+      state.join_type == tuix::JoinType_LeftSemi || state.join_type == tuix::JoinType_LeftAnti;
+  std::string key;
+  uint32_t foreign_idx = 0;
+
+  RowReader probe_r(input);
+  while (probe_r.has_next()) {
+    const tuix::Row *foreign = probe_r.next();
+    if (foreign->is_dummy() || state.join_expr_eval.is_primary(foreign)) {
+      continue;
+    }
+
+    bool match_found = false;
+    if (state.join_expr_eval.get_join_key(foreign, key)) {
+      auto it = table.find(key);
+      if (it != table.end()) {
+        for (uint32_t row_idx : it->second) {
+          // Semi and anti joins only need to know whether a primary row has any match
+          if (is_existence_join && primary_matched[row_idx]) {
+            continue;
+          }
+          const tuix::Row *primary = primary_rows.get(row_idx);
+          if (eval_condition(state, primary, foreign)) {
+            match_found = true;
+            primary_matched[row_idx] = true;
+            write_match(state, primary, foreign);
+          }
+        }
+      }
+    }
+
+    if (foreign_matched != nullptr) {
+      if (foreign_idx == foreign_matched->size()) {
+        foreign_matched->push_back(false);
+      }
+      if (match_found) {
+        (*foreign_matched)[foreign_idx] = true;
+      }
+    } else if (!match_found) {
+      write_unmatched_foreign(state, foreign);
+    }
+    foreign_idx++;
+  }
+
+  for (uint32_t row_idx = 0; row_idx < primary_rows.size(); row_idx++) {
+    if (!primary_matched[row_idx]) {
+      write_unmatched_primary(state, primary_rows.get(row_idx));
+    } else if (state.join_type == tuix::JoinType_LeftSemi) {
+      state.w.append(primary_rows.get(row_idx));
+    }
+  }
+}
+
+/**
+ * Hash join over rows of both tables, which must have been tagged in Scala.
+ *
+ * Build: insert all primary rows into a hash table keyed on their join keys. If the table would
+ * exceed max_materialized_size(), fall back to spill_and_join(), unless the partition has already
+ * been repartitioned HASH_JOIN_MAX_SPILL_DEPTH times. The primary rows are then split into chunks
+ * that fit, and each chunk is built and probed in turn, like a block nested loop join.
+ *
+ * Probe: look up each foreign row in the hash table and output the matching pairs that satisfy
+ * the join condition, marking the primary rows that matched.
+ *
+ * Finally, output the primary rows that matched (semi join) or did not match (anti and outer
+ * joins). The foreign rows of a full outer join that matched no chunk are output last.
+ */
+void hash_join_partition(HashJoinState &state, BufferRefView<tuix::EncryptedBlocks> input,
+                         uint32_t depth) {
+  FlatbuffersRowArena primary_rows;
+  std::unordered_map<std::string, std::vector<uint32_t>> table;
+  std::vector<bool> primary_matched;
+  std::vector<bool> foreign_matched;
+  bool is_chunked = false;
+  std::string key;
+
+  RowReader r(input);
+  do {
+    primary_rows.clear();
+    table.clear();
+    size_t table_bytes = 0;
+    while (r.has_next()) {
+      const tuix::Row *row = r.next();
+      if (row->is_dummy()) {
+        set_dummy_row(state, row);
+        continue;
+      }
+      if (!state.join_expr_eval.is_primary(row)) {
+        continue;
+      }
+
+      uint32_t row_idx = primary_rows.append(row);
+      // Primary rows with NULL join keys are kept so they can be output as unmatched, but are
+      // not added to the table
+      if (state.join_expr_eval.get_join_key(row, key)) {
+        table[key].push_back(row_idx);
+        table_bytes += key.size() + HASH_JOIN_ENTRY_OVERHEAD;
+      }
+
+      if (primary_rows.size_bytes() + table_bytes > max_materialized_size()) {
+        if (depth < HASH_JOIN_MAX_SPILL_DEPTH) {
+          table.clear();
+          primary_rows.clear();
+          spill_and_join(state, input, depth);
+          return;
+        }
+        // Repartitioning cannot split this partition further, so the rest of its primary rows
+        // are joined in later chunks
+        if (!is_chunked) {
+          count_spill();
+        }
+        is_chunked = true;
+        break;
+      }
+    }
+
+    if (primary_rows.size() > 0 || !is_chunked) {
+      primary_matched.assign(primary_rows.size(), false);
+      // Unmatched foreign rows of a full outer join are only known once every chunk is probed
+      const bool track_foreign = is_chunked && state.join_type == tuix::JoinType_FullOuter;
+      probe_chunk(state, input, primary_rows, table, primary_matched,
+                  track_foreign ? &foreign_matched : nullptr);
+    }
+  } while (r.has_next());
+
+  if (is_chunked && state.join_type == tuix::JoinType_FullOuter) {
+    uint32_t foreign_idx = 0;
+    RowReader foreign_r(input);
+    while (foreign_r.has_next()) {
+      const tuix::Row *foreign = foreign_r.next();
+      if (foreign->is_dummy() || state.join_expr_eval.is_primary(foreign)) {
+        continue;
+      }
+      if (!foreign_matched[foreign_idx++]) {
+        write_unmatched_foreign(state, foreign);
+      }
+    }
+  }
+}
+
+void hash_join(uint8_t *join_expr, size_t join_expr_length, uint8_t *input_rows,
+               size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length) {
+  HashJoinState state(join_expr, join_expr_length);
+
+  switch (state.join_type) {
+  case tuix::JoinType_Inner:
+  case tuix::JoinType_LeftOuter:
+  case tuix::JoinType_RightOuter:
+  case tuix::JoinType_FullOuter:
+  case tuix::JoinType_LeftSemi:
+  case tuix::JoinType_LeftAnti:
+    break;
+  default:
+    throw std::runtime_error(std::string("Join type not supported: ") +
+                             std::string(to_string(state.join_type)));
+  }
+
+  hash_join_partition(state, BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length),
+                      0);
+  state.w.output_buffer(output_rows, output_rows_length);
+}
@@ -19,13 +19,19 @@ void test_rows_same_group(FlatbuffersJoinExprEvaluator &join_expr_eval, const tu
   }
 }
 
-void write_output_rows(RowWriter &input, RowWriter &output, tuix::JoinType join_type,
-                       const tuix::Row *foreign_row = nullptr) {
-  auto input_buffer = input.output_buffer();
-  RowReader input_reader(input_buffer.view());
-
-  while (input_reader.has_next()) {
-    const tuix::Row *row = input_reader.next();
+/**
+ * Output the rows of the primary group whose entry in `group_matched` equals `matched`. If
+ * `foreign_row` is given, each row is joined with it, with the foreign row's fields set to NULL.
+ */
+void write_group_rows(SpillableRowBuffer &group, const std::vector<bool> &group_matched,
+                      bool matched, RowWriter &output, tuix::JoinType join_type,
+                      const tuix::Row *foreign_row = nullptr) {
+  group.rewind();
+  for (uint32_t i = 0; group.has_next(); i++) {
+    const tuix::Row *row = group.next();
+    if (group_matched[i] != matched) {
+      continue;
+    }
     if (foreign_row == nullptr) {
       output.append(row);
     } else if (join_type == tuix::JoinType_FullOuter || join_type == tuix::JoinType_LeftOuter) {
@@ -34,12 +40,36 @@ void write_output_rows(RowWriter &input, RowWriter &output, tuix::JoinType join_
       output.append(foreign_row, row, true, false);
     } else {
       throw std::runtime_error(
-          std::string("write_output_rows should not take a foreign row with join type ") +
+          std::string("write_group_rows should not take a foreign row with join type ") +
           to_string(join_type));
     }
   }
 }
 
+/**
+ * Output the rows of the primary group that a finished group contributes to the result: the
+ * matched rows for semi joins, and the unmatched rows for anti and outer joins.
+ */
+void finish_group(SpillableRowBuffer &group, const std::vector<bool> &group_matched,
+                  RowWriter &output, tuix::JoinType join_type, const tuix::Row *dummy_foreign_row) {
+  switch (join_type) {
+  case tuix::JoinType_LeftSemi:
+    write_group_rows(group, group_matched, true, output, join_type);
+    break;
+  case tuix::JoinType_LeftAnti:
+    write_group_rows(group, group_matched, false, output, join_type);
+    break;
+  case tuix::JoinType_FullOuter:
+  case tuix::JoinType_LeftOuter:
+  case tuix::JoinType_RightOuter:
+    // Dummy row is always guaranteed to be the first row, so dummy_foreign_row cannot be null
+    write_group_rows(group, group_matched, false, output, join_type, dummy_foreign_row);
+    break;
+  default:
+    break;
+  }
+}
+
 /**
  * Sort merge equi join algorithm
  * Input: the rows are unioned from both the primary (or left) table and the
@@ -50,16 +80,17 @@ void write_output_rows(RowWriter &input, RowWriter &output, tuix::JoinType join_
  * If it's a row from the left table
  * - Add it to the current group
  * - Otherwise start a new group
- *   - If it's a left semi/anti join, output the
- * primary_matched_rows/primary_unmatched_rows
+ *   - Output the rows of the finished group that were matched (left semi join)
+ *     or unmatched (left anti and outer joins), according to the group's match
+ *     bitmap
  *
  * If it's a row from the right table
- * - Inner join: iterate over current left group, output the joined row only if
- * the condition is satisfied
- * - Left semi/anti join: iterate over `primary_unmatched_rows`, add a matched
- * row to `primary_matched_rows` and remove from `primary_unmatched_rows`
+ * - Iterate over the current left group, marking the rows that satisfy the
+ * condition as matched in the group's match bitmap
+ * - Inner and outer joins: also output each such joined row
+ * - Left semi/anti join: rows that have already matched are not evaluated again
  *
- * After loop: output the last group left semi/anti join
+ * After loop: output the last group for left semi/anti and outer joins
  */
 
 void non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_length,
@@ -70,10 +101,14 @@ void non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_length,
   RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
   RowWriter w;
 
-  RowWriter primary_group;
-  RowWriter primary_matched_rows,
-      primary_unmatched_rows; // These are used for all joins but inner
-  FlatbuffersTemporaryRow last_primary_of_group;
+  // The current group is scanned once per foreign row, so it is kept in enclave memory. Rows of
+  // the group are identified by their position, and group_matched records which of them have
+  // satisfied the join condition with some foreign row.
+  SpillableRowBuffer primary_group;
+  std::vector<bool> group_matched;
+  uint32_t group_num_matched = 0;
+  // Points into a block pinned in the reader, so it stays valid until the next primary row
+  const tuix::Row *last_primary_of_group = nullptr;
 
   // Used for outer rows to get the schema of the foreign table.
   // A "dummy" row with the desired schema is added for each partition,
@@ -106,81 +141,59 @@ void non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_length,
     }
 
     if (join_expr_eval.is_primary(current)) {
-      if (last_primary_of_group.get() &&
-          join_expr_eval.is_same_group(last_primary_of_group.get(), current)) {
-
-        // Add this primary row to the current group
-        primary_group.append(current);
-        if (join_type != tuix::JoinType_Inner) {
-          primary_unmatched_rows.append(current);
-        }
-        last_primary_of_group.set(current);
-
-      } else {
+      if (!last_primary_of_group ||
+          !join_expr_eval.is_same_group(last_primary_of_group, current)) {
         // If a new primary group is encountered
-        if (join_type == tuix::JoinType_LeftSemi) {
-          write_output_rows(primary_matched_rows, w, join_type);
-        } else if (join_type == tuix::JoinType_LeftAnti) {
-          write_output_rows(primary_unmatched_rows, w, join_type);
-        } else if (join_expr_eval.is_outer_join()) {
-          // Dummy row is always guaranteed to be the first row, so dummy_foreign_row.get() cannot
-          // be null.
-          write_output_rows(primary_unmatched_rows, w, join_type, dummy_foreign_row.get());
-        }
-
+        finish_group(primary_group, group_matched, w, join_type, dummy_foreign_row.get());
         primary_group.clear();
-        primary_unmatched_rows.clear();
-        primary_matched_rows.clear();
-
-        primary_group.append(current);
-        primary_unmatched_rows.append(current);
-        last_primary_of_group.set(current);
+        group_matched.clear();
+        group_num_matched = 0;
       }
+
+      // Add this primary row to the current group
+      primary_group.append(current);
+      group_matched.push_back(false);
+      last_primary_of_group = current;
+      r.pin();
     } else {
-      if (last_primary_of_group.get() &&
-          join_expr_eval.is_same_group(last_primary_of_group.get(), current)) {
-        if (join_type == tuix::JoinType_Inner || join_expr_eval.is_outer_join()) {
-          auto primary_group_buffer = primary_group.output_buffer();
-          RowReader primary_group_reader(primary_group_buffer.view());
-
-          bool match_found = false;
-          while (primary_group_reader.has_next()) {
-            const tuix::Row *primary = primary_group_reader.next();
-            test_rows_same_group(join_expr_eval, primary, current);
-
-            if (join_expr_eval.eval_condition(primary, current)) {
-              match_found = true;
-              if (join_expr_eval.is_right_join()) {
-                w.append(current, primary);
-              } else {
-                w.append(primary, current);
-              }
-            }
-          }
-          // Join condition not satisfied for any primary group rows; add (nulls, foreign row) to
-          // output
-          if (join_type == tuix::JoinType_FullOuter && !match_found) {
-            w.append(dummy_primary_row.get(), current, true, false);
-          }
+      if (last_primary_of_group &&
+          join_expr_eval.is_same_group(last_primary_of_group, current)) {
+        // Semi and anti joins only need to know whether each primary row matches at all
+        bool is_semi_or_anti =
+            join_type == tuix::JoinType_LeftSemi || join_type == tuix::JoinType_LeftAnti;
+        if (is_semi_or_anti && group_num_matched == group_matched.size()) {
+          continue;
         }
-        if (join_type != tuix::JoinType_Inner) {
-          auto primary_unmatched_rows_buffer = primary_unmatched_rows.output_buffer();
-          RowReader primary_unmatched_rows_reader(primary_unmatched_rows_buffer.view());
-          RowWriter new_primary_unmatched_rows;
-
-          while (primary_unmatched_rows_reader.has_next()) {
-            const tuix::Row *primary = primary_unmatched_rows_reader.next();
-            test_rows_same_group(join_expr_eval, primary, current);
-            if (join_expr_eval.eval_condition(primary, current)) {
-              primary_matched_rows.append(primary);
+
+        bool match_found = false;
+        primary_group.rewind();
+        for (uint32_t i = 0; primary_group.has_next(); i++) {
+          const tuix::Row *primary = primary_group.next();
+          if (is_semi_or_anti && group_matched[i]) {
+            continue;
+          }
+          test_rows_same_group(join_expr_eval, primary, current);
+
+          if (join_expr_eval.eval_condition(primary, current)) {
+            match_found = true;
+            if (!group_matched[i]) {
+              group_matched[i] = true;
+              group_num_matched++;
+            }
+            if (is_semi_or_anti) {
+              continue;
+            }
+            if (join_expr_eval.is_right_join()) {
+              w.append(current, primary);
             } else {
-              new_primary_unmatched_rows.append(primary);
+              w.append(primary, current);
             }
           }
-
-          // Reset primary_unmatched_rows
-          primary_unmatched_rows.clear();
-          write_output_rows(new_primary_unmatched_rows, primary_unmatched_rows, join_type);
+        }
+        // Join condition not satisfied for any primary group rows; add (nulls, foreign row) to
+        // output
+        if (join_type == tuix::JoinType_FullOuter && !match_found) {
+          w.append(dummy_primary_row.get(), current, true, false);
         }
       } else if (join_type == tuix::JoinType_FullOuter) {
         // No match found for foreign row; need to add (nulls, foreign row) to output
@@ -189,21 +202,7 @@ void non_oblivious_sort_merge_join(uint8_t *join_expr, size_t join_expr_length,
     }
   }
 
-  switch (join_type) {
-  case tuix::JoinType_LeftSemi:
-    write_output_rows(primary_matched_rows, w, join_type);
-    break;
-  case tuix::JoinType_LeftAnti:
-    write_output_rows(primary_unmatched_rows, w, join_type);
-    break;
-  case tuix::JoinType_FullOuter:
-  case tuix::JoinType_LeftOuter:
-  case tuix::JoinType_RightOuter:
-    write_output_rows(primary_unmatched_rows, w, join_type, dummy_foreign_row.get());
-    break;
-  default:
-    break;
-  }
+  finish_group(primary_group, group_matched, w, join_type, dummy_foreign_row.get());
 
   w.output_buffer(output_rows, output_rows_length);
 }
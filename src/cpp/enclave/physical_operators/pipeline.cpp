@@ -0,0 +1,248 @@
+#include "pipeline.h"
+
+#include "common.h"
+#include "flatbuffer_helpers/block_stats.h"
+#include "flatbuffer_helpers/expression_evaluation.h"
+#include "flatbuffer_helpers/flatbuffers_readers.h"
+#include "flatbuffer_helpers/flatbuffers_writers.h"
+#include "hash_aggregate.h"
+
+using namespace edu::berkeley::cs::rise::opaque;
+
+/** A filter or projection in a pipeline, evaluated on a batch of rows at a time. */
+class PipelineStageEvaluator {
+public:
+  PipelineStageEvaluator(const tuix::PipelineStage *stage)
+      : condition(nullptr), condition_eval(), project_eval_list(), selection(), out_fields(),
+        arena() {
+    switch (stage->op_type()) {
+    case tuix::PipelineOp_FilterExpr:
+      condition = stage->op_as_FilterExpr()->condition();
+      condition_eval.reset(new FlatbuffersConjunctionEvaluator(condition));
+      break;
+    case tuix::PipelineOp_ProjectExpr: {
+      auto project_list = stage->op_as_ProjectExpr()->project_list();
+      for (auto it = project_list->begin(); it != project_list->end(); ++it) {
+        project_eval_list.emplace_back(new FlatbuffersExpressionEvaluator(*it));
+      }
+      out_fields.resize(project_eval_list.size());
+      break;
+    }
+    default:
+      throw std::runtime_error(std::string("Unsupported pipeline stage ") +
+                               std::string(tuix::EnumNamePipelineOp(stage->op_type())));
+    }
+  }
+
+  /** The condition of a filter stage, or nullptr for a projection. */
+  const tuix::Expr *get_condition() { return condition; }
+
+  /** The evaluator of the condition of a filter stage. */
+  FlatbuffersConjunctionEvaluator &get_condition_eval() { return *condition_eval; }
+
+  /** Mark the columns of its input rows that this stage reads in `used_columns`. */
+  void mark_used_columns(std::vector<bool> &used_columns) {
+    if (condition_eval) {
+      condition_eval->mark_used_columns(used_columns);
+    }
+    for (auto &eval : project_eval_list) {
+      eval->mark_used_columns(used_columns);
+    }
+  }
+
+  /**
+   * Replace `rows` with the rows that this stage outputs for them. Rows output by a projection are
+   * only valid until the stage is applied again.
+   */
+  void apply(std::vector<const tuix::Row *> &rows) {
+    if (condition_eval) {
+      // The selection is in increasing order, so the kept rows can be moved forward in place
+      condition_eval->select(rows, selection);
+      for (uint32_t i = 0; i < selection.size(); i++) {
+        rows[i] = rows[selection[i]];
+      }
+      rows.resize(selection.size());
+      return;
+    }
+
+    for (auto &eval : project_eval_list) {
+      eval->eval_batch(rows);
+    }
+    arena.clear();
+    for (uint32_t i = 0; i < rows.size(); i++) {
+      for (uint32_t j = 0; j < project_eval_list.size(); j++) {
+        out_fields[j] = project_eval_list[j]->batch_result(i);
+      }
+      arena.append(out_fields);
+    }
+    // Appending to the arena invalidates earlier pointers into it, so they are taken at the end
+    for (uint32_t i = 0; i < rows.size(); i++) {
+      rows[i] = arena.get(i);
+    }
+  }
+
+private:
+  const tuix::Expr *condition;
+  std::unique_ptr<FlatbuffersConjunctionEvaluator> condition_eval;
+  std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> project_eval_list;
+
+  std::vector<uint32_t> selection;
+  std::vector<const tuix::Field *> out_fields;
+  FlatbuffersRowArena arena;
+};
+
+/**
+ * The filters and projections of a pipeline, applied to one block at a time. Each range of blocks
+ * processed in parallel has its own evaluator, since the stages keep the state of their batches.
+ */
+class PipelineEvaluator {
+public:
+  PipelineEvaluator(const tuix::Pipeline *pipeline_op)
+      : stages(), block_conditions(), condition_columns(), used_columns(),
+        all_columns_used(true), extra_columns_used(false), block_reader(), selection() {
+    if (pipeline_op->stages() != nullptr) {
+      for (auto it = pipeline_op->stages()->begin(); it != pipeline_op->stages()->end(); ++it) {
+        stages.emplace_back(new PipelineStageEvaluator(*it));
+      }
+    }
+
+    // Blocks can be skipped using their statistics for the filters that come before any
+    // projection, and only the columns that are read up to the first projection need to be
+    // decrypted
+    for (auto &stage : stages) {
+      stage->mark_used_columns(used_columns);
+      if (stage->get_condition() == nullptr) {
+        all_columns_used = false;
+        break;
+      }
+      block_conditions.push_back(stage->get_condition());
+    }
+
+    // Whether the stages after a leading filter read columns that its condition does not
+    if (!block_conditions.empty()) {
+      stages[0]->mark_used_columns(condition_columns);
+      condition_columns.resize(used_columns.size(), false);
+      extra_columns_used = all_columns_used || condition_columns != used_columns;
+    }
+  }
+
+  /**
+   * Set `rows` to the rows that the stages output for the rows of `block`. They are valid until
+   * the next block is applied.
+   */
+  void apply(const tuix::EncryptedBlock *block, std::vector<const tuix::Row *> &rows) {
+    rows.clear();
+    for (const tuix::Expr *condition : block_conditions) {
+      if (!block_may_match(block, condition)) {
+        return;
+      }
+    }
+
+    const std::vector<bool> *columns = all_columns_used ? nullptr : &used_columns;
+    uint32_t first_stage = 0;
+    if (block_conditions.empty()) {
+      block_reader.reset(block, columns);
+      rows.assign(block_reader.begin(), block_reader.end());
+    } else {
+      // A leading filter is evaluated on the typed columns of blocks stored column by column when
+      // possible, so that only the rows it keeps are built. Blocks with separately-encrypted
+      // columns were only partially decrypted, so the columns that later stages read are
+      // decrypted if any rows are kept.
+      FlatbuffersConjunctionEvaluator &condition_eval = stages[0]->get_condition_eval();
+      const bool columnar = block_reader.reset_columns(block, &condition_columns);
+      const bool partial = block->enc_columns() != nullptr && extra_columns_used;
+      if (columnar &&
+          condition_eval.select_columns(block_reader.columns(), block->num_rows(), selection)) {
+        if (selection.empty()) {
+          return;
+        }
+        block_reader.add_columns(block, columns);
+        block_reader.select_rows(&selection);
+        rows.assign(block_reader.begin(), block_reader.end());
+      } else {
+        if (columnar) {
+          block_reader.select_rows(nullptr, partial);
+        }
+        rows.assign(block_reader.begin(), block_reader.end());
+        condition_eval.select(rows, selection);
+        if (partial && !selection.empty()) {
+          block_reader.add_columns(block, columns);
+          block_reader.select_rows(&selection);
+          rows.assign(block_reader.begin(), block_reader.end());
+        } else {
+          for (uint32_t i = 0; i < selection.size(); i++) {
+            rows[i] = rows[selection[i]];
+          }
+          rows.resize(selection.size());
+        }
+      }
+      first_stage = 1;
+    }
+
+    for (uint32_t i = first_stage; i < stages.size() && !rows.empty(); i++) {
+      stages[i]->apply(rows);
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<PipelineStageEvaluator>> stages;
+  std::vector<const tuix::Expr *> block_conditions;
+  std::vector<bool> condition_columns;
+  std::vector<bool> used_columns;
+  bool all_columns_used;
+  bool extra_columns_used;
+
+  EncryptedBlockToRowReader block_reader;
+  std::vector<uint32_t> selection;
+};
+
+void execute_pipeline(uint8_t *pipeline, size_t pipeline_length, uint8_t *input_rows,
+                      size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length) {
+  BufferRefView<tuix::Pipeline> pipeline_buf(pipeline, pipeline_length);
+  pipeline_buf.verify();
+  const tuix::Pipeline *pipeline_op = pipeline_buf.root();
+  BufferRefView<tuix::EncryptedBlocks> input(input_rows, input_rows_length);
+  input.verify();
+  const tuix::EncryptedBlocks *blocks = input.root();
+
+  RowWriter w;
+  if (pipeline_op->aggregate() == nullptr) {
+    // The blocks are processed in parallel, each range of them with its own evaluators
+    write_blocks_in_parallel(blocks, w, [&](uint32_t begin, uint32_t end, RowWriter &out) {
+      PipelineEvaluator pipeline_eval(pipeline_op);
+      std::vector<const tuix::Row *> rows;
+      for (uint32_t b = begin; b < end; b++) {
+        pipeline_eval.apply(blocks->blocks()->Get(b), rows);
+        for (const tuix::Row *row : rows) {
+          out.append(row);
+        }
+      }
+    });
+    w.output_buffer(output_rows, output_rows_length);
+    return;
+  }
+
+  // The aggregation runs on a single thread, since the hash table of each range would have to fit
+  // in enclave memory alongside the others
+  FlatbuffersAggOpEvaluator agg_op_eval(const_cast<uint8_t *>(pipeline_op->aggregate()->data()),
+                                        pipeline_op->aggregate()->size());
+  HashAggregator aggregator(agg_op_eval, pipeline_op->is_partial(), input_rows_length, 0, w);
+  PipelineEvaluator pipeline_eval(pipeline_op);
+  std::vector<const tuix::Row *> rows;
+  for (uint32_t b = 0; b < blocks->blocks()->size(); b++) {
+    pipeline_eval.apply(blocks->blocks()->Get(b), rows);
+    for (const tuix::Row *row : rows) {
+      aggregator.aggregate(row);
+    }
+  }
+
+  uint32_t count = aggregator.finish();
+  // As in hash_aggregate(), a partial global aggregation outputs the initial values even if there
+  // are no input rows
+  if (count == 0 && agg_op_eval.get_num_grouping_keys() == 0 && pipeline_op->is_partial()) {
+    agg_op_eval.reset_group();
+    w.append(agg_op_eval.evaluate());
+  }
+
+  w.output_buffer(output_rows, output_rows_length);
+}
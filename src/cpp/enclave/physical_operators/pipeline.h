@@ -0,0 +1,15 @@
+#include <cstddef>
+#include <cstdint>
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/**
+ * Stream each block of the input through a chain of filters and projections, and optionally a hash
+ * aggregation of their output, encrypting only the rows that come out of the end of the chain.
+ * Without an aggregation, ranges of blocks are streamed through the chain in parallel.
+ */
+void execute_pipeline(uint8_t *pipeline, size_t pipeline_length, uint8_t *input_rows,
+                      size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length);
+
+#endif // PIPELINE_H
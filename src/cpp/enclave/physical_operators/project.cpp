@@ -5,31 +5,56 @@
 #include "flatbuffer_helpers/flatbuffers_readers.h"
 #include "flatbuffer_helpers/flatbuffers_writers.h"
 
-void project(uint8_t *project_list, size_t project_list_length, uint8_t *input_rows,
-             size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length) {
-  BufferRefView<tuix::ProjectExpr> project_list_buf(project_list, project_list_length);
-  project_list_buf.verify();
-
+/** Project the rows of the blocks from `begin` to `end` of `blocks`, writing the results to `w`. */
+void project_blocks(const tuix::ProjectExpr *project_expr, const tuix::EncryptedBlocks *blocks,
+                    uint32_t begin, uint32_t end, RowWriter &w) {
   // Create a vector of expression evaluators, one per output column
-  const tuix::ProjectExpr *project_expr = project_list_buf.root();
   std::vector<std::unique_ptr<FlatbuffersExpressionEvaluator>> project_eval_list;
   for (auto it = project_expr->project_list()->begin(); it != project_expr->project_list()->end();
        ++it) {
     project_eval_list.emplace_back(new FlatbuffersExpressionEvaluator(*it));
   }
 
-  RowReader r(BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
-  RowWriter w;
+  EncryptedBlockToRowReader block_reader;
+
+  // Only the columns that the project list reads need to be decrypted
+  std::vector<bool> used_columns;
+  for (uint32_t j = 0; j < project_eval_list.size(); j++) {
+    project_eval_list[j]->mark_used_columns(used_columns);
+  }
 
+  std::vector<const tuix::Row *> rows;
   std::vector<const tuix::Field *> out_fields(project_eval_list.size());
 
-  while (r.has_next()) {
-    const tuix::Row *row = r.next();
+  // Evaluate each output column on one block at a time
+  for (uint32_t b = begin; b < end; b++) {
+    block_reader.reset(blocks->blocks()->Get(b), &used_columns);
+    rows.assign(block_reader.begin(), block_reader.end());
     for (uint32_t j = 0; j < project_eval_list.size(); j++) {
-      out_fields[j] = project_eval_list[j]->eval(row);
+      project_eval_list[j]->eval_batch(rows);
+    }
+
+    for (uint32_t i = 0; i < rows.size(); i++) {
+      for (uint32_t j = 0; j < project_eval_list.size(); j++) {
+        out_fields[j] = project_eval_list[j]->batch_result(i);
+      }
+      w.append(out_fields);
     }
-    w.append(out_fields);
   }
+}
+
+void project(uint8_t *project_list, size_t project_list_length, uint8_t *input_rows,
+             size_t input_rows_length, uint8_t **output_rows, size_t *output_rows_length) {
+  BufferRefView<tuix::ProjectExpr> project_list_buf(project_list, project_list_length);
+  project_list_buf.verify();
+  BufferRefView<tuix::EncryptedBlocks> input(input_rows, input_rows_length);
+  input.verify();
+  RowWriter w;
+
+  // The blocks are projected in parallel, each range of them with its own evaluators
+  write_blocks_in_parallel(input.root(), w, [&](uint32_t begin, uint32_t end, RowWriter &out) {
+    project_blocks(project_list_buf.root(), input.root(), begin, end, out);
+  });
 
   w.output_buffer(output_rows, output_rows_length);
 }
@@ -8,10 +8,12 @@
 #include "flatbuffer_helpers/expression_evaluation.h"
 #include "flatbuffer_helpers/flatbuffers_readers.h"
 #include "flatbuffer_helpers/flatbuffers_writers.h"
+#include "task_pool.h"
 
 class MergeItem {
 public:
   const tuix::Row *v;
+  std::string key;
   uint32_t run_idx;
 };
 
@@ -19,10 +21,9 @@ public:
 void external_merge(SortedRunsReader &r, uint32_t run_start, uint32_t num_runs,
                     SortedRunsWriter &w, FlatbuffersSortOrderEvaluator &sort_eval) {
 
-  // Maintain a priority queue (by default a max heap) with one row per run.
-  auto compare = [&sort_eval](const MergeItem &a, const MergeItem &b) {
-    return !sort_eval.order_before(a.v, b.v);
-  };
+  // Maintain a priority queue (by default a max heap) with one row per run. Each row's sort key
+  // is computed once when it enters the queue.
+  auto compare = [](const MergeItem &a, const MergeItem &b) { return a.key > b.key; };
   std::priority_queue<MergeItem, std::vector<MergeItem>, decltype(compare)> queue(compare);
 
   // Initialize the priority queue with the first row from each run
@@ -30,8 +31,9 @@ void external_merge(SortedRunsReader &r, uint32_t run_start, uint32_t num_runs,
     SPDLOG_DEBUG("external_merge: Read first row from run %d\n", i);
     MergeItem item;
     item.v = r.next_from_run(i);
+    sort_eval.get_sort_key(item.v, item.key);
     item.run_idx = i;
-    queue.push(item);
+    queue.push(std::move(item));
   }
 
   // Merge the runs using the priority queue
@@ -43,7 +45,8 @@ void external_merge(SortedRunsReader &r, uint32_t run_start, uint32_t num_runs,
     // Read another row from the same run that this one came from
     if (r.run_has_next(item.run_idx)) {
       item.v = r.next_from_run(item.run_idx);
-      queue.push(item);
+      sort_eval.get_sort_key(item.v, item.key);
+      queue.push(std::move(item));
     }
   }
   w.finish_run();
@@ -55,15 +58,20 @@ void sort_single_encrypted_block(SortedRunsWriter &w, const tuix::EncryptedBlock
 
   EncryptedBlockToRowReader r;
   r.reset(block);
-  std::vector<const tuix::Row *> sort_ptrs(r.begin(), r.end());
 
-  std::sort(sort_ptrs.begin(), sort_ptrs.end(),
-            [&sort_eval](const tuix::Row *a, const tuix::Row *b) {
-              return sort_eval.order_before(a, b);
-            });
+  // Evaluate each row's sort key once, then sort by comparing keys
+  std::vector<MergeItem> sort_items(block->num_rows());
+  uint32_t i = 0;
+  for (auto it = r.begin(); it != r.end(); ++it, ++i) {
+    sort_items[i].v = *it;
+    sort_eval.get_sort_key(*it, sort_items[i].key);
+  }
+
+  std::sort(sort_items.begin(), sort_items.end(),
+            [](const MergeItem &a, const MergeItem &b) { return a.key < b.key; });
 
-  for (auto it = sort_ptrs.begin(); it != sort_ptrs.end(); ++it) {
-    w.append(*it);
+  for (auto it = sort_items.begin(); it != sort_items.end(); ++it) {
+    w.append(it->v);
   }
   w.finish_run();
 }
@@ -74,15 +82,36 @@ void external_sort(uint8_t *sort_order, size_t sort_order_length, uint8_t *input
   FlatbuffersSortOrderEvaluator sort_eval(sort_order, sort_order_length);
 
   // 1. Sort each EncryptedBlock individually by decrypting it, sorting within
-  // the enclave, and re-encrypting to a different buffer.
+  // the enclave, and re-encrypting to a different buffer. Ranges of blocks are sorted in
+  // parallel, each with its own evaluator and writer, and their runs are then collected in order.
   SortedRunsWriter w;
   {
-    EncryptedBlocksToEncryptedBlockReader r(
-        BufferRefView<tuix::EncryptedBlocks>(input_rows, input_rows_length));
-    uint32_t i = 0;
-    for (auto it = r.begin(); it != r.end(); ++it, ++i) {
-      SPDLOG_DEBUG("Sorting buffer %d with %d rows\n", i, it->num_rows());
-      sort_single_encrypted_block(w, *it, sort_eval);
+    BufferRefView<tuix::EncryptedBlocks> input(input_rows, input_rows_length);
+    input.verify();
+    auto blocks = input.root()->blocks();
+    const uint32_t num_ranges = std::min(blocks->size(), TaskPool::getInstance().num_threads());
+    if (num_ranges <= 1) {
+      for (uint32_t i = 0; i < blocks->size(); i++) {
+        SPDLOG_DEBUG("Sorting buffer %d with %d rows\n", i, blocks->Get(i)->num_rows());
+        sort_single_encrypted_block(w, blocks->Get(i), sort_eval);
+      }
+    } else {
+      std::vector<std::unique_ptr<UntrustedBufferRef<tuix::SortedRuns>>> range_runs(num_ranges);
+      TaskPool::getInstance().run_ranges(num_ranges, blocks->size(), [&](uint32_t r, uint32_t begin,
+                                                                         uint32_t end) {
+        FlatbuffersSortOrderEvaluator range_sort_eval(sort_order, sort_order_length);
+        SortedRunsWriter range_w;
+        for (uint32_t i = begin; i < end; i++) {
+          sort_single_encrypted_block(range_w, blocks->Get(i), range_sort_eval);
+        }
+        range_runs[r].reset(new UntrustedBufferRef<tuix::SortedRuns>(range_w.output_buffer()));
+      });
+      for (auto &&runs : range_runs) {
+        // Verified again since the runs were written to untrusted memory
+        BufferRefView<tuix::SortedRuns> view = runs->view();
+        view.verify();
+        w.append_runs(view.root());
+      }
     }
 
     if (w.num_runs() <= 1) {
@@ -202,15 +231,24 @@ void partition_for_sort(uint8_t *sort_order, size_t sort_order_length, uint32_t
 
   RowReader b(BufferRefView<tuix::EncryptedBlocks>(boundary_rows, boundary_rows_length));
   // Invariant: b_upper is the first boundary row strictly greater than the
-  // current range, or nullptr if we are in the last range
-  FlatbuffersTemporaryRow b_upper(b.has_next() ? b.next() : nullptr);
+  // current range, or nullptr if we are in the last range. b_upper_key is its
+  // sort key.
+  const tuix::Row *b_upper = b.has_next() ? b.next() : nullptr;
+  std::string b_upper_key, row_key;
+  if (b_upper != nullptr) {
+    sort_eval.get_sort_key(b_upper, b_upper_key);
+  }
 
   while (r.has_next()) {
     const tuix::Row *row = r.next();
+    sort_eval.get_sort_key(row, row_key);
 
     // Advance boundary rows to maintain the invariant on b_upper
-    while (b_upper.get() != nullptr && !sort_eval.order_before(row, b_upper.get())) {
-      b_upper.set(b.has_next() ? b.next() : nullptr);
+    while (b_upper != nullptr && !(row_key < b_upper_key)) {
+      b_upper = b.has_next() ? b.next() : nullptr;
+      if (b_upper != nullptr) {
+        sort_eval.get_sort_key(b_upper, b_upper_key);
+      }
 
       // Write out the newly-finished partition
       w.output_buffer(&output_partition_ptrs[output_partition_idx],
@@ -0,0 +1,92 @@
+#include "task_pool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void TaskPool::run(uint32_t num_tasks, const std::function<void(uint32_t)> &fn) {
+  if (num_tasks == 0) {
+    return;
+  }
+
+  Job job;
+  job.fn = &fn;
+  job.num_tasks = num_tasks;
+  job.next_task = 0;
+  job.num_finished = 0;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (num_tasks > 1 && num_workers > 0) {
+    jobs.push_back(&job);
+    work_available.notify_all();
+  }
+  work_on(job, lock);
+  job_finished.wait(lock, [&job]() { return job.num_finished == job.num_tasks; });
+
+  if (!job.error.empty()) {
+    throw std::runtime_error(job.error);
+  }
+}
+
+void TaskPool::run_ranges(uint32_t num_ranges, uint32_t num_items,
+                          const std::function<void(uint32_t, uint32_t, uint32_t)> &fn) {
+  run(num_ranges, [&](uint32_t i) {
+    const uint32_t begin = static_cast<uint64_t>(num_items) * i / num_ranges;
+    const uint32_t end = static_cast<uint64_t>(num_items) * (i + 1) / num_ranges;
+    fn(i, begin, end);
+  });
+}
+
+uint32_t TaskPool::num_threads() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return num_workers + 1;
+}
+
+void TaskPool::worker_loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  num_workers++;
+  while (true) {
+    work_available.wait(lock, [this]() { return stopped || !jobs.empty(); });
+    if (stopped) {
+      break;
+    }
+    work_on(*jobs.front(), lock);
+  }
+  num_workers--;
+}
+
+void TaskPool::stop() {
+  std::lock_guard<std::mutex> lock(mutex);
+  stopped = true;
+  work_available.notify_all();
+}
+
+void TaskPool::work_on(Job &job, std::unique_lock<std::mutex> &lock) {
+  while (job.next_task < job.num_tasks) {
+    uint32_t task = job.next_task++;
+    if (job.next_task == job.num_tasks) {
+      // Every task has been claimed, so no other thread needs to find this job
+      auto it = std::find(jobs.begin(), jobs.end(), &job);
+      if (it != jobs.end()) {
+        jobs.erase(it);
+      }
+    }
+
+    lock.unlock();
+    bool failed = false;
+    std::string error;
+    try {
+      (*job.fn)(task);
+    } catch (const std::exception &e) {
+      failed = true;
+      error = e.what();
+    }
+    lock.lock();
+
+    if (failed && job.error.empty()) {
+      job.error = error.empty() ? std::string("Task ") + std::to_string(task) + " failed" : error;
+    }
+    if (++job.num_finished == job.num_tasks) {
+      job_finished.notify_all();
+    }
+  }
+}
@@ -0,0 +1,78 @@
+// -*- c-basic-offset: 2; fill-column: 100 -*-
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+/**
+ * A pool of enclave threads that operators can use to work on independent parts of their input,
+ * such as the blocks of one partition, in parallel. The threads are host threads that enter the
+ * enclave through ecall_worker_loop() and stay there until the enclave is stopped.
+ *
+ * A thread that runs a job works on its tasks along with the workers, so jobs also complete if
+ * there are no workers, and several ecalls may run jobs at once.
+ */
+class TaskPool {
+public:
+  TaskPool(TaskPool const &) = delete;
+  void operator=(TaskPool const &) = delete;
+
+  static TaskPool &getInstance() {
+    static TaskPool instance;
+    return instance;
+  }
+
+  /**
+   * Call `fn` with each task index from 0 to `num_tasks` - 1, in parallel, and return once all
+   * calls have returned. If any call throws, the message of the first exception is rethrown as a
+   * std::runtime_error once all calls have returned.
+   */
+  void run(uint32_t num_tasks, const std::function<void(uint32_t)> &fn);
+
+  /**
+   * Split the items from 0 to `num_items` - 1 into `num_ranges` contiguous ranges of about equal
+   * size, and run a task for each range i that calls fn(i, begin, end) with its first item and
+   * one past its last.
+   */
+  void run_ranges(uint32_t num_ranges, uint32_t num_items,
+                  const std::function<void(uint32_t, uint32_t, uint32_t)> &fn);
+
+  /** Number of threads that a job can be run on at once, including the thread that runs it. */
+  uint32_t num_threads();
+
+  /** Work on the tasks of submitted jobs until stop() is called. */
+  void worker_loop();
+
+  /** Make all threads in worker_loop() return. */
+  void stop();
+
+private:
+  TaskPool() : mutex(), work_available(), job_finished(), jobs(), num_workers(0), stopped(false) {}
+
+  struct Job {
+    const std::function<void(uint32_t)> *fn;
+    uint32_t num_tasks;
+    uint32_t next_task;
+    uint32_t num_finished;
+    std::string error;
+  };
+
+  /** Run tasks of `job` until all of them have been claimed. Must be called with `lock` held. */
+  void work_on(Job &job, std::unique_lock<std::mutex> &lock);
+
+  std::mutex mutex;
+  std::condition_variable work_available;
+  std::condition_variable job_finished;
+  // Jobs with tasks that have not been claimed yet, in the order they were submitted
+  std::deque<Job *> jobs;
+  uint32_t num_workers;
+  bool stopped;
+};
+
+#endif
@@ -1,8 +1,11 @@
 #include "util.h"
 
+#include <atomic>
 #include <climits>
 #include <cstdio>
+#include <stdexcept>
 
+#include "define.h"
 #include "enclave_t.h"
 
 int printf(const char *fmt, ...) {
@@ -35,15 +38,38 @@ std::string string_format(const std::string &fmt, ...) {
 }
 
 void ocall_malloc(size_t size, uint8_t **ret) {
-// TODO: why do we need the ifndef here when running oegdb?
-#ifndef DEBUG
-  // Guard against overwriting enclave memory
-  assert(oe_is_outside_enclave(*ret, size) == 1);
-#endif
+  // Allocate through the switchless ocall rather than oe_host_malloc(), which always exits the
+  // enclave
+  unsafe_ocall_malloc(size, ret);
+  if (*ret == nullptr) {
+    throw std::runtime_error(std::string("Failed to allocate ") + std::to_string(size) +
+                             std::string(" bytes of untrusted memory"));
+  }
+  // The host chose the pointer, so check that writing to it cannot overwrite enclave memory
+  if (!oe_is_outside_enclave(*ret, size)) {
+    throw std::runtime_error(std::string("Untrusted allocation of ") + std::to_string(size) +
+                             std::string(" bytes overlaps enclave memory"));
+  }
   __builtin_ia32_lfence();
-  *ret = (uint8_t *)oe_host_malloc(size);
 }
 
+std::atomic<size_t> materialized_size_limit(MAX_MATERIALIZED_SIZE);
+
+size_t max_materialized_size() { return materialized_size_limit.load(std::memory_order_relaxed); }
+
+void set_max_materialized_size(size_t size) {
+  // The host may only make operators spill earlier, never let them use more enclave memory
+  materialized_size_limit.store(size > 0 && size < MAX_MATERIALIZED_SIZE ? size
+                                                                          : MAX_MATERIALIZED_SIZE,
+                                std::memory_order_relaxed);
+}
+
+std::atomic<uint64_t> spill_count(0);
+
+void count_spill() { spill_count.fetch_add(1, std::memory_order_relaxed); }
+
+uint64_t num_spills() { return spill_count.load(std::memory_order_relaxed); }
+
 void print_bytes(uint8_t *ptr, uint32_t len) {
   for (uint32_t i = 0; i < len; i++) {
     printf("%u", *(ptr + i));
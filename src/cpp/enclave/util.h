@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <cstdarg>
+#include <cstddef>
 #include <cstdint>
 #include <ctime>
 #include <string>
@@ -26,6 +27,22 @@ using ::exit;
  */
 void ocall_malloc(size_t size, uint8_t **ret);
 
+/**
+ * Maximum number of plaintext bytes an operator may materialize in enclave memory at once. This is
+ * MAX_MATERIALIZED_SIZE unless lowered with set_max_materialized_size(), which tests use to
+ * exercise the spilling paths of operators on small inputs.
+ */
+size_t max_materialized_size();
+
+/** Lower the value of max_materialized_size(). Values above MAX_MATERIALIZED_SIZE restore it. */
+void set_max_materialized_size(size_t size);
+
+/** Record that an operator exceeded max_materialized_size() and spilled to untrusted memory. */
+void count_spill();
+
+/** Number of times operators have spilled since the enclave started. */
+uint64_t num_spills();
+
 std::string string_format(const std::string &fmt, ...);
 
 void print_bytes(uint8_t *ptr, uint32_t len);
@@ -30,9 +30,11 @@ import javax.crypto._
 import javax.crypto.spec.GCMParameterSpec
 import javax.crypto.spec.SecretKeySpec
 
+import scala.collection.mutable.ArrayBuffer
 import scala.collection.mutable.ArrayBuilder
 
 import com.google.flatbuffers.FlatBufferBuilder
+import net.jpountz.lz4.LZ4Factory
 import org.apache.spark.SparkContext
 import org.apache.spark.SparkEnv
 import org.apache.spark.internal.Logging
@@ -61,6 +63,7 @@ import org.apache.spark.sql.catalyst.expressions.GreaterThan
 import org.apache.spark.sql.catalyst.expressions.GreaterThanOrEqual
 import org.apache.spark.sql.catalyst.expressions.If
 import org.apache.spark.sql.catalyst.expressions.In
+import org.apache.spark.sql.catalyst.expressions.InSet
 import org.apache.spark.sql.catalyst.expressions.IsNotNull
 import org.apache.spark.sql.catalyst.expressions.IsNull
 import org.apache.spark.sql.catalyst.expressions.KnownFloatingPointNormalized
@@ -73,6 +76,8 @@ import org.apache.spark.sql.catalyst.expressions.CaseWhen
 import org.apache.spark.sql.catalyst.expressions.CreateArray
 import org.apache.spark.sql.catalyst.expressions.NamedExpression
 import org.apache.spark.sql.catalyst.expressions.Not
+import org.apache.spark.sql.catalyst.expressions.NullsFirst
+import org.apache.spark.sql.catalyst.expressions.NullsLast
 import org.apache.spark.sql.catalyst.expressions.Or
 import org.apache.spark.sql.catalyst.expressions.SortOrder
 import org.apache.spark.sql.catalyst.expressions.StartsWith
@@ -100,6 +105,7 @@ import org.apache.spark.sql.catalyst.util.ArrayData
 import org.apache.spark.sql.catalyst.util.MapData
 import org.apache.spark.sql.execution.SubqueryExec
 import org.apache.spark.sql.execution.ScalarSubquery
+import org.apache.spark.sql.execution.SparkPlan
 import org.apache.spark.sql.execution.aggregate.ScalaUDAF
 import org.apache.spark.sql.types._
 import org.apache.spark.storage.StorageLevel
@@ -108,6 +114,9 @@ import org.apache.spark.unsafe.types.UTF8String
 import org.apache.spark.util.LongAccumulator
 
 import edu.berkeley.cs.rise.opaque.execution.Block
+import edu.berkeley.cs.rise.opaque.execution.EncryptedFilterExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedHashAggregateExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedProjectExec
 import edu.berkeley.cs.rise.opaque.execution.OpaqueOperatorExec
 import edu.berkeley.cs.rise.opaque.execution.SGXEnclave
 import edu.berkeley.cs.rise.opaque.expressions.ClosestPoint
@@ -258,7 +267,7 @@ object Utils extends Logging {
    */
   var sharedKey: Option[Array[Byte]] = None
 
-  def encrypt(data: Array[Byte]): Array[Byte] = sharedKey match {
+  def encrypt(data: Array[Byte], aad: Array[Byte] = Array.empty): Array[Byte] = sharedKey match {
     case Some(sharedKey) =>
       val random = SecureRandom.getInstance("SHA1PRNG")
       val cipherKey = new SecretKeySpec(sharedKey, "AES")
@@ -267,6 +276,9 @@ object Utils extends Logging {
       val spec = new GCMParameterSpec(GCM_TAG_LENGTH * 8, iv)
       val cipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
       cipher.init(Cipher.ENCRYPT_MODE, cipherKey, spec)
+      if (aad.nonEmpty) {
+        cipher.updateAAD(aad)
+      }
       val cipherText = cipher.doFinal(data)
       /* Cipher in Scala produces cipher text of the form
        * IV || ENCRYPTED DATA || TAG
@@ -281,7 +293,7 @@ object Utils extends Logging {
       throw new OpaqueException("Cannot encrypt without sharedKey.")
   }
 
-  def decrypt(data: Array[Byte]): Array[Byte] = sharedKey match {
+  def decrypt(data: Array[Byte], aad: Array[Byte] = Array.empty): Array[Byte] = sharedKey match {
     case Some(sharedKey) =>
       val cipherKey = new SecretKeySpec(sharedKey, "AES")
       val iv = data.take(GCM_IV_LENGTH)
@@ -296,6 +308,9 @@ object Utils extends Logging {
       val swappedCipherText = encrypted_data ++ tag
       val cipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
       cipher.init(Cipher.DECRYPT_MODE, cipherKey, new GCMParameterSpec(GCM_TAG_LENGTH * 8, iv))
+      if (aad.nonEmpty) {
+        cipher.updateAAD(aad)
+      }
       cipher.doFinal(swappedCipherText)
     case None =>
       throw new OpaqueException("Cannot decrypt without sharedKey.")
@@ -853,6 +868,149 @@ object Utils extends Logging {
     }
   }
 
+  /** Returns a bitmap of `numBits` bits in which bit i is set if `isSet(i)`. */
+  def flatbuffersBitmap(numBits: Int, isSet: Int => Boolean): Array[Byte] = {
+    val bits = new Array[Byte]((numBits + 7) / 8)
+    for (i <- 0 until numBits if isSet(i)) {
+      bits(i / 8) = (bits(i / 8) | (1 << (i % 8))).toByte
+    }
+    bits
+  }
+
+  /**
+   * Serializes column `j` of the given rows into a tuix.Column. Columns of types without a columnar
+   * encoding are stored as tuix.Fields. Returns the offset of the written tuix.Column.
+   */
+  def flatbuffersCreateColumn(
+      builder: FlatBufferBuilder,
+      rows: IndexedSeq[InternalRow],
+      j: Int,
+      dataType: DataType
+  ): Int = {
+    val numRows = rows.size
+    def isNull(i: Int) = rows(i).isNullAt(j)
+    val nulls = tuix.Column.createNullsVector(builder, flatbuffersBitmap(numRows, isNull))
+    val (colType, addValues): (Byte, () => Unit) = dataType match {
+      case BooleanType =>
+        val bools = tuix.Column.createBoolsVector(
+          builder,
+          Array.tabulate(numRows)(i => !isNull(i) && rows(i).getBoolean(j))
+        )
+        (tuix.ColType.BooleanType, () => tuix.Column.addBools(builder, bools))
+      case IntegerType | DateType =>
+        val ints = tuix.Column.createIntsVector(
+          builder,
+          Array.tabulate(numRows)(i => if (isNull(i)) 0 else rows(i).getInt(j))
+        )
+        val colType =
+          if (dataType == DateType) tuix.ColType.DateType else tuix.ColType.IntegerType
+        (colType, () => tuix.Column.addInts(builder, ints))
+      case LongType =>
+        val longs = tuix.Column.createLongsVector(
+          builder,
+          Array.tabulate(numRows)(i => if (isNull(i)) 0L else rows(i).getLong(j))
+        )
+        (tuix.ColType.LongType, () => tuix.Column.addLongs(builder, longs))
+      case FloatType =>
+        val floats = tuix.Column.createFloatsVector(
+          builder,
+          Array.tabulate(numRows)(i => if (isNull(i)) 0f else rows(i).getFloat(j))
+        )
+        (tuix.ColType.FloatType, () => tuix.Column.addFloats(builder, floats))
+      case DoubleType =>
+        val doubles = tuix.Column.createDoublesVector(
+          builder,
+          Array.tabulate(numRows)(i => if (isNull(i)) 0d else rows(i).getDouble(j))
+        )
+        (tuix.ColType.DoubleType, () => tuix.Column.addDoubles(builder, doubles))
+      case StringType | BinaryType =>
+        val values = Array.tabulate(numRows) { i =>
+          if (isNull(i)) Array.empty[Byte]
+          else if (dataType == StringType) rows(i).getUTF8String(j).getBytes
+          else rows(i).getBinary(j)
+        }
+        val bytes = tuix.Column.createBytesVector(builder, Array.concat(values: _*))
+        val offsets =
+          tuix.Column.createOffsetsVector(builder, values.scanLeft(0)(_ + _.length))
+        val colType =
+          if (dataType == StringType) tuix.ColType.StringType else tuix.ColType.BinaryType
+        (
+          colType,
+          () => {
+            tuix.Column.addBytes(builder, bytes)
+            tuix.Column.addOffsets(builder, offsets)
+          }
+        )
+      case _ =>
+        val fields = tuix.Column.createFieldsVector(
+          builder,
+          Array.tabulate(numRows) { i =>
+            flatbuffersCreateField(
+              builder,
+              if (isNull(i)) null else rows(i).get(j, dataType),
+              dataType,
+              isNull(i)
+            )
+          }
+        )
+        (tuix.ColType.NullType, () => tuix.Column.addFields(builder, fields))
+    }
+
+    tuix.Column.startColumn(builder)
+    tuix.Column.addColType(builder, colType)
+    tuix.Column.addNulls(builder, nulls)
+    addValues()
+    tuix.Column.endColumn(builder)
+  }
+
+  /**
+   * Serializes the given rows column by column into a tuix.ColumnarRows. Returns the offset of the
+   * written tuix.ColumnarRows.
+   */
+  def flatbuffersCreateColumnarRows(
+      builder: FlatBufferBuilder,
+      rows: IndexedSeq[InternalRow],
+      types: Seq[DataType],
+      isDummyRows: Boolean
+  ): Int = {
+    val columnOffsets = types.zipWithIndex.map { case (dataType, j) =>
+      flatbuffersCreateColumn(builder, rows, j, dataType)
+    }
+    tuix.ColumnarRows.createColumnarRows(
+      builder,
+      rows.size,
+      tuix.ColumnarRows.createColumnsVector(builder, columnOffsets.toArray),
+      tuix.ColumnarRows.createDummiesVector(builder, flatbuffersBitmap(rows.size, _ => isDummyRows))
+    )
+  }
+
+  /** Extracts the value in row `i` of the given tuix.Column. */
+  def flatbuffersExtractColumnValue(column: tuix.Column, i: Int): Any = {
+    if (column.fieldsLength > 0) {
+      val field = column.fields(i)
+      if (field.isNull()) null else flatbuffersExtractFieldValue(field)
+    } else if ((column.nulls(i / 8) & (1 << (i % 8))) != 0) {
+      null
+    } else {
+      column.colType match {
+        case tuix.ColType.BooleanType => column.bools(i)
+        case tuix.ColType.IntegerType | tuix.ColType.DateType => column.ints(i)
+        case tuix.ColType.LongType => column.longs(i)
+        case tuix.ColType.FloatType => column.floats(i)
+        case tuix.ColType.DoubleType => column.doubles(i)
+        case tuix.ColType.StringType | tuix.ColType.BinaryType =>
+          val start = column.offsets(i).toInt
+          val bytes = new Array[Byte](column.offsets(i + 1).toInt - start)
+          if (bytes.nonEmpty) {
+            val bytesBuf = column.bytesAsByteBuffer
+            bytesBuf.position(bytesBuf.position + start)
+            bytesBuf.get(bytes)
+          }
+          if (column.colType == tuix.ColType.StringType) UTF8String.fromBytes(bytes) else bytes
+      }
+    }
+  }
+
   /**
    * Encrypts/decrypts a given scalar value
    */
@@ -947,58 +1105,102 @@ object Utils extends Logging {
     val builder2 = new FlatBufferBuilder
     val encryptedBlockOffsets = ArrayBuilder.make[Int]
 
-    // 1. Serialize the rows as plaintext using tuix.Rows
-    var builder = new FlatBufferBuilder
-    var rowsOffsets = ArrayBuilder.make[Int]
+    def encryptBlockData(plaintext: Array[Byte]): Array[Byte] =
+      if (useEnclave) {
+        val (enclave, eid) = initEnclave()
+        enclave.Encrypt(eid, plaintext)
+      } else {
+        encrypt(plaintext)
+      }
+
+    // 1. Serialize the rows as plaintext using tuix.ColumnarRows. Blocks with several columns are
+    // encrypted column by column instead, so that the enclave only decrypts the columns it uses
+    val blockRows = ArrayBuffer.empty[InternalRow]
+    var blockSize = 0
 
     def finishBlock(): Unit = {
-      val rowsOffsetsArray = rowsOffsets.result
-      builder.finish(
-        tuix.Rows.createRows(builder, tuix.Rows.createRowsVector(builder, rowsOffsetsArray))
-      )
-      val plaintext = builder.sizedByteArray()
-
-      // 2. Encrypt the row data and put it into a tuix.EncryptedBlock
-      val ciphertext =
-        if (useEnclave) {
-          val (enclave, eid) = initEnclave()
-          enclave.Encrypt(eid, plaintext)
-        } else {
-          encrypt(plaintext)
+      if (types.size > 1) {
+        // 2. Encrypt each column and a tuix.ColumnDirectory binding them together, and put them
+        // into a tuix.EncryptedBlock
+        val encColumns = types.zipWithIndex.map { case (dataType, j) =>
+          val columnBuilder = new FlatBufferBuilder
+          columnBuilder.finish(flatbuffersCreateColumn(columnBuilder, blockRows, j, dataType))
+          encryptBlockData(columnBuilder.sizedByteArray())
         }
+        val builder = new FlatBufferBuilder
+        builder.finish(
+          tuix.ColumnDirectory.createColumnDirectory(
+            builder,
+            blockRows.size,
+            tuix.ColumnDirectory
+              .createColumnIvsVector(builder, encColumns.flatMap(_.take(GCM_IV_LENGTH)).toArray),
+            tuix.ColumnDirectory.createDummiesVector(
+              builder,
+              flatbuffersBitmap(blockRows.size, _ => isDummyRows)
+            )
+          )
+        )
 
-      encryptedBlockOffsets += tuix.EncryptedBlock.createEncryptedBlock(
-        builder2,
-        rowsOffsetsArray.size,
-        tuix.EncryptedBlock.createEncRowsVector(builder2, ciphertext)
-      )
+        encryptedBlockOffsets += tuix.EncryptedBlock.createEncryptedBlock(
+          builder2,
+          blockRows.size,
+          tuix.EncryptedBlock.createEncRowsVector(
+            builder2,
+            encryptBlockData(builder.sizedByteArray())
+          ),
+          tuix.EncryptedBlock.createEncColumnsVector(
+            builder2,
+            encColumns.map { encColumn =>
+              tuix.EncryptedColumn.createEncryptedColumn(
+                builder2,
+                tuix.EncryptedColumn.createEncDataVector(builder2, encColumn)
+              )
+            }.toArray
+          ),
+          0,
+          0,
+          0
+        )
+      } else {
+        val builder = new FlatBufferBuilder
+        tuix.ColumnarRows.finishColumnarRowsBuffer(
+          builder,
+          flatbuffersCreateColumnarRows(builder, blockRows, types, isDummyRows)
+        )
+
+        // 2. Encrypt the row data and put it into a tuix.EncryptedBlock
+        encryptedBlockOffsets += tuix.EncryptedBlock.createEncryptedBlock(
+          builder2,
+          blockRows.size,
+          tuix.EncryptedBlock.createEncRowsVector(
+            builder2,
+            encryptBlockData(builder.sizedByteArray())
+          ),
+          0,
+          0,
+          0,
+          0
+        )
+      }
 
-      builder = new FlatBufferBuilder
-      rowsOffsets = ArrayBuilder.make[Int]
+      blockRows.clear()
+      blockSize = 0
     }
 
     for (row <- rows) {
-      rowsOffsets += tuix.Row.createRow(
-        builder,
-        tuix.Row.createFieldValuesVector(
-          builder,
-          row
-            .toSeq(types)
-            .zip(types)
-            .zipWithIndex
-            .map { case ((value, dataType), i) =>
-              flatbuffersCreateField(builder, value, dataType, row.isNullAt(i))
-            }
-            .toArray
-        ),
-        isDummyRows
-      )
-
-      if (builder.offset() > MaxBlockSize) {
+      // Rows are buffered until the block is full, so they must not be reused by the caller
+      blockRows += row.copy()
+      blockSize += types.zipWithIndex.map {
+        case (StringType, i) if !row.isNullAt(i) => row.getUTF8String(i).numBytes + 4
+        case (BinaryType, i) if !row.isNullAt(i) => row.getBinary(i).length + 4
+        case _ => 8
+      }.sum
+
+      if (blockSize > MaxBlockSize) {
         finishBlock()
       }
     }
-    if (builder.offset() > 0) {
+    if (blockRows.nonEmpty) {
       finishBlock()
     }
 
@@ -1015,6 +1217,45 @@ object Utils extends Logging {
     Block(encryptedBlockBytes)
   }
 
+  /**
+   * Decrypts the enc_rows of the given tuix.EncryptedBlock, decompressing them if the enclave
+   * compressed them before encryption.
+   */
+  def decryptBlockPlaintext(encryptedBlock: tuix.EncryptedBlock): Array[Byte] = {
+    val ciphertextBuf = encryptedBlock.encRowsAsByteBuffer
+    val ciphertext = new Array[Byte](ciphertextBuf.remaining)
+    ciphertextBuf.get(ciphertext)
+
+    val uncompressedSize = encryptedBlock.uncompressedSize.toInt
+    val plaintext = decrypt(ciphertext, encryptedBlockAad(encryptedBlock))
+    if (uncompressedSize > 0) {
+      LZ4Factory.safeInstance().safeDecompressor().decompress(plaintext, uncompressedSize)
+    } else {
+      plaintext
+    }
+  }
+
+  /**
+   * The additional authenticated data with which the enc_rows of the given tuix.EncryptedBlock
+   * were encrypted: its uncompressed size if it is compressed, followed by its producer if it was
+   * written by an enclave, each as a 4-byte little-endian integer.
+   */
+  def encryptedBlockAad(encryptedBlock: tuix.EncryptedBlock): Array[Byte] = {
+    val uncompressedSize = encryptedBlock.uncompressedSize.toInt
+    if (encryptedBlock.producer != 0) {
+      ByteBuffer
+        .allocate(8)
+        .order(ByteOrder.LITTLE_ENDIAN)
+        .putInt(uncompressedSize)
+        .putInt(encryptedBlock.producer)
+        .array()
+    } else if (uncompressedSize > 0) {
+      ByteBuffer.allocate(4).order(ByteOrder.LITTLE_ENDIAN).putInt(uncompressedSize).array()
+    } else {
+      Array.empty
+    }
+  }
+
   /**
    * Decrypts the given [[Block]] (a serialized tuix.EncryptedBlocks) and returns the rows within as
    * Spark SQL [[InternalRow]]s.
@@ -1030,27 +1271,54 @@ object Utils extends Logging {
     val encryptedBlocks = tuix.EncryptedBlocks.getRootAsEncryptedBlocks(buf)
     (for (i <- 0 until encryptedBlocks.blocksLength) yield {
       val encryptedBlock = encryptedBlocks.blocks(i)
-      val ciphertextBuf = encryptedBlock.encRowsAsByteBuffer
-      val ciphertext = new Array[Byte](ciphertextBuf.remaining)
-      ciphertextBuf.get(ciphertext)
 
       // 2. Decrypt the row data
-      val plaintext = decrypt(ciphertext)
-
-      // 1. Deserialize the tuix.Rows and return them as Scala InternalRow objects
-      val rows = tuix.Rows.getRootAsRows(ByteBuffer.wrap(plaintext))
-      for (j <- 0 until rows.rowsLength) yield {
-        val row = rows.rows(j)
-        assert(!row.isDummy)
-        InternalRow.fromSeq(for (k <- 0 until row.fieldValuesLength) yield {
-          val field: Any =
-            if (!row.fieldValues(k).isNull()) {
-              flatbuffersExtractFieldValue(row.fieldValues(k))
-            } else {
-              null
-            }
-          field
-        })
+      val plaintext = decryptBlockPlaintext(encryptedBlock)
+
+      // 1. Deserialize the tuix.Rows, tuix.ColumnarRows, or separately-encrypted tuix.Columns and
+      // return them as Scala InternalRow objects
+      val plaintextBuf = ByteBuffer.wrap(plaintext)
+      if (encryptedBlock.encColumnsLength > 0) {
+        val directory = tuix.ColumnDirectory.getRootAsColumnDirectory(plaintextBuf)
+        val columns = for (k <- 0 until encryptedBlock.encColumnsLength) yield {
+          val encDataBuf = encryptedBlock.encColumns(k).encDataAsByteBuffer
+          val encData = new Array[Byte](encDataBuf.remaining)
+          encDataBuf.get(encData)
+          // The IV of each column is authenticated in the directory, which binds the column to
+          // its block
+          if (encData.length < GCM_IV_LENGTH || (0 until GCM_IV_LENGTH).exists { b =>
+                (encData(b) & 0xff) != directory.columnIvs(k * GCM_IV_LENGTH + b)
+              }) {
+            throw new OpaqueException("Column IV mismatch")
+          }
+          tuix.Column.getRootAsColumn(ByteBuffer.wrap(decrypt(encData)))
+        }
+        for (j <- 0 until directory.numRows.toInt) yield {
+          assert((directory.dummies(j / 8) & (1 << (j % 8))) == 0)
+          InternalRow.fromSeq(columns.map(flatbuffersExtractColumnValue(_, j)))
+        }
+      } else if (tuix.ColumnarRows.ColumnarRowsBufferHasIdentifier(plaintextBuf)) {
+        val columnarRows = tuix.ColumnarRows.getRootAsColumnarRows(plaintextBuf)
+        val columns = (0 until columnarRows.columnsLength).map(columnarRows.columns(_))
+        for (j <- 0 until columnarRows.numRows.toInt) yield {
+          assert((columnarRows.dummies(j / 8) & (1 << (j % 8))) == 0)
+          InternalRow.fromSeq(columns.map(flatbuffersExtractColumnValue(_, j)))
+        }
+      } else {
+        val rows = tuix.Rows.getRootAsRows(plaintextBuf)
+        for (j <- 0 until rows.rowsLength) yield {
+          val row = rows.rows(j)
+          assert(!row.isDummy)
+          InternalRow.fromSeq(for (k <- 0 until row.fieldValuesLength) yield {
+            val field: Any =
+              if (!row.fieldValues(k).isNull()) {
+                flatbuffersExtractFieldValue(row.fieldValues(k))
+              } else {
+                null
+              }
+            field
+          })
+        }
       }
     }).flatten
   }
@@ -1220,10 +1488,15 @@ object Utils extends Logging {
           )
 
         case (Like(left, right, escapeChar), Seq(leftOffset, rightOffset)) =>
+          if (escapeChar > 127) {
+            throw new OpaqueException(
+              s"LIKE with the non-ASCII escape character '$escapeChar' is not supported"
+            )
+          }
           tuix.Expr.createExpr(
             builder,
             tuix.ExprUnion.Like,
-            tuix.Like.createLike(builder, leftOffset, rightOffset)
+            tuix.Like.createLike(builder, leftOffset, rightOffset, escapeChar.toInt)
           )
 
         case (StartsWith(left, right), Seq(leftOffset, rightOffset)) =>
@@ -1315,6 +1588,21 @@ object Utils extends Logging {
               .createIn(builder, tuix.In.createChildrenVector(builder, childrenOffsets.toArray))
           )
 
+        // The optimizer replaces an In with a long list of literals by an InSet, which is
+        // evaluated as an In with the same literals
+        case (InSet(child, hset), Seq(childOffset)) =>
+          val itemOffsets = hset.toSeq.map { value =>
+            flatbuffersSerializeExpression(builder, Literal(value, child.dataType), input)
+          }
+          tuix.Expr.createExpr(
+            builder,
+            tuix.ExprUnion.In,
+            tuix.In.createIn(
+              builder,
+              tuix.In.createChildrenVector(builder, (childOffset +: itemOffsets).toArray)
+            )
+          )
+
         // Time expressions
         case (Year(child), Seq(childOffset)) =>
           tuix.Expr.createExpr(
@@ -1431,9 +1719,17 @@ object Utils extends Logging {
           } else {
             assert(encryptedBlocks.blocksLength == 1)
             val encryptedBlock = encryptedBlocks.blocks(0)
-            val ciphertextBuf = encryptedBlock.encRowsAsByteBuffer
-            val ciphertext = new Array[Byte](ciphertextBuf.remaining)
-            ciphertextBuf.get(ciphertext)
+            val ciphertext =
+              if (encryptedBlock.uncompressedSize > 0 || encryptedBlock.producer != 0) {
+                // Decrypt expressions take uncompressed rows encrypted without additional
+                // authenticated data, so other rows are re-encrypted
+                encrypt(decryptBlockPlaintext(encryptedBlock))
+              } else {
+                val ciphertextBuf = encryptedBlock.encRowsAsByteBuffer
+                val ciphertext = new Array[Byte](ciphertextBuf.remaining)
+                ciphertextBuf.get(ciphertext)
+                ciphertext
+              }
             val ciphertext_str = Base64.getEncoder().encodeToString(ciphertext)
             flatbuffersSerializeExpression(
               builder,
@@ -1491,6 +1787,10 @@ object Utils extends Logging {
                 o.direction match {
                   case Ascending => tuix.SortDirection.Ascending
                   case Descending => tuix.SortDirection.Descending
+                },
+                o.nullOrdering match {
+                  case NullsFirst => tuix.NullOrdering.NullsFirst
+                  case NullsLast => tuix.NullOrdering.NullsLast
                 }
               )
             )
@@ -1595,6 +1895,58 @@ object Utils extends Logging {
     builder.sizedByteArray()
   }
 
+  /**
+   * Serialize a chain of EncryptedFilterExecs and EncryptedProjectExecs, in the order they are
+   * applied, and an optional hash aggregation of their output into a tuix.Pipeline.
+   */
+  def serializePipeline(
+      stages: Seq[SparkPlan],
+      aggregate: Option[EncryptedHashAggregateExec]
+  ): Array[Byte] = {
+    val builder = new FlatBufferBuilder
+    val stageOffsets = stages.map {
+      case EncryptedFilterExec(condition, child) =>
+        tuix.PipelineStage.createPipelineStage(
+          builder,
+          tuix.PipelineOp.FilterExpr,
+          tuix.FilterExpr.createFilterExpr(
+            builder,
+            flatbuffersSerializeExpression(builder, condition, child.output)
+          )
+        )
+      case EncryptedProjectExec(projectList, child) =>
+        tuix.PipelineStage.createPipelineStage(
+          builder,
+          tuix.PipelineOp.ProjectExpr,
+          tuix.ProjectExpr.createProjectExpr(
+            builder,
+            tuix.ProjectExpr.createProjectListVector(
+              builder,
+              projectList
+                .map(expr => flatbuffersSerializeExpression(builder, expr, child.output))
+                .toArray
+            )
+          )
+        )
+    }
+    val stagesOffset = tuix.Pipeline.createStagesVector(builder, stageOffsets.toArray)
+    val aggregateOffset = aggregate match {
+      case Some(a) =>
+        tuix.Pipeline.createAggregateVector(
+          builder,
+          serializeAggOp(a.groupingExpressions, a.aggregateExpressions, a.child.output)
+        )
+      case None => 0
+    }
+    val isPartial = aggregate.exists(
+      _.aggregateExpressions.exists(e => e.mode == Partial || e.mode == PartialMerge)
+    )
+    builder.finish(
+      tuix.Pipeline.createPipeline(builder, stagesOffset, aggregateOffset, isPartial)
+    )
+    builder.sizedByteArray()
+  }
+
   /**
    * Serialize an AggregateExpression into a tuix.AggregateExpr. Returns the offset of the written
    * tuix.AggregateExpr.
@@ -1644,6 +1996,14 @@ object Utils extends Logging {
           case _ =>
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, Seq(Cast(child, dataType))))
+          case Final => Some((true, avg.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.Average, nativeInputs, input)
+
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -1660,7 +2020,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case c @ Count(children) =>
@@ -1693,6 +2056,14 @@ object Utils extends Logging {
           case _ =>
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, children.filter(_.nullable)))
+          case PartialMerge | Final => Some((true, c.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.Count, nativeInputs, input)
+
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -1706,7 +2077,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case f @ First(child, false) =>
@@ -1731,6 +2105,14 @@ object Utils extends Logging {
           }
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, Seq(child)))
+          case Final => Some((true, f.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.First, nativeInputs, input)
+
         // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
@@ -1752,7 +2134,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case l @ Last(child, false) =>
@@ -1778,6 +2163,14 @@ object Utils extends Logging {
           }
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, Seq(child)))
+          case Final => Some((true, l.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.Last, nativeInputs, input)
+
         // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
@@ -1799,7 +2192,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case m @ Max(child) =>
@@ -1824,6 +2220,14 @@ object Utils extends Logging {
           }
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, Seq(child)))
+          case Final => Some((true, m.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.Max, nativeInputs, input)
+
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -1843,7 +2247,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case m @ Min(child) =>
@@ -1868,6 +2275,14 @@ object Utils extends Logging {
           }
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, Seq(child)))
+          case Final => Some((true, m.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.Min, nativeInputs, input)
+
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -1887,7 +2302,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case s @ Sum(child) =>
@@ -1927,6 +2345,14 @@ object Utils extends Logging {
           }
         }
 
+        val nativeInputs = e.mode match {
+          case Partial | Complete => Some((false, Seq(Cast(child, sumDataType))))
+          case PartialMerge | Final => Some((true, s.inputAggBufferAttributes))
+          case _ => None
+        }
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          serializeNativeAggregate(builder, tuix.AggregateFunction.Sum, nativeInputs, input)
+
         tuix.AggregateExpr.createAggregateExpr(
           builder,
           tuix.AggregateExpr.createInitialValuesVector(
@@ -1940,7 +2366,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case vs @ ScalaUDAF(Seq(child), _: VectorSum, _, _) =>
@@ -1961,6 +2390,9 @@ object Utils extends Logging {
           }
         }
 
+        val (nativeFunction, nativeMerge, nativeInputsOffset) =
+          (tuix.AggregateFunction.Generic, false, 0)
+
         // TODO: support aggregating null values
         tuix.AggregateExpr.createAggregateExpr(
           builder,
@@ -1977,7 +2409,10 @@ object Utils extends Logging {
           tuix.AggregateExpr.createEvaluateExprsVector(
             builder,
             evaluateExprs.map(e => flatbuffersSerializeExpression(builder, e, aggSchema)).toArray
-          )
+          ),
+          nativeFunction,
+          nativeMerge,
+          nativeInputsOffset
         )
 
       case _ =>
@@ -1987,6 +2422,31 @@ object Utils extends Logging {
     }
   }
 
+  /**
+   * Serialize the inputs from which the enclave can natively update the aggregation buffer of the
+   * given aggregate function. `nativeInputs` holds whether they are aggregation buffer columns to
+   * merge along with the input expressions, or is None if the buffer can only be updated by
+   * evaluating the update expressions. Returns the function, merge flag and offset of the inputs
+   * to store in the tuix.AggregateExpr.
+   */
+  def serializeNativeAggregate(
+      builder: FlatBufferBuilder,
+      function: Byte,
+      nativeInputs: Option[(Boolean, Seq[Expression])],
+      input: Seq[Attribute]
+  ): (Byte, Boolean, Int) = nativeInputs match {
+    case Some((merge, inputs)) =>
+      (
+        function,
+        merge,
+        tuix.AggregateExpr.createNativeInputsVector(
+          builder,
+          inputs.map(e => flatbuffersSerializeExpression(builder, e, input)).toArray
+        )
+      )
+    case None => (tuix.AggregateFunction.Generic, false, 0)
+  }
+
   def concatEncryptedBlocks(blocks: Seq[Block]): Block = {
     val allBlocks = for {
       block <- blocks
@@ -2005,10 +2465,38 @@ object Utils extends Logging {
           allBlocks.map { encryptedBlock =>
             val encRows = new Array[Byte](encryptedBlock.encRowsLength)
             encryptedBlock.encRowsAsByteBuffer.get(encRows)
+            val encColumns =
+              if (encryptedBlock.encColumnsLength > 0) {
+                tuix.EncryptedBlock.createEncColumnsVector(
+                  builder,
+                  (0 until encryptedBlock.encColumnsLength).map { k =>
+                    val encData = new Array[Byte](encryptedBlock.encColumns(k).encDataLength)
+                    encryptedBlock.encColumns(k).encDataAsByteBuffer.get(encData)
+                    tuix.EncryptedColumn.createEncryptedColumn(
+                      builder,
+                      tuix.EncryptedColumn.createEncDataVector(builder, encData)
+                    )
+                  }.toArray
+                )
+              } else {
+                0
+              }
+            val encStats =
+              if (encryptedBlock.encStatsLength > 0) {
+                val stats = new Array[Byte](encryptedBlock.encStatsLength)
+                encryptedBlock.encStatsAsByteBuffer.get(stats)
+                tuix.EncryptedBlock.createEncStatsVector(builder, stats)
+              } else {
+                0
+              }
             tuix.EncryptedBlock.createEncryptedBlock(
               builder,
               encryptedBlock.numRows,
-              tuix.EncryptedBlock.createEncRowsVector(builder, encRows)
+              tuix.EncryptedBlock.createEncRowsVector(builder, encRows),
+              encColumns,
+              encStats,
+              encryptedBlock.uncompressedSize,
+              encryptedBlock.producer
             )
           }.toArray
         )
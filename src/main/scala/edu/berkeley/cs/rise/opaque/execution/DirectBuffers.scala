@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package edu.berkeley.cs.rise.opaque.execution
+
+import java.lang.ref.PhantomReference
+import java.lang.ref.ReferenceQueue
+import java.nio.ByteBuffer
+import java.util.concurrent.ConcurrentHashMap
+
+/**
+ * Frees the host memory behind the direct ByteBuffers returned by the `*Direct` methods of
+ * [[SGXEnclave]], which the JVM does not manage. Each tracked buffer is freed by a cleaner thread
+ * once it becomes unreachable, or earlier by [[release]] once its contents have been consumed.
+ */
+object DirectBuffers {
+  private val enclave = new SGXEnclave()
+  private val queue = new ReferenceQueue[ByteBuffer]
+  // Tracked buffers by address, which also keeps their references reachable until they are freed
+  private val live = new ConcurrentHashMap[Long, BufferRef]
+
+  private class BufferRef(buffer: ByteBuffer, val address: Long)
+      extends PhantomReference[ByteBuffer](buffer, queue)
+
+  private val cleaner = new Thread("opaque-direct-buffer-cleaner") {
+    override def run(): Unit = {
+      while (true) {
+        free(queue.remove().asInstanceOf[BufferRef])
+      }
+    }
+  }
+  cleaner.setDaemon(true)
+  cleaner.start()
+
+  /** Take ownership of a buffer returned by a `*Direct` method, returning the buffer. */
+  def track(buffer: ByteBuffer): ByteBuffer = {
+    if (buffer != null) {
+      val address = enclave.DirectBufferAddress(buffer)
+      live.put(address, new BufferRef(buffer, address))
+    }
+    buffer
+  }
+
+  /** Free a tracked buffer immediately. The buffer must not be used afterwards. */
+  def release(buffer: ByteBuffer): Unit = {
+    if (buffer != null) {
+      val ref = live.get(enclave.DirectBufferAddress(buffer))
+      if (ref != null) {
+        ref.clear()
+        free(ref)
+      }
+    }
+  }
+
+  /** The number of tracked buffers that have not been freed yet. */
+  def numLive: Int = live.size
+
+  private def free(ref: BufferRef): Unit = {
+    // Only the first of the cleaner and release() to remove the reference frees its memory
+    if (live.remove(ref.address, ref)) {
+      enclave.FreeDirectBuffer(ref.address)
+    }
+  }
+}
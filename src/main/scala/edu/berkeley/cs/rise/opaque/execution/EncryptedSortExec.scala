@@ -79,14 +79,19 @@ object EncryptedSortExec {
     } else {
       // Collect a sample of the input rows
       val sampled = applyLoggingLevel(childRDD, "enclave.Sample") { childRDD =>
+        val releaseInput = Block.releasable(childRDD)
         Utils.concatEncryptedBlocks(childRDD.map { block =>
           val (enclave, eid) = Utils.initEnclave()
-          val sampledBlock = enclave.Sample(eid, block.bytes)
+          val sampledBlock = enclave.SampleDirect(eid, block.directBuffer)
+          if (releaseInput) {
+            block.release()
+          }
           Block(sampledBlock)
         }.collect)
       }
 
-      // Find range boundaries parceled out to a single worker
+      // Find range boundaries parceled out to a single worker. The sample is built on the
+      // driver, so its rows are already in a Java array.
       val boundaries = applyLoggingLevel(childRDD, "enclave.FindRangeBounds") { childRDD =>
         childRDD.context
           .parallelize(Array(sampled.bytes), 1)
@@ -100,11 +105,20 @@ object EncryptedSortExec {
 
       // Broadcast the range boundaries and use them to partition the input
       // Shuffle the input to achieve range partitioning and sort locally
+      val releaseInput = Block.releasable(childRDD)
       val result = childRDD
         .flatMap { block =>
           val (enclave, eid) = Utils.initEnclave()
-          val partitions =
-            enclave.PartitionForSort(eid, orderSer, numPartitions, block.bytes, boundaries)
+          val partitions = enclave.PartitionForSortDirect(
+            eid,
+            orderSer,
+            numPartitions,
+            block.directBuffer,
+            boundaries
+          )
+          if (releaseInput) {
+            block.release()
+          }
           partitions.zipWithIndex.map { case (partition, i) =>
             (i, Block(partition))
           }
@@ -118,11 +132,8 @@ object EncryptedSortExec {
   }
 
   def localSort(childRDD: RDD[Block], orderSer: Array[Byte]): RDD[Block] = {
-    val result = childRDD.map { block =>
-      val (enclave, eid) = Utils.initEnclave()
-      val sortedRows = enclave.ExternalSort(eid, orderSer, block.bytes)
-      Block(sortedRows)
+    Block.mapDirect(childRDD) { (enclave, eid, input) =>
+      enclave.ExternalSortDirect(eid, orderSer, input)
     }
-    result
   }
 }
@@ -17,6 +17,8 @@
 
 package edu.berkeley.cs.rise.opaque.execution
 
+import java.nio.ByteBuffer
+
 import ch.jodersky.jni.nativeLoader
 
 @nativeLoader("enclave_jni")
@@ -53,6 +55,8 @@ class SGXEnclave extends java.io.Serializable {
       input: Array[Byte]
   ): Array[Byte]
 
+  @native def HashJoin(eid: Long, joinExpr: Array[Byte], input: Array[Byte]): Array[Byte]
+
   @native def BroadcastNestedLoopJoin(
       eid: Long,
       joinExpr: Array[Byte],
@@ -67,6 +71,19 @@ class SGXEnclave extends java.io.Serializable {
       isPartial: Boolean
   ): (Array[Byte])
 
+  @native def HashAggregate(
+      eid: Long,
+      aggOp: Array[Byte],
+      inputRows: Array[Byte],
+      isPartial: Boolean
+  ): Array[Byte]
+
+  @native def ExecutePipeline(
+      eid: Long,
+      pipeline: Array[Byte],
+      inputRows: Array[Byte]
+  ): Array[Byte]
+
   @native def CountRowsPerPartition(eid: Long, inputRows: Array[Byte]): Array[Byte]
   @native def ComputeNumRowsPerPartition(
       eid: Long,
@@ -81,6 +98,79 @@ class SGXEnclave extends java.io.Serializable {
       inputRows: Array[Byte]
   ): Array[Byte]
 
+  // Variants of the operators above that take their input rows in a direct ByteBuffer, which
+  // they read in place, and return their output rows in a direct ByteBuffer wrapping host memory
+  // rather than copying them into a Java array. The output must be registered with
+  // [[DirectBuffers.track]] so that its memory is freed, as [[Block.direct]] does.
+  @native def ProjectDirect(eid: Long, projectList: Array[Byte], input: ByteBuffer): ByteBuffer
+  @native def FilterDirect(eid: Long, condition: Array[Byte], input: ByteBuffer): ByteBuffer
+  @native def ExternalSortDirect(eid: Long, order: Array[Byte], input: ByteBuffer): ByteBuffer
+  @native def NonObliviousSortMergeJoinDirect(
+      eid: Long,
+      joinExpr: Array[Byte],
+      input: ByteBuffer
+  ): ByteBuffer
+  @native def HashJoinDirect(eid: Long, joinExpr: Array[Byte], input: ByteBuffer): ByteBuffer
+  @native def NonObliviousAggregateDirect(
+      eid: Long,
+      aggOp: Array[Byte],
+      inputRows: ByteBuffer,
+      isPartial: Boolean
+  ): ByteBuffer
+  @native def HashAggregateDirect(
+      eid: Long,
+      aggOp: Array[Byte],
+      inputRows: ByteBuffer,
+      isPartial: Boolean
+  ): ByteBuffer
+  @native def BroadcastNestedLoopJoinDirect(
+      eid: Long,
+      joinExpr: Array[Byte],
+      outerBlock: ByteBuffer,
+      innerBlock: Array[Byte]
+  ): ByteBuffer
+  @native def ExecutePipelineDirect(
+      eid: Long,
+      pipeline: Array[Byte],
+      inputRows: ByteBuffer
+  ): ByteBuffer
+  @native def LocalLimitDirect(eid: Long, limit: Int, inputRows: ByteBuffer): ByteBuffer
+  @native def LimitReturnRowsDirect(
+      eid: Long,
+      partitionID: Long,
+      limits: Array[Byte],
+      inputRows: ByteBuffer
+  ): ByteBuffer
+
+  // Variants that read their input rows from a direct ByteBuffer but return Java arrays, since
+  // their output is always collected or shuffled
+  @native def SampleDirect(eid: Long, input: ByteBuffer): Array[Byte]
+  @native def PartitionForSortDirect(
+      eid: Long,
+      order: Array[Byte],
+      numPartitions: Int,
+      input: ByteBuffer,
+      boundaries: Array[Byte]
+  ): Array[Array[Byte]]
+  @native def CountRowsPerPartitionDirect(eid: Long, inputRows: ByteBuffer): Array[Byte]
+
+  // Memory management for the output of the direct variants
+  @native def DirectBufferAddress(buffer: ByteBuffer): Long
+  @native def FreeDirectBuffer(address: Long): Unit
+
+  // Statistics of the host pool of untrusted buffers that the enclave writes its output to:
+  // the number of buffers allocated, the number of those reused from the pool, the bytes
+  // currently allocated, the most bytes ever allocated at once, and the bytes of free buffers
+  // kept in the pool
+  @native def HostBufferPoolStats(): Array[Long]
+
+  // Lower the number of plaintext bytes that operators may materialize in enclave memory before
+  // spilling to untrusted memory, so that tests can exercise the spilling paths on small inputs.
+  // Sizes of zero or above the compiled-in limit restore that limit.
+  @native def SetMaxMaterializedSize(eid: Long, size: Long): Unit
+  // The number of times operators in the enclave have spilled to untrusted memory
+  @native def NumSpills(eid: Long): Long
+
   // Remote attestation, enclave side
   @native def GenerateEvidence(eid: Long): Array[Byte]
   @native def FinishAttestation(eid: Long, attResultInput: Array[Byte]): Unit
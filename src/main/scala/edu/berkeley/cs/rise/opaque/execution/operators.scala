@@ -17,8 +17,18 @@
 
 package edu.berkeley.cs.rise.opaque.execution
 
+import java.io.ObjectOutputStream
+import java.lang.{Boolean => JBoolean}
+import java.nio.ByteBuffer
+import java.util.Collections
+import java.util.WeakHashMap
+
 import scala.collection.mutable.ArrayBuffer
 
+import com.esotericsoftware.kryo.Kryo
+import com.esotericsoftware.kryo.KryoSerializable
+import com.esotericsoftware.kryo.io.Input
+import com.esotericsoftware.kryo.io.Output
 import edu.berkeley.cs.rise.opaque.Utils
 import org.apache.spark.rdd.RDD
 import org.apache.spark.sql.catalyst.InternalRow
@@ -30,6 +40,7 @@ import org.apache.spark.sql.catalyst.plans._
 import org.apache.spark.sql.catalyst.plans.physical.Partitioning
 import org.apache.spark.sql.catalyst.optimizer.{BuildLeft, BuildRight, BuildSide}
 import org.apache.spark.sql.execution.SparkPlan
+import org.apache.spark.storage.StorageLevel
 
 trait LeafExecNode extends SparkPlan {
   override final def children: Seq[SparkPlan] = Nil
@@ -138,7 +149,113 @@ case class EncryptedBlockRDDScanExec(output: Seq[Attribute], rdd: RDD[Block])
   override def executeBlocked(): RDD[Block] = rdd
 }
 
-case class Block(bytes: Array[Byte]) extends Serializable
+/**
+ * A serialized tuix.EncryptedBlocks, held either in a Java array or in host memory returned by a
+ * `*Direct` method of [[SGXEnclave]] and tracked by [[DirectBuffers]]. Blocks in host memory are
+ * passed to the next operator in the same task without being copied, and are only copied into an
+ * array when their bytes are needed, such as when Spark serializes them.
+ */
+final class Block private (
+    @transient private var buffer: ByteBuffer,
+    private var array: Array[Byte]
+) extends Serializable
+    with KryoSerializable {
+
+  /** The contents of this block, copied out of host memory on first use. */
+  def bytes: Array[Byte] = {
+    if (array == null) {
+      val copy = new Array[Byte](buffer.remaining)
+      buffer.duplicate().get(copy)
+      array = copy
+    }
+    array
+  }
+
+  /** The contents of this block in a direct ByteBuffer, as the `*Direct` methods expect. */
+  def directBuffer: ByteBuffer =
+    if (buffer != null) {
+      buffer.duplicate()
+    } else {
+      val copy = ByteBuffer.allocateDirect(array.length)
+      copy.put(array)
+      copy.flip()
+      copy
+    }
+
+  /**
+   * Free the host memory of this block without waiting for it to become unreachable. The block
+   * must not be used afterwards.
+   */
+  def release(): Unit = {
+    DirectBuffers.release(buffer)
+    buffer = null
+  }
+
+  private def writeObject(out: ObjectOutputStream): Unit = {
+    bytes
+    out.defaultWriteObject()
+  }
+
+  override def write(kryo: Kryo, output: Output): Unit = {
+    output.writeInt(bytes.length)
+    output.writeBytes(bytes)
+  }
+
+  override def read(kryo: Kryo, input: Input): Unit = {
+    array = input.readBytes(input.readInt())
+    buffer = null
+  }
+}
+
+object Block {
+  def apply(bytes: Array[Byte]): Block = new Block(null, bytes)
+
+  /** Wrap the output of a `*Direct` method of [[SGXEnclave]], taking ownership of its memory. */
+  def direct(buffer: ByteBuffer): Block = new Block(DirectBuffers.track(buffer), null)
+
+  // The RDDs returned by mapDirect, whose blocks are allocated by the operator computing them
+  private val directRDDs =
+    Collections.synchronizedSet(Collections.newSetFromMap(new WeakHashMap[RDD[_], JBoolean]))
+
+  /**
+   * Whether the operator reading the blocks of `rdd` may free their host memory once it has
+   * read them. This is only the case for the blocks that [[mapDirect]] allocates, and only if
+   * `rdd` is not persisted. Any other RDD may pass on blocks that Spark keeps for an ancestor
+   * RDD, and so must leave them to be freed once they become unreachable.
+   */
+  def releasable(rdd: RDD[Block]): Boolean =
+    rdd.getStorageLevel == StorageLevel.NONE && directRDDs.contains(rdd)
+
+  /**
+   * Run an operator on each block of `rdd` through a `*Direct` method of [[SGXEnclave]], which
+   * `f` calls with the enclave, its ID and the rows of the block. The host memory of each input
+   * block is freed as soon as the operator has read it if it is [[releasable]].
+   */
+  def mapDirect(rdd: RDD[Block])(f: (SGXEnclave, Long, ByteBuffer) => ByteBuffer): RDD[Block] =
+    mapDirect(rdd, rdd.map((_, 0L))) { (enclave, eid, _, input) => f(enclave, eid, input) }
+
+  /** Like [[mapDirect]], but also passes `f` the index of each block within `rdd`. */
+  def mapDirectWithIndex(rdd: RDD[Block])(
+      f: (SGXEnclave, Long, Long, ByteBuffer) => ByteBuffer
+  ): RDD[Block] =
+    mapDirect(rdd, rdd.zipWithIndex)(f)
+
+  private def mapDirect(rdd: RDD[Block], blocks: RDD[(Block, Long)])(
+      f: (SGXEnclave, Long, Long, ByteBuffer) => ByteBuffer
+  ): RDD[Block] = {
+    val releaseInput = releasable(rdd)
+    val output = blocks.map { case (block, i) =>
+      val (enclave, eid) = Utils.initEnclave()
+      val output = Block.direct(f(enclave, eid, i, block.directBuffer))
+      if (releaseInput) {
+        block.release()
+      }
+      output
+    }
+    directRDDs.add(output)
+    output
+  }
+}
 
 trait OpaqueOperatorExec extends SparkPlan {
   def name: String
@@ -248,9 +365,8 @@ case class EncryptedProjectExec(projectList: Seq[NamedExpression], child: SparkP
     val projectListSer = Utils.serializeProjectList(projectList, child.output)
     val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
     applyLoggingLevel(childRDD) { childRDD =>
-      childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(enclave.Project(eid, projectListSer, block.bytes))
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.ProjectDirect(eid, projectListSer, input)
       }
     }
   }
@@ -268,9 +384,47 @@ case class EncryptedFilterExec(condition: Expression, child: SparkPlan)
     val conditionSer = Utils.serializeFilterExpression(condition, child.output)
     val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
     applyLoggingLevel(childRDD) { childRDD =>
-      childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(enclave.Filter(eid, conditionSer, block.bytes))
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.FilterDirect(eid, conditionSer, input)
+      }
+    }
+  }
+}
+
+/**
+ * Runs a chain of EncryptedFilterExecs and EncryptedProjectExecs, optionally topped by an
+ * EncryptedHashAggregateExec, as a single enclave call per block, in the spirit of
+ * whole-stage code generation. Each block is decrypted once and streamed through every operator
+ * of the chain, and only the rows that come out of its end are encrypted. `child` is the top of
+ * the chain, and the chain's input is the first operator below it that is not a filter or
+ * projection.
+ */
+case class EncryptedPipelineExec(child: SparkPlan) extends UnaryExecNode with OpaqueOperatorExec {
+
+  override def name = "EncryptedPipelineExec"
+
+  override def output: Seq[Attribute] = child.output
+
+  override def executeBlocked(): RDD[Block] = {
+    val (aggregate, top) = child match {
+      case a: EncryptedHashAggregateExec => (Some(a), a.child)
+      case _ => (None, child)
+    }
+
+    // Collect the stages of the chain in the order they are applied
+    def collectStages(plan: SparkPlan): (Seq[SparkPlan], SparkPlan) = plan match {
+      case p @ (_: EncryptedFilterExec | _: EncryptedProjectExec) =>
+        val (stages, input) = collectStages(p.children.head)
+        (stages :+ p, input)
+      case _ => (Seq.empty, plan)
+    }
+    val (stages, input) = collectStages(top)
+
+    val pipelineSer = Utils.serializePipeline(stages, aggregate)
+    val inputRDD = input.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    applyLoggingLevel(inputRDD) { inputRDD =>
+      Block.mapDirect(inputRDD) { (enclave, eid, input) =>
+        enclave.ExecutePipelineDirect(eid, pipelineSer, input)
       }
     }
   }
@@ -307,9 +461,50 @@ case class EncryptedAggregateExec(
 
     val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
     applyLoggingLevel(childRDD) { childRDD =>
-      childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(enclave.NonObliviousAggregate(eid, aggExprSer, block.bytes, isPartial))
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.NonObliviousAggregateDirect(eid, aggExprSer, input, isPartial)
+      }
+    }
+  }
+}
+
+/**
+ * Like EncryptedAggregateExec, but groups rows with an in-enclave hash table, so its input does not
+ * need to be sorted by the grouping expressions.
+ */
+case class EncryptedHashAggregateExec(
+    groupingExpressions: Seq[NamedExpression],
+    aggregateExpressions: Seq[AggregateExpression],
+    child: SparkPlan
+) extends UnaryExecNode
+    with OpaqueOperatorExec {
+
+  override def name = "EncryptedHashAggregateExec"
+
+  override def producedAttributes: AttributeSet =
+    AttributeSet(aggregateExpressions) -- AttributeSet(groupingExpressions)
+
+  override def output: Seq[Attribute] = groupingExpressions.map(_.toAttribute) ++
+    aggregateExpressions.flatMap(expr => {
+      expr.mode match {
+        case Partial | PartialMerge =>
+          expr.aggregateFunction.inputAggBufferAttributes
+        case _ =>
+          Seq(expr.resultAttribute)
+      }
+    })
+
+  override def executeBlocked(): RDD[Block] = {
+
+    val aggExprSer = Utils.serializeAggOp(groupingExpressions, aggregateExpressions, child.output)
+    val isPartial = aggregateExpressions
+      .map(expr => expr.mode)
+      .exists(mode => mode == Partial || mode == PartialMerge)
+
+    val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    applyLoggingLevel(childRDD) { childRDD =>
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.HashAggregateDirect(eid, aggExprSer, input, isPartial)
       }
     }
   }
@@ -359,9 +554,59 @@ case class EncryptedSortMergeJoinExec(
 
     val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
     applyLoggingLevel(childRDD) { childRDD =>
-      childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(enclave.NonObliviousSortMergeJoin(eid, joinExprSer, block.bytes))
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.NonObliviousSortMergeJoinDirect(eid, joinExprSer, input)
+      }
+    }
+  }
+}
+
+case class EncryptedHashJoinExec(
+    joinType: JoinType,
+    leftKeys: Seq[Expression],
+    rightKeys: Seq[Expression],
+    leftSchema: Seq[Attribute],
+    rightSchema: Seq[Attribute],
+    condition: Option[Expression],
+    child: SparkPlan
+) extends UnaryExecNode
+    with OpaqueOperatorExec {
+
+  override def name = "EncryptedHashJoinExec"
+
+  override def output: Seq[Attribute] = {
+    joinType match {
+      case Inner =>
+        (leftSchema ++ rightSchema).map(_.toAttribute)
+      case LeftOuter =>
+        leftSchema ++ rightSchema.map(_.withNullability(true))
+      case LeftSemi | LeftAnti =>
+        leftSchema.map(_.toAttribute)
+      case RightOuter =>
+        leftSchema.map(_.withNullability(true)) ++ rightSchema
+      case FullOuter =>
+        leftSchema.map(_.withNullability(true)) ++ rightSchema.map(_.withNullability(true))
+      case _ =>
+        throw new IllegalArgumentException(
+          s"HashJoin should not take $joinType as the JoinType"
+        )
+    }
+  }
+
+  override def executeBlocked(): RDD[Block] = {
+    val joinExprSer = Utils.serializeJoinExpression(
+      joinType,
+      Some(leftKeys),
+      Some(rightKeys),
+      leftSchema,
+      rightSchema,
+      condition
+    )
+
+    val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    applyLoggingLevel(childRDD) { childRDD =>
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.HashJoinDirect(eid, joinExprSer, input)
       }
     }
   }
@@ -421,14 +666,12 @@ case class EncryptedBroadcastNestedLoopJoinExec(
     }
     val streamRDD = stream.asInstanceOf[OpaqueOperatorExec].executeBlocked()
     val broadcastRDD = broadcast.asInstanceOf[OpaqueOperatorExec].executeBlocked()
-    val broadcastBlock = Utils.concatEncryptedBlocks(broadcastRDD.collect)
+    // Built on the driver, so the broadcast rows are already in a Java array
+    val broadcastRows = Utils.concatEncryptedBlocks(broadcastRDD.collect).bytes
 
     applyLoggingLevel(streamRDD) { streamRDD =>
-      streamRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(
-          enclave.BroadcastNestedLoopJoin(eid, joinExprSer, block.bytes, broadcastBlock.bytes)
-        )
+      Block.mapDirect(streamRDD) { (enclave, eid, input) =>
+        enclave.BroadcastNestedLoopJoinDirect(eid, joinExprSer, input, broadcastRows)
       }
     }
   }
@@ -476,9 +719,8 @@ case class EncryptedLocalLimitExec(limit: Int, child: SparkPlan)
   override def executeBlocked(): RDD[Block] = {
     val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
     applyLoggingLevel(childRDD) { childRDD =>
-      childRDD.map { block =>
-        val (enclave, eid) = Utils.initEnclave()
-        Block(enclave.LocalLimit(eid, limit, block.bytes))
+      Block.mapDirect(childRDD) { (enclave, eid, input) =>
+        enclave.LocalLimitDirect(eid, limit, input)
       }
     }
   }
@@ -495,9 +737,14 @@ case class EncryptedGlobalLimitExec(limit: Int, child: SparkPlan)
 
   override def executeBlocked(): RDD[Block] = {
     val childRDD = child.asInstanceOf[OpaqueOperatorExec].executeBlocked()
+    val releaseInput = Block.releasable(childRDD)
     val numRowsPerPartition = Utils.concatEncryptedBlocks(childRDD.map { block =>
       val (enclave, eid) = Utils.initEnclave()
-      Block(enclave.CountRowsPerPartition(eid, block.bytes))
+      val numRows = Block(enclave.CountRowsPerPartitionDirect(eid, block.directBuffer))
+      if (releaseInput) {
+        block.release()
+      }
+      numRows
     }.collect)
 
     val limitPerPartition = childRDD.context
@@ -510,11 +757,8 @@ case class EncryptedGlobalLimitExec(limit: Int, child: SparkPlan)
       .head
 
     applyLoggingLevel(childRDD) { childRDD =>
-      childRDD.zipWithIndex.map {
-        case (block, i) => {
-          val (enclave, eid) = Utils.initEnclave()
-          Block(enclave.LimitReturnRows(eid, i, limitPerPartition, block.bytes))
-        }
+      Block.mapDirectWithIndex(childRDD) { (enclave, eid, i, input) =>
+        enclave.LimitReturnRowsDirect(eid, i, limitPerPartition, input)
       }
     }
   }
@@ -49,9 +49,16 @@ import org.apache.spark.sql.catalyst.optimizer.{
   BuildSide,
   JoinSelectionHelper
 }
+import org.apache.spark.sql.internal.SQLConf
 
 object OpaqueOperators extends Strategy with JoinSelectionHelper {
 
+  /**
+   * SQL configuration that selects how each range partition of an equi-join is joined: with the
+   * in-enclave hash join if true (the default), or by sorting it and using the sort-merge join.
+   */
+  val HASH_JOIN_ENABLED = "spark.opaque.join.hashJoin.enabled"
+
   def isEncrypted(plan: LogicalPlan): Boolean = {
     plan.find {
       case _: OpaqueOperator => true
@@ -66,19 +73,50 @@ object OpaqueOperators extends Strategy with JoinSelectionHelper {
     }.nonEmpty
   }
 
-  def apply(plan: LogicalPlan): Seq[SparkPlan] = plan match {
+  /**
+   * Plan a chain of Projects and Filters over an encrypted plan, returning the planned chain
+   * along with the number of operators in it.
+   */
+  private def planPipeline(plan: LogicalPlan): (SparkPlan, Int) = plan match {
     case Project(projectList, child) if isEncrypted(child) =>
-      EncryptedProjectExec(projectList, planLater(child)) :: Nil
+      val (planned, numStages) = planPipeline(child)
+      (EncryptedProjectExec(projectList, planned), numStages + 1)
 
     // We don't support null values yet, so there's no point in checking whether the output of an
     // encrypted operator is null
-    case p @ Filter(And(IsNotNull(_), IsNotNull(_)), child) if isEncrypted(child) =>
-      planLater(child) :: Nil
-    case p @ Filter(IsNotNull(_), child) if isEncrypted(child) =>
-      planLater(child) :: Nil
+    case Filter(And(IsNotNull(_), IsNotNull(_)), child) if isEncrypted(child) =>
+      planPipeline(child)
+    case Filter(IsNotNull(_), child) if isEncrypted(child) =>
+      planPipeline(child)
 
     case Filter(condition, child) if isEncrypted(child) =>
-      EncryptedFilterExec(condition, planLater(child)) :: Nil
+      val (planned, numStages) = planPipeline(child)
+      (EncryptedFilterExec(condition, planned), numStages + 1)
+
+    case _ => (planLater(plan), 0)
+  }
+
+  /**
+   * Plan a hash aggregation over an encrypted plan, fusing it with any Projects and Filters at
+   * the top of the plan so that they are evaluated in the same pass over each block.
+   */
+  private def planHashAggregate(
+      groupingExpressions: Seq[NamedExpression],
+      aggregateExpressions: Seq[AggregateExpression],
+      child: LogicalPlan
+  ): SparkPlan = {
+    val (planned, numStages) = planPipeline(child)
+    val aggregate = EncryptedHashAggregateExec(groupingExpressions, aggregateExpressions, planned)
+    if (numStages > 0) EncryptedPipelineExec(aggregate) else aggregate
+  }
+
+  def apply(plan: LogicalPlan): Seq[SparkPlan] = plan match {
+    // Chains of more than one Project and Filter are fused into a single pass over each block
+    case p @ (_: Project | _: Filter) if isEncrypted(p.children.head) =>
+      planPipeline(p) match {
+        case (planned, numStages) if numStages > 1 => EncryptedPipelineExec(planned) :: Nil
+        case (planned, _) => planned :: Nil
+      }
 
     case Sort(sortExprs, global, child) if isEncrypted(child) =>
       EncryptedSortExec(sortExprs, global, planLater(child)) :: Nil
@@ -108,39 +146,57 @@ object OpaqueOperators extends Strategy with JoinSelectionHelper {
       // will colocate to the same partition.
       val partitionOrder = primaryKeysProj.map(k => SortOrder(k, Ascending))
       val partitioned = EncryptedRangePartitionExec(partitionOrder, unioned)
-      val sortOrder = sortForJoin(primaryKeysProj, tag, partitioned.output)
+
+      // Matching rows are colocated by the range partitioning, so each partition can be joined
+      // with an in-enclave hash table and does not need to be sorted. The sort-merge join instead
+      // needs the primary rows of each group before its foreign rows.
+      val hashJoin = SQLConf.get.getConfString(HASH_JOIN_ENABLED, "true").toBoolean
+      val joinInput =
+        if (hashJoin) partitioned
+        else {
+          val sortOrder = sortForJoin(primaryKeysProj, tag, partitioned.output)
+          EncryptedSortExec(sortOrder, false, partitioned)
+        }
 
       // Add dummy row for the foreign table if outer join.
-      val sorted = joinType match {
+      val withDummyRows = joinType match {
         case LeftOuter | RightOuter =>
-          EncryptedAddDummyRowExec(
-            foreignProjSchema.map(_.toAttribute),
-            EncryptedSortExec(sortOrder, false, partitioned)
-          )
+          EncryptedAddDummyRowExec(foreignProjSchema.map(_.toAttribute), joinInput)
         case FullOuter => {
           val withForeignDummy =
-            EncryptedAddDummyRowExec(
-              foreignProjSchema.map(_.toAttribute),
-              EncryptedSortExec(sortOrder, false, partitioned)
-            )
+            EncryptedAddDummyRowExec(foreignProjSchema.map(_.toAttribute), joinInput)
           EncryptedAddDummyRowExec(
             primaryProjSchema.map(_.toAttribute).map(_.toAttribute),
             withForeignDummy
           )
         }
         case _ =>
-          EncryptedSortExec(sortOrder, false, partitioned)
+          joinInput
       }
 
-      val joined = EncryptedSortMergeJoinExec(
-        joinType,
-        leftKeysProj,
-        rightKeysProj,
-        leftProjSchema.map(_.toAttribute),
-        rightProjSchema.map(_.toAttribute),
-        condition,
-        sorted
-      )
+      val leftSchema = leftProjSchema.map(_.toAttribute)
+      val rightSchema = rightProjSchema.map(_.toAttribute)
+      val joined =
+        if (hashJoin)
+          EncryptedHashJoinExec(
+            joinType,
+            leftKeysProj,
+            rightKeysProj,
+            leftSchema,
+            rightSchema,
+            condition,
+            withDummyRows
+          )
+        else
+          EncryptedSortMergeJoinExec(
+            joinType,
+            leftKeysProj,
+            rightKeysProj,
+            leftSchema,
+            rightSchema,
+            condition,
+            withDummyRows
+          )
 
       val tagsDropped = joinType match {
         case Inner | LeftOuter | RightOuter | FullOuter =>
@@ -210,23 +266,19 @@ object OpaqueOperators extends Strategy with JoinSelectionHelper {
               )
             ) :: Nil
           } else {
-            // Grouping aggregation
+            // Grouping aggregation. The partial aggregates of each group are colocated by the
+            // range partitioning, so they can be merged with a hash table without sorting them.
             EncryptedProjectExec(
               resultExpressions,
-              EncryptedAggregateExec(
+              EncryptedHashAggregateExec(
                 groupingExpressions,
                 aggregateExpressions.map(_.copy(mode = Final)),
-                EncryptedSortExec(
+                EncryptedRangePartitionExec(
                   groupingExpressions.map(_.toAttribute).map(e => SortOrder(e, Ascending)),
-                  true,
-                  EncryptedAggregateExec(
+                  planHashAggregate(
                     groupingExpressions,
                     aggregateExpressions.map(_.copy(mode = Partial)),
-                    EncryptedSortExec(
-                      groupingExpressions.map(e => SortOrder(e, Ascending)),
-                      false,
-                      planLater(child)
-                    )
+                    child
                   )
                 )
               )
@@ -252,18 +304,11 @@ object OpaqueOperators extends Strategy with JoinSelectionHelper {
           val combinedGroupingExpressions = groupingExpressions ++ namedDistinctExpressions
 
           // 1. Create an Aggregate operator for partial aggregations.
-          val partialAggregate = {
-            val sorted = EncryptedSortExec(
-              combinedGroupingExpressions.map(e => SortOrder(e, Ascending)),
-              false,
-              planLater(child)
-            )
-            EncryptedAggregateExec(
-              combinedGroupingExpressions,
-              functionsWithoutDistinct.map(_.copy(mode = Partial)),
-              sorted
-            )
-          }
+          val partialAggregate = planHashAggregate(
+            combinedGroupingExpressions,
+            functionsWithoutDistinct.map(_.copy(mode = Partial)),
+            child
+          )
 
           // 2. Create an Aggregate operator for partial merge aggregations.
           val partialMergeAggregate = {
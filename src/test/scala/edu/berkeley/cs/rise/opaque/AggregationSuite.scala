@@ -17,6 +17,8 @@
 
 package edu.berkeley.cs.rise.opaque
 
+import org.apache.spark.sql.DataFrame
+import org.apache.spark.sql.functions._
 import org.apache.spark.sql.internal.SQLConf
 import org.apache.spark.sql.types._
 import org.apache.spark.sql.Row
@@ -395,6 +397,103 @@ trait AggregationSuite extends OpaqueSuiteBase with SQLHelper {
     }
   }
 
+  test("aggregates with nulls") {
+    // Group 3 has only NULL values, and the NULL key forms a group of its own
+    checkAnswer() { sl =>
+      loadAggData(sl)
+      spark.sql("""
+          |SELECT key, sum(value), count(value), count(*), avg(value), min(value), max(value)
+          |FROM agg1
+          |GROUP BY key
+        """.stripMargin)
+    }
+
+    checkAnswer() { sl =>
+      loadAggData(sl)
+      spark.sql("""
+          |SELECT sum(value), count(value), count(*), avg(value), min(value), max(value)
+          |FROM agg1
+        """.stripMargin)
+    }
+  }
+
+  test("aggregates over groups removed by a filter") {
+    checkAnswer() { sl =>
+      loadAggData(sl)
+      spark.sql("""
+          |SELECT key, sum(value), count(*)
+          |FROM agg1
+          |WHERE value > 1000
+          |GROUP BY key
+        """.stripMargin)
+    }
+
+    // A global aggregation of no rows still outputs one row
+    checkAnswer() { sl =>
+      loadAggData(sl)
+      spark.sql("""
+          |SELECT sum(value), count(value), count(*), min(value)
+          |FROM agg1
+          |WHERE value > 1000
+        """.stripMargin)
+    }
+  }
+
+  test("overflowing sums") {
+    // Sums of longs wrap around on overflow, and sums of ints are computed as longs
+    def overflowData(sl: SecurityLevel): DataFrame =
+      makeDF(
+        Seq(
+          (1, Long.MaxValue, Int.MaxValue),
+          (1, 1L, Int.MaxValue),
+          (2, Long.MinValue, Int.MinValue),
+          (2, -1L, Int.MinValue),
+          (3, Long.MaxValue, Int.MaxValue),
+          (3, Long.MaxValue, Int.MaxValue),
+          (3, 2L, 1)
+        ),
+        sl,
+        "key",
+        "l",
+        "i"
+      )
+
+    checkAnswer() { sl =>
+      overflowData(sl).groupBy("key").agg(sum("l"), sum("i"), max("l"), min("i"))
+    }
+    checkAnswer() { sl =>
+      overflowData(sl).agg(sum("l"), sum("i"))
+    }
+  }
+
+  // Many groups with several rows each, so that the hash tables of both the partial and the
+  // final aggregation exceed a small materialized size
+  def manyGroups(sl: SecurityLevel): DataFrame =
+    makeDF(
+      (0 until 3000).map(i => (i % 700, if (i % 11 == 0) None else Some(i.toLong))),
+      sl,
+      "key",
+      "value"
+    )
+
+  test("partial and final hash aggregation") {
+    checkAnswer() { sl =>
+      manyGroups(sl)
+        .groupBy("key")
+        .agg(sum("value"), count("value"), count("*"), avg("value"), min("value"), max("value"))
+    }
+  }
+
+  test("partial and final hash aggregation spilling to untrusted memory") {
+    withMaxMaterializedSize(4096) {
+      checkAnswer() { sl =>
+        manyGroups(sl)
+          .groupBy("key")
+          .agg(sum("value"), count("value"), count("*"), avg("value"), min("value"), max("value"))
+      }
+    }
+  }
+
   def loadAggData(sl: SecurityLevel) = {
     val data1 = sl.applyTo(
       Seq[(Integer, Integer)](
@@ -19,6 +19,9 @@ package edu.berkeley.cs.rise.opaque
 
 import java.util.Locale
 
+import org.apache.spark.sql.DataFrame
+import org.apache.spark.sql.functions._
+
 trait FilterSuite extends OpaqueSQLSuiteBase with SQLHelper {
   import spark.implicits._
 
@@ -65,6 +68,201 @@ trait FilterSuite extends OpaqueSQLSuiteBase with SQLHelper {
     loadFilterData(sl)
   }
 
+  def nullableData(sl: SecurityLevel): DataFrame =
+    sl.applyTo(
+      Seq[(Integer, Integer)]((1, 2), (null, 3), (4, null), (null, null), (5, 0), (0, 5), (7, 7))
+        .toDF("a", "b")
+    )
+
+  test("expressions with nulls") {
+    checkAnswer() { sl =>
+      nullableData(sl).select(
+        $"a" + $"b",
+        $"a" * $"b",
+        $"a" < $"b",
+        $"a" === $"b",
+        $"a" > 1 && $"b" > 1,
+        $"a" > 1 || $"b" > 1,
+        !($"a" < $"b"),
+        $"a".isNull
+      )
+    }
+    checkAnswer() { sl => nullableData(sl).filter($"a" > 1 && $"b" > 1) }
+    checkAnswer() { sl => nullableData(sl).filter($"a" > 1 || $"b" > 1) }
+    checkAnswer() { sl => nullableData(sl).filter(!($"a" < $"b")) }
+    checkAnswer() { sl => nullableData(sl).filter($"a".isNull || $"a" > $"b") }
+  }
+
+  test("short-circuiting expressions") {
+    // The branches and operands that are not needed for a row divide by zero or are NULL
+    checkAnswer() { sl =>
+      nullableData(sl).select(
+        when($"b" === 0, -1.0).otherwise($"a" / $"b"),
+        when($"a".isNull, 0).when($"a" > 3, $"a" * 2),
+        expr("IF(b IS NULL, a, a + b)")
+      )
+    }
+    checkAnswer() { sl => nullableData(sl).filter($"b" =!= 0 && $"a" / $"b" > 1) }
+    checkAnswer() { sl => nullableData(sl).filter($"b".isNull || $"a" / $"b" < 1) }
+  }
+
+  test("IN with NULLs, duplicates and mixed types") {
+    // An item that is NULL makes the result NULL rather than false when nothing matches, and
+    // NOT of a NULL result keeps no rows
+    checkAnswer() { sl =>
+      nullableData(sl).select(
+        $"a",
+        $"a".isin(1, 4, null),
+        $"a".isin(1, 1, 4, 4),
+        $"a".isin(1, 4L, 7.0),
+        $"b".isin(null, 3)
+      )
+    }
+    checkAnswer() { sl => nullableData(sl).filter($"a".isin(1, 4, null)) }
+    checkAnswer() { sl => nullableData(sl).filter(!$"a".isin(1, 4, null)) }
+    checkAnswer() { sl => nullableData(sl).filter(!$"a".isin(1, 4)) }
+    checkAnswer() { sl => nullableData(sl).filter($"a".isin(0, 0L, 5.0) || $"b".isin(7, 7)) }
+  }
+
+  test("IN with a long list of items") {
+    val ints: Seq[Any] = 3 until 40
+    val intsWithNull: Seq[Any] = (10 until 40) :+ null
+    val strings: Seq[Any] = "cccccCCCCC" +: (0 until 30).map(i => "x" * i)
+    // The optimizer replaces lists of more than 10 literals with an InSet unless the threshold
+    // is raised, and both are looked up in a hash set once they have more than 16 items
+    for (threshold <- Seq("10", "1000")) {
+      withSQLConf("spark.sql.optimizer.inSetConversionThreshold" -> threshold) {
+        checkAnswer() { sl =>
+          nullableData(sl).select($"a", $"a".isin(ints: _*), $"b".isin(intsWithNull: _*))
+        }
+        checkAnswer() { sl => nullableData(sl).filter($"b".isin(ints: _*)) }
+        checkAnswer() { sl => nullableData(sl).filter(!$"b".isin(intsWithNull: _*)) }
+        checkAnswer() { sl =>
+          loadFilterData(sl)
+          spark.table("oneToTenFiltered").filter($"c".isin(strings: _*))
+        }
+      }
+    }
+  }
+
+  test("string predicates with escapes and empty patterns") {
+    val words =
+      Seq("", "a", "ab", "a%b", "a_b", "a\\b", "a/b", "axb", "%", "_", "\\", "ba%", null)
+    def data(sl: SecurityLevel): DataFrame =
+      makeDF(words.zipWithIndex.map(_.swap), sl, "id", "s")
+
+    val predicates = Seq(
+      $"s".like(""),
+      $"s".like("%"),
+      $"s".like("_"),
+      $"s".like("a%b"),
+      $"s".like("a_b"),
+      $"s".like("a\\%b"),
+      $"s".like("a\\_b"),
+      $"s".like("a\\\\b"),
+      $"s".like("%\\%"),
+      $"s".like("\\_%"),
+      $"s".like("%\\\\"),
+      expr("s LIKE 'a/%b' ESCAPE '/'"),
+      expr("s LIKE 'a//b' ESCAPE '/'"),
+      expr("s LIKE '%/_' ESCAPE '/'"),
+      $"s".contains(""),
+      $"s".contains("%"),
+      $"s".startsWith(""),
+      $"s".startsWith("a_"),
+      $"s".endsWith(""),
+      $"s".endsWith("\\")
+    )
+    for (predicate <- predicates) {
+      checkAnswer() { sl => data(sl).select($"id", predicate) }
+      checkAnswer() { sl => data(sl).filter(predicate) }
+    }
+  }
+
+  test("string predicates on batch boundaries") {
+    // Input blocks close once their rows take more than 1024 bytes, which is every 65 rows of an
+    // integer and a string of four bytes or NULL, so the enclave evaluates batches of 65 rows
+    for (rowsPerPartition <- Seq(64, 65, 66, 130, 131)) {
+      val data = for (i <- 0 until rowsPerPartition * numPartitions) yield {
+        (i, if (i % 7 == 3) null else f"w${i % 100}%03d")
+      }
+      def df(sl: SecurityLevel): DataFrame = makeDF(data, sl, "id", "s")
+      for (predicate <- Seq($"s".like("w0%"), $"s".like("%1_"), $"s".contains("5"))) {
+        checkAnswer() { sl => df(sl).select($"id", predicate) }
+        checkAnswer() { sl => df(sl).filter(predicate || $"id" === 0) }
+      }
+    }
+  }
+
+  test("filters and projections reading some columns of each block") {
+    // Input with several columns is encrypted column by column, and each operator only decrypts
+    // the columns it reads. Blocks close once their rows take more than 1024 bytes, which is
+    // every 33 rows of these four columns.
+    for (rowsPerPartition <- Seq(32, 33, 34, 66, 67)) {
+      val data = for (i <- 0 until rowsPerPartition * numPartitions) yield {
+        (
+          i,
+          if (i % 5 == 1) None else Some(i * 3),
+          if (i % 4 == 2) null else f"c${i % 1000}%03d",
+          if (i % 6 == 0) None else Some(i / 100.0)
+        )
+      }
+      def df(sl: SecurityLevel): DataFrame = makeDF(data, sl, "a", "b", "c", "d")
+      checkAnswer() { sl => df(sl).select($"b") }
+      checkAnswer() { sl => df(sl).select($"c", $"a" + 1) }
+      checkAnswer() { sl => df(sl).filter($"b" > 30).select($"d") }
+      checkAnswer() { sl => df(sl).filter($"c".isNull).select($"a", $"d") }
+      checkAnswer() { sl => df(sl).filter($"d" < 0.5 || $"b".isNull) }
+    }
+  }
+
+  test("filters on blocks with statistics") {
+    // Blocks written by the enclave record the minimum, maximum and number of NULLs of each
+    // column, from which filters skip blocks. Caching sorted input keeps such blocks, which the
+    // filters then read rather than being pushed below the sort. Their values range from 1 to
+    // 1999 and "s0001" to "s1999" overall, and their column n is all NULL.
+    val data = for (i <- 1 until 2000) yield {
+      (i, if (i % 10 == 0) None else Some(i), f"s$i%04d", Option.empty[Int])
+    }
+    val sorted = Seq(Insecure, Encrypted).map { sl =>
+      sl -> makeDF(data, sl, "id", "x", "s", "n").sort($"x").cache()
+    }.toMap
+
+    val conditions = Seq(
+      $"x" < 1,
+      $"x" <= 1,
+      $"x" === 1,
+      $"x" >= 1999,
+      $"x" > 1999,
+      $"x" === 1999,
+      lit(1) >= $"x",
+      lit(1999) < $"x",
+      $"x" > 1999 || $"x" <= 1,
+      $"x" >= 1 && $"x" <= 1999,
+      $"x".isNull,
+      $"x".isNotNull && $"x" < 2,
+      $"n" > 0,
+      $"n" === 1,
+      $"n".isNull,
+      $"n".isNotNull,
+      $"n".isNull && $"x" === 1999,
+      $"n" < 0 || $"x" === 1,
+      $"s" < "s0001",
+      $"s" <= "s0001",
+      $"s" === "s0001",
+      $"s" >= "s1999",
+      $"s" > "s1999",
+      $"s" > "s1999a",
+      $"s" < "s",
+      $"s" >= "",
+      $"s" === ""
+    )
+    for (condition <- conditions) {
+      checkAnswer() { sl => sorted(sl).filter(condition) }
+    }
+    sorted.values.foreach(_.unpersist())
+  }
+
   def loadFilterData(sl: SecurityLevel) = {
     val df = sl.applyTo(
       (1 to 10)
@@ -17,6 +17,7 @@
 
 package edu.berkeley.cs.rise.opaque
 
+import org.apache.spark.sql.DataFrame
 import org.apache.spark.sql.internal.SQLConf
 
 trait JoinSuite extends OpaqueSQLSuiteBase with SQLHelper {
@@ -237,6 +238,129 @@ trait JoinSuite extends OpaqueSQLSuiteBase with SQLHelper {
     safeDropTables("left", "right")
   }
 
+  // Join inputs large enough to be spilled under a small materialized size, with several rows per
+  // join key on both sides, keys that only one side has, and NULL keys
+  def manyMatches(sl: SecurityLevel): (DataFrame, DataFrame) = {
+    val left = makeDF(
+      (0 until 1000).map(i => (if (i % 97 == 0) None else Some(i % 300), i.toString)),
+      sl,
+      "k",
+      "v"
+    )
+    val right = makeDF(
+      (0 until 600).map(i => (if (i % 89 == 0) None else Some(i % 400), i * 2)),
+      sl,
+      "k2",
+      "w"
+    )
+    (left, right)
+  }
+
+  // Join inputs where half of the rows of each side share a single join key, so that under a
+  // small materialized size that key's rows cannot be split into partitions that fit
+  def hotKey(sl: SecurityLevel): (DataFrame, DataFrame) = {
+    val left = makeDF(
+      (0 until 400).map { i =>
+        (if (i % 2 == 0) Some(0) else if (i % 37 == 0) None else Some(i), "l" * 100 + i)
+      },
+      sl,
+      "k",
+      "v"
+    )
+    val right = makeDF(
+      (0 until 400).map { i =>
+        val k =
+          if (i % 2 == 0) Some(0) else if (i % 41 == 0) None else Some(if (i % 3 == 0) i else -i)
+        (k, i, "r" * 100)
+      },
+      sl,
+      "k2",
+      "w",
+      "s"
+    )
+    (left, right)
+  }
+
+  // Join inputs whose groups of rows with the same join key have sizes around multiples of 64,
+  // many NULL keys, and keys that only one side has. The right side's w is above 300 for only
+  // the later rows of each group.
+  def groupSizes(sl: SecurityLevel): (DataFrame, DataFrame) = {
+    val sizes = Seq(1, 63, 64, 65, 127, 128, 129)
+    val left = makeDF(
+      sizes.flatMap(n => (0 until n).map(i => (Option(n), s"l$n-$i"))) ++
+        (0 until 65).map(i => (Option.empty[Int], s"l-null-$i")) ++
+        (0 until 64).map(i => (Option(1000), s"l-only-$i")),
+      sl,
+      "k",
+      "v"
+    )
+    val right = makeDF(
+      sizes.flatMap(n => (0 until n).map(i => (Option(n), 270 + i))) ++
+        (0 until 63).map(i => (Option.empty[Int], 400 + i)) ++
+        (0 until 65).map(i => (Option(2000), 200 + i * 3)),
+      sl,
+      "k2",
+      "w"
+    )
+    (left, right)
+  }
+
+  def checkEquiJoins(
+      tables: SecurityLevel => (DataFrame, DataFrame) = manyMatches
+  ): Unit = {
+    for (joinType <- Seq("inner", "left", "right", "full", "left_semi", "left_anti")) {
+      checkAnswer() { sl =>
+        val (left, right) = tables(sl)
+        left.join(right, $"k" === $"k2", joinType)
+      }
+      checkAnswer() { sl =>
+        val (left, right) = tables(sl)
+        left.join(right, $"k" === $"k2" && $"w" > 300, joinType)
+      }
+    }
+  }
+
+  test("equi-joins, hash join") {
+    checkEquiJoins()
+  }
+
+  test("equi-joins, hash join spilling to untrusted memory") {
+    withMaxMaterializedSize(10000) {
+      checkEquiJoins()
+    }
+  }
+
+  test("equi-joins, hash join on a key with more rows than fit in enclave memory") {
+    withMaxMaterializedSize(10000) {
+      checkEquiJoins(hotKey)
+    }
+  }
+
+  test("equi-joins, sort-merge join") {
+    withSQLConf(OpaqueOperators.HASH_JOIN_ENABLED -> "false") {
+      checkEquiJoins()
+    }
+  }
+
+  test("equi-joins, sort-merge join spilling to untrusted memory") {
+    withSQLConf(OpaqueOperators.HASH_JOIN_ENABLED -> "false") {
+      withMaxMaterializedSize(10000) {
+        checkEquiJoins()
+        // Only groups of rows with the same join key are kept in enclave memory
+        checkEquiJoins(hotKey)
+      }
+    }
+  }
+
+  test("equi-joins, sort-merge join on groups around multiples of 64 rows") {
+    withSQLConf(OpaqueOperators.HASH_JOIN_ENABLED -> "false") {
+      checkEquiJoins(groupSizes)
+      withMaxMaterializedSize(10000) {
+        checkEquiJoins(groupSizes)
+      }
+    }
+  }
+
   ignore("cross join with broadcast") {
     withSQLConf(
       SQLConf.AUTO_BROADCASTJOIN_THRESHOLD.key -> 0.toString,
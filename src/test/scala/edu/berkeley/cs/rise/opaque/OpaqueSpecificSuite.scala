@@ -17,6 +17,12 @@
 
 package edu.berkeley.cs.rise.opaque
 
+import java.io.File
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+import com.google.flatbuffers.FlatBufferBuilder
+import net.jpountz.lz4.LZ4Factory
 import org.apache.spark.SparkException
 import org.apache.spark.sql.Dataset
 import org.apache.spark.sql.Row
@@ -24,9 +30,15 @@ import org.apache.spark.sql.functions._
 import org.apache.spark.sql.types._
 import org.apache.spark.storage.StorageLevel
 import org.apache.spark.unsafe.types.CalendarInterval
+import org.scalatest.concurrent.Eventually._
+import org.scalatest.time.SpanSugar._
 
 import edu.berkeley.cs.rise.opaque.expressions.Decrypt.decrypt
+import edu.berkeley.cs.rise.opaque.execution.Block
+import edu.berkeley.cs.rise.opaque.execution.DirectBuffers
 import edu.berkeley.cs.rise.opaque.execution.EncryptedBlockRDDScanExec
+import edu.berkeley.cs.rise.opaque.execution.EncryptedPipelineExec
+import edu.berkeley.cs.rise.opaque.execution.OpaqueOperatorExec
 
 class OpaqueSpecificSuite extends OpaqueSuiteBase with SinglePartitionSparkSession {
   import spark.implicits._
@@ -64,6 +76,109 @@ class OpaqueSpecificSuite extends OpaqueSuiteBase with SinglePartitionSparkSessi
     df.unpersist()
   }
 
+  test("pipeline of filter, project and partial aggregate") {
+    def numPipelines(ds: Dataset[_]): Int =
+      ds.queryExecution.executedPlan.collect { case p: EncryptedPipelineExec => p }.size
+
+    val data = for (i <- 0 until 256) yield (i, abc(i), i % 7)
+    val df = makeDF(data, Encrypted, "id", "word", "count")
+
+    val filtered = df.filter($"id" > 10).select($"word", ($"count" * 2).as("count2"))
+    assert(numPipelines(filtered) === 1)
+    assert(
+      filtered.collect.toSet ===
+        data.filter(_._1 > 10).map(t => Row(t._2, t._3 * 2)).toSet
+    )
+
+    val agg = filtered.groupBy($"word").agg(sum("count2"))
+    assert(numPipelines(agg) === 1)
+    val expected = data.filter(_._1 > 10).groupBy(_._2).mapValues(_.map(_._3 * 2L).sum)
+    assert(agg.collect.toSet === expected.map(Row.fromTuple).toSet)
+  }
+
+  test("operators on many blocks keep their order") {
+    // Input blocks are encrypted with about a kilobyte of rows each, so this input spans
+    // hundreds of blocks, which the enclave filters, projects and sorts in parallel ranges
+    val data = for (i <- 0 until 20000) yield (i, abc(i), (i * 7919) % 1000)
+    val df = makeDF(data, Encrypted, "id", "word", "score")
+
+    assert(
+      df.filter($"score" > 500 && $"word" =!= "B").collect.toSeq ===
+        data.filter(t => t._3 > 500 && t._2 != "B").map(Row.fromTuple)
+    )
+    assert(
+      df.select($"id", ($"score" * 2).as("score2")).collect.toSeq ===
+        data.map(t => Row(t._1, t._3 * 2))
+    )
+    assert(
+      df.filter($"score" > 500).select($"id", ($"score" * 2).as("score2")).collect.toSeq ===
+        data.filter(_._3 > 500).map(t => Row(t._1, t._3 * 2))
+    )
+    assert(
+      df.sort($"score", $"id".desc).collect.toSeq ===
+        data.sortBy(t => (t._3, -t._1)).map(Row.fromTuple)
+    )
+  }
+
+  test("host buffer pool") {
+    val (enclave, _) = Utils.initEnclave()
+    val data = for (i <- 0 until 256) yield (i, abc(i), 1)
+    val df = makeDF(data, Encrypted, "id", "word", "count")
+    assert(df.groupBy("word").agg(sum("count")).collect.length === 3)
+
+    val Array(allocations, hits, _, peakBytesOutstanding, bytesPooled) =
+      enclave.HostBufferPoolStats()
+    assert(allocations > 0)
+    assert(hits > 0 && hits <= allocations)
+    assert(peakBytesOutstanding > 0)
+    assert(bytesPooled > 0)
+  }
+
+  test("operators on direct buffers") {
+    val (enclave, _) = Utils.initEnclave()
+    val bytesOutstanding = enclave.HostBufferPoolStats()(2)
+    val data = for (i <- 0 until 256) yield (i, abc(i), i % 7)
+    val df = makeDF(data, Encrypted, "id", "word", "count")
+
+    // The sorted rows are passed to the projection in host memory, and the projected rows are
+    // only copied into the Java heap when they are collected
+    val projected = df.sort($"count", $"id").select($"id", ($"count" * 2).as("count2"))
+    assert(
+      projected.collect.toSeq === data.sortBy(t => (t._3, t._1)).map(t => Row(t._1, t._3 * 2))
+    )
+
+    // The host memory of each block is freed once it is consumed or becomes unreachable
+    eventually(timeout(30.seconds), interval(100.milliseconds)) {
+      System.gc()
+      assert(DirectBuffers.numLive === 0)
+      assert(enclave.HostBufferPoolStats()(2) === bytesOutstanding)
+    }
+  }
+
+  test("direct operators keep the blocks of persisted ancestors") {
+    val data = for (i <- 0 until 256) yield (i, i % 7)
+    val df = makeDF(data, Encrypted, "id", "count")
+    val expected = data.sortBy(t => (t._2, t._1))
+    def rows(blocks: Array[Block]): Seq[(Int, Int)] =
+      blocks.toSeq.flatMap(Utils.decryptBlockFlatbuffers).map(r => (r.getInt(0), r.getInt(1)))
+
+    // The sorted blocks are in host memory. Reading them through an RDD that is not persisted
+    // itself must not free them, since Spark keeps them for the persisted RDD.
+    val sorted = df
+      .sort($"count", $"id")
+      .queryExecution
+      .executedPlan
+      .asInstanceOf[OpaqueOperatorExec]
+      .executeBlocked()
+      .persist(StorageLevel.MEMORY_ONLY)
+    val limited = Block.mapDirect(sorted.map(identity)) { (enclave, eid, input) =>
+      enclave.LocalLimitDirect(eid, Int.MaxValue, input)
+    }
+    assert(rows(limited.collect) === expected)
+    assert(rows(sorted.collect) === expected)
+    sorted.unpersist()
+  }
+
   def saveTable() = {
     val data = for (i <- 0 until 256) yield (i, abc(i), 1)
     val df = makeDF(data, Encrypted, "id", "word", "count")
@@ -143,6 +258,134 @@ class OpaqueSpecificSuite extends OpaqueSuiteBase with SinglePartitionSparkSessi
     }
   }
 
+  /** Reads the blocks of a table saved with EncryptedSource at `path`. */
+  def savedBlocks(path: File): Seq[tuix.EncryptedBlock] =
+    spark.sparkContext
+      .sequenceFile[Int, Array[Byte]](new File(path, "data").toString)
+      .map(_._2)
+      .collect
+      .flatMap { bytes =>
+        val blocks = tuix.EncryptedBlocks.getRootAsEncryptedBlocks(ByteBuffer.wrap(bytes))
+        (0 until blocks.blocksLength).map(blocks.blocks(_))
+      }
+
+  /**
+   * Saves a table at `path` with EncryptedSource whose only block holds `numRows` rows,
+   * compressed to `compressed` and claimed to decompress to `uncompressedSize` bytes.
+   */
+  def saveCompressedBlock(
+      path: File,
+      numRows: Long,
+      compressed: Array[Byte],
+      uncompressedSize: Int
+  ): Unit = {
+    val aad =
+      ByteBuffer.allocate(4).order(ByteOrder.LITTLE_ENDIAN).putInt(uncompressedSize).array()
+    val builder = new FlatBufferBuilder
+    builder.finish(
+      tuix.EncryptedBlocks.createEncryptedBlocks(
+        builder,
+        tuix.EncryptedBlocks.createBlocksVector(
+          builder,
+          Array(
+            tuix.EncryptedBlock.createEncryptedBlock(
+              builder,
+              numRows,
+              tuix.EncryptedBlock.createEncRowsVector(builder, Utils.encrypt(compressed, aad)),
+              0,
+              0,
+              uncompressedSize,
+              0
+            )
+          )
+        )
+      )
+    )
+    spark.sparkContext
+      .makeRDD(Seq((0, builder.sizedByteArray())), 1)
+      .saveAsSequenceFile(new File(path, "data").toString)
+  }
+
+  test("compressed blocks") {
+    // Long runs of repeated letters make the blocks that the enclave writes compressible
+    val data = for (i <- 0 until 4096) yield (i, abc(i) * 200)
+    val df = makeDF(data, Encrypted, "id", "word").filter($"id" >= 0)
+    val path = Utils.createTempDir()
+    path.delete()
+    try {
+      df.write.format("edu.berkeley.cs.rise.opaque.EncryptedSource").save(path.toString)
+      assert(savedBlocks(path).exists { block =>
+        block.uncompressedSize > 0 && block.encRowsLength < block.uncompressedSize
+      })
+
+      // The driver decompresses the saved blocks with lz4-java, and the enclave with its own
+      // decompressor
+      val saved = spark.read
+        .format("edu.berkeley.cs.rise.opaque.EncryptedSource")
+        .schema(df.schema)
+        .load(path.toString)
+      assert(saved.collect.toSet === data.map(Row.fromTuple).toSet)
+      assert(
+        saved.filter($"id" < 100).collect.toSet ===
+          data.filter(_._1 < 100).map(Row.fromTuple).toSet
+      )
+    } finally {
+      Utils.deleteRecursively(path)
+    }
+  }
+
+  test("blocks compressed by lz4-java and corrupted compressed blocks") {
+    val data = for (i <- 0 until 4096) yield (i, abc(i) * 200)
+    val df = makeDF(data, Encrypted, "id", "word").filter($"id" >= 0)
+    val path = Utils.createTempDir()
+    path.delete()
+    val (numRows, plaintext) =
+      try {
+        df.write.format("edu.berkeley.cs.rise.opaque.EncryptedSource").save(path.toString)
+        val block = savedBlocks(path).head
+        (block.numRows, Utils.decryptBlockPlaintext(block))
+      } finally {
+        Utils.deleteRecursively(path)
+      }
+    val compressed = LZ4Factory.safeInstance().fastCompressor().compress(plaintext)
+
+    def load(compressed: Array[Byte], uncompressedSize: Int) = {
+      val path = Utils.createTempDir()
+      path.delete()
+      try {
+        saveCompressedBlock(path, numRows, compressed, uncompressedSize)
+        spark.read
+          .format("edu.berkeley.cs.rise.opaque.EncryptedSource")
+          .schema(df.schema)
+          .load(path.toString)
+          .filter($"id" >= 0)
+          .collect
+          .toSet
+      } finally {
+        Utils.deleteRecursively(path)
+      }
+    }
+
+    // The enclave decompresses blocks written by the reference compressor
+    val rows = load(compressed, plaintext.length)
+    assert(rows.size.toLong === numRows)
+    assert(rows.subsetOf(data.map(Row.fromTuple).toSet))
+
+    // and rejects compressed blocks that are truncated or decompress to the wrong size
+    for ((corrupted, size) <- Seq(
+        (compressed.dropRight(1), plaintext.length),
+        (compressed, plaintext.length + 1),
+        (compressed, plaintext.length - 1)
+      )) {
+      val e = intercept[SparkException] {
+        withLoggingOff {
+          load(corrupted, size)
+        }
+      }
+      assert(e.getCause.isInstanceOf[OpaqueException])
+    }
+  }
+
   test("cast error") {
     val data: Seq[(CalendarInterval, Byte)] = Seq((new CalendarInterval(12, 1, 12345), 0.toByte))
     val schema = StructType(
@@ -22,6 +22,8 @@ import org.apache.spark.sql.SparkSession
 
 import org.scalatest.BeforeAndAfterAll
 
+import edu.berkeley.cs.rise.opaque.execution.SGXEnclave
+
 trait OpaqueSuiteBase extends OpaqueFunSuite with BeforeAndAfterAll with SQLTestData {
 
   def numPartitions: Int
@@ -46,4 +48,42 @@ trait OpaqueSuiteBase extends OpaqueFunSuite with BeforeAndAfterAll with SQLTest
         .toDF(columnNames: _*)
     )
   }
+
+  /**
+   * Lowers the number of plaintext bytes that operators may materialize in enclave memory to
+   * `size` bytes, calls `f`, and then restores the default, so that `f` exercises the paths where
+   * operators spill to untrusted memory. Fails if no operator spilled while running `f`.
+   */
+  def withMaxMaterializedSize(size: Long)(f: => Unit): Unit = {
+    val spillsBefore = onEachExecutor { (enclave, eid) =>
+      enclave.SetMaxMaterializedSize(eid, size)
+      enclave.NumSpills(eid)
+    }
+    try {
+      f
+      val spillsAfter = onEachExecutor((enclave, eid) => enclave.NumSpills(eid))
+      assert(spillsAfter.sum > spillsBefore.sum, s"Nothing spilled with a limit of $size bytes")
+    } finally {
+      onEachExecutor { (enclave, eid) =>
+        enclave.SetMaxMaterializedSize(eid, 0)
+        0L
+      }
+    }
+  }
+
+  /**
+   * Runs `f` once in the enclave of every executor and returns the results. Each executor of the
+   * test sessions has a single core, so the `numPartitions` tasks of a barrier stage, which are
+   * all scheduled at once, run on distinct executors.
+   */
+  private def onEachExecutor(f: (SGXEnclave, Long) => Long): Seq[Long] =
+    spark.sparkContext
+      .parallelize(0 until numPartitions, numPartitions)
+      .barrier()
+      .mapPartitions { _ =>
+        val (enclave, eid) = Utils.initEnclave()
+        Iterator(f(enclave, eid))
+      }
+      .collect
+      .toSeq
 }
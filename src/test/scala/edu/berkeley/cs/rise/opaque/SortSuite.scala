@@ -78,6 +78,38 @@ trait SortSuite extends OpaqueSuiteBase with SQLHelper {
     }
   }
 
+  test("sorting by keys with extreme values, zero bytes and nulls") {
+    // Sort keys flip the sign bits of numbers, escape zero bytes in strings and encode where
+    // NULLs go, so the values at the edges of each encoding are sorted in every direction. The
+    // input spans several blocks.
+    val ints = Seq(Some(Int.MinValue), Some(-1), Some(0), Some(1), Some(Int.MaxValue), None)
+    val doubles = Seq(
+      Some(Double.NegativeInfinity),
+      Some(-1.5),
+      Some(-0.0),
+      Some(0.0),
+      Some(Double.MinPositiveValue),
+      Some(Double.NaN),
+      Some(Double.PositiveInfinity),
+      None
+    )
+    val strings = Seq("", "a", "a\u0000", "a\u0000b", "a\u0001", "ab", "b", "\u0000", null)
+    val data = for (i <- 0 until 200) yield {
+      (i, ints(i % ints.size), doubles(i % doubles.size), strings(i % strings.size))
+    }
+    def df(sl: SecurityLevel) = makeDF(data, sl, "id", "x", "y", "s")
+
+    for (
+      c <- Seq($"x", $"y", $"s");
+      order <- Seq(c.asc_nulls_first, c.asc_nulls_last, c.desc_nulls_first, c.desc_nulls_last)
+    ) {
+      checkAnswer(isOrdered = true) { sl => df(sl).sort(order, $"id") }
+    }
+    checkAnswer(isOrdered = true) { sl =>
+      df(sl).sort($"s".desc, $"x".asc_nulls_last, $"y".desc_nulls_first, $"id")
+    }
+  }
+
   test("sort followed by limit") {
     checkAnswer() { sl =>
       val input = sl.applyTo((1 to 100).map(v => Tuple1(v)).toDF("a"))